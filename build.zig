@@ -55,7 +55,15 @@ pub fn build(b: *std.Build) !void {
         break :blk false;
     };
 
-    const facilio = try build_facilio("facil.io", b, target, optimize, use_openssl);
+    const use_zlib = b.option(bool, "zlib", "Use system-installed zlib for WebSocket compression (permessage-deflate) in zap") orelse blk: {
+        if (std.process.getEnvVarOwned(b.allocator, "ZAP_USE_ZLIB")) |val| {
+            defer b.allocator.free(val);
+            if (std.mem.eql(u8, val, "true")) break :blk true;
+        } else |_| {}
+        break :blk false;
+    };
+
+    const facilio = try build_facilio("facil.io", b, target, optimize, use_openssl, use_zlib);
 
     const zap_module = b.addModule("zap", .{
         .root_source_file = b.path("src/zap.zig"),
@@ -90,9 +98,12 @@ pub fn build(b: *std.Build) !void {
         .{ .name = "https", .src = "examples/https/https.zig" },
         .{ .name = "hello2", .src = "examples/hello2/hello2.zig" },
         .{ .name = "simple_router", .src = "examples/simple_router/simple_router.zig" },
+        .{ .name = "router_bench", .src = "examples/router_bench/router_bench.zig" },
         .{ .name = "routes", .src = "examples/routes/routes.zig" },
         .{ .name = "serve", .src = "examples/serve/serve.zig" },
         .{ .name = "hello_json", .src = "examples/hello_json/hello_json.zig" },
+        .{ .name = "json_bench", .src = "examples/json_bench/json_bench.zig" },
+        .{ .name = "pubsub_bench", .src = "examples/pubsub_bench/pubsub_bench.zig" },
         .{ .name = "endpoint", .src = "examples/endpoint/main.zig" },
         .{ .name = "mustache", .src = "examples/mustache/mustache.zig" },
         .{ .name = "endpoint_auth", .src = "examples/endpoint_auth/endpoint_auth.zig" },
@@ -181,6 +192,34 @@ pub fn build(b: *std.Build) !void {
     test_system.addTest("src/tests/test_sendfile.zig", "sendfile");
     test_system.addTest("src/tests/test_recvfile.zig", "recv");
     test_system.addTest("src/tests/test_recvfile_notype.zig", "recv_notype");
+    // async handlers: pause / resume
+    test_system.addTest("src/tests/test_pause.zig", "pause");
+    // radix tree router
+    test_system.addTest("src/tests/test_router.zig", "router");
+    // several listeners in one process
+    test_system.addTest("src/tests/test_listeners.zig", "listeners");
+    // json written into the response packet
+    test_system.addTest("src/tests/test_writejson.zig", "writejson");
+    // publish / subscribe
+    test_system.addTest("src/tests/test_pubsub.zig", "pubsub");
+    // websocket broadcasts (shared frames)
+    test_system.addTest("src/tests/test_websockets.zig", "websocket_frames");
+    // response micro-cache
+    test_system.addTest("src/tests/test_response_cache.zig", "response_cache");
+    // buffered access log
+    test_system.addTest("src/tests/test_access_log.zig", "access_log");
+    // per-IP request rate limit
+    test_system.addTest("src/tests/test_rate_limit.zig", "rate_limit");
+    // thread pool for blocking work
+    test_system.addTest("src/tests/test_blocking_pool.zig", "blocking_pool");
+    // compile-time route tables
+    test_system.addTest("src/tests/test_routes.zig", "routes");
+    // App request arenas
+    test_system.addTest("src/tests/test_app_arena.zig", "app_arena");
+    // typed json decoding
+    test_system.addTest("src/tests/test_json.zig", "json");
+    // url-encoded form and query decoding
+    test_system.addTest("src/tests/test_urlencoded.zig", "urlencoded");
     // TODO: for some reason, tests aren't run more than once unless
     //       dependencies have changed.
     //       So, for now, we just force the exe to be built, so in order that
@@ -0,0 +1,97 @@
+//!
+//! Part of the Zap examples.
+//!
+//! Build me with `zig build     json_bench`.
+//! Run   me with `zig build run-json_bench`.
+//!
+//! Compares zap.Json.decode with std.json.parseFromSlice and facilio's
+//! fiobj_json2obj on a generated document, without any networking.
+//! Build with `-Doptimize=ReleaseFast` for meaningful numbers.
+//!
+const std = @import("std");
+const zap = @import("zap");
+
+const Item = struct {
+    sku: []const u8,
+    title: []const u8,
+    qty: u32,
+    price: f64,
+    tags: []const []const u8,
+};
+
+const Order = struct {
+    id: u64,
+    customer: []const u8,
+    gift: bool,
+    note: ?[]const u8,
+    items: []const Item,
+};
+
+const iterations = 50;
+
+fn generate(allocator: std.mem.Allocator, item_count: usize) ![]u8 {
+    var out: std.io.Writer.Allocating = .init(allocator);
+    errdefer out.deinit();
+    const w = &out.writer;
+
+    try w.writeAll("{\"id\": 123456789, \"customer\": \"Jane \\\"JD\\\" Doe\", \"gift\": false, \"note\": null, \"items\": [");
+    for (0..item_count) |i| {
+        if (i > 0) try w.writeAll(",");
+        try w.print(
+            \\{{"sku": "SKU-{d:0>8}", "title": "A reasonably long product title number {d}",
+            \\ "qty": {d}, "price": {d}.99, "tags": ["new", "sale", "tag-{d}"]}}
+        , .{ i, i, i % 10, i % 1000, i % 7 });
+    }
+    try w.writeAll("]}");
+    return out.toOwnedSlice();
+}
+
+fn report(name: []const u8, bytes: usize, elapsed_ns: u64) void {
+    const per_run = @as(f64, @floatFromInt(elapsed_ns)) / iterations;
+    const mb_per_s = @as(f64, @floatFromInt(bytes)) / per_run * 1e9 / (1024 * 1024);
+    std.debug.print("{s:<32} {d:>10.1} us/doc {d:>8.1} MiB/s\n", .{ name, per_run / 1000, mb_per_s });
+}
+
+pub fn main() !void {
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    const allocator = gpa.allocator();
+
+    const input = try generate(allocator, 10_000);
+    defer allocator.free(input);
+    std.debug.print("document: {d} bytes\n", .{input.len});
+
+    var arena_state = std.heap.ArenaAllocator.init(allocator);
+    defer arena_state.deinit();
+    const arena = arena_state.allocator();
+
+    var timer = try std.time.Timer.start();
+    for (0..iterations) |_| {
+        const order = try zap.Json.decode(Order, arena, input);
+        std.mem.doNotOptimizeAway(order.items.len);
+        _ = arena_state.reset(.retain_capacity);
+    }
+    report("zap.Json.decode", input.len, timer.lap());
+
+    for (0..iterations) |_| {
+        const order = try std.json.parseFromSliceLeaky(Order, arena, input, .{ .allocate = .alloc_if_needed });
+        std.mem.doNotOptimizeAway(order.items.len);
+        _ = arena_state.reset(.retain_capacity);
+    }
+    report("std.json (alloc_if_needed)", input.len, timer.lap());
+
+    for (0..iterations) |_| {
+        const parsed = try std.json.parseFromSlice(Order, allocator, input, .{});
+        std.mem.doNotOptimizeAway(parsed.value.items.len);
+        parsed.deinit();
+    }
+    report("std.json.parseFromSlice", input.len, timer.lap());
+
+    for (0..iterations) |_| {
+        var obj: zap.fio.FIOBJ = 0;
+        const consumed = zap.fio.fiobj_json2obj(&obj, input.ptr, input.len);
+        if (consumed == 0) return error.ParseError;
+        zap.fio.fiobj_free_wrapped(obj);
+    }
+    report("fiobj_json2obj", input.len, timer.lap());
+}
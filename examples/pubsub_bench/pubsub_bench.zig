@@ -0,0 +1,106 @@
+//!
+//! Part of the Zap examples.
+//!
+//! Build me with `zig build     pubsub_bench`.
+//! Run   me with `zig build run-pubsub_bench`.
+//!
+//! Measures zap.PubSub delivery across worker processes: the root process
+//! publishes messages to a channel every worker is subscribed to, for 1 to 16
+//! workers, over the cluster socket and through shared memory. Pass a worker
+//! count (`zig build run-pubsub_bench -- 4`) to run a single configuration,
+//! and a ring capacity to use shared memory (`-- 4 1048576`). With 1 worker,
+//! everything stays in one process. Build with `-Doptimize=ReleaseFast` for
+//! meaningful numbers.
+//!
+const std = @import("std");
+const zap = @import("zap");
+
+const messages = 100_000;
+const message_size = 64;
+
+var workers: usize = 1;
+var shm_capacity: usize = 0;
+var timer: std.time.Timer = undefined;
+// per process counters
+var received: std.atomic.Value(usize) = .init(0);
+var ready: std.atomic.Value(usize) = .init(0);
+var done: std.atomic.Value(usize) = .init(0);
+
+const Bench = struct {
+    // workers: count the messages, report to the root once all arrived
+    fn onMessage(_: *Bench, _: zap.PubSub.Message) !void {
+        if (received.fetchAdd(1, .monotonic) + 1 == messages) {
+            zap.PubSub.publish(.{ .channel = "done", .message = "1", .engine = .root });
+        }
+    }
+
+    // root: once every worker is subscribed, publish the messages
+    fn onReady(_: *Bench, _: zap.PubSub.Message) !void {
+        if (ready.fetchAdd(1, .monotonic) + 1 < workers) return;
+        const payload: [message_size]u8 = @splat('x');
+        timer = try std.time.Timer.start();
+        for (0..messages) |_| {
+            zap.PubSub.publish(.{ .channel = "bench", .message = &payload, .engine = .cluster });
+        }
+    }
+
+    // root: every worker received all messages
+    fn onDone(_: *Bench, _: zap.PubSub.Message) !void {
+        if (done.fetchAdd(1, .monotonic) + 1 < workers) return;
+        const seconds = @as(f64, @floatFromInt(timer.read())) / std.time.ns_per_s;
+        std.debug.print("{d:>2} workers, {s:>6}: {d:>8.1} ms, {d:>10.0} messages/s delivered\n", .{
+            workers,
+            if (shm_capacity > 0) "shm" else "socket",
+            seconds * 1000,
+            @as(f64, @floatFromInt(messages * workers)) / seconds,
+        });
+        zap.stop();
+    }
+};
+
+var bench: Bench = .{};
+
+// runs in every worker process
+fn onStart(_: ?*anyopaque) callconv(.c) void {
+    _ = zap.PubSub.subscribe(.{ .channel = "bench" }, &bench, Bench.onMessage, null) catch |err| {
+        std.debug.print("subscribe failed: {}\n", .{err});
+        return;
+    };
+    zap.PubSub.publish(.{ .channel = "ready", .message = "1", .engine = .root });
+}
+
+fn run() !void {
+    // made before zap.start(), so the workers inherit them. They only receive
+    // messages published to the root engine in the root process.
+    _ = try zap.PubSub.subscribe(.{ .channel = "ready" }, &bench, Bench.onReady, null);
+    _ = try zap.PubSub.subscribe(.{ .channel = "done" }, &bench, Bench.onDone, null);
+    zap.fio.fio_state_callback_add(zap.fio.FIO_CALL_ON_START, onStart, null);
+    zap.PubSub.useSharedMemory(shm_capacity);
+    zap.start(.{
+        .threads = 1,
+        .workers = @intCast(workers),
+    });
+}
+
+pub fn main() !void {
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    const allocator = gpa.allocator();
+
+    const args = try std.process.argsAlloc(allocator);
+    defer std.process.argsFree(allocator, args);
+
+    if (args.len > 1) {
+        workers = try std.fmt.parseInt(usize, args[1], 10);
+        if (args.len > 2) shm_capacity = try std.fmt.parseInt(usize, args[2], 10);
+        return run();
+    }
+
+    // facil.io's reactor only starts once per process: one child per run
+    for ([_][]const u8{ "1", "2", "4", "8", "16" }) |count| {
+        for ([_][]const u8{ "0", "1048576" }) |capacity| {
+            var child = std.process.Child.init(&.{ args[0], count, capacity }, allocator);
+            _ = try child.spawnAndWait();
+        }
+    }
+}
@@ -0,0 +1,73 @@
+//!
+//! Part of the Zap examples.
+//!
+//! Build me with `zig build     router_bench`.
+//! Run   me with `zig build run-router_bench`.
+//!
+//! Measures zap.Router lookups for 1k and 10k routes, without any networking.
+//! Build with `-Doptimize=ReleaseFast` for meaningful numbers.
+//!
+const std = @import("std");
+const zap = @import("zap");
+
+fn on_request(_: zap.Request) !void {}
+
+const lookups = 1_000_000;
+
+fn bench(allocator: std.mem.Allocator, route_count: usize) !void {
+    var router = zap.Router.init(allocator, .{});
+    defer router.deinit();
+
+    // a mix of static routes and routes with params, sharing prefixes
+    var paths: std.ArrayList([]const u8) = .empty;
+    defer {
+        for (paths.items) |p| allocator.free(p);
+        paths.deinit(allocator);
+    }
+    for (0..route_count) |i| {
+        var buf: [128]u8 = undefined;
+        const route = switch (i % 4) {
+            0 => try std.fmt.bufPrint(&buf, "/api/v{d}/resource{d}", .{ i % 7, i }),
+            1 => try std.fmt.bufPrint(&buf, "/api/v{d}/resource{d}/:id", .{ i % 7, i }),
+            2 => try std.fmt.bufPrint(&buf, "/api/v{d}/resource{d}/:id/items/:item", .{ i % 7, i }),
+            else => try std.fmt.bufPrint(&buf, "/files{d}/*path", .{i}),
+        };
+        try router.handle_method_unbound(.GET, route, on_request);
+
+        const path = switch (i % 4) {
+            0 => try std.fmt.allocPrint(allocator, "/api/v{d}/resource{d}", .{ i % 7, i }),
+            1 => try std.fmt.allocPrint(allocator, "/api/v{d}/resource{d}/{d}", .{ i % 7, i, i }),
+            2 => try std.fmt.allocPrint(allocator, "/api/v{d}/resource{d}/{d}/items/abc", .{ i % 7, i, i }),
+            else => try std.fmt.allocPrint(allocator, "/files{d}/css/site.css", .{i}),
+        };
+        try paths.append(allocator, path);
+    }
+
+    var prng = std.Random.DefaultPrng.init(0);
+    const random = prng.random();
+    var params: zap.Router.Params = .{};
+    var found: usize = 0;
+
+    var timer = try std.time.Timer.start();
+    for (0..lookups) |_| {
+        const path = paths.items[random.uintLessThan(usize, paths.items.len)];
+        if (router.lookup(.GET, path, &params) == .found) found += 1;
+    }
+    const elapsed = timer.read();
+
+    std.debug.print("{d:>6} routes: {d:>8.1} ns/lookup ({d} of {d} found)\n", .{
+        route_count,
+        @as(f64, @floatFromInt(elapsed)) / lookups,
+        found,
+        lookups,
+    });
+}
+
+pub fn main() !void {
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    const allocator = gpa.allocator();
+
+    try bench(allocator, 1_000);
+    try bench(allocator, 10_000);
+}
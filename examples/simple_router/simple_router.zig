@@ -67,6 +67,12 @@ pub const SomePackage = struct {
     }
 };
 
+fn on_hello(r: zap.Request) !void {
+    var buf: [128]u8 = undefined;
+    const name = r.getRouteParam("name") orelse "stranger";
+    try r.sendBody(try std.fmt.bufPrint(&buf, "Hello, {s}!\n", .{name}));
+}
+
 fn not_found(req: zap.Request) !void {
     std.debug.print("not found handler", .{});
 
@@ -92,7 +98,9 @@ pub fn main() !void {
 
     try simpleRouter.handle_func("/getb", &somePackage, &SomePackage.getB);
 
-    try simpleRouter.handle_func("/inca", &somePackage, &SomePackage.incrementA);
+    try simpleRouter.handle_method(.POST, "/inca", &somePackage, &SomePackage.incrementA);
+
+    try simpleRouter.handle_method_unbound(.GET, "/hello/:name", on_hello);
 
     var listener = zap.HttpListener.init(.{
         .port = 3000,
@@ -109,7 +117,8 @@ pub fn main() !void {
         \\    curl http://localhost:3000/
         \\    curl http://localhost:3000/geta
         \\    curl http://localhost:3000/getb
-        \\    curl http://localhost:3000/inca
+        \\    curl -X POST http://localhost:3000/inca
+        \\    curl http://localhost:3000/hello/zap
         \\
         \\
     , .{});
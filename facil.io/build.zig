@@ -6,6 +6,7 @@ pub fn build_facilio(
     target: std.Build.ResolvedTarget,
     optimize: std.builtin.OptimizeMode,
     use_openssl: bool,
+    use_zlib: bool,
 ) !*std.Build.Step.Compile {
     const mod = b.addModule("facil.io", .{
         .target = target,
@@ -37,6 +38,8 @@ pub fn build_facilio(
         try flags.append(b.allocator, "-D_LARGEFILE64_SOURCE");
     if (use_openssl)
         try flags.append(b.allocator, "-DHAVE_OPENSSL -DFIO_TLS_FOUND");
+    if (use_zlib)
+        try flags.append(b.allocator, "-DHAVE_ZLIB");
 
     // Include paths
     mod.addIncludePath(b.path(subdir ++ "/."));
@@ -87,6 +90,11 @@ pub fn build_facilio(
         mod.linkSystemLibrary("crypto", .{});
     }
 
+    // link in zlib for WebSocket permessage-deflate on demand
+    if (use_zlib) {
+        mod.linkSystemLibrary("z", .{});
+    }
+
     b.installArtifact(lib);
 
     return lib;
@@ -819,11 +819,11 @@ Section Start Marker
 
 #ifndef DEFER_QUEUE_BLOCK_COUNT
 #if UINTPTR_MAX <= 0xFFFFFFFF
-/* Almost a page of memory on most 32 bit machines: ((4096/4)-8)/3 */
-#define DEFER_QUEUE_BLOCK_COUNT 338
+/* Almost a page of memory on most 32 bit machines: ((4096/4)-8)/5 */
+#define DEFER_QUEUE_BLOCK_COUNT 203
 #else
-/* Almost a page of memory on most 64 bit machines: ((4096/8)-8)/3 */
-#define DEFER_QUEUE_BLOCK_COUNT 168
+/* Almost a page of memory on most 64 bit machines: ((4096/8)-8)/4 */
+#define DEFER_QUEUE_BLOCK_COUNT 126
 #endif
 #endif
 
@@ -832,6 +832,8 @@ typedef struct {
   void (*func)(void *, void *);
   void *arg1;
   void *arg2;
+  /* scheduling time (microseconds), only set when latency is measured */
+  uint64_t queued_at;
 } fio_defer_task_s;
 
 /* task queue block */
@@ -865,6 +867,129 @@ static fio_task_queue_s task_queue_urgent = {
     .reader = &task_queue_urgent.static_queue,
     .writer = &task_queue_urgent.static_queue};
 
+/* *****************************************************************************
+Queueing Delay Measurements
+***************************************************************************** */
+
+/* 4 buckets per power of 2 (~25% precision), up to ~2^40 microseconds */
+#define FIO_DEFER_LATENCY_BUCKETS 160
+
+static struct {
+  volatile size_t target;   /* microseconds, 0 == disabled */
+  volatile size_t interval; /* microseconds */
+  volatile size_t p90;
+  volatile uint64_t next_review;
+  uint64_t first_above;
+  volatile uint8_t overloaded;
+  fio_lock_i lock;
+  volatile size_t buckets[FIO_DEFER_LATENCY_BUCKETS];
+} fio_defer_latency = {.lock = FIO_LOCK_INIT};
+
+static __thread size_t fio_defer_latency_current_task;
+
+static inline uint64_t fio_defer_latency_now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return ((uint64_t)t.tv_sec * 1000000) + (t.tv_nsec / 1000);
+}
+
+static inline size_t fio_defer_latency_bucket(uint64_t delay) {
+  if (delay < 4)
+    return (size_t)delay;
+  size_t msb = 63 - __builtin_clzll(delay);
+  size_t i = ((msb - 1) << 2) | ((delay >> (msb - 2)) & 3);
+  return i < FIO_DEFER_LATENCY_BUCKETS ? i : FIO_DEFER_LATENCY_BUCKETS - 1;
+}
+
+/* the (approximate) middle of a bucket's value range */
+static inline size_t fio_defer_latency_bucket2value(size_t i) {
+  if (i < 4)
+    return i;
+  size_t shift = (i >> 2) - 1;
+  return ((4 | (i & 3)) << shift) + ((1UL << shift) >> 1);
+}
+
+/* computes the interval's p90 and updates the CoDel state */
+static void fio_defer_latency_review(uint64_t now) {
+  if (fio_trylock(&fio_defer_latency.lock))
+    return;
+  if (now < fio_defer_latency.next_review)
+    goto finish;
+  fio_defer_latency.next_review = now + fio_defer_latency.interval;
+  size_t counts[FIO_DEFER_LATENCY_BUCKETS];
+  size_t total = 0;
+  for (size_t i = 0; i < FIO_DEFER_LATENCY_BUCKETS; ++i) {
+    counts[i] = fio_atomic_xchange(fio_defer_latency.buckets + i, 0);
+    total += counts[i];
+  }
+  size_t p90 = 0;
+  if (total) {
+    size_t rank = total - (total / 10);
+    for (size_t i = 0; i < FIO_DEFER_LATENCY_BUCKETS; ++i) {
+      if (counts[i] >= rank) {
+        p90 = fio_defer_latency_bucket2value(i);
+        break;
+      }
+      rank -= counts[i];
+    }
+  }
+  fio_defer_latency.p90 = p90;
+  if (p90 <= fio_defer_latency.target) {
+    fio_defer_latency.first_above = 0;
+    if (fio_defer_latency.overloaded)
+      FIO_LOG_DEBUG("(%d) task queue delay back to %zuus", (int)getpid(), p90);
+    fio_defer_latency.overloaded = 0;
+  } else if (!fio_defer_latency.first_above) {
+    fio_defer_latency.first_above = now;
+  } else if (!fio_defer_latency.overloaded &&
+             now - fio_defer_latency.first_above >=
+                 fio_defer_latency.interval) {
+    FIO_LOG_WARNING("(%d) task queue overloaded (p90 delay %zuus)",
+                    (int)getpid(), p90);
+    fio_defer_latency.overloaded = 1;
+  }
+finish:
+  fio_unlock(&fio_defer_latency.lock);
+}
+
+static inline void fio_defer_latency_record(uint64_t queued_at) {
+  if (!queued_at) {
+    fio_defer_latency_current_task = 0;
+    return;
+  }
+  const uint64_t now = fio_defer_latency_now();
+  const uint64_t delay = now > queued_at ? now - queued_at : 0;
+  fio_defer_latency_current_task = (size_t)delay;
+  fio_atomic_add(fio_defer_latency.buckets + fio_defer_latency_bucket(delay),
+                 1);
+  if (now >= fio_defer_latency.next_review)
+    fio_defer_latency_review(now);
+}
+
+void fio_defer_latency_target(size_t target_ms, size_t interval_ms) {
+  if (!target_ms)
+    return;
+  if (fio_defer_latency.target && fio_defer_latency.target <= target_ms * 1000)
+    return;
+  fio_defer_latency.interval = (interval_ms ? interval_ms : 100) * 1000;
+  fio_defer_latency.next_review =
+      fio_defer_latency_now() + fio_defer_latency.interval;
+  fio_defer_latency.target = target_ms * 1000;
+}
+
+size_t fio_defer_latency_p90(void) { return fio_defer_latency.p90; }
+
+size_t fio_defer_latency_current(void) {
+  return fio_defer_latency_current_task;
+}
+
+int fio_defer_is_overloaded(void) { return fio_defer_latency.overloaded; }
+
+int fio_defer_should_shed(void) {
+  return fio_defer_latency.overloaded &&
+         fio_defer_latency_current_task > fio_defer_latency.target;
+}
+
 /* *****************************************************************************
 Internal Task API
 ***************************************************************************** */
@@ -885,6 +1010,8 @@ static size_t fio_defer_count_alloc, fio_defer_count_dealloc;
 
 static inline void fio_defer_push_task_fn(fio_defer_task_s task,
                                           fio_task_queue_s *queue) {
+  if (fio_defer_latency.target)
+    task.queued_at = fio_defer_latency_now();
   fio_lock(&queue->lock);
 
   /* test if full */
@@ -1008,6 +1135,7 @@ fio_defer_perform_single_task_for_queue(fio_task_queue_s *queue) {
   fio_defer_task_s task = fio_defer_pop_task(queue);
   if (!task.func)
     return -1;
+  fio_defer_latency_record(task.queued_at);
   task.func(task.arg1, task.arg2);
   return 0;
 }
@@ -1021,6 +1149,7 @@ static inline void fio_defer_clear_tasks(void) {
 
 static void fio_defer_on_fork(void) {
   task_queue_normal.lock = FIO_LOCK_INIT;
+  fio_defer_latency.lock = FIO_LOCK_INIT;
 #if FIO_USE_URGENT_QUEUE
   task_queue_urgent.lock = FIO_LOCK_INIT;
 #endif
@@ -3794,6 +3923,9 @@ static void fio_worker_startup(void) {
   }
 }
 
+/* sentinel threads (watching workers) still running in the root */
+static volatile size_t fio_sentinel_count = 0;
+
 /* performs all clean-up / shutdown requirements except for the exit sequence */
 static void fio_worker_cleanup(void) {
   /* switch to winding down */
@@ -3821,6 +3953,9 @@ static void fio_worker_cleanup(void) {
     fio_defer_perform();
     while (wait(NULL) != -1)
       ;
+    /* sentinels read `fio_data` once their worker exits, keep it valid */
+    while (fio_sentinel_count)
+      fio_reschedule_thread();
   }
   fio_defer_perform();
   fio_state_callback_force(FIO_CALL_ON_FINISH);
@@ -3844,7 +3979,6 @@ static void *fio_sentinel_worker_thread(void *arg) {
     perror("\n           errno");
     kill(fio_parent_pid(), SIGINT);
     fio_stop();
-    return NULL;
   } else if (child) {
     int status;
     waitpid(child, &status, 0);
@@ -3882,6 +4016,7 @@ static void *fio_sentinel_worker_thread(void *arg) {
     fio_worker_cleanup();
     exit(0);
   }
+  fio_atomic_sub(&fio_sentinel_count, 1);
   return NULL;
   (void)arg;
 }
@@ -3891,6 +4026,7 @@ static void fio_sentinel_task(void *arg1, void *arg2) {
     return;
   fio_state_callback_force(FIO_CALL_BEFORE_FORK);
   fio_lock(&fio_fork_lock); /* will wait for worker thread to release lock. */
+  fio_atomic_add(&fio_sentinel_count, 1);
   void *thrd =
       fio_thread_new(fio_sentinel_worker_thread, (void *)&fio_fork_lock);
   fio_thread_free(thrd);
@@ -4470,6 +4606,215 @@ Section Start Marker
 
 ***************************************************************************** */
 
+/* *****************************************************************************
+Per-IP Connection and Request Limits
+***************************************************************************** */
+
+#ifndef FIO_IP_LIMIT_SHARDS
+/** The number of (separately locked) shards in a per-IP limit table. */
+#define FIO_IP_LIMIT_SHARDS 64
+#endif
+#ifndef FIO_IP_LIMIT_BINS
+/** The number of hash bins per shard. */
+#define FIO_IP_LIMIT_BINS 256
+#endif
+/* idle entries are collected at most once per this many milliseconds */
+#define FIO_IP_LIMIT_SWEEP_MS 5000
+
+typedef struct fio_ip_limit_entry_s {
+  struct fio_ip_limit_entry_s *next;
+  fio_ip_limit_s *limit;
+  uint64_t hash;
+  uint64_t stamp;  /* last token refill, in milliseconds */
+  uint64_t tokens; /* in thousandths of a token */
+  uint32_t connections;
+  uint8_t addr_len;
+  char addr[48];
+} fio_ip_limit_entry_s;
+
+typedef struct {
+  fio_lock_i lock;
+  uint64_t last_sweep;
+  fio_ip_limit_entry_s *bins[FIO_IP_LIMIT_BINS];
+} fio_ip_limit_shard_s;
+
+struct fio_ip_limit_s {
+  volatile size_t ref;
+  uint64_t capacity; /* bucket capacity, in thousandths of a token */
+  fio_ip_limit_args_s args;
+  fio_ip_limit_shard_s shards[FIO_IP_LIMIT_SHARDS];
+};
+
+static inline uint64_t fio_ip_limit_now(void) {
+  struct timespec t = fio_last_tick();
+  return ((uint64_t)t.tv_sec * 1000) + (t.tv_nsec / 1000000);
+}
+
+#define fio_ip_limit_hash2shard(limit, hash)                                   \
+  ((limit)->shards + ((hash) % FIO_IP_LIMIT_SHARDS))
+#define fio_ip_limit_hash2bin(hash)                                            \
+  (((hash) / FIO_IP_LIMIT_SHARDS) % FIO_IP_LIMIT_BINS)
+
+/* refills the token bucket, returning the current token count */
+static inline uint64_t fio_ip_limit_refill(fio_ip_limit_s *limit,
+                                           fio_ip_limit_entry_s *e,
+                                           uint64_t now) {
+  if (now > e->stamp) {
+    e->tokens += (now - e->stamp) * limit->args.rate;
+    if (e->tokens > limit->capacity)
+      e->tokens = limit->capacity;
+    e->stamp = now;
+  }
+  return e->tokens;
+}
+
+/* frees entries with no open connections and a full bucket (lock required) */
+static void fio_ip_limit_sweep(fio_ip_limit_s *limit,
+                               fio_ip_limit_shard_s *shard, uint64_t now) {
+  shard->last_sweep = now;
+  for (size_t i = 0; i < FIO_IP_LIMIT_BINS; ++i) {
+    fio_ip_limit_entry_s **pos = shard->bins + i;
+    while (*pos) {
+      fio_ip_limit_entry_s *e = *pos;
+      if (!e->connections &&
+          fio_ip_limit_refill(limit, e, now) >= limit->capacity) {
+        *pos = e->next;
+        free(e);
+        continue;
+      }
+      pos = &e->next;
+    }
+  }
+}
+
+/* finds (or creates) an entry - the shard must be locked */
+static fio_ip_limit_entry_s *fio_ip_limit_find(fio_ip_limit_s *limit,
+                                               fio_ip_limit_shard_s *shard,
+                                               fio_str_info_s addr,
+                                               uint64_t hash, uint64_t now) {
+  fio_ip_limit_entry_s **bin = shard->bins + fio_ip_limit_hash2bin(hash);
+  for (fio_ip_limit_entry_s *e = *bin; e; e = e->next) {
+    if (e->hash == hash && e->addr_len == addr.len &&
+        !memcmp(e->addr, addr.data, addr.len))
+      return e;
+  }
+  if (now - shard->last_sweep >= FIO_IP_LIMIT_SWEEP_MS)
+    fio_ip_limit_sweep(limit, shard, now);
+  fio_ip_limit_entry_s *e = malloc(sizeof(*e));
+  if (!e)
+    return NULL;
+  *e = (fio_ip_limit_entry_s){
+      .next = *bin,
+      .limit = limit,
+      .hash = hash,
+      .stamp = now,
+      .tokens = limit->capacity,
+      .addr_len = (uint8_t)addr.len,
+  };
+  memcpy(e->addr, addr.data, addr.len);
+  *bin = e;
+  return e;
+}
+
+static inline fio_str_info_s fio_ip_limit_addr(intptr_t uuid, uint64_t *hash) {
+  fio_str_info_s addr = fio_peer_addr(uuid);
+  if (addr.len > sizeof(((fio_ip_limit_entry_s *)0)->addr))
+    addr.len = sizeof(((fio_ip_limit_entry_s *)0)->addr);
+  if (addr.len)
+    *hash = fio_risky_hash(addr.data, addr.len, 0);
+  return addr;
+}
+
+#undef fio_ip_limit_new
+fio_ip_limit_s *fio_ip_limit_new(fio_ip_limit_args_s args) {
+  if (!args.max_connections && !args.rate)
+    return NULL;
+  if (args.burst < args.rate)
+    args.burst = args.rate;
+  fio_ip_limit_s *limit = calloc(1, sizeof(*limit));
+  FIO_ASSERT_ALLOC(limit);
+  limit->ref = 1;
+  limit->args = args;
+  limit->capacity = (uint64_t)args.burst * 1000;
+  return limit;
+}
+
+fio_ip_limit_s *fio_ip_limit_dup(fio_ip_limit_s *limit) {
+  if (limit)
+    fio_atomic_add(&limit->ref, 1);
+  return limit;
+}
+
+void fio_ip_limit_free(fio_ip_limit_s *limit) {
+  if (!limit || fio_atomic_sub(&limit->ref, 1))
+    return;
+  for (size_t s = 0; s < FIO_IP_LIMIT_SHARDS; ++s) {
+    for (size_t i = 0; i < FIO_IP_LIMIT_BINS; ++i) {
+      fio_ip_limit_entry_s *e = limit->shards[s].bins[i];
+      while (e) {
+        fio_ip_limit_entry_s *tmp = e;
+        e = e->next;
+        free(tmp);
+      }
+    }
+  }
+  free(limit);
+}
+
+static void fio_ip_limit_on_close(void *e_) {
+  fio_ip_limit_entry_s *e = e_;
+  fio_ip_limit_s *limit = e->limit;
+  fio_ip_limit_shard_s *shard = fio_ip_limit_hash2shard(limit, e->hash);
+  fio_lock(&shard->lock);
+  --e->connections;
+  fio_unlock(&shard->lock);
+  fio_ip_limit_free(limit);
+}
+
+int fio_ip_limit_attach(fio_ip_limit_s *limit, intptr_t uuid) {
+  uint64_t hash = 0;
+  fio_str_info_s addr = fio_ip_limit_addr(uuid, &hash);
+  if (!limit || !addr.len)
+    return 0;
+  fio_ip_limit_shard_s *shard = fio_ip_limit_hash2shard(limit, hash);
+  fio_lock(&shard->lock);
+  fio_ip_limit_entry_s *e =
+      fio_ip_limit_find(limit, shard, addr, hash, fio_ip_limit_now());
+  if (!e || (limit->args.max_connections &&
+             e->connections >= limit->args.max_connections)) {
+    fio_unlock(&shard->lock);
+    return -1;
+  }
+  ++e->connections;
+  fio_unlock(&shard->lock);
+  fio_ip_limit_dup(limit);
+  fio_uuid_link(uuid, e, fio_ip_limit_on_close);
+  return 0;
+}
+
+int fio_ip_limit_take(fio_ip_limit_s *limit, intptr_t uuid) {
+  if (!limit || !limit->args.rate)
+    return 0;
+  uint64_t hash = 0;
+  fio_str_info_s addr = fio_ip_limit_addr(uuid, &hash);
+  if (!addr.len)
+    return 0;
+  int ret = -1;
+  const uint64_t now = fio_ip_limit_now();
+  fio_ip_limit_shard_s *shard = fio_ip_limit_hash2shard(limit, hash);
+  fio_lock(&shard->lock);
+  fio_ip_limit_entry_s *e = fio_ip_limit_find(limit, shard, addr, hash, now);
+  if (e && fio_ip_limit_refill(limit, e, now) >= 1000) {
+    e->tokens -= 1000;
+    ret = 0;
+  }
+  fio_unlock(&shard->lock);
+  return ret;
+}
+
+#undef fio_ip_limit_hash2shard
+#undef fio_ip_limit_hash2bin
+
 /* *****************************************************************************
 The listening protocol (use the facil.io API to make a socket and attach it)
 ***************************************************************************** */
@@ -4486,12 +4831,14 @@ typedef struct {
   size_t port_len;
   size_t addr_len;
   void *tls;
+  fio_ip_limit_s *ip_limit;
 } fio_listen_protocol_s;
 
 static void fio_listen_cleanup_task(void *pr_) {
   fio_listen_protocol_s *pr = pr_;
   if (pr->tls)
     fio_tls_destroy(pr->tls);
+  fio_ip_limit_free(pr->ip_limit);
   if (pr->on_finish) {
     pr->on_finish(pr->uuid, pr->udata);
   }
@@ -4528,6 +4875,10 @@ static void fio_listen_on_data(intptr_t uuid, fio_protocol_s *pr_) {
     intptr_t client = fio_accept(uuid);
     if (client == -1)
       return;
+    if (pr->ip_limit && fio_ip_limit_attach(pr->ip_limit, client)) {
+      fio_force_close(client);
+      continue;
+    }
     pr->on_open(client, pr->udata);
   }
 }
@@ -4538,6 +4889,10 @@ static void fio_listen_on_data_tls(intptr_t uuid, fio_protocol_s *pr_) {
     intptr_t client = fio_accept(uuid);
     if (client == -1)
       return;
+    if (pr->ip_limit && fio_ip_limit_attach(pr->ip_limit, client)) {
+      fio_force_close(client);
+      continue;
+    }
     fio_tls_accept(client, pr->tls, pr->udata);
     pr->on_open(client, pr->udata);
   }
@@ -4549,6 +4904,10 @@ static void fio_listen_on_data_tls_alpn(intptr_t uuid, fio_protocol_s *pr_) {
     intptr_t client = fio_accept(uuid);
     if (client == -1)
       return;
+    if (pr->ip_limit && fio_ip_limit_attach(pr->ip_limit, client)) {
+      fio_force_close(client);
+      continue;
+    }
     fio_tls_accept(client, pr->tls, pr->udata);
   }
 }
@@ -4612,6 +4971,7 @@ intptr_t fio_listen FIO_IGNORE_MACRO(struct fio_listen_args args) {
       .on_start = args.on_start,
       .on_finish = args.on_finish,
       .tls = args.tls,
+      .ip_limit = fio_ip_limit_dup(args.ip_limit),
       .addr_len = addr_len,
       .port_len = port_len,
       .addr = (char *)(pr + 1),
@@ -5102,6 +5462,7 @@ typedef enum fio_cluster_message_type_e {
   FIO_CLUSTER_MSG_SHUTDOWN,
   FIO_CLUSTER_MSG_ERROR,
   FIO_CLUSTER_MSG_PING,
+  FIO_CLUSTER_MSG_SHM_ATTACH,
 } fio_cluster_message_type_e;
 
 typedef struct fio_collection_s fio_collection_s;
@@ -5195,6 +5556,8 @@ static int fio_channel_cmp(channel_s *ch1, channel_s *ch2) {
 
 struct fio_collection_s {
   fio_ch_set_s channels;
+  /** changes whenever a channel is added or removed (see channel handles) */
+  volatile size_t generation;
   fio_lock_i lock;
 };
 
@@ -5365,6 +5728,183 @@ static inline ssize_t fio_msg_internal_send_dup(intptr_t uuid,
  */
 static void fio_mock_on_message(fio_msg_s *msg) { (void)msg; }
 
+/* *****************************************************************************
+Pattern Index
+***************************************************************************** */
+
+/*
+Glob patterns are indexed by their literal prefix (the bytes before the first
+wildcard or escape) in a byte trie, so publishing only tests the patterns that
+could match: those stored in the nodes along the published channel's name.
+
+Patterns with no literal prefix and patterns using other match functions are
+kept in the root node and tested against every published channel.
+
+The index is protected by the `fio_postoffice.patterns` lock.
+*/
+
+#ifndef FIO_PATTERN_INDEX_DEPTH
+/** Prefix bytes indexed (longer prefixes are verified by the match). */
+#define FIO_PATTERN_INDEX_DEPTH 64
+#endif
+
+typedef struct fio_pattern_node_s fio_pattern_node_s;
+struct fio_pattern_node_s {
+  fio_pattern_node_s **children; /* sorted by `byte` */
+  channel_s **patterns;
+  uint32_t child_count;
+  uint32_t child_capa;
+  uint32_t pattern_count;
+  uint32_t pattern_capa;
+  uint8_t byte;
+};
+
+static fio_pattern_node_s fio_pattern_index;
+
+static int fio_glob_match(fio_str_info_s pat, fio_str_info_s ch);
+
+/** Returns the length of the indexed prefix of a pattern. */
+static size_t fio_pattern_index_prefix(channel_s *ch) {
+  if (ch->match != fio_glob_match)
+    return 0;
+  size_t len = 0;
+  while (len < ch->name_len && len < FIO_PATTERN_INDEX_DEPTH) {
+    switch (ch->name[len]) {
+    case '*': /* fallthrough */
+    case '?': /* fallthrough */
+    case '[': /* fallthrough */
+    case '\\':
+      return len;
+    }
+    ++len;
+  }
+  return len;
+}
+
+/** Finds the child's position (or where it should be inserted). */
+static uint32_t fio_pattern_node_find(fio_pattern_node_s *node, uint8_t byte) {
+  uint32_t start = 0, end = node->child_count;
+  while (start < end) {
+    uint32_t mid = (start + end) >> 1;
+    if (node->children[mid]->byte < byte)
+      start = mid + 1;
+    else
+      end = mid;
+  }
+  return start;
+}
+
+/** Returns the child for `byte`, or NULL. */
+static inline fio_pattern_node_s *fio_pattern_node_child(fio_pattern_node_s *node,
+                                                         uint8_t byte) {
+  uint32_t i = fio_pattern_node_find(node, byte);
+  if (i < node->child_count && node->children[i]->byte == byte)
+    return node->children[i];
+  return NULL;
+}
+
+/** Adds a pattern channel to the index. */
+static void fio_pattern_index_add(channel_s *ch) {
+  fio_pattern_node_s *node = &fio_pattern_index;
+  const size_t len = fio_pattern_index_prefix(ch);
+  for (size_t i = 0; i < len; ++i) {
+    const uint8_t byte = (uint8_t)ch->name[i];
+    uint32_t pos = fio_pattern_node_find(node, byte);
+    if (pos == node->child_count || node->children[pos]->byte != byte) {
+      if (node->child_count == node->child_capa) {
+        node->child_capa = node->child_capa ? (node->child_capa << 1) : 2;
+        node->children = realloc(node->children,
+                                 sizeof(*node->children) * node->child_capa);
+        FIO_ASSERT_ALLOC(node->children);
+      }
+      fio_pattern_node_s *child = calloc(1, sizeof(*child));
+      FIO_ASSERT_ALLOC(child);
+      child->byte = byte;
+      memmove(node->children + pos + 1, node->children + pos,
+              sizeof(*node->children) * (node->child_count - pos));
+      node->children[pos] = child;
+      ++node->child_count;
+    }
+    node = node->children[pos];
+  }
+  if (node->pattern_count == node->pattern_capa) {
+    node->pattern_capa = node->pattern_capa ? (node->pattern_capa << 1) : 2;
+    node->patterns =
+        realloc(node->patterns, sizeof(*node->patterns) * node->pattern_capa);
+    FIO_ASSERT_ALLOC(node->patterns);
+  }
+  node->patterns[node->pattern_count++] = ch;
+}
+
+/** Removes a pattern channel from the index, releasing unused nodes. */
+static void fio_pattern_index_remove(channel_s *ch) {
+  fio_pattern_node_s *path[FIO_PATTERN_INDEX_DEPTH + 1];
+  fio_pattern_node_s *node = &fio_pattern_index;
+  const size_t len = fio_pattern_index_prefix(ch);
+  path[0] = node;
+  for (size_t i = 0; i < len; ++i) {
+    node = fio_pattern_node_child(node, (uint8_t)ch->name[i]);
+    if (!node)
+      return;
+    path[i + 1] = node;
+  }
+  for (uint32_t i = 0; i < node->pattern_count; ++i) {
+    if (node->patterns[i] != ch)
+      continue;
+    node->patterns[i] = node->patterns[--node->pattern_count];
+    break;
+  }
+  for (size_t depth = len; depth; --depth) {
+    node = path[depth];
+    if (node->pattern_count || node->child_count)
+      break;
+    fio_pattern_node_s *parent = path[depth - 1];
+    uint32_t pos = fio_pattern_node_find(parent, node->byte);
+    memmove(parent->children + pos, parent->children + pos + 1,
+            sizeof(*parent->children) * (parent->child_count - pos - 1));
+    --parent->child_count;
+    free(node->children);
+    free(node->patterns);
+    free(node);
+  }
+}
+
+/** Releases the index's memory (the channels are owned by the collection). */
+static void fio_pattern_index_free(fio_pattern_node_s *node) {
+  while (node->child_count) {
+    fio_pattern_node_s *child = node->children[--node->child_count];
+    fio_pattern_index_free(child);
+    free(child);
+  }
+  free(node->children);
+  free(node->patterns);
+  *node = (fio_pattern_node_s){.byte = node->byte};
+}
+
+/**
+ * Calls `task` for every indexed pattern matching the channel `name`. Call with
+ * the patterns collection locked.
+ */
+static void fio_pattern_index_match(fio_str_info_s name,
+                                    void (*task)(channel_s *, void *),
+                                    void *arg) {
+  fio_pattern_node_s *node = &fio_pattern_index;
+  size_t i = 0;
+  for (;;) {
+    for (uint32_t j = 0; j < node->pattern_count; ++j) {
+      channel_s *p = node->patterns[j];
+      if (p->match((fio_str_info_s){.data = p->name, .len = p->name_len},
+                   name))
+        task(p, arg);
+    }
+    if (i == name.len || i == FIO_PATTERN_INDEX_DEPTH)
+      return;
+    node = fio_pattern_node_child(node, (uint8_t)name.data[i++]);
+    if (!node)
+      return;
+  }
+}
+
 /* *****************************************************************************
 Channel Subscription Management
 ***************************************************************************** */
@@ -5377,7 +5917,13 @@ static inline channel_s *fio_filter_dup_lock_internal(channel_s *ch,
                                                       uint64_t hashed,
                                                       fio_collection_s *c) {
   fio_lock(&c->lock);
+  const size_t count = fio_ch_set_count(&c->channels);
   ch = fio_ch_set_insert(&c->channels, hashed, ch);
+  if (fio_ch_set_count(&c->channels) != count) {
+    ++c->generation;
+    if (c == &fio_postoffice.patterns)
+      fio_pattern_index_add(ch);
+  }
   fio_channel_dup(ch);
   fio_lock(&ch->lock);
   fio_unlock(&c->lock);
@@ -5500,7 +6046,10 @@ void fio_unsubscribe(subscription_s *s) {
     fio_lock(&c->lock);
     /* test again within lock */
     if (fio_ls_embd_is_empty(&ch->subscriptions)) {
+      if (c == &fio_postoffice.patterns)
+        fio_pattern_index_remove(ch);
       fio_ch_set_remove(&c->channels, hashed, ch, NULL);
+      ++c->generation;
       removed = (c != &fio_postoffice.filters);
     }
     fio_unlock(&c->lock);
@@ -5707,14 +6256,29 @@ void fio_message_defer(fio_msg_s *msg_) {
   cl->marker = 1;
 }
 
-/* performs the actual callback */
-static void fio_perform_subscription_callback(void *s_, void *msg_) {
-  subscription_s *s = s_;
-  if (fio_trylock(&s->lock)) {
-    fio_defer_push_task(fio_perform_subscription_callback, s_, msg_);
-    return;
-  }
-  fio_msg_internal_s *msg = (fio_msg_internal_s *)msg_;
+#ifndef FIO_PUBSUB_BATCH
+/**
+ * The number of subscriptions a single task delivers a message to, so a channel
+ * with many subscribers doesn't flood the task queue.
+ */
+#define FIO_PUBSUB_BATCH 64
+#endif
+
+/** a message and the subscriptions it should be delivered to */
+typedef struct {
+  fio_msg_internal_s *msg;
+  size_t count;
+  subscription_s *subs[FIO_PUBSUB_BATCH];
+} fio_subscription_batch_s;
+
+/**
+ * Performs the actual callback. Returns 0 if the callback should be called
+ * again later (the subscription was busy or the message was deferred).
+ */
+static int fio_perform_subscription_callback(subscription_s *s,
+                                             fio_msg_internal_s *msg) {
+  if (fio_trylock(&s->lock))
+    return 0;
   fio_msg_client_s m = {
       .msg =
           {
@@ -5733,25 +6297,52 @@ static void fio_perform_subscription_callback(void *s_, void *msg_) {
     s->on_message(&m.msg);
   }
   fio_unlock(&s->lock);
-  if (m.marker) {
-    fio_defer_push_task(fio_perform_subscription_callback, s_, msg_);
+  return !m.marker;
+}
+
+/** delivers a message to a batch of subscriptions, re-queuing the busy ones */
+static void fio_perform_subscription_batch(void *b_, void *ignr) {
+  fio_subscription_batch_s *b = b_;
+  size_t pending = 0;
+  for (size_t i = 0; i < b->count; ++i) {
+    if (fio_perform_subscription_callback(b->subs[i], b->msg))
+      fio_subscription_free(b->subs[i]);
+    else
+      b->subs[pending++] = b->subs[i];
+  }
+  b->count = pending;
+  if (pending) {
+    fio_defer_push_task(fio_perform_subscription_batch, b, NULL);
     return;
   }
-  fio_msg_internal_free(msg);
-  fio_subscription_free(s);
+  fio_msg_internal_free(b->msg);
+  fio_free(b);
+  (void)ignr;
 }
 
 /** UNSAFE! publishes a message to a channel, managing the reference counts */
 static void fio_publish2channel(channel_s *ch, fio_msg_internal_s *msg) {
+  fio_subscription_batch_s *b = NULL;
   FIO_LS_EMBD_FOR(&ch->subscriptions, pos) {
     subscription_s *s = FIO_LS_EMBD_OBJ(subscription_s, node, pos);
     if (!s || s->on_message == fio_mock_on_message) {
       continue;
     }
+    if (!b) {
+      b = fio_malloc(sizeof(*b));
+      FIO_ASSERT_ALLOC(b);
+      b->msg = fio_msg_internal_dup(msg);
+      b->count = 0;
+    }
     fio_atomic_add(&s->ref, 1);
-    fio_atomic_add(&msg->ref, 1);
-    fio_defer_push_task(fio_perform_subscription_callback, s, msg);
+    b->subs[b->count++] = s;
+    if (b->count == FIO_PUBSUB_BATCH) {
+      fio_defer_push_task(fio_perform_subscription_batch, b, NULL);
+      b = NULL;
+    }
   }
+  if (b)
+    fio_defer_push_task(fio_perform_subscription_batch, b, NULL);
   fio_msg_internal_free(msg);
 }
 static void fio_publish2channel_task(void *ch_, void *msg) {
@@ -5770,6 +6361,12 @@ finish:
   fio_channel_free(ch);
 }
 
+/** Schedules publishing the message to a channel (adds references). */
+static void fio_publish2channel_push(channel_s *ch, void *m) {
+  fio_channel_dup(ch);
+  fio_defer_push_urgent(fio_publish2channel_task, ch, fio_msg_internal_dup(m));
+}
+
 /** Publishes the message to the current process and frees the strings. */
 static void fio_publish2process(fio_msg_internal_s *m) {
   fio_msg_internal_finalize(m);
@@ -5788,21 +6385,9 @@ static void fio_publish2process(fio_msg_internal_s *m) {
                           fio_msg_internal_dup(m));
   }
   if (m->filter == 0) {
-    /* pattern matching match */
+    /* pattern matching match, for the patterns indexed along the name */
     fio_lock(&fio_postoffice.patterns.lock);
-    FIO_SET_FOR_LOOP(&fio_postoffice.patterns.channels, p) {
-      if (!p->hash) {
-        continue;
-      }
-
-      if (p->obj->match(
-              (fio_str_info_s){.data = p->obj->name, .len = p->obj->name_len},
-              m->channel)) {
-        fio_channel_dup(p->obj);
-        fio_defer_push_urgent(fio_publish2channel_task, p->obj,
-                              fio_msg_internal_dup(m));
-      }
-    }
+    fio_pattern_index_match(m->channel, fio_publish2channel_push, m);
     fio_unlock(&fio_postoffice.patterns.lock);
   }
 finish:
@@ -5914,6 +6499,738 @@ static void fio_cluster_init(void) {
   fio_state_callback_add(FIO_CALL_AT_EXIT, fio_cluster_cleanup, NULL);
 }
 
+/* *****************************************************************************
+ * Shared memory transport (see `fio_pubsub_cluster_shm`)
+ **************************************************************************** */
+
+/*
+Data messages (FORWARD, JSON, ROOT, ROOT_JSON) can bypass the cluster socket:
+
+* The root writes every message once to a broadcast ring. Each worker reads the
+  ring using a cursor of its own, skipping the messages it sent.
+
+* Each worker writes to a ring of its own (single producer, single consumer),
+  which the root reads, relaying messages like it would when read from the
+  socket.
+
+* Readers are woken by an `eventfd` doorbell. A flag in the shared memory
+  prevents ringing a doorbell that was already rung.
+
+Workers claim a free slot (a ring and a doorbell) after `fork` and announce it
+to the root over the socket (FIO_CLUSTER_MSG_SHM_ATTACH). The root releases the
+slot when the worker's connection closes. A worker without a slot keeps using
+the socket, as does everything except data messages.
+
+Messages that don't fit in a ring wait in a (process local) queue, preserving
+their order, until the reader reports progress by ringing the writer's doorbell.
+*/
+
+static size_t fio_cluster_shm_capa;
+
+#if FIO_PUBSUB_CLUSTER_SHM
+#include <sys/eventfd.h>
+
+#define FIO_CLUSTER_SHM_FIRST 1
+#define FIO_CLUSTER_SHM_LAST 2
+#define FIO_CLUSTER_SHM_PAD 4
+
+/** a record in a ring, followed by (part of) the channel and data bytes */
+typedef struct {
+  uint32_t len;   /* the number of channel and data bytes in this record */
+  uint8_t flags;  /* FIO_CLUSTER_SHM_FIRST | FIO_CLUSTER_SHM_LAST or PAD */
+  uint8_t type;   /* the cluster message type */
+  int16_t origin; /* the slot that sent the message, -1 for the root */
+  int32_t filter;
+  uint32_t ch_len;
+  uint32_t data_len;
+  uint32_t reserved;
+} fio_cluster_shm_record_s;
+
+/** a worker's slot (fields written by different processes are kept apart) */
+typedef struct {
+  volatile intptr_t pid;    /* 0 when free, -1 while claimed */
+  volatile uint64_t cursor; /* the worker's position in the broadcast ring */
+  volatile uint8_t bell;    /* set while the worker's doorbell was rung */
+  volatile uint8_t waiting; /* set while the worker waits for room */
+  uint8_t pad0_[64 - sizeof(intptr_t) - sizeof(uint64_t) - 2];
+  volatile uint64_t head; /* the worker's ring, written by the worker */
+  uint8_t pad1_[64 - sizeof(uint64_t)];
+  volatile uint64_t tail; /* the worker's ring, read position of the root */
+  uint8_t pad2_[64 - sizeof(uint64_t)];
+} fio_cluster_shm_slot_s;
+
+/** the shared memory header, followed by the slots and the rings */
+typedef struct {
+  volatile uint64_t head; /* the broadcast ring, written by the root */
+  uint8_t pad0_[64 - sizeof(uint64_t)];
+  volatile uint8_t bell;    /* set while the root's doorbell was rung */
+  volatile uint8_t waiting; /* set while the root waits for room */
+  uint8_t pad1_[62];
+  fio_cluster_shm_slot_s slots[];
+} fio_cluster_shm_header_s;
+
+/** assembles messages that were split across records */
+typedef struct {
+  fio_msg_internal_s *msg;
+  size_t offset;
+} fio_cluster_shm_reader_s;
+
+/** a message waiting for room */
+typedef struct {
+  fio_ls_embd_s node;
+  fio_msg_internal_s *msg;
+  size_t offset;
+  int16_t origin;
+  uint8_t type;
+} fio_cluster_shm_pending_s;
+
+static struct {
+  fio_cluster_shm_header_s *hdr;
+  uint8_t *bcast;      /* the broadcast ring */
+  uint8_t *rings;      /* the worker rings, `ring_capa` bytes per slot */
+  size_t bcast_capa;   /* a power of 2 */
+  size_t ring_capa;    /* a power of 2 */
+  size_t map_len;      /* the length of the shared memory mapping */
+  size_t slot_count;   /* the number of slots */
+  int *bells;          /* the doorbells of the slots */
+  int root_bell;       /* the root's doorbell */
+  int slot;            /* the worker's slot, -1 in the root or without a slot */
+  intptr_t *uuids;     /* root: the connection of every attached slot (or 0) */
+  fio_cluster_shm_reader_s *readers; /* root: message assembly per slot */
+  fio_cluster_shm_reader_s reader;   /* worker: broadcast message assembly */
+  fio_ls_embd_s pending;             /* messages waiting for room */
+  fio_lock_i lock;      /* protects writing and the attached slots */
+  fio_lock_i read_lock; /* root: protects reading the worker rings */
+} cluster_shm = {
+    .slot = -1,
+    .root_bell = -1,
+    .pending = FIO_LS_INIT(cluster_shm.pending),
+    .lock = FIO_LOCK_INIT,
+    .read_lock = FIO_LOCK_INIT,
+};
+
+static void fio_cluster_server_sender(void *m_, intptr_t avoid_uuid);
+
+/** the message type, as written to the message's socket header */
+static inline uint32_t fio_msg_internal_type(fio_msg_internal_s *m) {
+  return fio_str2u32((uint8_t *)(m + 1) + (m->meta_len * sizeof(*m->meta)) +
+                     8);
+}
+
+/** returns true for the message types that can use the shared memory */
+static inline int fio_cluster_shm_is_data(uint32_t type) {
+  return type == FIO_CLUSTER_MSG_FORWARD || type == FIO_CLUSTER_MSG_JSON ||
+         type == FIO_CLUSTER_MSG_ROOT || type == FIO_CLUSTER_MSG_ROOT_JSON;
+}
+
+static inline uint8_t *fio_cluster_shm_ring(size_t slot) {
+  return cluster_shm.rings + (slot * cluster_shm.ring_capa);
+}
+
+/** rings a doorbell, unless it was rung and the reader didn't wake up yet */
+static inline void fio_cluster_shm_ring_bell(volatile uint8_t *flag, int fd) {
+  if (fio_atomic_xchange(flag, 1))
+    return;
+  uint64_t one = 1;
+  if (write(fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+    FIO_LOG_ERROR("(%d) (pub/sub) couldn't ring cluster doorbell: %s",
+                  (int)getpid(), strerror(errno));
+}
+
+/** root: returns the slot attached to the connection, or -1 */
+static int16_t fio_cluster_shm_slot_of(intptr_t uuid) {
+  if (uuid <= 0)
+    return -1;
+  for (size_t i = 0; i < cluster_shm.slot_count; ++i) {
+    if (cluster_shm.uuids[i] == uuid)
+      return (int16_t)i;
+  }
+  return -1;
+}
+
+/** root: rings the doorbells of all attached slots, except `avoid` */
+static void fio_cluster_shm_ring_workers(int16_t avoid) {
+  for (size_t i = 0; i < cluster_shm.slot_count; ++i) {
+    if (cluster_shm.uuids[i] && (int16_t)i != avoid)
+      fio_cluster_shm_ring_bell(&cluster_shm.hdr->slots[i].bell,
+                                cluster_shm.bells[i]);
+  }
+}
+
+/** root: the broadcast ring position all attached workers read past */
+static uint64_t fio_cluster_shm_consumed_unsafe(void) {
+  uint64_t consumed = __atomic_load_n(&cluster_shm.hdr->head, __ATOMIC_SEQ_CST);
+  for (size_t i = 0; i < cluster_shm.slot_count; ++i) {
+    if (!cluster_shm.uuids[i])
+      continue;
+    uint64_t cursor =
+        __atomic_load_n(&cluster_shm.hdr->slots[i].cursor, __ATOMIC_SEQ_CST);
+    if (cursor < consumed)
+      consumed = cursor;
+  }
+  return consumed;
+}
+
+/**
+ * Writes the message (from `*offset`) as one or more records. Returns 1 once
+ * the last record was written, 0 when the ring is full.
+ */
+static int fio_cluster_shm_write(uint8_t *buf, size_t capa, uint64_t *head,
+                                 uint64_t consumed, fio_cluster_shm_record_s r,
+                                 fio_msg_internal_s *m, size_t *offset) {
+  const size_t total = m->channel.len + m->data.len;
+  const size_t limit = (capa >> 2) - sizeof(r);
+  for (;;) {
+    size_t len = total - *offset;
+    if (len > limit)
+      len = limit;
+    const size_t need = sizeof(r) + ((len + 7) & (~(size_t)7));
+    size_t pos = *head & (capa - 1);
+    size_t skip = 0;
+    if (capa - pos < need)
+      skip = capa - pos; /* records never wrap around */
+    if (*head + skip + need - consumed > capa)
+      return 0;
+    if (skip) {
+      if (skip >= sizeof(r)) {
+        fio_cluster_shm_record_s pad = {.flags = FIO_CLUSTER_SHM_PAD};
+        memcpy(buf + pos, &pad, sizeof(pad));
+      }
+      *head += skip;
+      pos = 0;
+    }
+    r.len = (uint32_t)len;
+    r.flags = (*offset == 0 ? FIO_CLUSTER_SHM_FIRST : 0) |
+              (*offset + len == total ? FIO_CLUSTER_SHM_LAST : 0);
+    memcpy(buf + pos, &r, sizeof(r));
+    uint8_t *dest = buf + pos + sizeof(r);
+    size_t i = *offset;
+    *offset += len;
+    if (i < m->channel.len) {
+      size_t part = m->channel.len - i;
+      if (part > len)
+        part = len;
+      memcpy(dest, m->channel.data + i, part);
+      dest += part;
+      i += part;
+      len -= part;
+    }
+    if (len)
+      memcpy(dest, m->data.data + (i - m->channel.len), len);
+    *head += need;
+    if (r.flags & FIO_CLUSTER_SHM_LAST)
+      return 1;
+  }
+}
+
+/**
+ * Reads the records up to `head`, updating the `*cursor` after each record,
+ * and calls `on_message` for every complete message not sent by `skip`.
+ */
+static void fio_cluster_shm_read(
+    uint8_t *buf, size_t capa, volatile uint64_t *cursor, uint64_t head,
+    fio_cluster_shm_reader_s *reader, int16_t skip,
+    void (*on_message)(fio_msg_internal_s *m, uint32_t type, int16_t origin)) {
+  uint64_t pos = __atomic_load_n(cursor, __ATOMIC_SEQ_CST);
+  while (pos < head) {
+    fio_cluster_shm_record_s r;
+    size_t i = pos & (capa - 1);
+    if (capa - i < sizeof(r)) {
+      pos += capa - i;
+      continue;
+    }
+    memcpy(&r, buf + i, sizeof(r));
+    if (r.flags & FIO_CLUSTER_SHM_PAD) {
+      pos += capa - i;
+      continue;
+    }
+    if (r.origin != skip) {
+      if (r.flags & FIO_CLUSTER_SHM_FIRST) {
+        if (reader->msg)
+          fio_msg_internal_free(reader->msg);
+        reader->msg = fio_msg_internal_create(
+            r.filter, r.type, (fio_str_info_s){.len = r.ch_len},
+            (fio_str_info_s){.len = r.data_len},
+            (int8_t)(r.type == FIO_CLUSTER_MSG_JSON ||
+                     r.type == FIO_CLUSTER_MSG_ROOT_JSON),
+            0);
+        reader->offset = 0;
+      }
+      fio_msg_internal_s *m = reader->msg;
+      /* a reader attached mid-message waits for the next one */
+      if (m && reader->offset + r.len <= m->channel.len + m->data.len) {
+        uint8_t *src = buf + i + sizeof(r);
+        size_t len = r.len;
+        if (reader->offset < m->channel.len) {
+          size_t part = m->channel.len - reader->offset;
+          if (part > len)
+            part = len;
+          memcpy(m->channel.data + reader->offset, src, part);
+          src += part;
+          reader->offset += part;
+          len -= part;
+        }
+        if (len) {
+          memcpy(m->data.data + (reader->offset - m->channel.len), src, len);
+          reader->offset += len;
+        }
+        if (r.flags & FIO_CLUSTER_SHM_LAST) {
+          reader->msg = NULL;
+          fio_postoffice_meta_update(m);
+          on_message(m, r.type, r.origin);
+          fio_msg_internal_free(m);
+        }
+      }
+    }
+    pos += sizeof(r) + ((r.len + 7) & (~(size_t)7));
+    __atomic_store_n(cursor, pos, __ATOMIC_SEQ_CST);
+  }
+}
+
+/** writes to the process's ring (root: broadcast ring). Call within lock. */
+static int fio_cluster_shm_push_unsafe(fio_cluster_shm_pending_s *p) {
+  uint8_t *buf = cluster_shm.bcast;
+  size_t capa = cluster_shm.bcast_capa;
+  volatile uint64_t *head_p = &cluster_shm.hdr->head;
+  volatile uint8_t *waiting = &cluster_shm.hdr->waiting;
+  fio_cluster_shm_slot_s *s = NULL;
+  if (cluster_shm.slot >= 0) {
+    s = cluster_shm.hdr->slots + cluster_shm.slot;
+    buf = fio_cluster_shm_ring(cluster_shm.slot);
+    capa = cluster_shm.ring_capa;
+    head_p = &s->head;
+    waiting = &s->waiting;
+  }
+  const fio_cluster_shm_record_s r = {
+      .type = p->type,
+      .origin = p->origin,
+      .filter = p->msg->filter,
+      .ch_len = (uint32_t)p->msg->channel.len,
+      .data_len = (uint32_t)p->msg->data.len,
+  };
+  for (int retry = 0;; retry = 1) {
+    uint64_t consumed = s ? __atomic_load_n(&s->tail, __ATOMIC_SEQ_CST)
+                          : fio_cluster_shm_consumed_unsafe();
+    uint64_t head = *head_p;
+    int done = fio_cluster_shm_write(buf, capa, &head, consumed, r, p->msg,
+                                     &p->offset);
+    __atomic_store_n(head_p, head, __ATOMIC_SEQ_CST);
+    if (done || retry)
+      return done;
+    /* ask the reader(s) to ring our doorbell, then test for room once more */
+    fio_atomic_xchange(waiting, 1);
+  }
+}
+
+/** writes queued messages, for as long as there's room. Call within lock. */
+static void fio_cluster_shm_flush_unsafe(void) {
+  while (fio_ls_embd_any(&cluster_shm.pending)) {
+    fio_cluster_shm_pending_s *p = FIO_LS_EMBD_OBJ(
+        fio_cluster_shm_pending_s, node, cluster_shm.pending.next);
+    if (!fio_cluster_shm_push_unsafe(p))
+      return;
+    fio_ls_embd_remove(&p->node);
+    fio_msg_internal_free(p->msg);
+    fio_free(p);
+  }
+}
+
+/** writes a message, or queues it behind earlier ones. Call within lock. */
+static void fio_cluster_shm_send_unsafe(fio_msg_internal_s *m, uint8_t type,
+                                        int16_t origin) {
+  fio_cluster_shm_pending_s tmp = {.msg = m, .type = type, .origin = origin};
+  if (!fio_ls_embd_any(&cluster_shm.pending) &&
+      fio_cluster_shm_push_unsafe(&tmp))
+    return;
+  fio_cluster_shm_pending_s *p = fio_malloc(sizeof(*p));
+  FIO_ASSERT_ALLOC(p);
+  *p = tmp;
+  p->msg = fio_msg_internal_dup(m);
+  fio_ls_embd_push(&cluster_shm.pending, &p->node);
+}
+
+/** root: handles a message read from a worker's ring */
+static void fio_cluster_shm_root_on_message(fio_msg_internal_s *m,
+                                            uint32_t type, int16_t origin) {
+  switch ((fio_cluster_message_type_e)type) {
+  case FIO_CLUSTER_MSG_FORWARD: /* fallthrough */
+  case FIO_CLUSTER_MSG_JSON:
+    fio_cluster_server_sender(fio_msg_internal_dup(m),
+                              cluster_shm.uuids[origin]);
+    fio_publish2process(fio_msg_internal_dup(m));
+    break;
+  case FIO_CLUSTER_MSG_ROOT:      /* fallthrough */
+  case FIO_CLUSTER_MSG_ROOT_JSON: /* fallthrough */
+    fio_publish2process(fio_msg_internal_dup(m));
+    break;
+  default:
+    break;
+  }
+}
+
+/** worker: handles a message read from the broadcast ring */
+static void fio_cluster_shm_worker_on_message(fio_msg_internal_s *m,
+                                              uint32_t type, int16_t origin) {
+  if (type == FIO_CLUSTER_MSG_FORWARD || type == FIO_CLUSTER_MSG_JSON)
+    fio_publish2process(fio_msg_internal_dup(m));
+  (void)origin;
+}
+
+/** root: reads a worker's ring. Call within the read lock. */
+static void fio_cluster_shm_read_slot_unsafe(size_t slot) {
+  fio_cluster_shm_slot_s *s = cluster_shm.hdr->slots + slot;
+  fio_cluster_shm_read(fio_cluster_shm_ring(slot), cluster_shm.ring_capa,
+                       &s->tail, __atomic_load_n(&s->head, __ATOMIC_SEQ_CST),
+                       cluster_shm.readers + slot, -2,
+                       fio_cluster_shm_root_on_message);
+  if (s->waiting && fio_atomic_xchange(&s->waiting, 0))
+    fio_cluster_shm_ring_bell(&s->bell, cluster_shm.bells[slot]);
+}
+
+/** clears an `eventfd` doorbell */
+static void fio_cluster_shm_bell_clear(int fd) {
+  uint64_t count;
+  if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+    FIO_LOG_ERROR("(%d) (pub/sub) couldn't read cluster doorbell: %s",
+                  (int)getpid(), strerror(errno));
+}
+
+/** root: the doorbell rang, read the worker rings and flush the queue. */
+static void fio_cluster_shm_root_on_data(intptr_t uuid, fio_protocol_s *pr) {
+  fio_cluster_shm_bell_clear(fio_uuid2fd(uuid));
+  fio_atomic_xchange(&cluster_shm.hdr->bell, 0);
+  fio_lock(&cluster_shm.read_lock);
+  for (size_t i = 0; i < cluster_shm.slot_count; ++i) {
+    if (cluster_shm.uuids[i])
+      fio_cluster_shm_read_slot_unsafe(i);
+  }
+  fio_unlock(&cluster_shm.read_lock);
+  fio_lock(&cluster_shm.lock);
+  if (fio_ls_embd_any(&cluster_shm.pending)) {
+    fio_cluster_shm_flush_unsafe();
+    fio_cluster_shm_ring_workers(-1);
+  }
+  fio_unlock(&cluster_shm.lock);
+  (void)pr;
+}
+
+/** worker: the doorbell rang, read the broadcast ring and flush the queue. */
+static void fio_cluster_shm_worker_on_data(intptr_t uuid, fio_protocol_s *pr) {
+  fio_cluster_shm_slot_s *s = cluster_shm.hdr->slots + cluster_shm.slot;
+  fio_cluster_shm_bell_clear(fio_uuid2fd(uuid));
+  fio_atomic_xchange(&s->bell, 0);
+  fio_cluster_shm_read(
+      cluster_shm.bcast, cluster_shm.bcast_capa, &s->cursor,
+      __atomic_load_n(&cluster_shm.hdr->head, __ATOMIC_SEQ_CST),
+      &cluster_shm.reader, (int16_t)cluster_shm.slot,
+      fio_cluster_shm_worker_on_message);
+  if (cluster_shm.hdr->waiting &&
+      fio_atomic_xchange(&cluster_shm.hdr->waiting, 0))
+    fio_cluster_shm_ring_bell(&cluster_shm.hdr->bell, cluster_shm.root_bell);
+  fio_lock(&cluster_shm.lock);
+  if (fio_ls_embd_any(&cluster_shm.pending)) {
+    fio_cluster_shm_flush_unsafe();
+    fio_cluster_shm_ring_bell(&cluster_shm.hdr->bell, cluster_shm.root_bell);
+  }
+  fio_unlock(&cluster_shm.lock);
+  (void)pr;
+}
+
+static fio_protocol_s fio_cluster_shm_root_protocol = {
+    .on_data = fio_cluster_shm_root_on_data,
+    .on_shutdown = mock_on_shutdown_eternal,
+    .ping = mock_ping_eternal,
+};
+
+static fio_protocol_s fio_cluster_shm_worker_protocol = {
+    .on_data = fio_cluster_shm_worker_on_data,
+    .on_shutdown = mock_on_shutdown_eternal,
+    .ping = mock_ping_eternal,
+};
+
+/**
+ * root: writes a data message to the broadcast ring and locks the attached
+ * slots (so none attaches between writing and sending through the socket).
+ * Returns 0 (without locking) if the message isn't written to the ring.
+ */
+static int fio_cluster_shm_broadcast_lock(fio_msg_internal_s *m,
+                                          intptr_t avoid_uuid) {
+  if (!cluster_shm.hdr)
+    return 0;
+  const uint32_t type = fio_msg_internal_type(m);
+  if (!fio_cluster_shm_is_data(type))
+    return 0;
+  fio_lock(&cluster_shm.lock);
+  const int16_t origin = fio_cluster_shm_slot_of(avoid_uuid);
+  fio_cluster_shm_send_unsafe(m, (uint8_t)type, origin);
+  fio_cluster_shm_ring_workers(origin);
+  return 1;
+}
+
+static inline void fio_cluster_shm_broadcast_unlock(void) {
+  fio_unlock(&cluster_shm.lock);
+}
+
+/** root: true if the connection's worker reads the broadcast ring. */
+static inline int fio_cluster_shm_is_attached(intptr_t uuid) {
+  return fio_cluster_shm_slot_of(uuid) >= 0;
+}
+
+/** worker: writes a data message to the worker's ring. Returns 0 if not. */
+static int fio_cluster_shm_send2root(fio_msg_internal_s *m) {
+  if (cluster_shm.slot < 0)
+    return 0;
+  const uint32_t type = fio_msg_internal_type(m);
+  if (!fio_cluster_shm_is_data(type))
+    return 0;
+  fio_lock(&cluster_shm.lock);
+  fio_cluster_shm_send_unsafe(m, (uint8_t)type, (int16_t)cluster_shm.slot);
+  fio_unlock(&cluster_shm.lock);
+  fio_cluster_shm_ring_bell(&cluster_shm.hdr->bell, cluster_shm.root_bell);
+  return 1;
+}
+
+/** root: a worker announced its slot, start using the shared memory. */
+static void fio_cluster_shm_attach(intptr_t uuid, int32_t slot) {
+  if (!cluster_shm.hdr || slot < 0 || (size_t)slot >= cluster_shm.slot_count ||
+      cluster_shm.hdr->slots[slot].pid <= 0)
+    return;
+  fio_lock(&cluster_shm.read_lock);
+  fio_lock(&cluster_shm.lock);
+  __atomic_store_n(&cluster_shm.hdr->slots[slot].cursor, cluster_shm.hdr->head,
+                   __ATOMIC_SEQ_CST);
+  cluster_shm.uuids[slot] = uuid;
+  fio_unlock(&cluster_shm.lock);
+  /* messages written before the root knew about the slot */
+  fio_cluster_shm_read_slot_unsafe(slot);
+  fio_unlock(&cluster_shm.read_lock);
+}
+
+/**
+ * root: frees a slot for the next worker to claim. A doorbell rung for the
+ * previous worker would wake the next one before it's attached, reading the
+ * broadcast ring from a stale cursor, so it's cleared too.
+ */
+static void fio_cluster_shm_release_unsafe(size_t slot) {
+  fio_cluster_shm_slot_s *s = cluster_shm.hdr->slots + slot;
+  fio_cluster_shm_bell_clear(cluster_shm.bells[slot]);
+  s->tail = s->head;
+  s->bell = 0;
+  s->waiting = 0;
+  __atomic_store_n(&s->pid, 0, __ATOMIC_SEQ_CST);
+}
+
+/** root: a worker's connection closed, release its slot. */
+static void fio_cluster_shm_detach(intptr_t uuid) {
+  /* a new worker closes the connections it inherited before it's a worker */
+  if (!cluster_shm.hdr || getpid() != fio_parent_pid())
+    return;
+  fio_lock(&cluster_shm.read_lock);
+  const int16_t slot = fio_cluster_shm_slot_of(uuid);
+  if (slot >= 0) {
+    /* deliver what the worker published before exiting */
+    fio_cluster_shm_read_slot_unsafe(slot);
+    fio_lock(&cluster_shm.lock);
+    cluster_shm.uuids[slot] = 0;
+    if (cluster_shm.readers[slot].msg)
+      fio_msg_internal_free(cluster_shm.readers[slot].msg);
+    cluster_shm.readers[slot].msg = NULL;
+    fio_cluster_shm_release_unsafe(slot);
+    /* the worker might have been the slowest reader */
+    fio_cluster_shm_flush_unsafe();
+    fio_cluster_shm_ring_workers(-1);
+    fio_unlock(&cluster_shm.lock);
+  }
+  /* release the slots of workers that exited before attaching */
+  for (size_t i = 0; i < cluster_shm.slot_count; ++i) {
+    intptr_t pid = cluster_shm.hdr->slots[i].pid;
+    if (!cluster_shm.uuids[i] && pid > 0 && kill((pid_t)pid, 0) == -1 &&
+        errno == ESRCH)
+      fio_cluster_shm_release_unsafe(i);
+  }
+  fio_unlock(&cluster_shm.read_lock);
+}
+
+/** drops queued messages and partially assembled ones */
+static void fio_cluster_shm_clear(void) {
+  while (fio_ls_embd_any(&cluster_shm.pending)) {
+    fio_ls_embd_s *n = fio_ls_embd_shift(&cluster_shm.pending);
+    fio_cluster_shm_pending_s *p =
+        FIO_LS_EMBD_OBJ(fio_cluster_shm_pending_s, node, n);
+    fio_msg_internal_free(p->msg);
+    fio_free(p);
+  }
+  for (size_t i = 0; cluster_shm.readers && i < cluster_shm.slot_count; ++i) {
+    if (cluster_shm.readers[i].msg)
+      fio_msg_internal_free(cluster_shm.readers[i].msg);
+    cluster_shm.readers[i].msg = NULL;
+    cluster_shm.uuids[i] = 0;
+  }
+  if (cluster_shm.reader.msg)
+    fio_msg_internal_free(cluster_shm.reader.msg);
+  cluster_shm.reader.msg = NULL;
+}
+
+/** releases the shared memory and the doorbells */
+static void fio_cluster_shm_destroy(void *ignore) {
+  if (!cluster_shm.hdr)
+    return;
+  fio_cluster_shm_clear();
+  for (size_t i = 0; i < cluster_shm.slot_count; ++i) {
+    /* a worker's own doorbell is closed by the reactor */
+    if (cluster_shm.bells[i] != -1 && (int)i != cluster_shm.slot)
+      close(cluster_shm.bells[i]);
+  }
+  if (cluster_shm.root_bell != -1)
+    close(cluster_shm.root_bell);
+  munmap((void *)cluster_shm.hdr, cluster_shm.map_len);
+  fio_free(cluster_shm.bells);
+  fio_free(cluster_shm.uuids);
+  fio_free(cluster_shm.readers);
+  cluster_shm.hdr = NULL;
+  cluster_shm.bells = NULL;
+  cluster_shm.uuids = NULL;
+  cluster_shm.readers = NULL;
+  cluster_shm.root_bell = -1;
+  cluster_shm.slot = -1;
+  (void)ignore;
+}
+
+/** root: maps the shared memory and opens the doorbells before forking. */
+static void fio_cluster_shm_init(void *ignore) {
+  if (!fio_cluster_shm_capa || fio_data->workers <= 1 || cluster_shm.hdr)
+    return;
+  size_t capa = 1 << 16;
+  while (capa < fio_cluster_shm_capa)
+    capa <<= 1;
+  cluster_shm.bcast_capa = capa;
+  cluster_shm.ring_capa = capa >> 2;
+  /* spare slots, for workers respawning before their predecessor's release */
+  cluster_shm.slot_count = (size_t)fio_data->workers + 2;
+  if (cluster_shm.slot_count > INT16_MAX)
+    cluster_shm.slot_count = INT16_MAX;
+  cluster_shm.map_len =
+      sizeof(fio_cluster_shm_header_s) +
+      (sizeof(fio_cluster_shm_slot_s) * cluster_shm.slot_count) + capa +
+      (cluster_shm.ring_capa * cluster_shm.slot_count);
+  void *mem = mmap(NULL, cluster_shm.map_len, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
+    FIO_LOG_ERROR("(pub/sub) couldn't map cluster shared memory (%s), "
+                  "using the cluster socket.",
+                  strerror(errno));
+    return;
+  }
+  cluster_shm.hdr = mem;
+  cluster_shm.bcast = (uint8_t *)(cluster_shm.hdr->slots +
+                                  cluster_shm.slot_count);
+  cluster_shm.rings = cluster_shm.bcast + capa;
+  cluster_shm.bells = fio_malloc(sizeof(int) * cluster_shm.slot_count);
+  cluster_shm.uuids = fio_malloc(sizeof(intptr_t) * cluster_shm.slot_count);
+  cluster_shm.readers =
+      fio_malloc(sizeof(*cluster_shm.readers) * cluster_shm.slot_count);
+  FIO_ASSERT_ALLOC(cluster_shm.bells && cluster_shm.uuids &&
+                   cluster_shm.readers);
+  for (size_t i = 0; i < cluster_shm.slot_count; ++i)
+    cluster_shm.bells[i] = -1;
+  int root_uuid_fd = -1;
+  cluster_shm.root_bell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (cluster_shm.root_bell != -1)
+    root_uuid_fd = dup(cluster_shm.root_bell);
+  for (size_t i = 0; i < cluster_shm.slot_count; ++i) {
+    cluster_shm.bells[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (cluster_shm.bells[i] == -1)
+      goto error;
+  }
+  if (root_uuid_fd == -1)
+    goto error;
+  /* the reactor closes attached descriptors after forking, so children keep
+   * the original for writing, while the root reads the duplicate */
+  fio_attach_fd(root_uuid_fd, &fio_cluster_shm_root_protocol);
+  FIO_LOG_DEBUG("(%d) cluster messages use shared memory (%zu bytes).",
+                (int)getpid(), cluster_shm.map_len);
+  (void)ignore;
+  return;
+error:
+  FIO_LOG_ERROR("(pub/sub) couldn't open cluster doorbells (%s), "
+                "using the cluster socket.",
+                strerror(errno));
+  if (root_uuid_fd != -1)
+    close(root_uuid_fd);
+  fio_cluster_shm_destroy(NULL);
+}
+
+/** worker: claims a free slot after forking. */
+static void fio_cluster_shm_in_child(void *ignore) {
+  cluster_shm.lock = FIO_LOCK_INIT;
+  cluster_shm.read_lock = FIO_LOCK_INIT;
+  cluster_shm.slot = -1;
+  if (!cluster_shm.hdr)
+    return;
+  /* the root's state */
+  fio_cluster_shm_clear();
+  for (size_t i = 0; i < cluster_shm.slot_count; ++i) {
+    fio_cluster_shm_slot_s *s = cluster_shm.hdr->slots + i;
+    if (!__sync_bool_compare_and_swap(&s->pid, 0, -1))
+      continue;
+    s->bell = 0;
+    s->waiting = 0;
+    __atomic_store_n(&s->pid, (intptr_t)getpid(), __ATOMIC_SEQ_CST);
+    cluster_shm.slot = (int)i;
+    fio_attach_fd(cluster_shm.bells[i], &fio_cluster_shm_worker_protocol);
+    return;
+  }
+  FIO_LOG_WARNING("(%d) no free cluster shared memory slot, "
+                  "using the cluster socket.",
+                  (int)getpid());
+  (void)ignore;
+}
+
+/** worker: tells the root which slot to read. */
+static void fio_cluster_shm_announce(void) {
+  if (cluster_shm.slot < 0)
+    return;
+  fio_msg_internal_s *m = fio_msg_internal_create(
+      cluster_shm.slot, FIO_CLUSTER_MSG_SHM_ATTACH, (fio_str_info_s){.len = 0},
+      (fio_str_info_s){.len = 0}, 0, 1);
+  fio_msg_internal_send_dup(cluster_data.uuid, m);
+  fio_msg_internal_free(m);
+}
+
+#else /* FIO_PUBSUB_CLUSTER_SHM */
+
+static inline int fio_cluster_shm_broadcast_lock(fio_msg_internal_s *m,
+                                                 intptr_t avoid_uuid) {
+  return 0;
+  (void)m;
+  (void)avoid_uuid;
+}
+static inline void fio_cluster_shm_broadcast_unlock(void) {}
+static inline int fio_cluster_shm_is_attached(intptr_t uuid) {
+  return 0;
+  (void)uuid;
+}
+static inline int fio_cluster_shm_send2root(fio_msg_internal_s *m) {
+  return 0;
+  (void)m;
+}
+static inline void fio_cluster_shm_attach(intptr_t uuid, int32_t slot) {
+  (void)uuid;
+  (void)slot;
+}
+static inline void fio_cluster_shm_detach(intptr_t uuid) { (void)uuid; }
+static inline void fio_cluster_shm_announce(void) {}
+static void fio_cluster_shm_init(void *ignore) {
+  if (fio_cluster_shm_capa && fio_data->workers > 1)
+    FIO_LOG_WARNING("(pub/sub) cluster shared memory unsupported, "
+                    "using the cluster socket.");
+  (void)ignore;
+}
+static void fio_cluster_shm_in_child(void *ignore) { (void)ignore; }
+static void fio_cluster_shm_destroy(void *ignore) { (void)ignore; }
+
+#endif /* FIO_PUBSUB_CLUSTER_SHM */
+
 /* *****************************************************************************
  * Cluster Protocol callbacks
  **************************************************************************** */
@@ -6037,6 +7354,8 @@ static void fio_cluster_on_close(intptr_t uuid, fio_protocol_s *pr_) {
       }
     }
     fio_unlock(&cluster_data.lock);
+    /* `uuid` was invalidated before `on_close`, the slot knows the original */
+    fio_cluster_shm_detach(c->uuid);
   } else if (fio_data->active) {
     /* no shutdown message received - parent crashed. */
     if (c->type != FIO_CLUSTER_MSG_SHUTDOWN && fio_is_running()) {
@@ -6085,15 +7404,20 @@ fio_cluster_protocol_alloc(intptr_t uuid,
 
 static void fio_cluster_server_sender(void *m_, intptr_t avoid_uuid) {
   fio_msg_internal_s *m = m_;
+  /* workers reading the shared memory don't need the socket */
+  const int shm = fio_cluster_shm_broadcast_lock(m, avoid_uuid);
   fio_lock(&cluster_data.lock);
   FIO_LS_FOR(&cluster_data.clients, pos) {
     if ((intptr_t)pos->obj != -1) {
-      if ((intptr_t)pos->obj != avoid_uuid) {
+      if ((intptr_t)pos->obj != avoid_uuid &&
+          !(shm && fio_cluster_shm_is_attached((intptr_t)pos->obj))) {
         fio_msg_internal_send_dup((intptr_t)pos->obj, m);
       }
     }
   }
   fio_unlock(&cluster_data.lock);
+  if (shm)
+    fio_cluster_shm_broadcast_unlock();
   fio_msg_internal_free(m);
 }
 
@@ -6173,6 +7497,10 @@ static void fio_cluster_server_handler(struct cluster_pr_s *pr) {
     fio_publish2process(fio_msg_internal_dup(pr->msg));
     break;
 
+  case FIO_CLUSTER_MSG_SHM_ATTACH:
+    fio_cluster_shm_attach(pr->uuid, pr->filter);
+    break;
+
   case FIO_CLUSTER_MSG_SHUTDOWN: /* fallthrough */
   case FIO_CLUSTER_MSG_ERROR:    /* fallthrough */
   case FIO_CLUSTER_MSG_PING:     /* fallthrough */
@@ -6270,7 +7598,8 @@ static void fio_cluster_client_sender(void *m_, intptr_t ignr_) {
                         (void *)ignr_);
     return;
   }
-  fio_msg_internal_send_dup(cluster_data.uuid, m);
+  if (!fio_cluster_shm_send2root(m))
+    fio_msg_internal_send_dup(cluster_data.uuid, m);
   fio_msg_internal_free(m);
 }
 
@@ -6286,6 +7615,7 @@ static void fio_cluster_client_sender(void *m_, intptr_t ignr_) {
  */
 static void fio_cluster_on_connect(intptr_t uuid, void *udata) {
   cluster_data.uuid = uuid;
+  fio_cluster_shm_announce();
 
   /* inform root about all existing channels */
   fio_lock(&fio_postoffice.pubsub.lock);
@@ -6410,6 +7740,7 @@ static void fio_cluster_at_exit(void *ignore) {
     }
     fio_ch_set_pop(&fio_postoffice.patterns.channels);
   }
+  fio_pattern_index_free(&fio_pattern_index);
 
   while (fio_ch_set_count(&fio_postoffice.pubsub.channels)) {
     channel_s *ch = fio_ch_set_last(&fio_postoffice.pubsub.channels);
@@ -6452,9 +7783,12 @@ static void fio_cluster_at_exit(void *ignore) {
 static void fio_pubsub_initialize(void) {
   fio_cluster_init();
   fio_state_callback_add(FIO_CALL_PRE_START, fio_listen2cluster, NULL);
+  fio_state_callback_add(FIO_CALL_PRE_START, fio_cluster_shm_init, NULL);
   fio_state_callback_add(FIO_CALL_IN_MASTER, fio_accept_after_fork, NULL);
+  fio_state_callback_add(FIO_CALL_IN_CHILD, fio_cluster_shm_in_child, NULL);
   fio_state_callback_add(FIO_CALL_IN_CHILD, fio_connect2cluster, NULL);
   fio_state_callback_add(FIO_CALL_ON_FINISH, fio_cluster_cleanup, NULL);
+  fio_state_callback_add(FIO_CALL_AT_EXIT, fio_cluster_shm_destroy, NULL);
   fio_state_callback_add(FIO_CALL_AT_EXIT, fio_cluster_at_exit, NULL);
 }
 
@@ -6500,6 +7834,10 @@ static void fio_pubsub_on_fork(void) {
  * External API
  **************************************************************************** */
 
+void fio_pubsub_cluster_shm(size_t capacity) {
+  fio_cluster_shm_capa = capacity;
+}
+
 /** Signals children (or self) to shutdown) - NOT signal safe. */
 static void fio_cluster_signal_children(void) {
   if (fio_parent_pid() != getpid()) {
@@ -6585,6 +7923,133 @@ void fio_publish FIO_IGNORE_MACRO(fio_publish_args_s args) {
   return;
 }
 
+/* *****************************************************************************
+ * Channel Handles
+ **************************************************************************** */
+
+struct fio_channel_handle_s {
+  /** the channel (NULL if it had no subscriptions), with a reference */
+  channel_s *channel;
+  /** the pattern channels matching the name, with a reference */
+  channel_s **patterns;
+  size_t pattern_count;
+  size_t pattern_capa;
+  /** the collections' generations when the channels were resolved */
+  size_t pubsub_generation;
+  size_t patterns_generation;
+  fio_lock_i lock;
+  fio_str_info_s name;
+};
+
+/** Adds a matching pattern channel to the handle (with a reference). */
+static void fio_channel_handle_add_pattern(channel_s *p, void *h_) {
+  fio_channel_handle_s *h = h_;
+  if (h->pattern_count == h->pattern_capa) {
+    h->pattern_capa = h->pattern_capa ? (h->pattern_capa << 1) : 4;
+    h->patterns = realloc(h->patterns, sizeof(*h->patterns) * h->pattern_capa);
+    FIO_ASSERT_ALLOC(h->patterns);
+  }
+  fio_channel_dup(p);
+  h->patterns[h->pattern_count++] = p;
+}
+
+/** Resolves the channels again, if subscriptions changed since (locked). */
+static void fio_channel_handle_resolve(fio_channel_handle_s *h) {
+  size_t generation = fio_postoffice.pubsub.generation;
+  if (h->pubsub_generation != generation) {
+    fio_channel_free(h->channel);
+    h->channel = fio_channel_find_dup(h->name);
+    h->pubsub_generation = generation;
+  }
+  if (h->patterns_generation != fio_postoffice.patterns.generation) {
+    while (h->pattern_count)
+      fio_channel_free(h->patterns[--h->pattern_count]);
+    fio_lock(&fio_postoffice.patterns.lock);
+    fio_pattern_index_match(h->name, fio_channel_handle_add_pattern, h);
+    h->patterns_generation = fio_postoffice.patterns.generation;
+    fio_unlock(&fio_postoffice.patterns.lock);
+  }
+}
+
+/** Publishes the message to the current process through the handle. */
+static void fio_channel_handle_publish2process(fio_channel_handle_s *h,
+                                               fio_msg_internal_s *m) {
+  fio_msg_internal_finalize(m);
+  fio_lock(&h->lock);
+  fio_channel_handle_resolve(h);
+  if (h->channel)
+    fio_publish2channel_push(h->channel, m);
+  for (size_t i = 0; i < h->pattern_count; ++i)
+    fio_publish2channel_push(h->patterns[i], m);
+  fio_unlock(&h->lock);
+  fio_msg_internal_free(m);
+}
+
+/**
+ * Creates a handle for publishing to a pub/sub channel (not a filter).
+ */
+fio_channel_handle_s *fio_channel_handle_new(fio_str_info_s channel) {
+  fio_channel_handle_s *h = malloc(sizeof(*h) + channel.len + 1);
+  FIO_ASSERT_ALLOC(h);
+  *h = (fio_channel_handle_s){
+      .name = {.data = (char *)(h + 1), .len = channel.len},
+      .lock = FIO_LOCK_INIT,
+  };
+  if (channel.len)
+    memcpy(h->name.data, channel.data, channel.len);
+  h->name.data[channel.len] = 0;
+  /* differ from the current generations, so the first publish resolves */
+  h->pubsub_generation = ~fio_postoffice.pubsub.generation;
+  h->patterns_generation = ~fio_postoffice.patterns.generation;
+  return h;
+}
+
+/** Frees a channel handle. */
+void fio_channel_handle_free(fio_channel_handle_s *h) {
+  if (!h)
+    return;
+  fio_channel_free(h->channel);
+  while (h->pattern_count)
+    fio_channel_free(h->patterns[--h->pattern_count]);
+  free(h->patterns);
+  free(h);
+}
+
+/** Publishes a message through a channel handle, see `fio_publish`. */
+void fio_channel_handle_publish(fio_channel_handle_s *h,
+                                fio_pubsub_engine_s const *engine,
+                                fio_str_info_s message, uint8_t is_json) {
+  if (!engine)
+    engine = FIO_PUBSUB_DEFAULT;
+  fio_msg_internal_s *m;
+  switch ((uintptr_t)engine) {
+  case 0UL: /* fallthrough (missing default) */
+  case 1UL: // ((uintptr_t)FIO_PUBSUB_CLUSTER):
+    m = fio_msg_internal_create(
+        0, (is_json ? FIO_CLUSTER_MSG_JSON : FIO_CLUSTER_MSG_FORWARD), h->name,
+        message, is_json, 1);
+    fio_send2cluster(m);
+    fio_channel_handle_publish2process(h, m);
+    break;
+  case 2UL: // ((uintptr_t)FIO_PUBSUB_PROCESS):
+    m = fio_msg_internal_create(0, 0, h->name, message, is_json, 1);
+    fio_channel_handle_publish2process(h, m);
+    break;
+  case 4UL: // ((uintptr_t)FIO_PUBSUB_ROOT):
+    if (fio_data->is_worker == 0 || fio_data->workers == 1) {
+      m = fio_msg_internal_create(
+          0, (is_json ? FIO_CLUSTER_MSG_ROOT_JSON : FIO_CLUSTER_MSG_ROOT),
+          h->name, message, is_json, 1);
+      fio_channel_handle_publish2process(h, m);
+      break;
+    }
+    /* fallthrough */
+  default: /* nothing to resolve locally */
+    fio_publish(.engine = engine, .channel = h->name, .message = message,
+                .is_json = is_json);
+  }
+}
+
 /* *****************************************************************************
  * Glob Matching
  **************************************************************************** */
@@ -9646,6 +11111,105 @@ FIO_FUNC void fio_defer_test(void) {
   fprintf(stderr, "\n* passed.\n");
 }
 
+/* *****************************************************************************
+Testing task queue delay measurements
+***************************************************************************** */
+
+/* records `fast` delays of 10us and `slow` delays of 5ms for the interval */
+FIO_FUNC void fio_defer_latency_test_fill(size_t fast, size_t slow) {
+  fio_defer_latency.buckets[fio_defer_latency_bucket(10)] += fast;
+  fio_defer_latency.buckets[fio_defer_latency_bucket(5000)] += slow;
+}
+
+FIO_FUNC void fio_defer_latency_test(void) {
+  fprintf(stderr, "=== Testing task queue delay measurements\n");
+  for (uint64_t d = 0; d < 8; ++d) {
+    FIO_ASSERT(fio_defer_latency_bucket2value(fio_defer_latency_bucket(d)) ==
+                   d,
+               "small delays should be exact (%zu)", (size_t)d);
+  }
+  size_t prev = 0;
+  for (uint64_t d = 1; d < ((uint64_t)1 << 40); d += (d >> 3) + 1) {
+    size_t i = fio_defer_latency_bucket(d);
+    size_t v = fio_defer_latency_bucket2value(i);
+    FIO_ASSERT(i >= prev, "buckets should grow with the delay (%zu)",
+               (size_t)d);
+    FIO_ASSERT(v + (d >> 3) + 1 >= d && v <= d + (d >> 3) + 1,
+               "bucket value %zu too far from delay %zu", v, (size_t)d);
+    prev = i;
+  }
+  FIO_ASSERT(fio_defer_latency_bucket(~(uint64_t)0) ==
+                 FIO_DEFER_LATENCY_BUCKETS - 1,
+             "huge delays should use the last bucket");
+
+  /* the p90 rank and the overload (CoDel) state, using a synthetic clock */
+  const size_t fast = fio_defer_latency_bucket2value(
+      fio_defer_latency_bucket(10));
+  const size_t slow = fio_defer_latency_bucket2value(
+      fio_defer_latency_bucket(5000));
+  const uint64_t interval = 100000;
+  uint64_t now = 1000000;
+  size_t saved_current = fio_defer_latency_current_task;
+  __typeof__(fio_defer_latency) saved;
+  memcpy((void *)&saved, (void *)&fio_defer_latency, sizeof(saved));
+  memset((void *)fio_defer_latency.buckets, 0,
+         sizeof(fio_defer_latency.buckets));
+  fio_defer_latency.target = 1000;
+  fio_defer_latency.interval = interval;
+  fio_defer_latency.next_review = 0;
+  fio_defer_latency.first_above = 0;
+  fio_defer_latency.overloaded = 0;
+
+  fio_defer_latency_review(now);
+  FIO_ASSERT(fio_defer_latency.p90 == 0, "an empty interval's p90 should be 0");
+  fio_defer_latency_test_fill(90, 10);
+  fio_defer_latency_review(now += interval);
+  FIO_ASSERT(fio_defer_latency.p90 == fast, "p90 of 90%% fast delays != %zu",
+             fast);
+  fio_defer_latency_test_fill(9, 1);
+  fio_defer_latency_review(now += interval);
+  FIO_ASSERT(fio_defer_latency.p90 == fast, "p90 of 9 fast delays != %zu",
+             fast);
+  fio_defer_latency_test_fill(89, 11);
+  fio_defer_latency_review(now += interval / 2);
+  FIO_ASSERT(fio_defer_latency.p90 == fast,
+             "reviewed before the interval ended");
+  fio_defer_latency_review(now += interval / 2);
+  FIO_ASSERT(fio_defer_latency.p90 == slow, "p90 of 11%% slow delays != %zu",
+             slow);
+  FIO_ASSERT(!fio_defer_latency.overloaded,
+             "overloaded before a full interval above target");
+
+  fio_defer_latency_test_fill(0, 1);
+  fio_defer_latency_review(now += interval);
+  FIO_ASSERT(fio_defer_latency.overloaded,
+             "not overloaded after a full interval above target");
+  fio_defer_latency_current_task = 5000;
+  FIO_ASSERT(fio_defer_should_shed(), "delayed tasks should be shed");
+  fio_defer_latency_current_task = 10;
+  FIO_ASSERT(!fio_defer_should_shed(), "fresh tasks shouldn't be shed");
+  fio_defer_latency_test_fill(1, 0);
+  fio_defer_latency_review(now += interval);
+  FIO_ASSERT(!fio_defer_latency.overloaded && !fio_defer_latency.first_above,
+             "still overloaded after an interval below target");
+  /* a single interval below the target restarts the count */
+  fio_defer_latency_test_fill(0, 1);
+  fio_defer_latency_review(now += interval);
+  fio_defer_latency_test_fill(1, 0);
+  fio_defer_latency_review(now += interval);
+  fio_defer_latency_test_fill(0, 1);
+  fio_defer_latency_review(now += interval);
+  FIO_ASSERT(!fio_defer_latency.overloaded,
+             "overloaded although the delay dropped below target in between");
+  fio_defer_latency_test_fill(0, 1);
+  fio_defer_latency_review(now += interval);
+  FIO_ASSERT(fio_defer_latency.overloaded, "not overloaded again");
+
+  memcpy((void *)&fio_defer_latency, (void *)&saved, sizeof(saved));
+  fio_defer_latency_current_task = saved_current;
+  fprintf(stderr, "* passed.\n");
+}
+
 /* *****************************************************************************
 Array data-structure Testing
 ***************************************************************************** */
@@ -11019,6 +12583,7 @@ void fio_test(void) {
   fio_ary_test();
   fio_set_test();
   fio_defer_test();
+  fio_defer_latency_test();
   fio_timer_test();
   fio_poll_test();
   fio_socket_test();
@@ -181,6 +181,18 @@ Version and helper macros
 #define FIO_PUBSUB_SUPPORT 1
 #endif
 
+#ifndef FIO_PUBSUB_CLUSTER_SHM
+/**
+ * If true (1), compiles the shared memory transport for cluster messages (see
+ * `fio_pubsub_cluster_shm`). Requires `eventfd` (Linux).
+ */
+#if defined(__linux__)
+#define FIO_PUBSUB_CLUSTER_SHM 1
+#else
+#define FIO_PUBSUB_CLUSTER_SHM 0
+#endif
+#endif
+
 #ifndef FIO_LOG_LENGTH_LIMIT
 /**
  * Since logging uses stack memory rather than dynamic allocation, it's memory
@@ -672,6 +684,57 @@ void fio_force_event(intptr_t uuid, enum fio_io_event);
  */
 void fio_suspend(intptr_t uuid);
 
+/* *****************************************************************************
+Per-IP Connection and Request Limits
+***************************************************************************** */
+
+/**
+ * A sharded table of per-IP (`fio_peer_addr`) connection counters and request
+ * token buckets.
+ *
+ * The table is local to each process (every worker enforces its own limits).
+ */
+typedef struct fio_ip_limit_s fio_ip_limit_s;
+
+/** Arguments for the `fio_ip_limit_new` function. */
+typedef struct {
+  /** Maximum concurrent connections per IP address. 0 == unlimited. */
+  uint32_t max_connections;
+  /** Token bucket refill rate (requests per second). 0 == unlimited. */
+  uint32_t rate;
+  /** Token bucket capacity (burst size). Defaults to `rate`. */
+  uint32_t burst;
+} fio_ip_limit_args_s;
+
+/** Creates a new per-IP limit table. Returns NULL if no limit was set. */
+fio_ip_limit_s *fio_ip_limit_new(fio_ip_limit_args_s args);
+/** Creates a new per-IP limit table. Returns NULL if no limit was set. */
+#define fio_ip_limit_new(...)                                                  \
+  fio_ip_limit_new((fio_ip_limit_args_s){__VA_ARGS__})
+
+/** Increases the table's reference count. */
+fio_ip_limit_s *fio_ip_limit_dup(fio_ip_limit_s *limit);
+
+/** Decreases the table's reference count, freeing it when it reaches zero. */
+void fio_ip_limit_free(fio_ip_limit_s *limit);
+
+/**
+ * Counts a new connection against its peer address, returning -1 if the
+ * address reached the `max_connections` limit (the connection isn't counted).
+ *
+ * On success (0), the count is linked to the connection's lifetime and
+ * released automatically once the connection closes.
+ *
+ * Connections without a peer address (i.e., Unix sockets) are never limited.
+ */
+int fio_ip_limit_attach(fio_ip_limit_s *limit, intptr_t uuid);
+
+/**
+ * Takes a token from the peer address's request bucket, returning -1 if the
+ * bucket is empty (the request should be rejected) and 0 otherwise.
+ */
+int fio_ip_limit_take(fio_ip_limit_s *limit, intptr_t uuid);
+
 /* *****************************************************************************
 Listening to Incoming Connections
 ***************************************************************************** */
@@ -706,6 +769,13 @@ struct fio_listen_args {
    *
    * This will be called separately for every process. */
   void (*on_finish)(intptr_t uuid, void *udata);
+  /**
+   * An optional per-IP limit table (see `fio_ip_limit_new`).
+   *
+   * Connections exceeding the table's `max_connections` limit are closed
+   * before `on_open` is called. `fio_listen` holds its own reference.
+   */
+  fio_ip_limit_s *ip_limit;
 };
 
 /**
@@ -1571,6 +1641,43 @@ void fio_defer_perform(void);
 /** Returns true if there are deferred functions waiting for execution. */
 int fio_defer_has_queue(void);
 
+/* *****************************************************************************
+Task Queue Latency (Admission Control)
+***************************************************************************** */
+
+/**
+ * Enables queueing delay measurements for the task queue.
+ *
+ * Every task is time stamped when scheduled and its queueing delay is recorded
+ * when it's performed. Every `interval_ms` (defaults to 100ms) the 90th
+ * percentile of the recorded delays is compared to `target_ms`.
+ *
+ * Following CoDel, the queue is considered overloaded only once the delay
+ * stayed above the target for a full interval, and stops being overloaded
+ * as soon as an interval's delay falls back below the target.
+ *
+ * A `target_ms` of 0 disables the measurements (the default). When called more
+ * than once, the lowest target is used.
+ */
+void fio_defer_latency_target(size_t target_ms, size_t interval_ms);
+
+/** Returns the last interval's 90th percentile queueing delay (in us). */
+size_t fio_defer_latency_p90(void);
+
+/** Returns the queueing delay of the currently performed task (in us). */
+size_t fio_defer_latency_current(void);
+
+/** Returns true if the task queue is overloaded (see above). */
+int fio_defer_is_overloaded(void);
+
+/**
+ * Returns true if new work should be rejected by the current task.
+ *
+ * While the queue is overloaded, work is shed when it was itself delayed for
+ * longer than the target - stale work is dropped, fresh work is admitted.
+ */
+int fio_defer_should_shed(void);
+
 /* *****************************************************************************
 Startup / State Callbacks (fork, start up, idle, etc')
 ***************************************************************************** */
@@ -1870,6 +1977,52 @@ void *fio_message_metadata(fio_msg_s *msg, intptr_t type_id);
  */
 void fio_message_defer(fio_msg_s *msg);
 
+/**
+ * Moves cluster messages (published using the FIO_PUBSUB_CLUSTER,
+ * FIO_PUBSUB_SIBLINGS and FIO_PUBSUB_ROOT engines) from the cluster's Unix
+ * socket to rings in shared memory, where an `eventfd` wakes the reader.
+ *
+ * The root process writes each message once, to a ring read by all workers, so
+ * a message sent to N workers costs one copy and (at most) N notifications.
+ * Each worker writes to a ring of its own, read by the root. Subscriptions and
+ * control messages still use the socket.
+ *
+ * `capacity` is the byte size of the root's ring (rounded up to a power of 2,
+ * at least 64Kb); worker rings are a quarter of that size. Larger messages are
+ * split. A capacity of 0 disables shared memory (the default).
+ *
+ * Must be called before `fio_start`. Ignored when running a single process or
+ * when unsupported (see FIO_PUBSUB_CLUSTER_SHM).
+ */
+void fio_pubsub_cluster_shm(size_t capacity);
+
+/** A pub/sub channel, resolved once for repeated publishing. */
+typedef struct fio_channel_handle_s fio_channel_handle_s;
+
+/**
+ * Creates a handle for publishing to the pub/sub `channel` (the name is
+ * copied).
+ *
+ * Publishing through a handle skips hashing the channel's name and looking it
+ * up (and matching it against pattern subscriptions): the channel and the
+ * matching patterns are kept by the handle until subscriptions change.
+ *
+ * The handle must be freed using `fio_channel_handle_free`.
+ */
+fio_channel_handle_s *fio_channel_handle_new(fio_str_info_s channel);
+
+/** Frees a channel handle. */
+void fio_channel_handle_free(fio_channel_handle_s *handle);
+
+/**
+ * Publishes a message to the handle's channel, same as `fio_publish`.
+ *
+ * A NULL `engine` selects FIO_PUBSUB_DEFAULT. Thread safe.
+ */
+void fio_channel_handle_publish(fio_channel_handle_s *handle,
+                                fio_pubsub_engine_s const *engine,
+                                fio_str_info_s message, uint8_t is_json);
+
 /* *****************************************************************************
  * Cluster / Pub/Sub Middleware and Extensions ("Engines")
  **************************************************************************** */
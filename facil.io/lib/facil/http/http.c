@@ -11,11 +11,14 @@ Feel free to copy, use and enjoy according to the license provided.
 #include <http_internal.h>
 
 #include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 #ifndef HAVE_TM_TM_ZONE
@@ -357,6 +360,44 @@ int http_send_body(http_s *r, void *data, uintptr_t length) {
   return ((http_vtable_s *)r->private_data.vtbl)
       ->http_send_body(r, data, length);
 }
+/**
+ * Writes the response headers into a new packet (a FIOBJ String), reserving
+ * space for the content-length header. See `http_packet_send`.
+ *
+ * Returns FIOBJ_INVALID on error, leaving the `http_s` object untouched.
+ */
+FIOBJ http_packet_start(http_s *r, uintptr_t body_capa) {
+  if (HTTP_INVALID_HANDLE(r))
+    return FIOBJ_INVALID;
+  http_vtable_s *vtbl = (http_vtable_s *)r->private_data.vtbl;
+  if (!vtbl->http_packet_start)
+    return FIOBJ_INVALID;
+  static uint64_t cl_hash = 0;
+  if (!cl_hash)
+    cl_hash = fiobj_hash_string("content-length", 14);
+  /* the packet's own content-length is patched in by `http_packet_send` */
+  fiobj_hash_delete2(r->private_data.out_headers, cl_hash);
+  add_date(r);
+  return vtbl->http_packet_start(r, body_capa);
+}
+
+/**
+ * Sends a packet started by `http_packet_start`, after patching the length of
+ * the body (everything from `body_start` on) into its content-length header.
+ *
+ * Returns -1 on error and 0 on success. The packet is freed either way.
+ *
+ * AFTER THIS FUNCTION IS CALLED, THE `http_s` OBJECT IS NO LONGER VALID.
+ */
+int http_packet_send(http_s *r, FIOBJ packet, uintptr_t body_start) {
+  if (HTTP_INVALID_HANDLE(r)) {
+    fiobj_free(packet);
+    return -1;
+  }
+  return ((http_vtable_s *)r->private_data.vtbl)
+      ->http_packet_send(r, packet, body_start);
+}
+
 /**
  * Sends the response headers and the specified file (the response's body).
  *
@@ -854,8 +895,23 @@ static http_settings_s *http_settings_new(http_settings_s arg_settings) {
       arg_settings.max_clients -= HTTP_BUSY_UNLESS_HAS_FDS;
   }
 
-  http_settings_s *settings = malloc(sizeof(*settings) + sizeof(void *));
+  http_settings_s *settings = malloc(sizeof(*settings) + (sizeof(void *) * 2));
   *settings = arg_settings;
+  http_settings2ip_limit(settings) =
+      fio_ip_limit_new(.max_connections = settings->max_clients_per_ip,
+                       .rate = settings->max_requests_per_ip,
+                       .burst = settings->max_requests_burst);
+  if (settings->priority_hints_len) {
+    /* the hints (not the prefixes) are copied */
+    http_priority_hint_s *hints =
+        malloc(sizeof(*hints) * settings->priority_hints_len);
+    FIO_ASSERT_ALLOC(hints);
+    memcpy(hints, settings->priority_hints,
+           sizeof(*hints) * settings->priority_hints_len);
+    settings->priority_hints = hints;
+  } else {
+    settings->priority_hints = NULL;
+  }
 
   if (settings->public_folder) {
     settings->public_folder_length = strlen(settings->public_folder);
@@ -882,6 +938,8 @@ static http_settings_s *http_settings_new(http_settings_s arg_settings) {
 }
 
 static void http_settings_free(http_settings_s *s) {
+  fio_ip_limit_free(http_settings2ip_limit(s));
+  free((void *)s->priority_hints);
   free((void *)s->public_folder);
   free(s);
 }
@@ -942,6 +1000,8 @@ intptr_t http_listen(const char *port, const char *binding,
 
   http_settings_s *settings = http_settings_new(arg_settings);
   settings->is_client = 0;
+  if (settings->shed_target_ms)
+    fio_defer_latency_target(settings->shed_target_ms, 0);
   if (settings->tls) {
     fio_tls_alpn_add(settings->tls, "http/1.1", http_on_server_protocol_http1,
                      NULL, NULL);
@@ -949,7 +1009,8 @@ intptr_t http_listen(const char *port, const char *binding,
 
   return fio_listen(.port = port, .address = binding, .tls = arg_settings.tls,
                     .on_finish = http_on_finish, .on_open = http_on_open,
-                    .udata = settings);
+                    .udata = settings,
+                    .ip_limit = http_settings2ip_limit(settings));
 }
 /** Listens to HTTP connections at the specified `port` and `binding`. */
 #define http_listen(port, binding, ...)                                        \
@@ -2042,7 +2103,14 @@ FIOBJ http_req2str(http_s *h) {
   return w.dest;
 }
 
+static void http_write_log_async(http_s *h);
+static intptr_t http_log_fd = -1;
+
 void http_write_log(http_s *h) {
+  if (http_log_fd != -1) {
+    http_write_log_async(h);
+    return;
+  }
   FIOBJ l = fiobj_str_buf(128);
 
   intptr_t bytes_sent = fiobj_obj2num(fiobj_hash_get2(
@@ -2101,6 +2169,402 @@ void http_write_log(http_s *h) {
   fiobj_free(l);
 }
 
+/* *****************************************************************************
+Asynchronous access logging
+***************************************************************************** */
+
+#ifndef HTTP_LOG_PATH_LIMIT
+/** The longest request path (in bytes) copied into an access log record. */
+#define HTTP_LOG_PATH_LIMIT 192
+#endif
+
+#ifndef HTTP_LOG_BUFFER_SIZE
+/** The size of the writer's batch buffer (one `write` per full buffer). */
+#define HTTP_LOG_BUFFER_SIZE 65536
+#endif
+
+/* the longest possible formatted line (JSON escaping can grow the path x6) */
+#define HTTP_LOG_LINE_LIMIT ((HTTP_LOG_PATH_LIMIT * 6) + 512)
+
+typedef struct {
+  struct timespec start;
+  struct timespec end;
+  intptr_t bytes_sent;
+  uint16_t status;
+  uint16_t path_len;
+  uint8_t peer_len;
+  uint8_t method_len;
+  uint8_t version_len;
+  uint8_t truncated;
+  char peer[48];
+  char method[16];
+  char version[16];
+  char path[HTTP_LOG_PATH_LIMIT];
+} http_log_record_s;
+
+/* A single producer (the owning thread), single consumer (the writer) ring. */
+typedef struct http_log_ring_s {
+  struct http_log_ring_s *next;
+  size_t head; /* consumer position, only written by the writer thread */
+  size_t tail; /* producer position, only written by the owning thread */
+  size_t sample;
+  http_log_record_s records[];
+} http_log_ring_s;
+
+static struct {
+  http_log_ring_s *rings;
+  void *thread;
+  char *target;
+  size_t dropped;
+  size_t mask;
+  size_t flush_ns;
+  uint32_t sample_rate;
+  http_log_format_e format;
+  volatile uint8_t running;
+  uint8_t is_unix;
+  /* writer thread state */
+  time_t date_sec;
+  size_t date_len;
+  char date[48];
+  size_t len;
+  char buffer[HTTP_LOG_BUFFER_SIZE];
+} http_log_async = {.mask = 1023};
+
+static __thread http_log_ring_s *http_log_ring_local;
+
+static http_log_ring_s *http_log_ring_new(void) {
+  http_log_ring_s *ring =
+      calloc(1, sizeof(*ring) +
+                    (sizeof(ring->records[0]) * (http_log_async.mask + 1)));
+  if (!ring)
+    return NULL;
+  /* rings are never removed, so a lock-free push is enough */
+  ring->next = __atomic_load_n(&http_log_async.rings, __ATOMIC_ACQUIRE);
+  while (!__atomic_compare_exchange_n(&http_log_async.rings, &ring->next, ring,
+                                      0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    ;
+  http_log_ring_local = ring;
+  return ring;
+}
+
+static inline void http_log_copy(char *dest, void *dest_len, size_t dest_size,
+                                 int len_is_16bit, fio_str_info_s src) {
+  if (src.len > dest_size)
+    src.len = dest_size;
+  if (src.len)
+    memcpy(dest, src.data, src.len);
+  if (len_is_16bit)
+    *(uint16_t *)dest_len = (uint16_t)src.len;
+  else
+    *(uint8_t *)dest_len = (uint8_t)src.len;
+}
+
+static void http_write_log_async(http_s *h) {
+  http_log_ring_s *ring = http_log_ring_local;
+  if (!ring && !(ring = http_log_ring_new())) {
+    fio_atomic_add(&http_log_async.dropped, 1);
+    return;
+  }
+  if (http_log_async.sample_rate > 1 &&
+      (ring->sample++ % http_log_async.sample_rate))
+    return;
+  const size_t tail = ring->tail;
+  if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) >
+      http_log_async.mask) {
+    /* never block a request thread on logging */
+    fio_atomic_add(&http_log_async.dropped, 1);
+    return;
+  }
+  http_log_record_s *rec = ring->records + (tail & http_log_async.mask);
+#if FIO_HTTP_EXACT_LOGGING
+  clock_gettime(CLOCK_REALTIME, &rec->end);
+#else
+  rec->end = fio_last_tick();
+#endif
+  rec->start = h->received_at;
+  rec->status = (uint16_t)h->status;
+  rec->bytes_sent = fiobj_obj2num(fiobj_hash_get2(
+      h->private_data.out_headers, fiobj_obj2hash(HTTP_HEADER_CONTENT_LENGTH)));
+  http_log_copy(rec->peer, &rec->peer_len, sizeof(rec->peer), 0,
+                fio_peer_addr(http2protocol(h)->uuid));
+  http_log_copy(rec->method, &rec->method_len, sizeof(rec->method), 0,
+                fiobj_obj2cstr(h->method));
+  http_log_copy(rec->version, &rec->version_len, sizeof(rec->version), 0,
+                fiobj_obj2cstr(h->version));
+  fio_str_info_s path = fiobj_obj2cstr(h->path);
+  rec->truncated = (path.len > HTTP_LOG_PATH_LIMIT);
+  http_log_copy(rec->path, &rec->path_len, HTTP_LOG_PATH_LIMIT, 1, path);
+  __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+size_t http_log_dropped(void) {
+  return __atomic_load_n(&http_log_async.dropped, __ATOMIC_RELAXED);
+}
+
+/* writes the batch buffer, blocking only the writer thread */
+static void http_log_flush_buffer(void) {
+  char *data = http_log_async.buffer;
+  size_t len = http_log_async.len;
+  http_log_async.len = 0;
+  while (len) {
+    ssize_t w = write((int)http_log_fd, data, len);
+    if (w > 0) {
+      data += w;
+      len -= w;
+      continue;
+    }
+    if (w < 0 && errno == EINTR)
+      continue;
+    if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      fio_throttle_thread(1000000);
+      continue;
+    }
+    return;
+  }
+}
+
+static size_t http_log_json_escape(char *dest, const char *src, size_t len) {
+  static const char hex[] = "0123456789abcdef";
+  size_t pos = 0;
+  for (size_t i = 0; i < len; ++i) {
+    const uint8_t c = (uint8_t)src[i];
+    if (c == '"' || c == '\\') {
+      dest[pos++] = '\\';
+      dest[pos++] = c;
+    } else if (c < 0x20) {
+      memcpy(dest + pos, "\\u00", 4);
+      dest[pos + 4] = hex[c >> 4];
+      dest[pos + 5] = hex[c & 15];
+      pos += 6;
+    } else {
+      dest[pos++] = c;
+    }
+  }
+  return pos;
+}
+
+#define HTTP_LOG_WRITE(dest, str)                                              \
+  do {                                                                         \
+    memcpy((dest), (str), sizeof(str) - 1);                                    \
+    (dest) += sizeof(str) - 1;                                                 \
+  } while (0)
+
+static void http_log_format_record(http_log_record_s *rec) {
+  if (rec->end.tv_sec != http_log_async.date_sec) {
+    http_log_async.date_sec = rec->end.tv_sec;
+    http_log_async.date_len =
+        http_time2str(http_log_async.date, rec->end.tv_sec);
+  }
+  int64_t duration = ((rec->end.tv_sec - rec->start.tv_sec) * 1000000) +
+                     ((rec->end.tv_nsec - rec->start.tv_nsec) / 1000);
+  char *pos = http_log_async.buffer + http_log_async.len;
+
+  if (http_log_async.format == HTTP_LOG_FORMAT_JSON) {
+    HTTP_LOG_WRITE(pos, "{\"time\":\"");
+    memcpy(pos, http_log_async.date, http_log_async.date_len);
+    pos += http_log_async.date_len;
+    HTTP_LOG_WRITE(pos, "\",\"peer\":\"");
+    pos += http_log_json_escape(pos, rec->peer, rec->peer_len);
+    HTTP_LOG_WRITE(pos, "\",\"method\":\"");
+    pos += http_log_json_escape(pos, rec->method, rec->method_len);
+    HTTP_LOG_WRITE(pos, "\",\"path\":\"");
+    pos += http_log_json_escape(pos, rec->path, rec->path_len);
+    HTTP_LOG_WRITE(pos, "\",\"version\":\"");
+    pos += http_log_json_escape(pos, rec->version, rec->version_len);
+    HTTP_LOG_WRITE(pos, "\",\"status\":");
+    pos += fio_ltoa(pos, rec->status, 10);
+    HTTP_LOG_WRITE(pos, ",\"bytes\":");
+    pos += fio_ltoa(pos, rec->bytes_sent > 0 ? rec->bytes_sent : 0, 10);
+    HTTP_LOG_WRITE(pos, ",\"duration_us\":");
+    pos += fio_ltoa(pos, duration, 10);
+    if (rec->truncated)
+      HTTP_LOG_WRITE(pos, ",\"truncated\":true");
+    HTTP_LOG_WRITE(pos, "}\n");
+  } else {
+    /* same layout as the synchronous `http_write_log` */
+    if (rec->peer_len) {
+      memcpy(pos, rec->peer, rec->peer_len);
+      pos += rec->peer_len;
+    } else {
+      HTTP_LOG_WRITE(pos, "[unknown]");
+    }
+    HTTP_LOG_WRITE(pos, " - - [");
+    memcpy(pos, http_log_async.date, http_log_async.date_len);
+    pos += http_log_async.date_len;
+    HTTP_LOG_WRITE(pos, "] \"");
+    memcpy(pos, rec->method, rec->method_len);
+    pos += rec->method_len;
+    *pos++ = ' ';
+    memcpy(pos, rec->path, rec->path_len);
+    pos += rec->path_len;
+    *pos++ = ' ';
+    memcpy(pos, rec->version, rec->version_len);
+    pos += rec->version_len;
+    HTTP_LOG_WRITE(pos, "\" ");
+    pos += fio_ltoa(pos, rec->status, 10);
+    if (rec->bytes_sent > 0) {
+      *pos++ = ' ';
+      pos += fio_ltoa(pos, rec->bytes_sent, 10);
+      HTTP_LOG_WRITE(pos, "b ");
+    } else {
+      HTTP_LOG_WRITE(pos, " -- ");
+    }
+    pos += fio_ltoa(pos, duration, 10);
+    HTTP_LOG_WRITE(pos, "us\r\n");
+  }
+  http_log_async.len = pos - http_log_async.buffer;
+}
+
+#undef HTTP_LOG_WRITE
+
+/* drains all the rings into (as few as possible) `write` calls */
+static void http_log_drain(void) {
+  http_log_ring_s *ring = __atomic_load_n(&http_log_async.rings,
+                                          __ATOMIC_ACQUIRE);
+  for (; ring; ring = ring->next) {
+    size_t head = ring->head;
+    const size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+      if (http_log_async.len + HTTP_LOG_LINE_LIMIT > HTTP_LOG_BUFFER_SIZE) {
+        __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+        http_log_flush_buffer();
+      }
+      http_log_format_record(ring->records + (head & http_log_async.mask));
+      ++head;
+    }
+    __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+  }
+  if (http_log_async.len)
+    http_log_flush_buffer();
+}
+
+static void *http_log_writer(void *ignr_) {
+  while (http_log_async.running) {
+    http_log_drain();
+    fio_throttle_thread(http_log_async.flush_ns);
+  }
+  http_log_drain();
+  return NULL;
+  (void)ignr_;
+}
+
+static intptr_t http_log_open(const char *target) {
+  if (!target || !strcmp(target, "stderr"))
+    return fileno(stderr);
+  if (!strcmp(target, "-") || !strcmp(target, "stdout"))
+    return fileno(stdout);
+  if (!strncmp(target, "unix:", 5)) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    size_t len = strlen(target + 5);
+    if (len >= sizeof(addr.sun_path))
+      return -1;
+    memcpy(addr.sun_path, target + 5, len + 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1)
+      return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+  return open(target, O_WRONLY | O_APPEND | O_CREAT, 0644);
+}
+
+static void http_log_on_start(void *ignr_) {
+  if (http_log_async.thread)
+    return;
+  http_log_async.running = 1;
+  http_log_async.thread = fio_thread_new(http_log_writer, NULL);
+  if (!http_log_async.thread) {
+    http_log_async.running = 0;
+    FIO_LOG_ERROR("(%d) couldn't start the access log writer thread.",
+                  (int)getpid());
+  }
+  (void)ignr_;
+}
+
+static void http_log_on_finish(void *ignr_) {
+  if (http_log_async.thread) {
+    http_log_async.running = 0;
+    fio_thread_join(http_log_async.thread);
+    http_log_async.thread = NULL;
+  }
+  http_log_drain();
+  (void)ignr_;
+}
+
+/* each worker keeps its own socket connection, so batches never interleave */
+static void http_log_in_child(void *ignr_) {
+  if (!http_log_async.is_unix)
+    return;
+  intptr_t fd = http_log_open(http_log_async.target);
+  if (fd == -1) {
+    FIO_LOG_ERROR("(%d) couldn't connect to the access log socket %s",
+                  (int)getpid(), http_log_async.target + 5);
+    return;
+  }
+  close((int)http_log_fd);
+  http_log_fd = fd;
+  (void)ignr_;
+}
+
+static void http_log_at_exit(void *ignr_) {
+  http_log_on_finish(NULL);
+  if (http_log_async.is_unix ||
+      (http_log_fd != fileno(stderr) && http_log_fd != fileno(stdout)))
+    close((int)http_log_fd);
+  http_log_fd = -1;
+  while (http_log_async.rings) {
+    http_log_ring_s *ring = http_log_async.rings;
+    http_log_async.rings = ring->next;
+    free(ring);
+  }
+  http_log_ring_local = NULL;
+  free(http_log_async.target);
+  http_log_async.target = NULL;
+  (void)ignr_;
+}
+
+#undef http_log_setup
+int http_log_setup(http_log_settings_s settings) {
+  if (http_log_fd != -1) {
+    FIO_LOG_ERROR("the asynchronous access log was already set up.");
+    return -1;
+  }
+  intptr_t fd = http_log_open(settings.target);
+  if (fd == -1) {
+    FIO_LOG_ERROR("couldn't open access log target %s - %s",
+                  settings.target ? settings.target : "(stderr)",
+                  strerror(errno));
+    return -1;
+  }
+  size_t ring_size = settings.ring_size ? settings.ring_size : 1024;
+  size_t mask = 1;
+  while (mask < ring_size)
+    mask <<= 1;
+  http_log_async.mask = mask - 1;
+  http_log_async.format = settings.format;
+  http_log_async.sample_rate = settings.sample_rate;
+  http_log_async.flush_ns =
+      (settings.flush_interval_ms ? settings.flush_interval_ms : 50) *
+      1000000UL;
+  http_log_async.is_unix =
+      (settings.target && !strncmp(settings.target, "unix:", 5));
+  if (http_log_async.is_unix) {
+    size_t len = strlen(settings.target);
+    http_log_async.target = malloc(len + 1);
+    FIO_ASSERT_ALLOC(http_log_async.target);
+    memcpy(http_log_async.target, settings.target, len + 1);
+  }
+  http_log_fd = fd;
+  fio_state_callback_add(FIO_CALL_ON_START, http_log_on_start, NULL);
+  fio_state_callback_add(FIO_CALL_IN_CHILD, http_log_in_child, NULL);
+  fio_state_callback_add(FIO_CALL_ON_FINISH, http_log_on_finish, NULL);
+  fio_state_callback_add(FIO_CALL_AT_EXIT, http_log_at_exit, NULL);
+  return 0;
+}
+
 /**
 A faster (yet less localized) alternative to `gmtime_r`.
 
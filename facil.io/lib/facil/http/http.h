@@ -62,6 +62,26 @@ Compile Time Settings
 /** the `http_listen settings, see details in the struct definition. */
 typedef struct http_settings_s http_settings_s;
 
+/** Load shedding priorities, see `http_priority_hint_s`. */
+typedef enum {
+  /** Shed only when the request itself waited longer than the target. */
+  HTTP_PRIORITY_NORMAL = 0,
+  /** Never shed (health checks, admin routes, etc'). */
+  HTTP_PRIORITY_CRITICAL = 1,
+  /** Shed whenever the server is overloaded. */
+  HTTP_PRIORITY_LOW = 2,
+} http_priority_e;
+
+/** A load shedding priority hint for requests with a matching path prefix. */
+typedef struct {
+  /** The path prefix (not necessarily NUL terminated). */
+  const char *prefix;
+  /** The prefix length. */
+  size_t len;
+  /** The priority of matching requests. */
+  http_priority_e priority;
+} http_priority_hint_s;
+
 /* *****************************************************************************
 The Request / Response type and functions
 ***************************************************************************** */
@@ -211,6 +231,33 @@ int http_set_cookie(http_s *h, http_cookie_args_s);
  */
 int http_send_body(http_s *h, void *data, uintptr_t length);
 
+/**
+ * Writes the response headers into a new packet (a FIOBJ String) with room
+ * for `body_capa` more bytes, and reserves space for the content-length
+ * header.
+ *
+ * Append the body to the packet (`fiobj_str_write`, or write into its spare
+ * capacity and `fiobj_str_resize`), then send it with `http_packet_send`,
+ * passing the packet's length as it was returned (the start of the body).
+ * This avoids copying a body that is produced incrementally.
+ *
+ * To abort, free the packet with `fiobj_free`; the `http_s` object is still
+ * valid then.
+ *
+ * Returns FIOBJ_INVALID on error (or if the protocol doesn't support it).
+ */
+FIOBJ http_packet_start(http_s *h, uintptr_t body_capa);
+
+/**
+ * Sends a packet started by `http_packet_start`, patching in its
+ * content-length. The packet is freed.
+ *
+ * Returns -1 on error and 0 on success.
+ *
+ * AFTER THIS FUNCTION IS CALLED, THE `http_s` OBJECT IS NO LONGER VALID.
+ */
+int http_packet_send(http_s *h, FIOBJ packet, uintptr_t body_start);
+
 /**
  * Sends the response headers and the specified file (the response's body).
  *
@@ -418,6 +465,73 @@ struct http_settings_s {
   uint8_t log;
   /** a read only flag set automatically to indicate the protocol's mode. */
   uint8_t is_client;
+  /**
+   * The maximum number of concurrent connections per client IP address.
+   * Further connections are closed as soon as they're accepted.
+   *
+   * Limits are enforced per worker process. Defaults to 0 (unlimited).
+   */
+  uint32_t max_clients_per_ip;
+  /**
+   * The number of requests per second a client IP address may perform (token
+   * bucket refill rate). Requests above the limit receive a prebuilt `429 Too
+   * Many Requests` response and never reach `on_request`.
+   *
+   * Limits are enforced per worker process. Defaults to 0 (unlimited).
+   */
+  uint32_t max_requests_per_ip;
+  /**
+   * The number of requests a client IP address may burst above
+   * `max_requests_per_ip` (token bucket size). Defaults to
+   * `max_requests_per_ip`.
+   */
+  uint32_t max_requests_burst;
+  /**
+   * Adaptive load shedding: the target queueing delay (in milliseconds) for
+   * the task queue (see `fio_defer_latency_target`).
+   *
+   * While the queue is overloaded, requests that waited longer than the target
+   * receive a prebuilt `503 Service Unavailable` response (with `Retry-After`)
+   * and never reach `on_request`. Defaults to 0 (never shed).
+   */
+  uint32_t shed_target_ms;
+  /** The number of entries in the `priority_hints` array. */
+  uint32_t priority_hints_len;
+  /** Per-route priority hints for load shedding (path prefixes). */
+  const http_priority_hint_s *priority_hints;
+  /**
+   * Accept the permessage-deflate WebSocket extension (RFC 7692) when offered
+   * by the client. Requires facil.io to be compiled with zlib (`HAVE_ZLIB`),
+   * otherwise the offer is ignored.
+   */
+  uint8_t ws_deflate;
+  /**
+   * Keep the server's compression context between messages.
+   *
+   * This compresses better, but every connection keeps its own deflate stream
+   * (~256Kb). By default, messages are compressed independently, so deflate
+   * streams are pooled and pub/sub broadcasts are compressed only once.
+   */
+  uint8_t ws_deflate_context_takeover;
+  /**
+   * The LZ77 window size (9-15) used when compressing. Defaults to 15.
+   *
+   * Smaller windows save memory, but broadcasts are only compressed once for
+   * connections using the default window.
+   */
+  uint8_t ws_deflate_window_bits;
+  /**
+   * Coalesce small outgoing WebSocket frames into a per-connection buffer of
+   * this many bytes (see `websocket_coalesce`). Defaults to 0 (disabled).
+   */
+  uint32_t ws_coalesce_bytes;
+  /**
+   * The maximum time (in microseconds) a coalesced frame may wait for more
+   * frames before the buffer is written, rounded up to milliseconds (the
+   * resolution of facil.io's timers). Defaults to 0 (the buffer is written
+   * once the tasks scheduled before it were performed).
+   */
+  uint32_t ws_coalesce_us;
 };
 
 /**
@@ -907,6 +1021,51 @@ FIOBJ http_req2str(http_s *h);
  * This function is called automatically if the `.log` setting is enabled.
  */
 void http_write_log(http_s *h);
+
+/** Access log line formats supported by the asynchronous logger. */
+typedef enum {
+  /** `peer - - [date] "METHOD path VERSION" status bytes duration` */
+  HTTP_LOG_FORMAT_COMMON = 0,
+  /** One JSON object per line. */
+  HTTP_LOG_FORMAT_JSON = 1,
+} http_log_format_e;
+
+/** Settings for the asynchronous (buffered) access logger. */
+typedef struct {
+  /**
+   * The log target. NULL (or "stderr") logs to `stderr`, "-" (or "stdout")
+   * logs to `stdout`, "unix:/path" connects to a Unix stream socket and any
+   * other value is treated as a file path (opened for appending).
+   */
+  const char *target;
+  /** The log line format. */
+  http_log_format_e format;
+  /** Log only one of every `sample_rate` requests (per thread). 0 == 1. */
+  uint32_t sample_rate;
+  /** Records per thread ring (rounded up to a power of 2). Defaults to 1024. */
+  uint32_t ring_size;
+  /** Milliseconds between writer flushes. Defaults to 50ms. */
+  uint32_t flush_interval_ms;
+} http_log_settings_s;
+
+/**
+ * Routes `http_write_log` through an asynchronous logger.
+ *
+ * Request threads copy a fixed-size record into a lock-free, thread local ring
+ * buffer. A background writer thread (one per worker process) formats the
+ * records and flushes them in large batches. When a ring is full the record is
+ * dropped (see `http_log_dropped`) rather than blocking the request thread.
+ *
+ * Must be called before `fio_start`. Returns -1 on error (the target couldn't
+ * be opened) and 0 on success.
+ */
+int http_log_setup(http_log_settings_s);
+/** Routes `http_write_log` through an asynchronous logger. */
+#define http_log_setup(...) http_log_setup((http_log_settings_s){__VA_ARGS__})
+
+/** Returns the number of log records dropped by the asynchronous logger. */
+size_t http_log_dropped(void);
+
 /* *****************************************************************************
 HTTP Time related helper functions that could be used globally
 ***************************************************************************** */
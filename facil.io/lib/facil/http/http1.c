@@ -186,6 +186,50 @@ static int http1_send_body(http_s *h, void *data, uintptr_t length) {
   http1_after_finish(h);
   return 0;
 }
+/* "content-length:" followed by a right aligned value. Leading whitespace is
+ * allowed before a field value, so the value can be patched in place. */
+#define HTTP1_RESERVED_LENGTH_DIGITS 20
+static const char HTTP1_RESERVED_LENGTH[] =
+    "content-length:                    \r\n\r\n";
+
+/** Should write existing headers into a packet, reserving the content-length */
+static FIOBJ http1_packet_start(http_s *h, uintptr_t capa) {
+  FIOBJ packet = headers2str(h, capa + sizeof(HTTP1_RESERVED_LENGTH));
+  if (!packet)
+    return FIOBJ_INVALID;
+  /* replace the final CRLF with the reserved header (and the final CRLF) */
+  fiobj_str_resize(packet, fiobj_obj2cstr(packet).len - 2);
+  fiobj_str_write(packet, HTTP1_RESERVED_LENGTH,
+                  sizeof(HTTP1_RESERVED_LENGTH) - 1);
+  return packet;
+}
+
+/** Should patch the content-length and send a packet */
+static int http1_packet_send(http_s *h, FIOBJ packet, uintptr_t body_start) {
+  fio_str_info_s s = fiobj_obj2cstr(packet);
+  if (body_start < sizeof(HTTP1_RESERVED_LENGTH) - 1 || body_start > s.len) {
+    fiobj_free(packet);
+    http1_after_finish(h);
+    return -1;
+  }
+  /* write the digits backwards, ending right before the final CRLFCRLF */
+  char *pos = s.data + body_start - 4;
+  uintptr_t length = s.len - body_start;
+  /* the access log reads the length from the content-length header */
+  if (handle2pr(h)->p.settings->log)
+    fiobj_hash_set(h->private_data.out_headers, HTTP_HEADER_CONTENT_LENGTH,
+                   fiobj_num_new(length));
+  size_t digits = 0;
+  do {
+    *(--pos) = '0' + (length % 10);
+    length /= 10;
+    ++digits;
+  } while (length && digits < HTTP1_RESERVED_LENGTH_DIGITS);
+  fiobj_send_free((handle2pr(h)->p.uuid), packet);
+  http1_after_finish(h);
+  return 0;
+}
+
 /** Should send existing headers and file */
 static int http1_sendfile(http_s *h, int fd, uintptr_t length,
                           uintptr_t offset) {
@@ -325,10 +369,13 @@ static int http1_http2websocket_server(http_s *h, websocket_settings_s *args) {
   static char ws_key_accpt_str[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
   static uintptr_t sec_version = 0;
   static uintptr_t sec_key = 0;
+  static uintptr_t sec_extensions = 0;
   if (!sec_version)
     sec_version = fiobj_hash_string("sec-websocket-version", 21);
   if (!sec_key)
     sec_key = fiobj_hash_string("sec-websocket-key", 17);
+  if (!sec_extensions)
+    sec_extensions = fiobj_hash_string("sec-websocket-extensions", 24);
 
   FIOBJ tmp = fiobj_hash_get2(h->headers, sec_version);
   if (!tmp)
@@ -356,10 +403,22 @@ static int http1_http2websocket_server(http_s *h, websocket_settings_s *args) {
   http1pr_s *pr = handle2pr(h);
   const intptr_t uuid = handle2pr(h)->p.uuid;
   http_settings_s *set = handle2pr(h)->p.settings;
+  /* negotiate permessage-deflate */
+  websocket_deflate_s deflate = {.enabled = 0};
+  tmp = fiobj_hash_get2(h->headers, sec_extensions);
+  if (tmp && set->ws_deflate) {
+    tmp = websocket_deflate_negotiate(set, tmp, &deflate);
+    if (tmp)
+      http_set_header2(
+          h, (fio_str_info_s){.data = "sec-websocket-extensions", .len = 24},
+          fiobj_obj2cstr(tmp));
+    fiobj_free(tmp);
+  }
   http_finish(h);
   pr->stop = 1;
-  websocket_attach(uuid, set, args, pr->parser.state.next,
-                   pr->buf_len - (intptr_t)(pr->parser.state.next - pr->buf));
+  websocket_attach2(uuid, set, args, pr->parser.state.next,
+                    pr->buf_len - (intptr_t)(pr->parser.state.next - pr->buf),
+                    deflate);
   return 0;
 bad_request:
   http_send_error(h, 400);
@@ -529,6 +588,8 @@ Virtual Table Decleration
 struct http_vtable_s HTTP1_VTABLE = {
     .http_send_body = http1_send_body,
     .http_sendfile = http1_sendfile,
+    .http_packet_start = http1_packet_start,
+    .http_packet_send = http1_packet_send,
     .http_finish = htt1p_finish,
     .http_push_data = http1_push_data,
     .http_push_file = http1_push_file,
@@ -547,9 +608,65 @@ void *http1_vtable(void) { return (void *)&HTTP1_VTABLE; }
 Parser Callbacks
 ***************************************************************************** */
 
+/* a prebuilt response for clients exceeding the per-IP request rate */
+static const char http1_too_many_requests[] =
+    "HTTP/1.1 429 Too Many Requests\r\n"
+    "Retry-After: 1\r\n"
+    "Content-Length: 0\r\n\r\n";
+
+/* a prebuilt response for requests shed while the server is overloaded */
+static const char http1_service_unavailable[] =
+    "HTTP/1.1 503 Service Unavailable\r\n"
+    "Retry-After: 1\r\n"
+    "Content-Length: 0\r\n\r\n";
+
+/* answers the request with a static response, skipping the handler */
+static int http1_reject(http1pr_s *p, const char *response, size_t len,
+                        size_t status) {
+  fio_write2(p->p.uuid, .data.buffer = response, .length = len,
+             .after.dealloc = FIO_DEALLOC_NOOP);
+  p->request.status = status;
+  http1_after_finish(&p->request);
+  h1_reset(p);
+  return fio_is_closed(p->p.uuid);
+}
+
+/* tests if a request should be shed while the task queue is overloaded */
+static int http1_should_shed(http1pr_s *p) {
+  http_settings_s *s = p->p.settings;
+  http_priority_e priority = HTTP_PRIORITY_NORMAL;
+  if (s->priority_hints_len) {
+    fio_str_info_s path = fiobj_obj2cstr(p->request.path);
+    for (size_t i = 0; i < s->priority_hints_len; ++i) {
+      if (path.len >= s->priority_hints[i].len &&
+          !memcmp(path.data, s->priority_hints[i].prefix,
+                  s->priority_hints[i].len)) {
+        priority = s->priority_hints[i].priority;
+        break;
+      }
+    }
+  }
+  switch (priority) {
+  case HTTP_PRIORITY_CRITICAL:
+    return 0;
+  case HTTP_PRIORITY_LOW:
+    return 1;
+  default:
+    return fio_defer_should_shed();
+  }
+}
+
 /** called when a request was received. */
 static int http1_on_request(http1_parser_s *parser) {
   http1pr_s *p = parser2http(parser);
+  if (http_settings2ip_limit(p->p.settings) &&
+      fio_ip_limit_take(http_settings2ip_limit(p->p.settings), p->p.uuid))
+    return http1_reject(p, http1_too_many_requests,
+                        sizeof(http1_too_many_requests) - 1, 429);
+  if (p->p.settings->shed_target_ms && fio_defer_is_overloaded() &&
+      http1_should_shed(p))
+    return http1_reject(p, http1_service_unavailable,
+                        sizeof(http1_service_unavailable) - 1, 503);
   http_on_request_handler______internal(&http1_pr2handle(p), p->p.settings);
   if (p->request.method && !p->stop)
     http_finish(&p->request);
@@ -31,6 +31,12 @@ struct http_vtable_s {
   /** Should send existing headers and file */
   int (*const http_sendfile)(http_s *h, int fd, uintptr_t length,
                              uintptr_t offset);
+  /** Should write existing headers into a packet, reserving the
+   * content-length, with room for `capa` body bytes */
+  FIOBJ (*const http_packet_start)(http_s *h, uintptr_t capa);
+  /** Should patch the content-length and send a packet from
+   * `http_packet_start`. MUST free the FIOBJ. */
+  int (*const http_packet_send)(http_s *h, FIOBJ packet, uintptr_t body_start);
   /** Should send existing headers and data and prepare for streaming */
   int (*const http_stream)(http_s *h, void *data, uintptr_t length);
   /** Should send existing headers or complete streaming */
@@ -66,6 +72,9 @@ struct http_fio_protocol_s {
 
 #define http2protocol(h) ((http_fio_protocol_s *)h->private_data.flag)
 
+/* the (private) per-IP limit table is stored after the settings object */
+#define http_settings2ip_limit(s) (((fio_ip_limit_s **)((s) + 1))[1])
+
 /* *****************************************************************************
 Constants that shouldn't be accessed by the users (`fiobj_dup` required).
 ***************************************************************************** */
@@ -190,6 +199,37 @@ static inline void http_sse_destroy(http_sse_internal_s *sse) {
   http_sse_try_free(sse);
 }
 
+/* *****************************************************************************
+WebSocket permessage-deflate (RFC 7692)
+***************************************************************************** */
+
+/** The negotiated permessage-deflate parameters. */
+typedef struct {
+  /** set if the extension was accepted. */
+  uint8_t enabled;
+  /** set if the server keeps its compression context between messages. */
+  uint8_t server_context_takeover;
+  /** set if the client keeps its compression context between messages. */
+  uint8_t client_context_takeover;
+  /** the server's LZ77 window size (9-15). */
+  uint8_t server_window_bits;
+} websocket_deflate_s;
+
+/**
+ * Negotiates permessage-deflate for the `sec-websocket-extensions` header
+ * `value` (an offer list), according to the server's `settings`.
+ *
+ * Returns the `sec-websocket-extensions` response header value (or
+ * FIOBJ_INVALID if no offer was accepted) and fills in `params`.
+ */
+FIOBJ websocket_deflate_negotiate(http_settings_s *settings, FIOBJ value,
+                                  websocket_deflate_s *params);
+
+/** Attaches the Websocket protocol using the negotiated extensions. */
+void websocket_attach2(intptr_t uuid, http_settings_s *http_settings,
+                       websocket_settings_s *args, void *data, size_t length,
+                       websocket_deflate_s deflate);
+
 /* *****************************************************************************
 Helpers
 ***************************************************************************** */
@@ -90,6 +90,15 @@ static void websocket_on_protocol_ping(void *udata, void *msg, uint64_t len);
 static void websocket_on_protocol_pong(void *udata, void *msg, uint64_t len);
 static void websocket_on_protocol_close(void *udata);
 static void websocket_on_protocol_error(void *udata);
+/**
+ * Returns a buffer for a fragment of a fragmented (masked) message, or NULL.
+ *
+ * The fragment is unmasked straight into the buffer (instead of in place) and
+ * the buffer is passed to `websocket_on_unwrapped` as `msg`, saving a copy
+ * when assembling fragmented messages.
+ */
+static void *websocket_on_fragment(void *udata, uint64_t len, char first,
+                                   unsigned char rsv);
 
 /* *****************************************************************************
 API - Parsing (unwrapping)
@@ -134,6 +143,14 @@ API - Internal Helpers
 /** used internally to mask and unmask client messages. */
 inline static void websocket_xmask(void *msg, uint64_t len, uint32_t mask);
 
+/**
+ * Masks / unmasks `len` bytes from `src` into `dest` (which may be `src`).
+ *
+ * Uses AVX2 / SSE2 when available (see `WEBSOCKET_XMASK_SIMD`).
+ */
+inline static void websocket_xmask_copy(void *dest, const void *src,
+                                        uint64_t len, uint32_t mask);
+
 /* *****************************************************************************
 
                                 Implementation
@@ -143,8 +160,30 @@ inline static void websocket_xmask(void *msg, uint64_t len, uint32_t mask);
 /* *****************************************************************************
 Message masking
 ***************************************************************************** */
-/** used internally to mask and unmask client messages. */
-void websocket_xmask(void *msg, uint64_t len, uint32_t mask) {
+
+/**
+ * Set to 0 to use only the scalar (word at a time) masking implementation.
+ *
+ * On x86, AVX2 is used when the CPU supports it (detected once at runtime, or
+ * at build time when compiling with `-mavx2`), falling back to SSE2.
+ */
+#ifndef WEBSOCKET_XMASK_SIMD
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) &&         \
+    defined(__GNUC__)
+#define WEBSOCKET_XMASK_SIMD 1
+#else
+#define WEBSOCKET_XMASK_SIMD 0
+#endif
+#endif
+
+#if WEBSOCKET_XMASK_SIMD
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+/** the scalar in-place implementation, aligning memory before XOR. */
+inline static void websocket_xmask_scalar(void *msg, uint64_t len,
+                                          uint32_t mask) {
   if (len > 7) {
     { /* XOR any unaligned memory (4 byte alignment) */
       const uintptr_t offset = 4 - ((uintptr_t)msg & 3);
@@ -217,6 +256,106 @@ void websocket_xmask(void *msg, uint64_t len, uint32_t mask) {
   }
 }
 
+/** the scalar copying implementation (unaligned 8 byte words). */
+inline static void websocket_xmask_copy_scalar(uint8_t *dest,
+                                               const uint8_t *src, uint64_t len,
+                                               uint32_t mask) {
+  const uint64_t xmask = (((uint64_t)mask) << 32) | mask;
+  while (len >= 8) {
+    uint64_t tmp;
+    memcpy(&tmp, src, 8);
+    tmp ^= xmask;
+    memcpy(dest, &tmp, 8);
+    src += 8;
+    dest += 8;
+    len -= 8;
+  }
+  for (uint64_t i = 0; i < len; ++i)
+    dest[i] = src[i] ^ ((uint8_t *)(&mask))[i & 3];
+}
+
+#if WEBSOCKET_XMASK_SIMD
+/* 32 bytes per iteration. Offsets stay a multiple of 4, so the mask lines up */
+inline static void websocket_xmask_copy_sse2(uint8_t *dest, const uint8_t *src,
+                                             uint64_t len, uint32_t mask) {
+  const __m128i xmask = _mm_set1_epi32((int)mask);
+  while (len >= 32) {
+    __m128i a = _mm_loadu_si128((const __m128i *)src);
+    __m128i b = _mm_loadu_si128((const __m128i *)(src + 16));
+    _mm_storeu_si128((__m128i *)dest, _mm_xor_si128(a, xmask));
+    _mm_storeu_si128((__m128i *)(dest + 16), _mm_xor_si128(b, xmask));
+    src += 32;
+    dest += 32;
+    len -= 32;
+  }
+  websocket_xmask_copy_scalar(dest, src, len, mask);
+}
+
+/* 64 bytes per iteration */
+__attribute__((target("avx2"))) static void
+websocket_xmask_copy_avx2(uint8_t *dest, const uint8_t *src, uint64_t len,
+                          uint32_t mask) {
+  const __m256i xmask = _mm256_set1_epi32((int)mask);
+  while (len >= 64) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)src);
+    __m256i b = _mm256_loadu_si256((const __m256i *)(src + 32));
+    _mm256_storeu_si256((__m256i *)dest, _mm256_xor_si256(a, xmask));
+    _mm256_storeu_si256((__m256i *)(dest + 32), _mm256_xor_si256(b, xmask));
+    src += 64;
+    dest += 64;
+    len -= 64;
+  }
+  websocket_xmask_copy_sse2(dest, src, len, mask);
+}
+
+#if !defined(__AVX2__)
+/* tests for AVX2, including OS support for the YMM registers */
+static int websocket_xmask_has_avx2(void) {
+  unsigned int a, b, c, d;
+  if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_OSXSAVE) || !(c & bit_AVX))
+    return 0;
+  unsigned int xcr0_lo, xcr0_hi;
+  __asm__ volatile("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+  (void)xcr0_hi;
+  if ((xcr0_lo & 6) != 6)
+    return 0;
+  if (!__get_cpuid_count(7, 0, &a, &b, &c, &d))
+    return 0;
+  return (b & bit_AVX2) != 0;
+}
+#endif
+#endif /* WEBSOCKET_XMASK_SIMD */
+
+/**
+ * Masks / unmasks `len` bytes from `src` into `dest` (which may be `src`).
+ */
+void websocket_xmask_copy(void *dest, const void *src, uint64_t len,
+                          uint32_t mask) {
+#if WEBSOCKET_XMASK_SIMD && defined(__AVX2__)
+  websocket_xmask_copy_avx2(dest, src, len, mask);
+#elif WEBSOCKET_XMASK_SIMD
+  /* benign race: every thread computes the same value */
+  static int has_avx2 = -1;
+  if (has_avx2 < 0)
+    has_avx2 = websocket_xmask_has_avx2();
+  if (has_avx2 && len >= 64)
+    websocket_xmask_copy_avx2(dest, src, len, mask);
+  else
+    websocket_xmask_copy_sse2(dest, src, len, mask);
+#else
+  websocket_xmask_copy_scalar(dest, src, len, mask);
+#endif
+}
+
+/** used internally to mask and unmask client messages. */
+void websocket_xmask(void *msg, uint64_t len, uint32_t mask) {
+#if WEBSOCKET_XMASK_SIMD
+  websocket_xmask_copy(msg, msg, len, mask);
+#else
+  websocket_xmask_scalar(msg, len, mask);
+#endif
+}
+
 /* *****************************************************************************
 Message wrapping
 ***************************************************************************** */
@@ -344,8 +483,7 @@ static uint64_t websocket_client_wrap(void *target, void *msg, uint64_t len,
     ((uint8_t *)target)[3] = ((uint8_t *)(&mask))[1];
     ((uint8_t *)target)[4] = ((uint8_t *)(&mask))[2];
     ((uint8_t *)target)[5] = ((uint8_t *)(&mask))[3];
-    memcpy(((uint8_t *)target) + 6, msg, len);
-    websocket_xmask((uint8_t *)target + 6, len, mask);
+    websocket_xmask_copy((uint8_t *)target + 6, msg, len, mask);
     return len + 6;
   } else if (len < (1UL << 16)) {
     /* head is 4 bytes */
@@ -355,8 +493,7 @@ static uint64_t websocket_client_wrap(void *target, void *msg, uint64_t len,
     ((uint8_t *)target)[5] = ((uint8_t *)(&mask))[1];
     ((uint8_t *)target)[6] = ((uint8_t *)(&mask))[2];
     ((uint8_t *)target)[7] = ((uint8_t *)(&mask))[3];
-    memcpy((uint8_t *)target + 8, msg, len);
-    websocket_xmask((uint8_t *)target + 8, len, mask);
+    websocket_xmask_copy((uint8_t *)target + 8, msg, len, mask);
     return len + 8;
   }
   /* Really Long Message  */
@@ -366,8 +503,7 @@ static uint64_t websocket_client_wrap(void *target, void *msg, uint64_t len,
   ((uint8_t *)target)[11] = ((uint8_t *)(&mask))[1];
   ((uint8_t *)target)[12] = ((uint8_t *)(&mask))[2];
   ((uint8_t *)target)[13] = ((uint8_t *)(&mask))[3];
-  memcpy((uint8_t *)target + 14, msg, len);
-  websocket_xmask((uint8_t *)target + 14, len, mask);
+  websocket_xmask_copy((uint8_t *)target + 14, msg, len, mask);
   return len + 14;
 }
 
@@ -447,7 +583,17 @@ static uint64_t websocket_consume(void *buffer, uint64_t len, void *udata,
       ((uint8_t *)(&mask))[1] = ((uint8_t *)(payload))[-3];
       ((uint8_t *)(&mask))[2] = ((uint8_t *)(payload))[-2];
       ((uint8_t *)(&mask))[3] = ((uint8_t *)(payload))[-1];
-      websocket_xmask(payload, info.packet_length, mask);
+      /* fragments are unmasked straight into the message buffer */
+      void *target = NULL;
+      if ((pos[0] & 15) == 0 || ((pos[0] & 15) < 3 && !(pos[0] & 128)))
+        target = websocket_on_fragment(udata, info.packet_length,
+                                       (pos[0] & 15) != 0, ((pos[0] >> 4) & 7));
+      if (target) {
+        websocket_xmask_copy(target, payload, info.packet_length, mask);
+        payload = target;
+      } else {
+        websocket_xmask(payload, info.packet_length, mask);
+      }
     } else if (require_masking && info.packet_length) {
 #if DEBUG
       fprintf(stderr, "ERROR: WebSocket protocol error - unmasked data.\n");
@@ -19,6 +19,7 @@ Feel free to copy, use and enjoy according to the license provided.
 
 #include <arpa/inet.h>
 #include <errno.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -26,6 +27,10 @@ Feel free to copy, use and enjoy according to the license provided.
 
 #include <websocket_parser.h>
 
+#if HAVE_ZLIB
+#include <zlib.h>
+#endif
+
 #if !defined(__BIG_ENDIAN__) && !defined(__LITTLE_ENDIAN__)
 #include <endian.h>
 #if !defined(__BIG_ENDIAN__) && !defined(__LITTLE_ENDIAN__) &&                 \
@@ -57,6 +62,13 @@ void free_ws_buffer(ws_s *owner, struct buffer_s);
 /** Sets the initial buffer size. (4Kb)*/
 #define WS_INITIAL_BUFFER_SIZE 4096UL
 
+/**
+ * Buffers that grew beyond this size (64Kb) for a large message are shrunk (or
+ * released) once the message was handled, so a single large message doesn't
+ * pin memory for the connection's lifetime.
+ */
+#define WS_BUFFER_SHRINK_LIMIT (WS_INITIAL_BUFFER_SIZE << 4)
+
 /*******************************************************************************
 Buffer management - simple implementation...
 Since Websocket connections have a long life expectancy, optimizing this part of
@@ -98,6 +110,7 @@ Create/Destroy the websocket object (prototypes)
 
 static ws_s *new_websocket(intptr_t uuid);
 static void destroy_ws(ws_s *ws);
+static void websocket_out_flush(ws_s *ws);
 
 /*******************************************************************************
 The Websocket object (protocol + parser)
@@ -130,6 +143,28 @@ struct ws_s {
   uint8_t is_text;
   /** websocket connection type. */
   uint8_t is_client;
+  /** set while receiving a compressed (permessage-deflate) message. */
+  uint8_t is_compressed;
+  /** the negotiated permessage-deflate parameters. */
+  websocket_deflate_s deflate;
+#if HAVE_ZLIB
+  /** owned deflate stream (server context takeover only). */
+  z_stream *deflater;
+  /** inflate stream (owned for client context takeover, otherwise pooled). */
+  z_stream *inflater;
+  /** keeps compression and writing in order when the deflater is owned. */
+  fio_lock_i deflate_lock;
+#endif
+  /** coalesced output: small frames waiting to be written together. */
+  uint8_t *out;
+  size_t out_len;
+  /** the coalescing buffer's capacity (0 when coalescing is disabled). */
+  size_t out_capa;
+  /** how long (in microseconds) coalesced frames may wait for more frames. */
+  size_t out_delay_us;
+  /** set while a flush task (or timer) is scheduled. */
+  uint8_t out_scheduled;
+  fio_lock_i out_lock;
 };
 
 /* *****************************************************************************
@@ -144,6 +179,357 @@ static inline void clear_subscriptions(ws_s *ws) {
   fio_unlock(&ws->sub_lock);
 }
 
+/* *****************************************************************************
+Shrinking buffers after large messages
+***************************************************************************** */
+
+/* releases the message assembly buffer if a large message grew it */
+static inline void websocket_shrink_msg(ws_s *ws) {
+  if (ws->msg && fiobj_str_capa(ws->msg) > WS_BUFFER_SHRINK_LIMIT) {
+    fiobj_free(ws->msg);
+    ws->msg = FIOBJ_INVALID;
+  }
+}
+
+/* shrinks the read buffer unless the pending frame is large as well */
+static inline void websocket_shrink_buffer(ws_s *ws) {
+  if (ws->buffer.size <= WS_BUFFER_SHRINK_LIMIT)
+    return;
+  if (ws->length) {
+    struct websocket_packet_info_s info =
+        websocket_buffer_peek(ws->buffer.data, ws->length);
+    if (info.head_length + info.packet_length >= WS_INITIAL_BUFFER_SIZE)
+      return;
+  }
+  ws->buffer.size = ws->length; /* rounded up to the initial size */
+  ws->buffer = resize_ws_buffer(ws, ws->buffer);
+  if (!ws->buffer.data) {
+    ws->length = 0;
+    websocket_close(ws);
+  }
+}
+
+/* *****************************************************************************
+permessage-deflate (RFC 7692)
+***************************************************************************** */
+
+#if HAVE_ZLIB
+/* returns the next `sep` delimited token, trimmed, advancing `s` */
+static fio_str_info_s ws_ext_token(fio_str_info_s *s, char sep) {
+  char *end = memchr(s->data, sep, s->len);
+  fio_str_info_s t = {.data = s->data,
+                      .len = (end ? (size_t)(end - s->data) : s->len)};
+  s->data += t.len + (end != NULL);
+  s->len -= t.len + (end != NULL);
+  while (t.len && (t.data[0] == ' ' || t.data[0] == '\t')) {
+    ++t.data;
+    --t.len;
+  }
+  while (t.len && (t.data[t.len - 1] == ' ' || t.data[t.len - 1] == '\t'))
+    --t.len;
+  return t;
+}
+
+#define ws_ext_is(token, name)                                                 \
+  ((token).len == sizeof(name) - 1 &&                                          \
+   !strncasecmp((token).data, (name), sizeof(name) - 1))
+
+/* parses a window bits value (8-15), returns 0 on error */
+static uint8_t ws_ext_window_bits(fio_str_info_s value) {
+  if (value.len >= 2 && value.data[0] == '"' &&
+      value.data[value.len - 1] == '"') {
+    ++value.data;
+    value.len -= 2;
+  }
+  if (value.len == 1 && value.data[0] >= '8' && value.data[0] <= '9')
+    return (uint8_t)(value.data[0] - '0');
+  if (value.len == 2 && value.data[0] == '1' && value.data[1] >= '0' &&
+      value.data[1] <= '5')
+    return (uint8_t)(10 + value.data[1] - '0');
+  return 0;
+}
+
+/* accepts a single permessage-deflate offer, returns -1 if declined */
+static int ws_deflate_accept(http_settings_s *settings, fio_str_info_s offer,
+                             websocket_deflate_s *p, FIOBJ *response) {
+  fio_str_info_s name = ws_ext_token(&offer, ';');
+  if (!ws_ext_is(name, "permessage-deflate"))
+    return -1;
+  uint8_t bits = settings->ws_deflate_window_bits;
+  if (bits < 9 || bits > 15)
+    bits = 15;
+  *p = (websocket_deflate_s){
+      .enabled = 1,
+      .server_context_takeover = (settings->ws_deflate_context_takeover != 0),
+      .client_context_takeover = (settings->ws_deflate_context_takeover != 0),
+  };
+  uint8_t seen = 0;
+  while (offer.len) {
+    fio_str_info_s param = ws_ext_token(&offer, ';');
+    fio_str_info_s value = param;
+    param = ws_ext_token(&value, '=');
+    value = ws_ext_token(&value, ';'); /* trims the value */
+    uint8_t flag;
+    if (ws_ext_is(param, "server_no_context_takeover")) {
+      flag = 1;
+      p->server_context_takeover = 0;
+    } else if (ws_ext_is(param, "client_no_context_takeover")) {
+      flag = 2;
+      p->client_context_takeover = 0;
+    } else if (ws_ext_is(param, "server_max_window_bits")) {
+      flag = 4;
+      uint8_t requested = ws_ext_window_bits(value);
+      /* zlib can't produce raw deflate data for a 256 byte window */
+      if (requested < 9)
+        return -1;
+      if (requested < bits)
+        bits = requested;
+    } else if (ws_ext_is(param, "client_max_window_bits")) {
+      /* a hint only, the inflater accepts any window size */
+      flag = 8;
+      if (value.len && !ws_ext_window_bits(value))
+        return -1;
+    } else {
+      return -1;
+    }
+    if ((seen & flag) || (value.len && flag < 4))
+      return -1;
+    seen |= flag;
+  }
+  p->server_window_bits = bits;
+
+  *response = fiobj_str_buf(96);
+  fiobj_str_write(*response, "permessage-deflate", 18);
+  if (!p->server_context_takeover)
+    fiobj_str_write(*response, "; server_no_context_takeover", 28);
+  if (!p->client_context_takeover)
+    fiobj_str_write(*response, "; client_no_context_takeover", 28);
+  if ((seen & 4)) {
+    fiobj_str_write(*response, "; server_max_window_bits=", 25);
+    fiobj_str_write_i(*response, bits);
+  }
+  return 0;
+}
+
+#undef ws_ext_is
+#endif /* HAVE_ZLIB */
+
+/**
+ * Negotiates permessage-deflate for the `sec-websocket-extensions` header
+ * `value` (an offer list), according to the server's `settings`.
+ */
+FIOBJ websocket_deflate_negotiate(http_settings_s *settings, FIOBJ value,
+                                  websocket_deflate_s *params) {
+  FIOBJ response = FIOBJ_INVALID;
+#if HAVE_ZLIB
+  if (FIOBJ_TYPE_IS(value, FIOBJ_T_ARRAY)) {
+    /* the header was sent more than once */
+    for (size_t i = 0; !response && i < fiobj_ary_count(value); ++i) {
+      response = websocket_deflate_negotiate(
+          settings, fiobj_ary_index(value, i), params);
+    }
+    return response;
+  }
+  fio_str_info_s offers = fiobj_obj2cstr(value);
+  while (offers.len) {
+    if (!ws_deflate_accept(settings, ws_ext_token(&offers, ','), params,
+                           &response))
+      return response;
+  }
+#endif
+  *params = (websocket_deflate_s){.enabled = 0};
+  return response;
+  (void)settings;
+  (void)value;
+}
+
+#if HAVE_ZLIB
+
+#ifndef WS_DEFLATE_POOL_LIMIT
+/** The number of idle deflate streams kept per window size (and inflaters). */
+#define WS_DEFLATE_POOL_LIMIT 32
+#endif
+
+#ifndef WS_DEFLATE_MIN_LENGTH
+/** Shorter messages are sent uncompressed. */
+#define WS_DEFLATE_MIN_LENGTH 64
+#endif
+
+#ifndef WS_DEFLATE_LEVEL
+/** The zlib compression level. */
+#define WS_DEFLATE_LEVEL Z_DEFAULT_COMPRESSION
+#endif
+
+typedef struct ws_zstream_s {
+  z_stream z; /* must be first */
+  struct ws_zstream_s *next;
+} ws_zstream_s;
+
+/*
+ * Idle streams. Deflaters are pooled by window size (9-15), inflaters (which
+ * always use a 15 bit window) take the last slot.
+ */
+static struct {
+  ws_zstream_s *list;
+  size_t count;
+  fio_lock_i lock;
+} ws_zpool[8];
+
+#define ws_zpool_index(bits) ((bits) ? (bits)-9 : 7)
+
+/* returns a deflater for `bits` window bits, or an inflater if `bits == 0` */
+static z_stream *ws_zstream_new(uint8_t bits) {
+  const size_t i = ws_zpool_index(bits);
+  fio_lock(&ws_zpool[i].lock);
+  ws_zstream_s *s = ws_zpool[i].list;
+  if (s) {
+    ws_zpool[i].list = s->next;
+    --ws_zpool[i].count;
+  }
+  fio_unlock(&ws_zpool[i].lock);
+  if (s)
+    return &s->z;
+  s = malloc(sizeof(*s));
+  FIO_ASSERT_ALLOC(s);
+  *s = (ws_zstream_s){.next = NULL};
+  int r = (bits ? deflateInit2(&s->z, WS_DEFLATE_LEVEL, Z_DEFLATED,
+                               0 - (int)bits, 8, Z_DEFAULT_STRATEGY)
+                : inflateInit2(&s->z, -15));
+  if (r != Z_OK) {
+    FIO_LOG_ERROR("(websocket) zlib stream initialization failed.");
+    free(s);
+    return NULL;
+  }
+  return &s->z;
+}
+
+/* resets the stream and returns it to the pool (or frees it) */
+static void ws_zstream_free(z_stream *z, uint8_t bits) {
+  if (!z)
+    return;
+  ws_zstream_s *s = (ws_zstream_s *)z;
+  const size_t i = ws_zpool_index(bits);
+  if ((bits ? deflateReset(z) : inflateReset(z)) == Z_OK) {
+    fio_lock(&ws_zpool[i].lock);
+    if (ws_zpool[i].count < WS_DEFLATE_POOL_LIMIT) {
+      s->next = ws_zpool[i].list;
+      ws_zpool[i].list = s;
+      ++ws_zpool[i].count;
+      s = NULL;
+    }
+    fio_unlock(&ws_zpool[i].lock);
+    if (!s)
+      return;
+  }
+  if (bits)
+    deflateEnd(z);
+  else
+    inflateEnd(z);
+  free(s);
+}
+
+#undef ws_zpool_index
+
+/*
+ * Compresses `len` bytes (a whole message) into `*out` (allocated using
+ * `fio_malloc`), without the trailing 0x00 0x00 0xff 0xff (RFC 7692, section
+ * 7.2.1). Returns the compressed length, or 0 on error.
+ */
+static size_t ws_deflate_message(z_stream *z, void *data, size_t len,
+                                 void **out) {
+  size_t capa = deflateBound(z, len) + 16;
+  uint8_t *buf = fio_malloc(capa);
+  FIO_ASSERT_ALLOC(buf);
+  z->next_in = data;
+  z->avail_in = (uInt)len;
+  z->next_out = buf;
+  z->avail_out = (uInt)capa;
+  for (;;) {
+    int r = deflate(z, Z_SYNC_FLUSH);
+    if (r != Z_OK && r != Z_BUF_ERROR)
+      goto error;
+    if (z->avail_out)
+      break;
+    /* out of space, the flush is incomplete */
+    buf = fio_realloc2(buf, capa << 1, capa);
+    FIO_ASSERT_ALLOC(buf);
+    z->next_out = buf + capa;
+    z->avail_out = (uInt)capa;
+    capa <<= 1;
+  }
+  len = capa - z->avail_out;
+  if (len < 4)
+    goto error;
+  *out = buf;
+  return len - 4;
+error:
+  fio_free(buf);
+  *out = NULL;
+  return 0;
+}
+
+/* inflates `len` bytes into the message buffer, returns -1 on error */
+static int ws_inflate(ws_s *ws, void *data, size_t len) {
+  z_stream *z = ws->inflater;
+  if (!z)
+    return -1;
+  z->next_in = data;
+  z->avail_in = (uInt)len;
+  do {
+    size_t used = fiobj_obj2cstr(ws->msg).len;
+    size_t capa = fiobj_str_capa(ws->msg);
+    if (capa - used < 1024)
+      capa = fiobj_str_capa_assert(ws->msg, (used << 1) + (len << 1) + 1024);
+    z->next_out = (Bytef *)fiobj_obj2cstr(ws->msg).data + used;
+    z->avail_out = (uInt)(capa - used);
+    int r = inflate(z, Z_SYNC_FLUSH);
+    used = capa - z->avail_out;
+    fiobj_str_resize(ws->msg, used);
+    if (used > ws->max_msg_size)
+      return -1; /* too big, don't inflate zip bombs */
+    if (r == Z_STREAM_END) {
+      /* the client ended the deflate stream (BFINAL), start a new one */
+      inflateReset(z);
+      continue;
+    }
+    if (r == Z_BUF_ERROR && z->avail_out)
+      break; /* no progress possible */
+    if (r != Z_OK && r != Z_BUF_ERROR)
+      return -1;
+  } while (z->avail_in || !z->avail_out);
+  return 0;
+}
+
+/* receives a compressed message fragment */
+static void websocket_on_unwrapped_deflated(ws_s *ws, void *msg, uint64_t len,
+                                            char first, char last, char text) {
+  static uint8_t tail[4] = {0x00, 0x00, 0xff, 0xff};
+  if (first) {
+    ws->is_text = (uint8_t)text;
+    if (ws->msg == FIOBJ_INVALID)
+      ws->msg = fiobj_str_buf(len << 2);
+    fiobj_str_resize(ws->msg, 0);
+    if (!ws->inflater)
+      ws->inflater = ws_zstream_new(0);
+  }
+  if (ws_inflate(ws, msg, len) || (last && ws_inflate(ws, tail, 4))) {
+    ws->is_compressed = 0;
+    websocket_close(ws);
+    return;
+  }
+  if (!last)
+    return;
+  if (!ws->deflate.client_context_takeover) {
+    /* the next message starts with a fresh context */
+    ws_zstream_free(ws->inflater, 0);
+    ws->inflater = NULL;
+  }
+  ws->on_message(ws, fiobj_obj2cstr(ws->msg), ws->is_text);
+  websocket_shrink_msg(ws);
+}
+
+#endif /* HAVE_ZLIB */
+
 /* *****************************************************************************
 Callbacks - Required functions for websocket_parser.h
 ***************************************************************************** */
@@ -152,6 +538,14 @@ static void websocket_on_unwrapped(void *ws_p, void *msg, uint64_t len,
                                    char first, char last, char text,
                                    unsigned char rsv) {
   ws_s *ws = ws_p;
+  if (first)
+    ws->is_compressed = ((rsv & 4) && ws->deflate.enabled);
+#if HAVE_ZLIB
+  if (ws->is_compressed) {
+    websocket_on_unwrapped_deflated(ws, msg, len, first, last, text);
+    return;
+  }
+#endif
   if (last && first) {
     ws->on_message(ws, (fio_str_info_s){.data = msg, .len = len},
                    (uint8_t)text);
@@ -161,14 +555,39 @@ static void websocket_on_unwrapped(void *ws_p, void *msg, uint64_t len,
     ws->is_text = (uint8_t)text;
     if (ws->msg == FIOBJ_INVALID)
       ws->msg = fiobj_str_buf(len);
-    fiobj_str_resize(ws->msg, 0);
+    if (msg != fiobj_obj2cstr(ws->msg).data)
+      fiobj_str_resize(ws->msg, 0);
+  }
+  fio_str_info_s assembled = fiobj_obj2cstr(ws->msg);
+  if ((char *)msg == assembled.data + assembled.len) {
+    /* already unmasked into place by `websocket_on_fragment` */
+    fiobj_str_resize(ws->msg, assembled.len + len);
+  } else {
+    fiobj_str_write(ws->msg, msg, len);
   }
-  fiobj_str_write(ws->msg, msg, len);
   if (last) {
     ws->on_message(ws, fiobj_obj2cstr(ws->msg), ws->is_text);
+    websocket_shrink_msg(ws);
   }
+}
 
-  (void)rsv;
+static void *websocket_on_fragment(void *ws_p, uint64_t len, char first,
+                                   unsigned char rsv) {
+  ws_s *ws = ws_p;
+  /* compressed fragments are inflated rather than assembled */
+  if (first ? ((rsv & 4) && ws->deflate.enabled) : ws->is_compressed)
+    return NULL;
+  if (first) {
+    if (ws->msg == FIOBJ_INVALID)
+      ws->msg = fiobj_str_buf(len);
+    fiobj_str_resize(ws->msg, 0);
+  } else if (ws->msg == FIOBJ_INVALID) {
+    return NULL;
+  }
+  const size_t used = fiobj_obj2cstr(ws->msg).len;
+  if (fiobj_str_capa_assert(ws->msg, used + len) < used + len)
+    return NULL;
+  return fiobj_obj2cstr(ws->msg).data + used;
 }
 static void websocket_on_protocol_ping(void *ws_p, void *msg_, uint64_t len) {
   ws_s *ws = ws_p;
@@ -234,6 +653,7 @@ static uint8_t on_shutdown(intptr_t fd, fio_protocol_s *ws) {
   (void)(fd);
   if (ws && ((ws_s *)ws)->on_shutdown)
     ((ws_s *)ws)->on_shutdown((ws_s *)ws);
+  websocket_out_flush((ws_s *)ws);
   if (((ws_s *)ws)->is_client) {
     fio_write2(fd, .data.buffer = "\x8a\x80MASK", .length = 6,
                .after.dealloc = FIO_DEALLOC_NOOP);
@@ -275,6 +695,7 @@ static void on_data(intptr_t sockfd, fio_protocol_s *ws_) {
   }
   ws->length = websocket_consume(ws->buffer.data, ws->length + len, ws,
                                  (~(ws->is_client) & 1));
+  websocket_shrink_buffer(ws);
 
   fio_force_event(sockfd, FIO_EVENT_ON_DATA);
 }
@@ -296,7 +717,8 @@ static void on_data_first(intptr_t sockfd, fio_protocol_s *ws_) {
 
 /* later */
 static void websocket_write_impl(intptr_t fd, void *data, size_t len, char text,
-                                 char first, char last, char client);
+                                 char first, char last, char client,
+                                 unsigned char rsv);
 
 /*******************************************************************************
 Create/Destroy the websocket object
@@ -322,6 +744,12 @@ static void destroy_ws(ws_s *ws) {
     ws->on_close(ws->fd, ws->udata);
   if (ws->msg)
     fiobj_free(ws->msg);
+#if HAVE_ZLIB
+  ws_zstream_free(ws->deflater, ws->deflate.server_window_bits);
+  ws_zstream_free(ws->inflater, 0);
+#endif
+  /* the connection is gone, coalesced frames can't be sent */
+  fio_free(ws->out);
   clear_subscriptions(ws);
   free_ws_buffer(ws, ws->buffer);
   free(ws);
@@ -329,8 +757,17 @@ static void destroy_ws(ws_s *ws) {
 
 void websocket_attach(intptr_t uuid, http_settings_s *http_settings,
                       websocket_settings_s *args, void *data, size_t length) {
+  websocket_attach2(uuid, http_settings, args, data, length,
+                    (websocket_deflate_s){.enabled = 0});
+}
+
+/** Attaches the Websocket protocol using the negotiated extensions. */
+void websocket_attach2(intptr_t uuid, http_settings_s *http_settings,
+                       websocket_settings_s *args, void *data, size_t length,
+                       websocket_deflate_s deflate) {
   ws_s *ws = new_websocket(uuid);
   FIO_ASSERT_ALLOC(ws);
+  ws->deflate = deflate;
   // we have an active websocket connection - prep the connection buffer
   ws->buffer = create_ws_buffer(ws);
   // Setup ws callbacks
@@ -346,6 +783,9 @@ void websocket_attach(intptr_t uuid, http_settings_s *http_settings,
     ws->is_client = http_settings->is_client;
     // buffer limits
     ws->max_msg_size = http_settings->ws_max_msg_size;
+    // output coalescing
+    ws->out_capa = http_settings->ws_coalesce_bytes;
+    ws->out_delay_us = http_settings->ws_coalesce_us;
     // update the timeout
     fio_timeout_set(uuid, http_settings->ws_timeout);
   } else {
@@ -380,59 +820,301 @@ Writing to the Websocket
   (FIO_MEMORY_BLOCK_ALLOC_LIMIT - 4096) // should be less then `unsigned short`
 
 static void websocket_write_impl(intptr_t fd, void *data, size_t len, char text,
-                                 char first, char last, char client) {
+                                 char first, char last, char client,
+                                 unsigned char rsv) {
   if (len <= WS_MAX_FRAME_SIZE) {
     void *buff = fio_malloc(len + 16);
     len = (client ? websocket_client_wrap(buff, data, len, (text ? 1 : 2),
-                                          first, last, 0)
+                                          first, last, rsv)
                   : websocket_server_wrap(buff, data, len, (text ? 1 : 2),
-                                          first, last, 0));
+                                          first, last, rsv));
     fio_write2(fd, .data.buffer = buff, .length = len,
                .after.dealloc = fio_free);
   } else {
     /* frame fragmentation is better for large data then large frames */
     while (len > WS_MAX_FRAME_SIZE) {
-      websocket_write_impl(fd, data, WS_MAX_FRAME_SIZE, text, first, 0, client);
+      websocket_write_impl(fd, data, WS_MAX_FRAME_SIZE, text, first, 0, client,
+                           rsv);
       data = ((uint8_t *)data) + WS_MAX_FRAME_SIZE;
       first = 0;
+      rsv = 0; /* only the first frame is marked */
       len -= WS_MAX_FRAME_SIZE;
     }
-    websocket_write_impl(fd, data, len, text, first, 1, client);
+    websocket_write_impl(fd, data, len, text, first, 1, client, rsv);
   }
   return;
 }
 
+/* *****************************************************************************
+Output coalescing
+***************************************************************************** */
+
+/* writes the coalesced frames, `out_lock` must be held */
+static void websocket_out_flush_unsafe(ws_s *ws) {
+  if (!ws->out_len)
+    return;
+  fio_write2(ws->fd, .data.buffer = ws->out, .length = ws->out_len,
+             .after.dealloc = fio_free);
+  ws->out = NULL;
+  ws->out_len = 0;
+}
+
+static void websocket_out_flush(ws_s *ws) {
+  fio_lock(&ws->out_lock);
+  websocket_out_flush_unsafe(ws);
+  fio_unlock(&ws->out_lock);
+}
+
+/*
+ * Flushes the buffer. Scheduled as a task when the first frame is buffered, so
+ * the tasks scheduled before it (which might write more frames) are performed
+ * first, or run by a timer once `out_delay_us` passed.
+ */
+static void websocket_out_task(void *uuid_, void *ignr) {
+  ws_s *ws = (ws_s *)fio_protocol_try_lock((intptr_t)uuid_, FIO_PR_LOCK_WRITE);
+  if (!ws) {
+    if (errno != EBADF)
+      fio_defer(websocket_out_task, uuid_, NULL);
+    return;
+  }
+  fio_lock(&ws->out_lock);
+  websocket_out_flush_unsafe(ws);
+  ws->out_scheduled = 0;
+  fio_unlock(&ws->out_lock);
+  fio_protocol_unlock((fio_protocol_s *)ws, FIO_PR_LOCK_WRITE);
+  (void)ignr;
+}
+
+static void websocket_out_timer(void *uuid_) {
+  websocket_out_task(uuid_, NULL);
+}
+
+/* returns room for `len` bytes in the buffer, `out_lock` must be held */
+static uint8_t *websocket_out_reserve_unsafe(ws_s *ws, size_t len) {
+  if (ws->out_len + len > ws->out_capa)
+    websocket_out_flush_unsafe(ws);
+  if (!ws->out) {
+    ws->out = fio_malloc(ws->out_capa);
+    FIO_ASSERT_ALLOC(ws->out);
+  }
+  if (!ws->out_scheduled) {
+    ws->out_scheduled = 1;
+    /* facil.io's timers have a millisecond resolution */
+    if (!ws->out_delay_us ||
+        fio_run_every((ws->out_delay_us + 999) / 1000, 1, websocket_out_timer,
+                      (void *)ws->fd, NULL) == -1)
+      fio_defer(websocket_out_task, (void *)ws->fd, NULL);
+  }
+  return ws->out + ws->out_len;
+}
+
+/*
+ * Writes a message as a single frame (unless it's huge), coalescing it if it
+ * fits the buffer. Otherwise the buffer is flushed first, preserving the
+ * order of the frames.
+ */
+static void websocket_write_msg(ws_s *ws, void *data, size_t len, char text,
+                                unsigned char rsv) {
+  const size_t wrapped = websocket_wrapped_len(len) + (ws->is_client ? 4 : 0);
+  fio_lock(&ws->out_lock);
+  if (wrapped > ws->out_capa) {
+    websocket_out_flush_unsafe(ws);
+    websocket_write_impl(ws->fd, data, len, text, 1, 1, ws->is_client, rsv);
+    fio_unlock(&ws->out_lock);
+    return;
+  }
+  uint8_t *pos = websocket_out_reserve_unsafe(ws, wrapped);
+  ws->out_len += (ws->is_client ? websocket_client_wrap(pos, data, len,
+                                                        (text ? 1 : 2), 1, 1,
+                                                        rsv)
+                                : websocket_server_wrap(pos, data, len,
+                                                        (text ? 1 : 2), 1, 1,
+                                                        rsv));
+  fio_unlock(&ws->out_lock);
+}
+
+#if HAVE_ZLIB
+/* compresses and writes a message (RSV1 marks compressed messages) */
+static int websocket_write_deflated(ws_s *ws, fio_str_info_s msg,
+                                    uint8_t is_text) {
+  void *out = NULL;
+  size_t len;
+  if (ws->deflate.server_context_takeover) {
+    /* the client decompresses in the order messages are written */
+    fio_lock(&ws->deflate_lock);
+    if (!ws->deflater)
+      ws->deflater = ws_zstream_new(ws->deflate.server_window_bits);
+    len = (ws->deflater
+               ? ws_deflate_message(ws->deflater, msg.data, msg.len, &out)
+               : 0);
+    if (len)
+      websocket_write_msg(ws, out, len, is_text, 4);
+    fio_unlock(&ws->deflate_lock);
+    if (!len) {
+      /* the shared context is lost */
+      websocket_close(ws);
+      return -1;
+    }
+    fio_free(out);
+    return 0;
+  }
+  z_stream *z = ws_zstream_new(ws->deflate.server_window_bits);
+  len = (z ? ws_deflate_message(z, msg.data, msg.len, &out) : 0);
+  ws_zstream_free(z, ws->deflate.server_window_bits);
+  if (len && len < msg.len)
+    websocket_write_msg(ws, out, len, is_text, 4);
+  else /* not worth it */
+    websocket_write_msg(ws, msg.data, msg.len, is_text, 0);
+  fio_free(out);
+  return 0;
+}
+#endif
+
 /* *****************************************************************************
 Multi-client broadcast optimizations
 ***************************************************************************** */
 
+struct websocket_frame_s {
+  volatile uintptr_t ref;
+  /** the length of the whole frame */
+  size_t len;
+  /** the length of the payload, at the end of the frame */
+  size_t payload_len;
+  uint8_t is_text;
+  uint8_t data[];
+};
+
+/**
+ * Creates a (server) WebSocket frame for `msg`, to be written to any number of
+ * connections using `websocket_write_frame`.
+ */
+websocket_frame_s *websocket_frame_new(fio_str_info_s msg, uint8_t is_text) {
+  websocket_frame_s *f = fio_malloc(sizeof(*f) + msg.len + 10);
+  FIO_ASSERT_ALLOC(f);
+  f->ref = 1;
+  f->payload_len = msg.len;
+  f->is_text = is_text;
+  f->len = websocket_server_wrap(f->data, msg.data, msg.len,
+                                 (is_text ? 1 : 2), 1, 1, 0);
+  return f;
+}
+
+/** Increases the frame's reference count. */
+websocket_frame_s *websocket_frame_dup(websocket_frame_s *frame) {
+  fio_atomic_add(&frame->ref, 1);
+  return frame;
+}
+
+/** Decreases the frame's reference count, freeing it when it reaches 0. */
+void websocket_frame_free(websocket_frame_s *frame) {
+  if (!frame || fio_atomic_sub(&frame->ref, 1))
+    return;
+  fio_free(frame);
+}
+
+static void websocket_frame_dealloc(void *frame) {
+  websocket_frame_free(frame);
+}
+
+/* writes a reference to the frame, released once the socket sent it */
+static int websocket_write_frame_uuid(intptr_t uuid, websocket_frame_s *frame) {
+  return (int)fio_write2(uuid, .data.buffer = websocket_frame_dup(frame),
+                         .offset = offsetof(websocket_frame_s, data),
+                         .length = frame->len,
+                         .after.dealloc = websocket_frame_dealloc);
+}
+
+/**
+ * Writes a frame created with `websocket_frame_new`. Server connections share
+ * the frame's memory, unless it fits the coalescing buffer.
+ */
+int websocket_write_frame(ws_s *ws, websocket_frame_s *frame) {
+  if (fio_is_closed(ws->fd))
+    return -1; /* don't count frames buffered for a closed connection */
+  if (ws->is_client) {
+    /* client frames are masked, they can't be shared */
+    fio_str_info_s msg = {
+        .data = (char *)frame->data + frame->len - frame->payload_len,
+        .len = frame->payload_len,
+    };
+    return websocket_write(ws, msg, frame->is_text);
+  }
+  int ret = 0;
+  fio_lock(&ws->out_lock);
+  if (frame->len <= ws->out_capa) {
+    /* copying a small frame is cheaper than a packet of its own */
+    memcpy(websocket_out_reserve_unsafe(ws, frame->len), frame->data,
+           frame->len);
+    ws->out_len += frame->len;
+  } else {
+    websocket_out_flush_unsafe(ws);
+    ret = websocket_write_frame_uuid(ws->fd, frame);
+  }
+  fio_unlock(&ws->out_lock);
+  return ret;
+}
+
+/*
+ * Creates a frame for `msg` compressed with a fresh (pooled) 15 bit context, so
+ * it can be shared by permessage-deflate connections without server context
+ * takeover. Small or incompressible messages produce a plain frame.
+ */
+static websocket_frame_s *websocket_frame_new_deflated(fio_str_info_s msg,
+                                                       uint8_t is_text) {
+#if HAVE_ZLIB
+  void *out = NULL;
+  size_t len = 0;
+  z_stream *z;
+  if (msg.len >= WS_DEFLATE_MIN_LENGTH && (z = ws_zstream_new(15))) {
+    len = ws_deflate_message(z, msg.data, msg.len, &out);
+    ws_zstream_free(z, 15);
+  }
+  if (len && len < msg.len) {
+    websocket_frame_s *f = fio_malloc(sizeof(*f) + len + 10);
+    FIO_ASSERT_ALLOC(f);
+    f->ref = 1;
+    f->payload_len = len;
+    f->is_text = is_text;
+    f->len = websocket_server_wrap(f->data, out, len, (is_text ? 1 : 2), 1, 1,
+                                   4);
+    fio_free(out);
+    return f;
+  }
+  fio_free(out);
+#endif
+  return websocket_frame_new(msg, is_text);
+}
+
 static void websocket_optimize_free(fio_msg_s *msg, void *metadata) {
-  fiobj_free((FIOBJ)metadata);
+  websocket_frame_free(metadata);
   (void)msg;
 }
 
 static inline fio_msg_metadata_s websocket_optimize(fio_str_info_s msg,
-                                                    unsigned char opcode) {
-  FIOBJ out = fiobj_str_buf(msg.len + 10);
-  fiobj_str_resize(out,
-                   websocket_server_wrap(fiobj_obj2cstr(out).data, msg.data,
-                                         msg.len, opcode, 1, 1, 0));
+                                                    unsigned char opcode,
+                                                    uint8_t deflate) {
   fio_msg_metadata_s ret = {
       .on_finish = websocket_optimize_free,
-      .metadata = (void *)out,
+      .metadata = (deflate ? websocket_frame_new_deflated(msg, opcode == 1)
+                           : websocket_frame_new(msg, opcode == 1)),
   };
   return ret;
 }
+
+/* best attempt to detect Text vs. Binary data */
+static inline unsigned char websocket_optimize_opcode(fio_str_info_s msg) {
+  fio_str_s tmp = FIO_STR_INIT_EXISTING(msg.data, msg.len, 0); // don't free
+  tmp.dealloc = NULL;
+  if (tmp.len <= (2 << 19) && fio_str_utf8_valid(&tmp))
+    return 1;
+  return 2;
+}
+
 static fio_msg_metadata_s websocket_optimize_generic(fio_str_info_s ch,
                                                      fio_str_info_s msg,
                                                      uint8_t is_json) {
-  fio_str_s tmp = FIO_STR_INIT_EXISTING(ch.data, ch.len, 0); // don't free
-  tmp.dealloc = NULL;
-  unsigned char opcode = 2;
-  if (tmp.len <= (2 << 19) && fio_str_utf8_valid(&tmp)) {
-    opcode = 1;
-  }
-  fio_msg_metadata_s ret = websocket_optimize(msg, opcode);
+  fio_msg_metadata_s ret =
+      websocket_optimize(msg, websocket_optimize_opcode(msg), 0);
   ret.type_id = WEBSOCKET_OPTIMIZE_PUBSUB;
   return ret;
   (void)ch;
@@ -442,7 +1124,7 @@ static fio_msg_metadata_s websocket_optimize_generic(fio_str_info_s ch,
 static fio_msg_metadata_s websocket_optimize_text(fio_str_info_s ch,
                                                   fio_str_info_s msg,
                                                   uint8_t is_json) {
-  fio_msg_metadata_s ret = websocket_optimize(msg, 1);
+  fio_msg_metadata_s ret = websocket_optimize(msg, 1, 0);
   ret.type_id = WEBSOCKET_OPTIMIZE_PUBSUB_TEXT;
   return ret;
   (void)ch;
@@ -452,13 +1134,44 @@ static fio_msg_metadata_s websocket_optimize_text(fio_str_info_s ch,
 static fio_msg_metadata_s websocket_optimize_binary(fio_str_info_s ch,
                                                     fio_str_info_s msg,
                                                     uint8_t is_json) {
-  fio_msg_metadata_s ret = websocket_optimize(msg, 2);
+  fio_msg_metadata_s ret = websocket_optimize(msg, 2, 0);
   ret.type_id = WEBSOCKET_OPTIMIZE_PUBSUB_BINARY;
   return ret;
   (void)ch;
   (void)is_json;
 }
 
+static fio_msg_metadata_s websocket_optimize_deflate(fio_str_info_s ch,
+                                                     fio_str_info_s msg,
+                                                     uint8_t is_json) {
+  fio_msg_metadata_s ret =
+      websocket_optimize(msg, websocket_optimize_opcode(msg), 1);
+  ret.type_id = WEBSOCKET_OPTIMIZE_PUBSUB_DEFLATE;
+  return ret;
+  (void)ch;
+  (void)is_json;
+}
+
+static fio_msg_metadata_s websocket_optimize_deflate_text(fio_str_info_s ch,
+                                                          fio_str_info_s msg,
+                                                          uint8_t is_json) {
+  fio_msg_metadata_s ret = websocket_optimize(msg, 1, 1);
+  ret.type_id = WEBSOCKET_OPTIMIZE_PUBSUB_DEFLATE_TEXT;
+  return ret;
+  (void)ch;
+  (void)is_json;
+}
+
+static fio_msg_metadata_s websocket_optimize_deflate_binary(fio_str_info_s ch,
+                                                            fio_str_info_s msg,
+                                                            uint8_t is_json) {
+  fio_msg_metadata_s ret = websocket_optimize(msg, 2, 1);
+  ret.type_id = WEBSOCKET_OPTIMIZE_PUBSUB_DEFLATE_BINARY;
+  return ret;
+  (void)ch;
+  (void)is_json;
+}
+
 /**
  * Enables (or disables) broadcast optimizations.
  *
@@ -480,6 +1193,8 @@ static fio_msg_metadata_s websocket_optimize_binary(fio_str_info_s ch,
  *                               best attempt to detect Text vs. Binary data.
  * * WEBSOCKET_OPTIMIZE_PUBSUB_TEXT - optimize direct pub/sub text messages.
  * * WEBSOCKET_OPTIMIZE_PUBSUB_BINARY - optimize direct pub/sub binary messages.
+ * * WEBSOCKET_OPTIMIZE_PUBSUB_DEFLATE(_TEXT / _BINARY) - the same, compressed
+ *                               once for permessage-deflate connections.
  *
  * Note: to disable an optimization it should be disabled the same amount of
  * times it was enabled - multiple optimization enablements for the same type
@@ -489,6 +1204,9 @@ void websocket_optimize4broadcasts(intptr_t type, int enable) {
   static intptr_t generic = 0;
   static intptr_t text = 0;
   static intptr_t binary = 0;
+  static intptr_t deflate = 0;
+  static intptr_t deflate_text = 0;
+  static intptr_t deflate_binary = 0;
   fio_msg_metadata_s (*callback)(fio_str_info_s, fio_str_info_s, uint8_t);
   intptr_t *counter;
   switch ((0 - type)) {
@@ -504,6 +1222,18 @@ void websocket_optimize4broadcasts(intptr_t type, int enable) {
     counter = &binary;
     callback = websocket_optimize_binary;
     break;
+  case (0 - WEBSOCKET_OPTIMIZE_PUBSUB_DEFLATE):
+    counter = &deflate;
+    callback = websocket_optimize_deflate;
+    break;
+  case (0 - WEBSOCKET_OPTIMIZE_PUBSUB_DEFLATE_TEXT):
+    counter = &deflate_text;
+    callback = websocket_optimize_deflate_text;
+    break;
+  case (0 - WEBSOCKET_OPTIMIZE_PUBSUB_DEFLATE_BINARY):
+    counter = &deflate_binary;
+    callback = websocket_optimize_deflate_binary;
+    break;
   default:
     return;
   }
@@ -529,6 +1259,15 @@ typedef struct {
   void *udata;
 } websocket_sub_data_s;
 
+/*
+ * Returns 1 if the connection can share pre-compressed broadcast frames, i.e.,
+ * every message is compressed independently using a 15 bit window.
+ */
+static inline uint8_t websocket_deflate_shared(ws_s *ws) {
+  return (ws->deflate.enabled && !ws->deflate.server_context_takeover &&
+          ws->deflate.server_window_bits == 15);
+}
+
 static inline void websocket_on_pubsub_message_direct_internal(fio_msg_s *msg,
                                                                uint8_t txt) {
   fio_protocol_s *pr =
@@ -539,21 +1278,26 @@ static inline void websocket_on_pubsub_message_direct_internal(fio_msg_s *msg,
     fio_message_defer(msg);
     return;
   }
-  FIOBJ message = FIOBJ_INVALID;
-  FIOBJ pre_wrapped = FIOBJ_INVALID;
-  if (!((ws_s *)pr)->is_client) {
-    /* pre-wrapping is only for client data */
+  websocket_frame_s *pre_wrapped = NULL;
+  const uint8_t deflate = websocket_deflate_shared((ws_s *)pr);
+  /* pre-wrapping is only for client data, compressed per connection if the
+   * deflate context isn't shareable */
+  if (!((ws_s *)pr)->is_client && (deflate || !((ws_s *)pr)->deflate.enabled)) {
     switch (txt) {
     case 0:
-      pre_wrapped =
-          (FIOBJ)fio_message_metadata(msg, WEBSOCKET_OPTIMIZE_PUBSUB_BINARY);
+      pre_wrapped = fio_message_metadata(
+          msg, (deflate ? WEBSOCKET_OPTIMIZE_PUBSUB_DEFLATE_BINARY
+                        : WEBSOCKET_OPTIMIZE_PUBSUB_BINARY));
       break;
     case 1:
-      pre_wrapped =
-          (FIOBJ)fio_message_metadata(msg, WEBSOCKET_OPTIMIZE_PUBSUB_TEXT);
+      pre_wrapped = fio_message_metadata(
+          msg, (deflate ? WEBSOCKET_OPTIMIZE_PUBSUB_DEFLATE_TEXT
+                        : WEBSOCKET_OPTIMIZE_PUBSUB_TEXT));
       break;
     case 2:
-      pre_wrapped = (FIOBJ)fio_message_metadata(msg, WEBSOCKET_OPTIMIZE_PUBSUB);
+      pre_wrapped = fio_message_metadata(
+          msg, (deflate ? WEBSOCKET_OPTIMIZE_PUBSUB_DEFLATE
+                        : WEBSOCKET_OPTIMIZE_PUBSUB));
       break;
     default:
       break;
@@ -561,7 +1305,8 @@ static inline void websocket_on_pubsub_message_direct_internal(fio_msg_s *msg,
     if (pre_wrapped) {
       // FIO_LOG_DEBUG(
       //     "pub/sub WebSocket optimization route for pre-wrapped message.");
-      fiobj_send_free((intptr_t)msg->udata1, fiobj_dup(pre_wrapped));
+      /* every subscriber's packet references the same frame */
+      websocket_write_frame((ws_s *)pr, pre_wrapped);
       goto finish;
     }
   }
@@ -572,7 +1317,6 @@ static inline void websocket_on_pubsub_message_direct_internal(fio_msg_s *msg,
     txt = (tmp.len >= (2 << 14) ? 0 : fio_str_utf8_valid(&tmp));
   }
   websocket_write((ws_s *)pr, msg->msg, txt & 1);
-  fiobj_free(message);
 finish:
   fio_protocol_unlock(pr, FIO_PR_LOCK_WRITE);
 }
@@ -611,14 +1355,11 @@ static void websocket_on_unsubscribe(void *u1, void *u2) {
     d->on_unsubscribe(d->udata);
   }
 
-  if ((intptr_t)d->on_message == (intptr_t)WEBSOCKET_OPTIMIZE_PUBSUB) {
-    websocket_optimize4broadcasts(WEBSOCKET_OPTIMIZE_PUBSUB, 0);
-  } else if ((intptr_t)d->on_message ==
-             (intptr_t)WEBSOCKET_OPTIMIZE_PUBSUB_TEXT) {
-    websocket_optimize4broadcasts(WEBSOCKET_OPTIMIZE_PUBSUB_TEXT, 0);
-  } else if ((intptr_t)d->on_message ==
-             (intptr_t)WEBSOCKET_OPTIMIZE_PUBSUB_BINARY) {
-    websocket_optimize4broadcasts(WEBSOCKET_OPTIMIZE_PUBSUB_BINARY, 0);
+  /* direct subscriptions store their optimization type */
+  if ((intptr_t)d->on_message <= (intptr_t)WEBSOCKET_OPTIMIZE_PUBSUB &&
+      (intptr_t)d->on_message >=
+          (intptr_t)WEBSOCKET_OPTIMIZE_PUBSUB_DEFLATE_BINARY) {
+    websocket_optimize4broadcasts((intptr_t)d->on_message, 0);
   }
   free(d);
   (void)u1;
@@ -641,14 +1382,18 @@ uintptr_t websocket_subscribe(struct websocket_subscribe_s args) {
   void (*handler)(fio_msg_s *) = websocket_on_pubsub_message;
   if (!args.on_message) {
     intptr_t br_type;
+    const uint8_t deflate = websocket_deflate_shared(args.ws);
     if (args.force_binary) {
-      br_type = WEBSOCKET_OPTIMIZE_PUBSUB_BINARY;
+      br_type = (deflate ? WEBSOCKET_OPTIMIZE_PUBSUB_DEFLATE_BINARY
+                         : WEBSOCKET_OPTIMIZE_PUBSUB_BINARY);
       handler = websocket_on_pubsub_message_direct_bin;
     } else if (args.force_text) {
-      br_type = WEBSOCKET_OPTIMIZE_PUBSUB_TEXT;
+      br_type = (deflate ? WEBSOCKET_OPTIMIZE_PUBSUB_DEFLATE_TEXT
+                         : WEBSOCKET_OPTIMIZE_PUBSUB_TEXT);
       handler = websocket_on_pubsub_message_direct_txt;
     } else {
-      br_type = WEBSOCKET_OPTIMIZE_PUBSUB;
+      br_type = (deflate ? WEBSOCKET_OPTIMIZE_PUBSUB_DEFLATE
+                         : WEBSOCKET_OPTIMIZE_PUBSUB);
       handler = websocket_on_pubsub_message_direct;
     }
     websocket_optimize4broadcasts(br_type, 1);
@@ -716,16 +1461,29 @@ uint8_t websocket_is_client(ws_s *ws) { return ws->is_client; }
 /** Writes data to the websocket. Returns -1 on failure (0 on success). */
 int websocket_write(ws_s *ws, fio_str_info_s msg, uint8_t is_text) {
   if (fio_is_valid(ws->fd)) {
-    websocket_write_impl(ws->fd, msg.data, msg.len, is_text, 1, 1,
-                         ws->is_client);
+#if HAVE_ZLIB
+    if (ws->deflate.enabled && msg.len >= WS_DEFLATE_MIN_LENGTH)
+      return websocket_write_deflated(ws, msg, is_text);
+#endif
+    websocket_write_msg(ws, msg.data, msg.len, is_text, 0);
     return 0;
   }
   return -1;
 }
 /** Closes a websocket connection. */
 void websocket_close(ws_s *ws) {
+  websocket_out_flush(ws);
   fio_write2(ws->fd, .data.buffer = "\x88\x00", .length = 2,
              .after.dealloc = FIO_DEALLOC_NOOP);
   fio_close(ws->fd);
   return;
 }
+
+/** Coalesces small outgoing frames (see the header for details). */
+void websocket_coalesce(ws_s *ws, size_t max_bytes, size_t max_delay_us) {
+  fio_lock(&ws->out_lock);
+  websocket_out_flush_unsafe(ws);
+  ws->out_capa = max_bytes;
+  ws->out_delay_us = max_delay_us;
+  fio_unlock(&ws->out_lock);
+}
@@ -56,6 +56,20 @@ int websocket_write(ws_s *ws, fio_str_info_s msg, uint8_t is_text);
 /** Closes a websocket connection. */
 void websocket_close(ws_s *ws);
 
+/**
+ * Coalesces small outgoing frames into a single buffer of up to `max_bytes`,
+ * so bursts of small messages are written (and sent) together.
+ *
+ * The buffer is written once the tasks scheduled before the first buffered
+ * frame were performed or, if `max_delay_us` is set, by a reactor timer once
+ * the first buffered frame waited that long (rounded up to milliseconds).
+ * Larger frames flush the buffer and are written directly.
+ *
+ * A `max_bytes` value of 0 disables coalescing (the buffer is flushed).
+ * Defaults to the `ws_coalesce_bytes` and `ws_coalesce_us` HTTP settings.
+ */
+void websocket_coalesce(ws_s *ws, size_t max_bytes, size_t max_delay_us);
+
 /* *****************************************************************************
 Websocket Pub/Sub
 =================
@@ -148,6 +162,12 @@ void websocket_unsubscribe(ws_s *ws, uintptr_t subscription_id);
 #define WEBSOCKET_OPTIMIZE_PUBSUB_TEXT (-33)
 /** Optimize binary broadcasts, for use in websocket_optimize4broadcasts. */
 #define WEBSOCKET_OPTIMIZE_PUBSUB_BINARY (-34)
+/** Optimize generic broadcasts to permessage-deflate connections. */
+#define WEBSOCKET_OPTIMIZE_PUBSUB_DEFLATE (-35)
+/** Optimize text broadcasts to permessage-deflate connections. */
+#define WEBSOCKET_OPTIMIZE_PUBSUB_DEFLATE_TEXT (-36)
+/** Optimize binary broadcasts to permessage-deflate connections. */
+#define WEBSOCKET_OPTIMIZE_PUBSUB_DEFLATE_BINARY (-37)
 
 /**
  * Enables (or disables) broadcast optimizations.
@@ -162,6 +182,9 @@ void websocket_unsubscribe(ws_s *ws, uintptr_t subscription_id);
  *                               best attempt to detect Text vs. Binary data.
  * * WEBSOCKET_OPTIMIZE_PUBSUB_TEXT - optimize direct pub/sub text messages.
  * * WEBSOCKET_OPTIMIZE_PUBSUB_BINARY - optimize direct pub/sub binary messages.
+ * * WEBSOCKET_OPTIMIZE_PUBSUB_DEFLATE(_TEXT / _BINARY) - the same, compressed
+ *                               once for permessage-deflate connections
+ *                               (requires zlib, see `ws_deflate`).
  *
  * Note: to disable an optimization it should be disabled the same amount of
  * times it was enabled - multiple optimization enablements for the same type
@@ -169,15 +192,49 @@ void websocket_unsubscribe(ws_s *ws, uintptr_t subscription_id);
  *
  * Note2: The pub/sub metadata type ID will match the optimnization type
  * requested (i.e., `WEBSOCKET_OPTIMIZE_PUBSUB`) and the optimized data is a
- * FIOBJ String containing a pre-encoded WebSocket packet ready to be sent.
- * i.e.:
+ * `websocket_frame_s` containing a pre-encoded WebSocket packet ready to be
+ * sent. i.e.:
  *
- *     FIOBJ pre_wrapped = (FIOBJ)fio_message_metadata(msg,
+ *     websocket_frame_s *pre_wrapped = fio_message_metadata(msg,
  *                               WEBSOCKET_OPTIMIZE_PUBSUB);
- *     fiobj_send_free((intptr_t)msg->udata1, fiobj_dup(pre_wrapped));
+ *     websocket_write_frame(ws, pre_wrapped);
  */
 void websocket_optimize4broadcasts(intptr_t type, int enable);
 
+/* *****************************************************************************
+Shared frames
+***************************************************************************** */
+
+/**
+ * A reference counted, pre-encoded (server) WebSocket frame.
+ *
+ * Writing the same frame to many connections shares its memory: every
+ * connection's packet holds a reference, and the frame is freed when the last
+ * connection has sent it (and `websocket_frame_free` was called).
+ */
+typedef struct websocket_frame_s websocket_frame_s;
+
+/** Creates a frame for `msg`. Free it with `websocket_frame_free`. */
+websocket_frame_s *websocket_frame_new(fio_str_info_s msg, uint8_t is_text);
+
+/** Increases the frame's reference count. */
+websocket_frame_s *websocket_frame_dup(websocket_frame_s *frame);
+
+/** Decreases the frame's reference count, freeing it when it reaches 0. */
+void websocket_frame_free(websocket_frame_s *frame);
+
+/**
+ * Writes a frame to the websocket.
+ *
+ * Server connections share the frame's memory, unless output coalescing is
+ * enabled (see `websocket_coalesce`) and the frame fits the coalescing
+ * buffer: small frames are copied into the buffer instead. Client connections
+ * mask their frames, so the message is framed again.
+ *
+ * Returns -1 on failure, i.e. if the connection was closed (0 on success).
+ */
+int websocket_write_frame(ws_s *ws, websocket_frame_s *frame);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -0,0 +1,197 @@
+/**
+ * Tests adaptive load shedding (`shed_target_ms` and `priority_hints`): a task
+ * that keeps the (single) thread busy delays every queued task well above the
+ * target, and a client checks how requests are answered:
+ *
+ * * Before the queue is overloaded, every request reaches `on_request`.
+ *
+ * * Once overloaded, normal routes are answered with a prebuilt 503 (with
+ *   Retry-After), `.critical` prefixes are never shed and `.low` prefixes are
+ *   always shed.
+ *
+ * * Once the busy task stops, the overload clears and normal routes are served
+ *   again.
+ *
+ * Compile with (for example):
+ *
+ *     cc -O2 -Ilib/facil -Ilib/facil/fiobj -Ilib/facil/http \
+ *        -Ilib/facil/http/parsers tests/load_shed.c \
+ *        lib/facil/fio.c $(find lib/facil/fiobj lib/facil/http -name '*.c') \
+ *        -lpthread -lm
+ */
+#include <fio.h>
+#include <http.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PORT 3993
+#define TARGET_MS 5
+#define HOG_US 20000 /* how long the busy task blocks the thread */
+#define ROUNDS 20    /* requests per route while overloaded */
+
+static double now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + (t.tv_nsec / 1000000000.0);
+}
+
+static void fail(const char *msg) {
+  fprintf(stderr, "ERROR: %s\n", msg);
+  exit(-1);
+}
+
+/* *****************************************************************************
+Server: answers "ok", while a busy task delays the queue on demand
+***************************************************************************** */
+
+static volatile int hogging;
+static volatile size_t handled;
+
+static void noop(void *a, void *b) {
+  (void)a;
+  (void)b;
+}
+
+/* queues tasks behind itself and blocks, so they wait longer than the target */
+static void hog(void *a, void *b) {
+  if (!hogging)
+    return;
+  for (int i = 0; i < 20; ++i)
+    fio_defer(noop, NULL, NULL);
+  usleep(HOG_US);
+  fio_defer(hog, a, b);
+}
+
+static void on_request(http_s *h) {
+  fio_atomic_add(&handled, 1);
+  http_send_body(h, "ok", 2);
+}
+
+static const http_priority_hint_s hints[] = {
+    {.prefix = "/health", .len = 7, .priority = HTTP_PRIORITY_CRITICAL},
+    {.prefix = "/batch", .len = 6, .priority = HTTP_PRIORITY_LOW},
+};
+
+/* *****************************************************************************
+Client: a blocking socket per request, returning the status code
+***************************************************************************** */
+
+static char last_response[1024];
+
+static int request(const char *path) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(PORT)};
+  struct timeval timeout = {.tv_sec = 2};
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  if (fd == -1 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)))
+    fail("couldn't connect");
+  char buf[256];
+  int len = snprintf(buf, sizeof(buf),
+                     "GET %s HTTP/1.1\r\nHost: localhost\r\n\r\n", path);
+  if (write(fd, buf, (size_t)len) != len)
+    fail("couldn't send a request");
+  size_t pos = 0;
+  char *end = NULL;
+  while (!end && pos < sizeof(last_response) - 1) {
+    ssize_t r = read(fd, last_response + pos, sizeof(last_response) - 1 - pos);
+    if (r <= 0)
+      fail("no response");
+    pos += (size_t)r;
+    last_response[pos] = 0;
+    end = strstr(last_response, "\r\n\r\n");
+  }
+  close(fd);
+  if (!end || strncmp(last_response, "HTTP/1.1 ", 9))
+    fail("malformed response");
+  return atoi(last_response + 9);
+}
+
+static void expect(const char *path, int status) {
+  int got = request(path);
+  if (got != status) {
+    fprintf(stderr, "%s: expected %d, got:\n%s\n", path, status,
+            last_response);
+    fail("unexpected status");
+  }
+  if (status == 503 && !strstr(last_response, "\r\nRetry-After: 1\r\n"))
+    fail("a shed request is missing Retry-After");
+}
+
+static void *client(void *ignr) {
+  expect("/normal", 200);
+  expect("/batch", 200); /* low priority routes are served while not overloaded */
+  if (fio_defer_is_overloaded())
+    fail("overloaded while idle");
+
+  hogging = 1;
+  fio_defer(hog, NULL, NULL);
+  double start = now();
+  while (!fio_defer_is_overloaded()) {
+    if (now() - start > 3)
+      fail("the queue never became overloaded");
+    request("/health"); /* queues tasks behind the busy task */
+  }
+  fprintf(stderr, "overloaded after %.1f ms (p90 delay %zuus)\n",
+          (now() - start) * 1000, fio_defer_latency_p90());
+  if (fio_defer_latency_p90() <= TARGET_MS * 1000)
+    fail("overloaded with a p90 delay below the target");
+
+  size_t before = handled;
+  expect("/normal", 503);
+  if (handled != before)
+    fail("a shed request reached on_request");
+  for (int i = 0; i < ROUNDS; ++i) {
+    expect("/health", 200);
+    expect("/health/deep", 200);
+    expect("/batch", 503);
+    expect("/batch/jobs", 503);
+  }
+  if (handled != before + (ROUNDS * 2))
+    fail("the wrong requests reached on_request");
+
+  hogging = 0;
+  start = now();
+  while (fio_defer_is_overloaded()) {
+    if (now() - start > 3)
+      fail("the overload never cleared");
+    request("/health"); /* the queue is reviewed as tasks are performed */
+  }
+  fprintf(stderr, "cleared after %.1f ms (p90 delay %zuus)\n",
+          (now() - start) * 1000, fio_defer_latency_p90());
+  expect("/normal", 200);
+  expect("/batch", 200);
+
+  fio_stop();
+  return ignr;
+}
+
+static void on_timeout(void *arg) {
+  fail("timed out");
+  (void)arg;
+}
+
+int main(void) {
+  if (http_listen(FIO_MACRO2STR(PORT), NULL, .on_request = on_request,
+                  .shed_target_ms = TARGET_MS,
+                  .priority_hints = hints,
+                  .priority_hints_len = sizeof(hints) / sizeof(hints[0])) == -1)
+    fail("couldn't listen");
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, client, NULL))
+    fail("couldn't start the client");
+  fio_run_every(30000, 1, on_timeout, NULL, NULL);
+  fio_start(.threads = 1, .workers = 1);
+  hogging = 0;
+  pthread_join(thread, NULL);
+  fprintf(stderr, "load shedding passed.\n");
+  return 0;
+}
@@ -0,0 +1,82 @@
+/**
+ * Tests the end-to-end latency of publishing to a channel with many
+ * subscribers: the time from `fio_publish` until the last subscriber's
+ * callback ran, for 1k, 10k and 100k subscribers (see `FIO_PUBSUB_BATCH`).
+ *
+ * Compile with (for example):
+ *
+ *     cc -O2 -Ilib/facil tests/pubsub_broadcast_speed.c lib/facil/fio.c \
+ *        -lpthread -lm
+ */
+#include <fio.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define ROUNDS 20 /* messages published per test */
+#define THREADS 4 /* reactor threads delivering the messages */
+
+static size_t subscribers;
+static size_t round_count;
+static volatile size_t delivered;
+static double started, total, best;
+
+static double now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + (t.tv_nsec / 1000000000.0);
+}
+
+static void publish(void *ignr) {
+  started = now();
+  fio_publish(.engine = FIO_PUBSUB_PROCESS,
+              .channel = {.data = "broadcast", .len = 9},
+              .message = {.data = "x", .len = 1});
+  (void)ignr;
+}
+
+static void publish_task(void *ignr, void *ignr2) {
+  publish(ignr);
+  (void)ignr2;
+}
+
+static void on_message(fio_msg_s *msg) {
+  if (fio_atomic_add(&delivered, 1) % subscribers)
+    return;
+  /* the last subscriber of this round */
+  double latency = now() - started;
+  total += latency;
+  if (!best || latency < best)
+    best = latency;
+  if (++round_count == ROUNDS) {
+    fio_stop();
+    return;
+  }
+  fio_defer(publish_task, NULL, NULL);
+  (void)msg;
+}
+
+int main(void) {
+  fprintf(stderr, "Broadcast latency (%d threads, %d rounds)\n", THREADS,
+          ROUNDS);
+  for (subscribers = 1000; subscribers <= 100000; subscribers *= 10) {
+    subscription_s **subs = malloc(sizeof(*subs) * subscribers);
+    FIO_ASSERT_ALLOC(subs);
+    for (size_t i = 0; i < subscribers; ++i)
+      subs[i] = fio_subscribe(.channel = {.data = "broadcast", .len = 9},
+                              .on_message = on_message);
+    round_count = 0;
+    delivered = 0;
+    total = best = 0;
+    fio_state_callback_add(FIO_CALL_ON_START, publish, NULL);
+    fio_start(.threads = THREADS, .workers = 1);
+    fio_state_callback_remove(FIO_CALL_ON_START, publish, NULL);
+    fprintf(stderr, "%7zu subscribers: %9.1f us average, %9.1f us best\n",
+            subscribers, total * 1000000 / ROUNDS, best * 1000000);
+    for (size_t i = 0; i < subscribers; ++i)
+      fio_unsubscribe(subs[i]);
+    free(subs);
+  }
+  return 0;
+}
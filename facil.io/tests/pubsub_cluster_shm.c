@@ -0,0 +1,270 @@
+/**
+ * Tests the shared memory transport of cluster messages
+ * (`fio_pubsub_cluster_shm`), with the smallest rings (64Kb for the root, 16Kb
+ * per worker):
+ *
+ * * Messages larger than a ring are split into records and reassembled, both
+ *   from the root to the workers and back.
+ *
+ * * Bursts many times the size of a ring keep every message, in order, while
+ *   writers wait for room.
+ *
+ * * A worker exits: what it published before exiting is delivered, its slot is
+ *   released (so it doesn't hold back the root's ring), and its replacement
+ *   takes part in the next burst.
+ *
+ * Compile with (for example):
+ *
+ *     cc -O2 -Ilib/facil tests/pubsub_cluster_shm.c lib/facil/fio.c \
+ *        -lpthread -lm
+ */
+#include <fio.h>
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define WORKERS 2
+#define CAPACITY (1 << 16) /* the smallest ring the transport uses */
+#define BIG_SIZE 100000    /* the root's message, larger than its ring */
+#define REPLY_SIZE 20000   /* the workers' replies, larger than their ring */
+#define BURST 20000        /* messages per burst, 20Mb each way */
+#define BURST_SIZE 1000
+#define LAST 10 /* messages an exiting worker publishes */
+
+static void fail(const char *msg) {
+  fprintf(stderr, "ERROR (%d): %s\n", (int)getpid(), msg);
+  if (fio_is_worker())
+    kill(fio_parent_pid(), SIGINT);
+  exit(-1);
+}
+
+/** the start of the burst and exit messages */
+typedef struct {
+  uint32_t round;
+  uint32_t seq;
+  int32_t pid;
+} header_s;
+
+static fio_str_info_s str(const char *s) {
+  return (fio_str_info_s){.data = (char *)s, .len = strlen(s)};
+}
+
+static void fill(char *buf, size_t len, uint8_t seed) {
+  for (size_t i = 0; i < len; ++i)
+    buf[i] = (char)(seed + (i * 7));
+}
+
+static int check(fio_str_info_s data, size_t len, uint8_t seed) {
+  if (data.len != len)
+    return 0;
+  for (size_t i = 0; i < len; ++i)
+    if ((uint8_t)data.data[i] != (uint8_t)(seed + (i * 7)))
+      return 0;
+  return 1;
+}
+
+static void publish_header(const char *channel, header_s h, size_t len,
+                           fio_pubsub_engine_s *engine) {
+  char buf[BURST_SIZE];
+  fill(buf, len, (uint8_t)h.seq);
+  memcpy(buf, &h, sizeof(h));
+  fio_publish(.engine = engine, .channel = str(channel),
+              .message = {.data = buf, .len = len});
+}
+
+static header_s read_header(fio_msg_s *msg, size_t len) {
+  header_s h;
+  if (msg->msg.len != len)
+    fail("a message has the wrong length");
+  memcpy(&h, msg->msg.data, sizeof(h));
+  fio_str_info_s rest = {.data = msg->msg.data + sizeof(h),
+                         .len = len - sizeof(h)};
+  char expected[BURST_SIZE];
+  fill(expected, len, (uint8_t)h.seq);
+  if (memcmp(rest.data, expected + sizeof(h), rest.len))
+    fail("a message was corrupted");
+  return h;
+}
+
+/* *****************************************************************************
+Workers
+***************************************************************************** */
+
+static uint32_t worker_round;
+static uint32_t worker_expected;
+
+static void worker_on_big(fio_msg_s *msg) {
+  if (!check(msg->msg, BIG_SIZE, 1))
+    fail("a split message was corrupted");
+  char *reply = malloc(REPLY_SIZE);
+  FIO_ASSERT_ALLOC(reply);
+  fill(reply, REPLY_SIZE, 2);
+  fio_publish(.engine = FIO_PUBSUB_ROOT, .channel = str("big_reply"),
+              .message = {.data = reply, .len = REPLY_SIZE});
+  free(reply);
+}
+
+static void worker_on_burst(fio_msg_s *msg) {
+  header_s h = read_header(msg, BURST_SIZE);
+  if (h.round != worker_round) {
+    worker_round = h.round;
+    worker_expected = 0;
+  }
+  if (h.seq != worker_expected++)
+    fail("a burst arrived out of order");
+  if (worker_expected < BURST)
+    return;
+  for (uint32_t i = 0; i < BURST; ++i)
+    publish_header("burst_reply",
+                   (header_s){.round = h.round, .seq = i, .pid = getpid()},
+                   BURST_SIZE, FIO_PUBSUB_ROOT);
+}
+
+static void worker_on_exit(fio_msg_s *msg) {
+  header_s h = read_header(msg, sizeof(h));
+  if (h.pid != getpid())
+    return;
+  for (uint32_t i = 0; i < LAST; ++i)
+    publish_header("last", (header_s){.seq = i, .pid = getpid()}, BURST_SIZE,
+                   FIO_PUBSUB_ROOT);
+  fio_stop();
+}
+
+/* runs in every worker process, including replacements */
+static void on_start(void *ignr) {
+  worker_round = 0;
+  fio_subscribe(.channel = str("big"), .on_message = worker_on_big);
+  fio_subscribe(.channel = str("burst"), .on_message = worker_on_burst);
+  fio_subscribe(.channel = str("exit"), .on_message = worker_on_exit);
+  publish_header("ready", (header_s){.pid = getpid()}, sizeof(header_s),
+                 FIO_PUBSUB_ROOT);
+  (void)ignr;
+}
+
+/* *****************************************************************************
+Root
+***************************************************************************** */
+
+static enum {
+  STARTING,
+  SPLIT,
+  BURST_1,
+  EXITING,
+  BURST_2,
+  DONE,
+} phase = STARTING;
+
+static int32_t pids[WORKERS + 1]; /* the workers and one replacement */
+static uint32_t expected[WORKERS + 1];
+static size_t ready, replies, finished, last;
+
+static size_t worker_index(int32_t pid) {
+  for (size_t i = 0; i < ready; ++i)
+    if (pids[i] == pid)
+      return i;
+  fail("a message from an unknown worker");
+  return 0;
+}
+
+static void start_burst(uint32_t round) {
+  finished = 0;
+  memset(expected, 0, sizeof(expected));
+  for (uint32_t i = 0; i < BURST; ++i)
+    publish_header("burst", (header_s){.round = round, .seq = i}, BURST_SIZE,
+                   FIO_PUBSUB_CLUSTER);
+}
+
+static void next_phase(void) {
+  switch (phase) {
+  case STARTING: {
+    phase = SPLIT;
+    char *big = malloc(BIG_SIZE);
+    FIO_ASSERT_ALLOC(big);
+    fill(big, BIG_SIZE, 1);
+    fio_publish(.engine = FIO_PUBSUB_CLUSTER, .channel = str("big"),
+                .message = {.data = big, .len = BIG_SIZE});
+    free(big);
+    break;
+  }
+  case SPLIT:
+    phase = BURST_1;
+    start_burst(1);
+    break;
+  case BURST_1:
+    phase = EXITING;
+    publish_header("exit", (header_s){.pid = pids[0]}, sizeof(header_s),
+                   FIO_PUBSUB_CLUSTER);
+    break;
+  case EXITING:
+    phase = BURST_2;
+    start_burst(2);
+    break;
+  case BURST_2:
+    phase = DONE;
+    fio_stop();
+    break;
+  case DONE:
+    break;
+  }
+}
+
+static void root_on_ready(fio_msg_s *msg) {
+  header_s h = read_header(msg, sizeof(h));
+  if (ready == WORKERS + 1)
+    fail("a worker was replaced more than once");
+  pids[ready++] = h.pid;
+  if (phase == STARTING && ready == WORKERS)
+    next_phase();
+  else if (phase == EXITING && ready == WORKERS + 1 && last == LAST)
+    next_phase();
+}
+
+static void root_on_big(fio_msg_s *msg) {
+  if (!check(msg->msg, REPLY_SIZE, 2))
+    fail("a split reply was corrupted");
+  if (++replies == WORKERS)
+    next_phase();
+}
+
+static void root_on_burst(fio_msg_s *msg) {
+  header_s h = read_header(msg, BURST_SIZE);
+  size_t i = worker_index(h.pid);
+  if (h.round != (phase == BURST_1 ? 1U : 2U) || h.seq != expected[i]++)
+    fail("a reply arrived out of order");
+  if (expected[i] == BURST && ++finished == WORKERS)
+    next_phase();
+}
+
+static void root_on_last(fio_msg_s *msg) {
+  header_s h = read_header(msg, BURST_SIZE);
+  if (h.pid != pids[0] || h.seq != last++)
+    fail("an exiting worker's messages arrived out of order");
+  if (last == LAST && ready == WORKERS + 1)
+    next_phase();
+}
+
+static void on_timeout(void *arg) {
+  if (fio_is_master())
+    fail("timed out");
+  (void)arg;
+}
+
+int main(void) {
+  fio_pubsub_cluster_shm(CAPACITY);
+  /* made before fio_start, so the workers inherit them. They only receive
+   * messages published to the root engine in the root process. */
+  fio_subscribe(.channel = str("ready"), .on_message = root_on_ready);
+  fio_subscribe(.channel = str("big_reply"), .on_message = root_on_big);
+  fio_subscribe(.channel = str("burst_reply"), .on_message = root_on_burst);
+  fio_subscribe(.channel = str("last"), .on_message = root_on_last);
+  fio_state_callback_add(FIO_CALL_ON_START, on_start, NULL);
+  fio_run_every(30000, 1, on_timeout, NULL, NULL);
+  fio_start(.threads = 1, .workers = WORKERS);
+  if (phase != DONE)
+    fail("stopped early");
+  fprintf(stderr, "split messages, bursts and a worker exiting passed.\n");
+  return 0;
+}
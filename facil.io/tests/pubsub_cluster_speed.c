@@ -0,0 +1,148 @@
+/**
+ * Tests cluster pub/sub throughput, reporting how many messages per second
+ * reached their subscribers:
+ *
+ * * root: the root process publishes 100k 64 byte messages to a channel every
+ *   worker is subscribed to. This is the flow of zap's `pubsub_bench` example,
+ *   written against the C API.
+ *
+ * * all: every worker publishes its share of 100k messages to the same
+ *   channel, so each worker receives 100k messages from all workers.
+ *
+ * Runs once for each of 1, 2, 4, 8 and 16 workers, over the cluster socket and
+ * through shared memory (`fio_pubsub_cluster_shm`), each run in a child process
+ * (facil.io only starts once per process). Pass a worker count, and optionally
+ * a shared memory capacity, to run a single configuration. With 1 worker,
+ * everything stays in one process.
+ *
+ * Compile with (for example):
+ *
+ *     cc -O2 -Ilib/facil tests/pubsub_cluster_speed.c lib/facil/fio.c \
+ *        -lpthread -lm
+ */
+#include <fio.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MESSAGES 100000 /* messages received per worker and test */
+#define MESSAGE_SIZE 64
+#define SHM_CAPACITY "1048576" /* the shared memory runs' capacity */
+
+static size_t workers;
+static size_t capacity;
+static volatile size_t received, ready, done;
+static double started;
+
+static double now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + (t.tv_nsec / 1000000000.0);
+}
+
+static void publish(const char *channel, size_t len, fio_pubsub_engine_s *e) {
+  fio_publish(.engine = e, .channel = {.data = (char *)channel, .len = len},
+              .message = {.data = "1", .len = 1});
+}
+
+static void publish_messages(size_t count) {
+  char payload[MESSAGE_SIZE] = {0};
+  for (size_t i = 0; i < count; ++i)
+    fio_publish(.engine = FIO_PUBSUB_CLUSTER,
+                .channel = {.data = "bench", .len = 5},
+                .message = {.data = payload, .len = MESSAGE_SIZE});
+}
+
+/* workers: count the messages, report to the root once a test's arrived */
+static void on_message(fio_msg_s *msg) {
+  if (fio_atomic_add(&received, 1) % MESSAGES == 0)
+    publish("done", 4, FIO_PUBSUB_ROOT);
+  (void)msg;
+}
+
+/* workers: publish their share of the all to all test */
+static void on_go(fio_msg_s *msg) {
+  publish_messages(MESSAGES / workers);
+  (void)msg;
+}
+
+/* root: once every worker is subscribed, publish the messages */
+static void on_ready(fio_msg_s *msg) {
+  if (fio_atomic_add(&ready, 1) < workers)
+    return;
+  started = now();
+  publish_messages(MESSAGES);
+  (void)msg;
+}
+
+/* root: every worker received all messages of a test */
+static void on_done(fio_msg_s *msg) {
+  size_t count = fio_atomic_add(&done, 1);
+  if (count % workers)
+    return;
+  double seconds = now() - started;
+  fprintf(stderr, "%2zu workers, %6s, %4s: %8.1f ms, %10.0f messages/s "
+                  "delivered\n",
+          workers, (capacity && workers > 1) ? "shm" : "socket",
+          count == workers ? "root" : "all", seconds * 1000,
+          (MESSAGES * workers) / seconds);
+  if (count == workers) {
+    started = now();
+    publish("go", 2, FIO_PUBSUB_CLUSTER);
+  } else {
+    fio_stop();
+  }
+  (void)msg;
+}
+
+/* runs in every worker process */
+static void on_start(void *ignr) {
+  fio_subscribe(.channel = {.data = "bench", .len = 5},
+                .on_message = on_message);
+  fio_subscribe(.channel = {.data = "go", .len = 2}, .on_message = on_go);
+  publish("ready", 5, FIO_PUBSUB_ROOT);
+  (void)ignr;
+}
+
+static int run(void) {
+  /* made before fio_start, so the workers inherit them. They only receive
+   * messages published to the root engine in the root process. */
+  fio_subscribe(.channel = {.data = "ready", .len = 5}, .on_message = on_ready);
+  fio_subscribe(.channel = {.data = "done", .len = 4}, .on_message = on_done);
+  fio_state_callback_add(FIO_CALL_ON_START, on_start, NULL);
+  fio_pubsub_cluster_shm(capacity);
+  fio_start(.threads = 1, .workers = (int16_t)workers);
+  return done < workers * 2;
+}
+
+int main(int argc, char const *argv[]) {
+  if (argc > 1) {
+    workers = strtoul(argv[1], NULL, 10);
+    if (argc > 2)
+      capacity = strtoul(argv[2], NULL, 10);
+    if (!workers || MESSAGES % workers)
+      return -1;
+    return run();
+  }
+  const char *counts[] = {"1", "2", "4", "8", "16"};
+  const char *capacities[] = {"0", SHM_CAPACITY};
+  for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); ++i) {
+    for (size_t j = 0; j < 2; ++j) {
+      if (i == 0 && j)
+        continue; /* a single process doesn't use the cluster */
+      pid_t child = fork();
+      if (child == 0) {
+        execl(argv[0], argv[0], counts[i], capacities[j], (char *)NULL);
+        perror("couldn't run the benchmark");
+        exit(-1);
+      }
+      int status = -1;
+      if (child == -1 || waitpid(child, &status, 0) == -1 || status)
+        return -1;
+    }
+  }
+  return 0;
+}
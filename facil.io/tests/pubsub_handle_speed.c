@@ -0,0 +1,124 @@
+/**
+ * Tests the cost of publishing to a channel by name (hashing and looking up the
+ * channel, matching it against the pattern index) against publishing through a
+ * channel handle, which resolves the channel once. Also tests that handles
+ * follow subscription changes.
+ *
+ * Compile with (for example):
+ *
+ *     cc -O2 -Ilib/facil tests/pubsub_handle_speed.c lib/facil/fio.c \
+ *        -lpthread -lm
+ */
+#include <fio.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define PATTERNS 1000   /* pattern subscriptions, most not matching */
+#define UNINDEXED 10    /* patterns starting with a wildcard (of PATTERNS) */
+#define MESSAGES 500000 /* messages published */
+#define BATCH 1000      /* messages published between deliveries */
+
+static size_t delivered;
+
+static void on_message(fio_msg_s *msg) {
+  ++delivered;
+  (void)msg;
+}
+
+static double now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + (t.tv_nsec / 1000000000.0);
+}
+
+static fio_str_info_s channel = {.data = "user.1234.events", .len = 16};
+static fio_str_info_s message = {.data = "x", .len = 1};
+
+/* publishes MESSAGES messages, returns the time spent publishing */
+static double publish(fio_channel_handle_s *h) {
+  double total = 0;
+  for (size_t i = 0; i < MESSAGES;) {
+    double start = now();
+    if (h) {
+      for (size_t end = i + BATCH; i < end; ++i)
+        fio_channel_handle_publish(h, FIO_PUBSUB_PROCESS, message, 0);
+    } else {
+      for (size_t end = i + BATCH; i < end; ++i)
+        fio_publish(.engine = FIO_PUBSUB_PROCESS, .channel = channel,
+                    .message = message);
+    }
+    total += now() - start;
+    fio_defer_perform(); /* deliver (not timed) */
+  }
+  return total;
+}
+
+/* publishes a message through the handle, returns the number of deliveries */
+static size_t deliveries(fio_channel_handle_s *h) {
+  size_t before = delivered;
+  fio_channel_handle_publish(h, FIO_PUBSUB_PROCESS, message, 0);
+  fio_defer_perform();
+  return delivered - before;
+}
+
+int main(void) {
+  char buf[64];
+  subscription_s **subs = malloc(sizeof(*subs) * PATTERNS);
+  FIO_ASSERT_ALLOC(subs);
+  for (size_t i = 0; i < PATTERNS; ++i) {
+    int len = sprintf(buf,
+                      i < UNINDEXED ? "*.%zu"
+                      : (i & 1)     ? "user.%zu*"
+                                    : "room.%zu.*",
+                      i);
+    subs[i] = fio_subscribe(.channel = {.data = buf, .len = (size_t)len},
+                            .match = FIO_MATCH_GLOB, .on_message = on_message);
+  }
+  subscription_s *sub =
+      fio_subscribe(.channel = channel, .on_message = on_message);
+  fio_channel_handle_s *h = fio_channel_handle_new(channel);
+
+  double by_name = publish(NULL);
+  size_t expected = delivered;
+  double by_handle = publish(h);
+  fprintf(stderr,
+          "%d patterns, %d messages, %zu deliveries each:\n"
+          "  fio_publish:                %6.3f us/message\n"
+          "  fio_channel_handle_publish: %6.3f us/message\n",
+          PATTERNS, MESSAGES, expected, by_name * 1000000 / MESSAGES,
+          by_handle * 1000000 / MESSAGES);
+  if (delivered != expected * 2) {
+    fprintf(stderr, "ERROR: expected %zu deliveries\n", expected * 2);
+    exit(-1);
+  }
+
+  /* the handle follows subscription changes */
+  size_t matched = expected / MESSAGES;
+  fio_unsubscribe(sub);
+  if (deliveries(h) != matched - 1) {
+    fprintf(stderr, "ERROR: delivered to a canceled subscription\n");
+    exit(-1);
+  }
+  sub = fio_subscribe(.channel = channel, .on_message = on_message);
+  subscription_s *pattern = fio_subscribe(.channel = {.data = "user.*", .len = 6},
+                                          .match = FIO_MATCH_GLOB,
+                                          .on_message = on_message);
+  if (deliveries(h) != matched + 1) {
+    fprintf(stderr, "ERROR: missed new subscriptions\n");
+    exit(-1);
+  }
+  fio_unsubscribe(pattern);
+  if (deliveries(h) != matched) {
+    fprintf(stderr, "ERROR: delivered to a canceled pattern\n");
+    exit(-1);
+  }
+
+  fio_channel_handle_free(h);
+  fio_unsubscribe(sub);
+  for (size_t i = 0; i < PATTERNS; ++i)
+    fio_unsubscribe(subs[i]);
+  free(subs);
+  return 0;
+}
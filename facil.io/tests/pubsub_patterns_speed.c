@@ -0,0 +1,126 @@
+/**
+ * Tests the cost of publishing with many pattern subscriptions: glob patterns
+ * are indexed by their literal prefix, so a publish only tests the patterns
+ * whose prefix the channel starts with. The result is compared against testing
+ * every pattern (the scan publishing used to perform).
+ *
+ * Compile with (for example):
+ *
+ *     cc -O2 -Ilib/facil tests/pubsub_patterns_speed.c lib/facil/fio.c \
+ *        -lpthread -lm
+ */
+#include <fio.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PATTERNS 10000  /* pattern subscriptions */
+#define UNINDEXED 100   /* patterns starting with a wildcard (of PATTERNS) */
+#define MESSAGES 100000 /* messages published */
+#define BATCH 1000      /* messages published between deliveries */
+
+static size_t delivered;
+
+static void on_message(fio_msg_s *msg) {
+  ++delivered;
+  (void)msg;
+}
+
+static double now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + (t.tv_nsec / 1000000000.0);
+}
+
+/* writes the name of the pattern / channel `i` */
+static fio_str_info_s pattern_name(char *buf, size_t i) {
+  int len;
+  if (i < UNINDEXED)
+    len = sprintf(buf, "*.%zu", i);
+  else if (i & 1)
+    len = sprintf(buf, "user.%zu.*", i);
+  else
+    len = sprintf(buf, "room.%zu.[a-z]*", i);
+  return (fio_str_info_s){.data = buf, .len = (size_t)len};
+}
+
+static fio_str_info_s channel_name(char *buf, size_t i) {
+  int len;
+  size_t id = (i * 7919) % (PATTERNS * 2);
+  switch (i % 3) {
+  case 0:
+    len = sprintf(buf, "user.%zu.events", id);
+    break;
+  case 1:
+    len = sprintf(buf, "room.%zu.joined", id);
+    break;
+  default:
+    len = sprintf(buf, "news.%zu", id % UNINDEXED);
+  }
+  return (fio_str_info_s){.data = buf, .len = (size_t)len};
+}
+
+int main(void) {
+  char buf[64];
+  fio_str_info_s *patterns = malloc(sizeof(*patterns) * PATTERNS);
+  FIO_ASSERT_ALLOC(patterns);
+  subscription_s **subs = malloc(sizeof(*subs) * PATTERNS);
+  FIO_ASSERT_ALLOC(subs);
+  for (size_t i = 0; i < PATTERNS; ++i) {
+    fio_str_info_s name = pattern_name(buf, i);
+    patterns[i] = (fio_str_info_s){.data = strdup(name.data), .len = name.len};
+    subs[i] = fio_subscribe(.channel = patterns[i], .match = FIO_MATCH_GLOB,
+                            .on_message = on_message);
+  }
+
+  /* testing every pattern, for every message */
+  size_t expected = 0;
+  double start = now();
+  for (size_t i = 0; i < MESSAGES; ++i) {
+    fio_str_info_s ch = channel_name(buf, i);
+    for (size_t j = 0; j < PATTERNS; ++j)
+      expected += FIO_MATCH_GLOB(patterns[j], ch);
+  }
+  double scan = now() - start;
+
+  /* publishing (using the index) */
+  double publish = 0;
+  for (size_t i = 0; i < MESSAGES;) {
+    start = now();
+    for (size_t end = i + BATCH; i < end; ++i)
+      fio_publish(.engine = FIO_PUBSUB_PROCESS, .channel = channel_name(buf, i),
+                  .message = {.data = "x", .len = 1});
+    publish += now() - start;
+    fio_defer_perform(); /* deliver (not timed) */
+  }
+
+  fprintf(stderr,
+          "%d patterns (%d unindexed), %d messages, %zu deliveries:\n"
+          "  scan:    %8.2f us/message\n"
+          "  publish: %8.2f us/message\n",
+          PATTERNS, UNINDEXED, MESSAGES, delivered, scan * 1000000 / MESSAGES,
+          publish * 1000000 / MESSAGES);
+  if (delivered != expected) {
+    fprintf(stderr, "ERROR: expected %zu deliveries\n", expected);
+    exit(-1);
+  }
+
+  for (size_t i = 0; i < PATTERNS; ++i) {
+    fio_unsubscribe(subs[i]);
+    free(patterns[i].data);
+  }
+  /* the index should be empty */
+  for (size_t i = 0; i < BATCH; ++i)
+    fio_publish(.engine = FIO_PUBSUB_PROCESS, .channel = channel_name(buf, i),
+                .message = {.data = "x", .len = 1});
+  fio_defer_perform();
+  if (delivered != expected) {
+    fprintf(stderr, "ERROR: delivered after unsubscribing\n");
+    exit(-1);
+  }
+  free(subs);
+  free(patterns);
+  return 0;
+}
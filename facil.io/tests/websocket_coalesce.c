@@ -0,0 +1,151 @@
+/**
+ * Tests WebSocket output coalescing (`ws_coalesce_bytes`, `ws_coalesce_us`):
+ * the server writes a burst of small messages when a client connects, and the
+ * client checks that they all arrive, in order, and when.
+ *
+ * Without a delay, the burst is written as soon as the tasks queued before it
+ * were performed. With a delay, a reactor timer writes it, and the (single)
+ * thread keeps polling instead of spinning while it waits. The test checks
+ * both the timing and the CPU time spent waiting.
+ *
+ * Compile with (for example):
+ *
+ *     cc -O2 -Ilib/facil -Ilib/facil/fiobj -Ilib/facil/http \
+ *        -Ilib/facil/http/parsers tests/websocket_coalesce.c \
+ *        lib/facil/fio.c $(find lib/facil/fiobj lib/facil/http -name '*.c') \
+ *        -lpthread -lm
+ */
+#include <fio.h>
+#include <http.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#define MESSAGES 100     /* messages per burst */
+#define DELAY_US 200000 /* ws_coalesce_us of the delayed listener */
+
+#define PORT_NOW "3997"
+#define PORT_DELAYED "3998"
+
+static double now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + (t.tv_nsec / 1000000000.0);
+}
+
+static double cpu_time(void) {
+  struct rusage u;
+  getrusage(RUSAGE_SELF, &u);
+  return u.ru_utime.tv_sec + u.ru_stime.tv_sec +
+         ((u.ru_utime.tv_usec + u.ru_stime.tv_usec) / 1000000.0);
+}
+
+static void fail(const char *msg) {
+  fprintf(stderr, "ERROR: %s\n", msg);
+  exit(-1);
+}
+
+/* *****************************************************************************
+Server: writes a burst of messages to every new connection
+***************************************************************************** */
+
+static double burst_time, burst_cpu;
+
+static void server_on_open(ws_s *ws) {
+  char buf[32];
+  burst_time = now();
+  burst_cpu = cpu_time();
+  for (int i = 0; i < MESSAGES; ++i) {
+    int len = snprintf(buf, sizeof(buf), "message %d", i);
+    websocket_write(ws, (fio_str_info_s){.data = buf, .len = (size_t)len}, 1);
+  }
+}
+
+static void on_request(http_s *h) { http_send_error(h, 400); }
+
+static void on_upgrade(http_s *h, char *protocol, size_t len) {
+  if (len != 9 || memcmp(protocol, "websocket", 9)) {
+    http_send_error(h, 400);
+    return;
+  }
+  http_upgrade2ws(h, .on_open = server_on_open);
+}
+
+/* *****************************************************************************
+Client: checks the messages and when they arrived
+***************************************************************************** */
+
+typedef struct {
+  const char *name;
+  int received;
+  double elapsed;
+  double cpu;
+} result_s;
+
+static result_s results[2] = {{.name = "no delay"}, {.name = "delayed"}};
+
+static void connect_next(void *arg, void *ignr);
+
+static void client_on_message(ws_s *ws, fio_str_info_s msg, uint8_t is_text) {
+  result_s *r = websocket_udata_get(ws);
+  char expected[32];
+  int len = snprintf(expected, sizeof(expected), "message %d", r->received);
+  if (!is_text || msg.len != (size_t)len || memcmp(msg.data, expected, len))
+    fail("messages are out of order");
+  if (++r->received < MESSAGES)
+    return;
+  r->elapsed = now() - burst_time;
+  r->cpu = cpu_time() - burst_cpu;
+  websocket_close(ws);
+  fio_defer(connect_next, r + 1, NULL);
+}
+
+static void connect_next(void *arg, void *ignr) {
+  result_s *r = arg;
+  if (r == results + 2) {
+    fio_stop();
+    return;
+  }
+  const char *url =
+      (r == results ? "ws://127.0.0.1:" PORT_NOW "/"
+                    : "ws://127.0.0.1:" PORT_DELAYED "/");
+  if (websocket_connect(url, .on_message = client_on_message, .udata = r) < 0)
+    fail("couldn't connect");
+  (void)ignr;
+}
+
+static void on_timeout(void *arg) {
+  fail("timed out");
+  (void)arg;
+}
+
+int main(void) {
+  if (http_listen(PORT_NOW, NULL, .on_request = on_request,
+                  .on_upgrade = on_upgrade, .ws_coalesce_bytes = 4096) == -1 ||
+      http_listen(PORT_DELAYED, NULL, .on_request = on_request,
+                  .on_upgrade = on_upgrade, .ws_coalesce_bytes = 4096,
+                  .ws_coalesce_us = DELAY_US) == -1)
+    fail("couldn't listen");
+  fio_defer(connect_next, results, NULL);
+  fio_run_every(10000, 1, on_timeout, NULL, NULL);
+  fio_start(.threads = 1, .workers = 1);
+
+  for (int i = 0; i < 2; ++i) {
+    fprintf(stderr, "%-8s: %d messages after %6.1f ms, %5.1f ms CPU\n",
+            results[i].name, results[i].received, results[i].elapsed * 1000,
+            results[i].cpu * 1000);
+    if (results[i].received != MESSAGES)
+      fail("messages are missing");
+  }
+  if (results[0].elapsed > 0.1)
+    fail("an undelayed burst waited");
+  /* the timer resolution is the reactor's: a millisecond */
+  if (results[1].elapsed < (DELAY_US - 1000) / 1000000.0)
+    fail("a delayed burst was written early");
+  if (results[1].cpu > results[1].elapsed / 2)
+    fail("the delay was spent spinning");
+  return 0;
+}
@@ -0,0 +1,377 @@
+/**
+ * Tests the permessage-deflate WebSocket extension (RFC 7692): the negotiation
+ * of `sec-websocket-extensions` offers, and a client exchanging compressed
+ * messages with an echo server, with and without context takeover.
+ *
+ * The client is a plain socket on its own thread, so the frames (RSV1 bit,
+ * compressed payloads) are checked exactly as they are sent.
+ *
+ * Compile with (for example):
+ *
+ *     cc -O2 -DHAVE_ZLIB=1 -Ilib/facil -Ilib/facil/fiobj -Ilib/facil/http \
+ *        -Ilib/facil/http/parsers tests/websocket_deflate.c \
+ *        lib/facil/fio.c $(find lib/facil/fiobj lib/facil/http -name '*.c') \
+ *        -lz -lpthread -lm
+ */
+#include <fio.h>
+#include <http.h>
+#include <http_internal.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define PORT_PLAIN "3995"    /* compresses messages independently */
+#define PORT_TAKEOVER "3996" /* keeps the compression contexts */
+
+static void fail(const char *msg, const char *detail) {
+  fprintf(stderr, "ERROR: %s%s%s\n", msg, (detail ? ": " : ""),
+          (detail ? detail : ""));
+  exit(-1);
+}
+
+/* *****************************************************************************
+Negotiation
+***************************************************************************** */
+
+typedef struct {
+  const char *offer;
+  uint8_t context_takeover; /* the server's setting */
+  const char *response;     /* NULL if declined */
+  uint8_t window_bits;
+} negotiation_s;
+
+static const negotiation_s negotiations[] = {
+    {"permessage-deflate", 0,
+     "permessage-deflate; server_no_context_takeover; "
+     "client_no_context_takeover",
+     15},
+    {"permessage-deflate", 1, "permessage-deflate", 15},
+    {"permessage-deflate; client_max_window_bits", 1, "permessage-deflate", 15},
+    {"permessage-deflate; client_max_window_bits=\"10\"", 1,
+     "permessage-deflate", 15},
+    {"permessage-deflate; server_max_window_bits=10", 1,
+     "permessage-deflate; server_max_window_bits=10", 10},
+    {" Permessage-Deflate ; server_no_context_takeover", 1,
+     "permessage-deflate; server_no_context_takeover", 15},
+    /* the first acceptable offer wins */
+    {"x-webkit-deflate-frame, permessage-deflate; foo, "
+     "permessage-deflate; client_no_context_takeover",
+     1, "permessage-deflate; client_no_context_takeover", 15},
+    /* declined */
+    {"x-webkit-deflate-frame", 1, NULL, 0},
+    {"permessage-deflate; server_max_window_bits=8", 1, NULL, 0},
+    {"permessage-deflate; server_max_window_bits=16", 1, NULL, 0},
+    {"permessage-deflate; client_max_window_bits=7", 1, NULL, 0},
+    {"permessage-deflate; server_no_context_takeover=1", 1, NULL, 0},
+    {"permessage-deflate; server_no_context_takeover; "
+     "server_no_context_takeover",
+     1, NULL, 0},
+    {"permessage-deflate; unknown", 1, NULL, 0},
+};
+
+static void test_negotiation(void) {
+  for (size_t i = 0; i < sizeof(negotiations) / sizeof(negotiations[0]); ++i) {
+    const negotiation_s *n = negotiations + i;
+    http_settings_s settings = {.ws_deflate = 1,
+                                .ws_deflate_context_takeover =
+                                    n->context_takeover};
+    websocket_deflate_s params;
+    FIOBJ offer = fiobj_str_new(n->offer, strlen(n->offer));
+    FIOBJ response = websocket_deflate_negotiate(&settings, offer, &params);
+    fiobj_free(offer);
+    if (!n->response) {
+      if (response || params.enabled)
+        fail("accepted", n->offer);
+      continue;
+    }
+    if (!response || !params.enabled)
+      fail("declined", n->offer);
+    fio_str_info_s r = fiobj_obj2cstr(response);
+    if (r.len != strlen(n->response) || memcmp(r.data, n->response, r.len))
+      fail("wrong response", r.data);
+    if (params.server_window_bits != n->window_bits)
+      fail("wrong window bits", n->offer);
+    fiobj_free(response);
+  }
+}
+
+/* *****************************************************************************
+Echo server
+***************************************************************************** */
+
+static void on_message(ws_s *ws, fio_str_info_s msg, uint8_t is_text) {
+  websocket_write(ws, msg, is_text);
+}
+
+static void on_request(http_s *h) { http_send_error(h, 400); }
+
+static void on_upgrade(http_s *h, char *protocol, size_t len) {
+  if (len != 9 || memcmp(protocol, "websocket", 9)) {
+    http_send_error(h, 400);
+    return;
+  }
+  http_upgrade2ws(h, .on_message = on_message);
+}
+
+/* *****************************************************************************
+Client
+***************************************************************************** */
+
+static int client_connect(const char *port) {
+  struct sockaddr_in addr = {.sin_family = AF_INET,
+                             .sin_port = htons(atoi(port)),
+                             .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+  for (int tries = 0; tries < 100; ++tries) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1)
+      fail("socket", NULL);
+    if (!connect(fd, (struct sockaddr *)&addr, sizeof(addr)))
+      return fd;
+    close(fd);
+    usleep(20000); /* the server isn't listening yet */
+  }
+  fail("couldn't connect", NULL);
+  return -1;
+}
+
+static void send_all(int fd, const void *data, size_t len) {
+  while (len) {
+    ssize_t w = write(fd, data, len);
+    if (w <= 0)
+      fail("write", NULL);
+    data = (const char *)data + w;
+    len -= w;
+  }
+}
+
+static void recv_all(int fd, void *data, size_t len) {
+  while (len) {
+    ssize_t r = read(fd, data, len);
+    if (r <= 0)
+      fail("read", NULL);
+    data = (char *)data + r;
+    len -= r;
+  }
+}
+
+/* sends the upgrade request, returns the sec-websocket-extensions value */
+static char *handshake(int fd, const char *offer) {
+  static char response[1024];
+  char request[512];
+  int len = snprintf(request, sizeof(request),
+                     "GET / HTTP/1.1\r\n"
+                     "Host: 127.0.0.1\r\n"
+                     "Upgrade: websocket\r\n"
+                     "Connection: Upgrade\r\n"
+                     "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                     "Sec-WebSocket-Version: 13\r\n"
+                     "Sec-WebSocket-Extensions: %s\r\n\r\n",
+                     offer);
+  send_all(fd, request, len);
+  /* byte by byte, so no frame data is consumed */
+  size_t pos = 0;
+  while (pos < 4 || memcmp(response + pos - 4, "\r\n\r\n", 4)) {
+    if (pos + 1 == sizeof(response))
+      fail("response too long", NULL);
+    recv_all(fd, response + pos++, 1);
+  }
+  response[pos] = 0;
+  if (strncmp(response, "HTTP/1.1 101", 12))
+    fail("not upgraded", response);
+  for (char *line = strstr(response, "\r\n"); line;
+       line = strstr(line + 2, "\r\n")) {
+    if (strncasecmp(line + 2, "sec-websocket-extensions:", 25))
+      continue;
+    char *value = line + 27;
+    while (*value == ' ')
+      ++value;
+    *strstr(value, "\r\n") = 0;
+    return value;
+  }
+  return NULL;
+}
+
+/* sends a masked frame, FIN set */
+static void send_frame(int fd, uint8_t rsv1, const void *data, size_t len) {
+  uint8_t head[14] = {0x81 | (rsv1 ? 0x40 : 0)};
+  const uint8_t mask[4] = {0x12, 0x34, 0x56, 0x78};
+  size_t head_len;
+  if (len < 126) {
+    head[1] = 0x80 | len;
+    head_len = 2;
+  } else {
+    head[1] = 0x80 | 126;
+    head[2] = len >> 8;
+    head[3] = len & 0xff;
+    head_len = 4;
+  }
+  memcpy(head + head_len, mask, 4);
+  send_all(fd, head, head_len + 4);
+  uint8_t *masked = malloc(len);
+  for (size_t i = 0; i < len; ++i)
+    masked[i] = ((const uint8_t *)data)[i] ^ mask[i & 3];
+  send_all(fd, masked, len);
+  free(masked);
+}
+
+/* reads an (unmasked, unfragmented) text frame into `payload` */
+static size_t recv_frame(int fd, uint8_t *rsv1, uint8_t *payload, size_t max) {
+  uint8_t head[2];
+  recv_all(fd, head, 2);
+  if ((head[0] & 0xbf) != 0x81 || (head[1] & 0x80))
+    fail("unexpected frame", NULL);
+  *rsv1 = (head[0] & 0x40) != 0;
+  size_t len = head[1] & 0x7f;
+  if (len == 126) {
+    uint8_t ext[2];
+    recv_all(fd, ext, 2);
+    len = ((size_t)ext[0] << 8) | ext[1];
+  } else if (len == 127) {
+    fail("frame too long", NULL);
+  }
+  if (len > max)
+    fail("frame too long", NULL);
+  recv_all(fd, payload, len);
+  return len;
+}
+
+/* RFC 7692: a message is a flushed deflate block without the 00 00 ff ff */
+static size_t compress_message(z_stream *z, const char *msg, size_t len,
+                               uint8_t *out, size_t max) {
+  z->next_in = (Bytef *)msg;
+  z->avail_in = len;
+  z->next_out = out;
+  z->avail_out = max;
+  if (deflate(z, Z_SYNC_FLUSH) != Z_OK || z->avail_in || z->avail_out < 4)
+    fail("deflate", NULL);
+  return max - z->avail_out - 4;
+}
+
+static size_t inflate_message(z_stream *z, uint8_t *data, size_t len,
+                              char *out, size_t max) {
+  static uint8_t tail[4] = {0, 0, 0xff, 0xff};
+  z->next_out = (Bytef *)out;
+  z->avail_out = max;
+  z->next_in = data;
+  z->avail_in = len;
+  if (inflate(z, Z_SYNC_FLUSH) != Z_OK || z->avail_in)
+    fail("inflate", NULL);
+  z->next_in = tail;
+  z->avail_in = 4;
+  int ret = inflate(z, Z_SYNC_FLUSH);
+  if ((ret != Z_OK && ret != Z_BUF_ERROR) || z->avail_in)
+    fail("inflate", NULL);
+  return max - z->avail_out;
+}
+
+static char long_message[2048];
+
+typedef struct {
+  const char *msg;
+  uint8_t compressed; /* sent compressed */
+} message_s;
+
+/* echoes `messages` over a new connection, returns the compressed echo sizes */
+static void echo(const char *port, const char *offer, const char *expected,
+                 uint8_t takeover, size_t *echo_sizes) {
+  const message_s messages[] = {
+      {long_message, 1},
+      {long_message, 1}, /* smaller the second time with context takeover */
+      {"short", 1},      /* the echo isn't worth compressing */
+      {long_message, 0}, /* the server takes uncompressed messages, too */
+      {"short", 0},
+  };
+  int fd = client_connect(port);
+  const char *extensions = handshake(fd, offer);
+  if (!extensions || strcmp(extensions, expected))
+    fail("unexpected extensions", extensions);
+
+  z_stream def = {0}, inf = {0};
+  if (deflateInit2(&def, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK ||
+      inflateInit2(&inf, -15) != Z_OK)
+    fail("zlib init", NULL);
+
+  static uint8_t buf[4096];
+  static char text[4096];
+  for (size_t i = 0; i < sizeof(messages) / sizeof(messages[0]); ++i) {
+    const message_s *m = messages + i;
+    size_t len = strlen(m->msg);
+    if (m->compressed) {
+      if (!takeover)
+        deflateReset(&def);
+      send_frame(fd, 1, buf, compress_message(&def, m->msg, len, buf,
+                                              sizeof(buf)));
+    } else {
+      send_frame(fd, 0, m->msg, len);
+    }
+
+    uint8_t rsv1;
+    size_t received = recv_frame(fd, &rsv1, buf, sizeof(buf));
+    if (rsv1 != (len >= 64))
+      fail("compressed the wrong messages", m->msg);
+    echo_sizes[i] = received;
+    if (rsv1) {
+      if (!takeover)
+        inflateReset(&inf);
+      received = inflate_message(&inf, buf, received, text, sizeof(text));
+    } else {
+      memcpy(text, buf, received);
+    }
+    if (received != len || memcmp(text, m->msg, len))
+      fail("echo differs", m->msg);
+  }
+  deflateEnd(&def);
+  inflateEnd(&inf);
+  send_all(fd, "\x88\x80\0\0\0\0", 6);
+  close(fd);
+}
+
+static void *client(void *arg) {
+  size_t plain[5], takeover[5];
+  echo(PORT_PLAIN, "permessage-deflate; client_max_window_bits",
+       "permessage-deflate; server_no_context_takeover; "
+       "client_no_context_takeover",
+       0, plain);
+  echo(PORT_TAKEOVER, "permessage-deflate; server_max_window_bits=12",
+       "permessage-deflate; server_max_window_bits=12", 1, takeover);
+  fprintf(stderr,
+          "%zu byte message echoed in %zu, %zu bytes without and %zu, %zu "
+          "bytes with context takeover\n",
+          strlen(long_message), plain[0], plain[1], takeover[0], takeover[1]);
+  if (plain[0] != plain[1])
+    fail("messages depend on each other without context takeover", NULL);
+  if (takeover[1] >= takeover[0] / 2)
+    fail("no context taken over", NULL);
+  fio_stop();
+  return arg;
+}
+
+int main(void) {
+  test_negotiation();
+
+  /* compressible, but not trivially so */
+  for (size_t i = 0; i + 1 < sizeof(long_message); ++i)
+    long_message[i] = "abcdefghijklmnopqrstuvwxyz "[(i * i + i / 7) % 27];
+
+  if (http_listen(PORT_PLAIN, NULL, .on_request = on_request,
+                  .on_upgrade = on_upgrade, .ws_deflate = 1) == -1 ||
+      http_listen(PORT_TAKEOVER, NULL, .on_request = on_request,
+                  .on_upgrade = on_upgrade, .ws_deflate = 1,
+                  .ws_deflate_context_takeover = 1) == -1)
+    fail("couldn't listen", NULL);
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, client, NULL))
+    fail("pthread_create", NULL);
+  fio_start(.threads = 1, .workers = 1);
+  pthread_join(thread, NULL);
+  return 0;
+}
@@ -0,0 +1,318 @@
+/**
+ * Tests shared WebSocket frames (`websocket_frame_new`,
+ * `websocket_write_frame`):
+ *
+ * * A large frame written to three server connections is shared, not copied:
+ *   each connection holds a reference until it has sent the frame, so the
+ *   frame lives until the last (slow reading) connection flushed it.
+ *
+ * * Client connections mask their frames, so the frame is framed again instead
+ *   of being shared (the server rejects unmasked frames).
+ *
+ * * With output coalescing, small frames are copied into the buffer.
+ *
+ * * Writing to a closed connection fails, with or without coalescing.
+ *
+ * The server side clients are plain sockets on their own threads, so they
+ * decide when the frame is read. The test includes websockets.c to inspect
+ * the frames' reference counts.
+ *
+ * Compile with (for example):
+ *
+ *     cc -O2 -Ilib/facil -Ilib/facil/fiobj -Ilib/facil/http \
+ *        -Ilib/facil/http/parsers tests/websocket_frames.c lib/facil/fio.c \
+ *        $(find lib/facil/fiobj lib/facil/http -name '*.c' \
+ *          ! -name websockets.c) -lpthread -lm
+ */
+#include "websockets.c"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define PORT_SHARED 3994   /* no coalescing, frames are shared */
+#define PORT_COALESCED 3992 /* small frames are copied into the buffer */
+
+#define BIG_SIZE (16 * 1024 * 1024) /* more than the socket buffers hold */
+#define READERS 3 /* the last one reads slowly */
+
+static void fail(const char *msg) {
+  fprintf(stderr, "ERROR: %s\n", msg);
+  exit(-1);
+}
+
+/* *****************************************************************************
+Clients: plain sockets, reading frames when told to
+***************************************************************************** */
+
+static volatile int release_slow, close_all;
+static volatile int read_done[READERS + 1];
+
+static int ws_connect(int port, int rcvbuf) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port)};
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (fd == -1)
+    fail("couldn't open a socket");
+  /* before connecting, so the window stays small */
+  if (rcvbuf)
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)))
+    fail("couldn't connect");
+  const char request[] = "GET / HTTP/1.1\r\n"
+                         "Host: localhost\r\n"
+                         "Upgrade: websocket\r\n"
+                         "Connection: Upgrade\r\n"
+                         "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                         "Sec-WebSocket-Version: 13\r\n\r\n";
+  if (write(fd, request, sizeof(request) - 1) != sizeof(request) - 1)
+    fail("couldn't send the handshake");
+  /* read the response byte by byte, frames may follow it */
+  char buf[1024];
+  size_t len = 0;
+  while (len < 4 || memcmp(buf + len - 4, "\r\n\r\n", 4)) {
+    if (len == sizeof(buf) || read(fd, buf + len, 1) != 1)
+      fail("no handshake response");
+    ++len;
+  }
+  if (strncmp(buf, "HTTP/1.1 101", 12))
+    fail("the upgrade was refused");
+  return fd;
+}
+
+static void read_exact(int fd, void *dest, size_t len) {
+  while (len) {
+    ssize_t r = read(fd, dest, len);
+    if (r <= 0)
+      fail("a connection closed early");
+    dest = (char *)dest + r;
+    len -= (size_t)r;
+  }
+}
+
+/* reads a frame, returning its payload length (the payload is dropped) */
+static size_t read_frame(int fd, uint8_t opcode, uint8_t *payload,
+                         size_t capa) {
+  uint8_t head[10];
+  size_t len;
+  read_exact(fd, head, 2);
+  if (head[0] != (0x80 | opcode) || (head[1] & 0x80))
+    fail("unexpected frame header (masked server frame?)");
+  len = head[1] & 127;
+  if (len == 126) {
+    read_exact(fd, head + 2, 2);
+    len = ((size_t)head[2] << 8) | head[3];
+  } else if (len == 127) {
+    read_exact(fd, head + 2, 8);
+    len = 0;
+    for (int i = 2; i < 10; ++i)
+      len = (len << 8) | head[i];
+  }
+  size_t left = len;
+  uint8_t chunk[65536];
+  while (left) {
+    size_t n = left > sizeof(chunk) ? sizeof(chunk) : left;
+    read_exact(fd, chunk, n);
+    if (payload && len <= capa)
+      memcpy(payload + (len - left), chunk, n);
+    left -= n;
+  }
+  return len;
+}
+
+static void *big_reader(void *index_) {
+  size_t index = (size_t)index_;
+  int fd = ws_connect(PORT_SHARED, index == READERS - 1 ? 4096 : 0);
+  if (index == READERS - 1)
+    while (!release_slow)
+      usleep(1000);
+  if (read_frame(fd, 2, NULL, 0) != BIG_SIZE)
+    fail("the shared frame has the wrong length");
+  read_done[index] = 1;
+  while (!close_all)
+    usleep(1000);
+  close(fd);
+  return NULL;
+}
+
+static void *small_reader(void *ignr) {
+  int fd = ws_connect(PORT_COALESCED, 0);
+  uint8_t payload[16];
+  for (int i = 0; i < 2; ++i) {
+    if (read_frame(fd, 1, payload, sizeof(payload)) != 9 ||
+        memcmp(payload, "coalesced", 9))
+      fail("the coalesced frames were corrupted");
+  }
+  read_done[READERS] = 1;
+  while (!close_all)
+    usleep(1000);
+  close(fd);
+  return ignr;
+}
+
+/* *****************************************************************************
+Server
+***************************************************************************** */
+
+static enum {
+  SHARED,
+  MASKED,
+  COALESCED,
+  CLOSING,
+} phase = SHARED;
+
+static websocket_frame_s *big;
+static ws_s *readers[READERS];
+static size_t opened, closed;
+static volatile int masked_received;
+static pthread_t threads[READERS + 1];
+
+static void server_on_open(ws_s *ws) {
+  /* udata is the connection, so on_close can still write to it */
+  websocket_udata_set(ws, ws);
+  if (phase != SHARED)
+    return;
+  readers[opened++] = ws;
+  if (opened < READERS)
+    return;
+  char *data = fio_malloc(BIG_SIZE);
+  FIO_ASSERT_ALLOC(data);
+  for (size_t i = 0; i < BIG_SIZE; ++i)
+    data[i] = (char)i;
+  big = websocket_frame_new((fio_str_info_s){.data = data, .len = BIG_SIZE}, 0);
+  fio_free(data);
+  for (size_t i = 0; i < READERS; ++i)
+    if (websocket_write_frame(readers[i], big))
+      fail("couldn't write the shared frame");
+}
+
+static void coalesced_on_open(ws_s *ws) {
+  websocket_udata_set(ws, ws);
+  websocket_frame_s *small = websocket_frame_new(
+      (fio_str_info_s){.data = "coalesced", .len = 9}, 1);
+  for (int i = 0; i < 2; ++i)
+    if (websocket_write_frame(ws, small))
+      fail("couldn't write a coalesced frame");
+  if (small->ref != 1)
+    fail("a frame fitting the coalescing buffer was shared");
+  websocket_frame_free(small);
+}
+
+static void server_on_message(ws_s *ws, fio_str_info_s msg, uint8_t is_text) {
+  if (is_text && msg.len == 6 && !memcmp(msg.data, "masked", 6))
+    masked_received = 1;
+  (void)ws;
+}
+
+static void server_on_close(intptr_t uuid, void *udata) {
+  ws_s *ws = udata;
+  websocket_frame_s *small =
+      websocket_frame_new((fio_str_info_s){.data = "late", .len = 4}, 1);
+  if (ws && websocket_write_frame(ws, small) != -1)
+    fail("writing to a closed connection didn't fail");
+  websocket_frame_free(small);
+  ++closed;
+  (void)uuid;
+}
+
+static void on_request(http_s *h) { http_send_error(h, 400); }
+
+static void on_upgrade(http_s *h, char *protocol, size_t len) {
+  if (len != 9 || memcmp(protocol, "websocket", 9)) {
+    http_send_error(h, 400);
+    return;
+  }
+  http_settings_s *s = http_settings(h);
+  http_upgrade2ws(h,
+                  .on_open = (s->ws_coalesce_bytes ? coalesced_on_open
+                                                   : server_on_open),
+                  .on_message = server_on_message,
+                  .on_close = server_on_close);
+}
+
+/* the facil.io client writes a shared frame, which it must mask */
+static void client_on_open(ws_s *ws) {
+  websocket_frame_s *frame =
+      websocket_frame_new((fio_str_info_s){.data = "masked", .len = 6}, 1);
+  if (websocket_write_frame(ws, frame))
+    fail("the client couldn't write a frame");
+  if (frame->ref != 1)
+    fail("a client connection shared an unmasked frame");
+  websocket_frame_free(frame);
+}
+
+static void check(void *ignr) {
+  switch (phase) {
+  case SHARED:
+    if (!big || !read_done[0] || !read_done[1])
+      return;
+    if (!release_slow) {
+      /* ours and the slow reader's, which couldn't flush the frame yet */
+      if (big->ref != 2)
+        fail("the frame was released before the last connection sent it");
+      release_slow = 1;
+      return;
+    }
+    if (!read_done[READERS - 1])
+      return;
+    if (big->ref != 1)
+      fail("a connection kept the frame after sending it");
+    websocket_frame_free(big);
+    big = NULL;
+    phase = MASKED;
+    if (websocket_connect("ws://127.0.0.1:" FIO_MACRO2STR(PORT_SHARED) "/",
+                          .on_open = client_on_open) < 0)
+      fail("couldn't connect the client");
+    return;
+  case MASKED:
+    if (!masked_received)
+      return;
+    phase = COALESCED;
+    if (pthread_create(threads + READERS, NULL, small_reader, NULL))
+      fail("couldn't start a reader");
+    return;
+  case COALESCED:
+    if (!read_done[READERS])
+      return;
+    phase = CLOSING;
+    close_all = 1;
+    return;
+  case CLOSING:
+    /* the three readers and the coalesced one */
+    if (closed >= READERS + 1)
+      fio_stop();
+    return;
+  }
+  (void)ignr;
+}
+
+static void on_timeout(void *arg) {
+  fail("timed out");
+  (void)arg;
+}
+
+int main(void) {
+  if (http_listen(FIO_MACRO2STR(PORT_SHARED), NULL, .on_request = on_request,
+                  .on_upgrade = on_upgrade) == -1 ||
+      http_listen(FIO_MACRO2STR(PORT_COALESCED), NULL,
+                  .on_request = on_request, .on_upgrade = on_upgrade,
+                  .ws_coalesce_bytes = 4096) == -1)
+    fail("couldn't listen");
+  for (size_t i = 0; i < READERS; ++i)
+    if (pthread_create(threads + i, NULL, big_reader, (void *)i))
+      fail("couldn't start a reader");
+  fio_run_every(5, 0, check, NULL, NULL);
+  fio_run_every(30000, 1, on_timeout, NULL, NULL);
+  fio_start(.threads = 1, .workers = 1);
+  for (size_t i = 0; i < READERS + 1; ++i)
+    pthread_join(threads[i], NULL);
+  if (phase != CLOSING)
+    fail("stopped early");
+  fprintf(stderr, "shared, masked and coalesced frames passed.\n");
+  return 0;
+}
@@ -0,0 +1,251 @@
+/**
+ * Tests that WebSocket connections release the memory a large message grew:
+ *
+ * * After a large single frame, the read buffer returns to its initial size.
+ *
+ * * After a large fragmented message, the message assembly buffer is released
+ *   (a small one is kept for the next message).
+ *
+ * * The read buffer isn't shrunk while a large frame is still pending.
+ *
+ * A plain socket client on its own thread sends the (masked) frames and asks
+ * the server for its buffer state between messages. The pending frame case
+ * calls `websocket_shrink_buffer` directly, since a connection that shrank too
+ * early would simply grow the buffer again. The test includes websockets.c to
+ * inspect the connection's buffers.
+ *
+ * Compile with (for example):
+ *
+ *     cc -O2 -Ilib/facil -Ilib/facil/fiobj -Ilib/facil/http \
+ *        -Ilib/facil/http/parsers tests/websocket_shrink.c lib/facil/fio.c \
+ *        $(find lib/facil/fiobj lib/facil/http -name '*.c' \
+ *          ! -name websockets.c) -lpthread -lm
+ */
+#include "websockets.c"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define PORT 3991
+#define BIG_SIZE (WS_BUFFER_SHRINK_LIMIT * 3)
+#define FRAGMENT_SIZE WS_BUFFER_SHRINK_LIMIT
+#define FRAGMENTS 4
+
+static void fail(const char *msg, const char *detail) {
+  fprintf(stderr, "ERROR: %s%s%s\n", msg, (detail ? ": " : ""),
+          (detail ? detail : ""));
+  exit(-1);
+}
+
+/* *****************************************************************************
+Server: answers messages with their length, and "state" with its buffers
+***************************************************************************** */
+
+static void server_on_message(ws_s *ws, fio_str_info_s msg, uint8_t is_text) {
+  char reply[64];
+  int len;
+  if (is_text && msg.len == 5 && !memcmp(msg.data, "state", 5)) {
+    len = snprintf(reply, sizeof(reply), "buffer=%zu msg=%s", ws->buffer.size,
+                   (ws->msg == FIOBJ_INVALID ? "none" : "kept"));
+  } else {
+    for (size_t i = 0; i < msg.len; ++i)
+      if ((uint8_t)msg.data[i] != (uint8_t)i)
+        fail("a message was corrupted", NULL);
+    len = snprintf(reply, sizeof(reply), "%zu", msg.len);
+  }
+  websocket_write(ws, (fio_str_info_s){.data = reply, .len = (size_t)len}, 1);
+}
+
+static void on_request(http_s *h) { http_send_error(h, 400); }
+
+static void on_upgrade(http_s *h, char *protocol, size_t len) {
+  if (len != 9 || memcmp(protocol, "websocket", 9)) {
+    http_send_error(h, 400);
+    return;
+  }
+  http_upgrade2ws(h, .on_message = server_on_message);
+}
+
+/* *****************************************************************************
+Client
+***************************************************************************** */
+
+static int ws_connect(void) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(PORT)};
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (fd == -1 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)))
+    fail("couldn't connect", NULL);
+  const char request[] = "GET / HTTP/1.1\r\n"
+                         "Host: localhost\r\n"
+                         "Upgrade: websocket\r\n"
+                         "Connection: Upgrade\r\n"
+                         "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                         "Sec-WebSocket-Version: 13\r\n\r\n";
+  if (write(fd, request, sizeof(request) - 1) != sizeof(request) - 1)
+    fail("couldn't send the handshake", NULL);
+  /* read the response byte by byte, frames may follow it */
+  char buf[1024];
+  size_t len = 0;
+  while (len < 4 || memcmp(buf + len - 4, "\r\n\r\n", 4)) {
+    if (len == sizeof(buf) || read(fd, buf + len, 1) != 1)
+      fail("no handshake response", NULL);
+    ++len;
+  }
+  if (strncmp(buf, "HTTP/1.1 101", 12))
+    fail("the upgrade was refused", NULL);
+  return fd;
+}
+
+static void write_all(int fd, const void *data, size_t len) {
+  while (len) {
+    ssize_t w = write(fd, data, len);
+    if (w <= 0)
+      fail("couldn't send a frame", NULL);
+    data = (const char *)data + w;
+    len -= (size_t)w;
+  }
+}
+
+/* sends a message, in `fragments` masked frames */
+static void send_message(int fd, const char *msg, size_t len, uint8_t opcode,
+                         size_t fragments) {
+  size_t part = len / fragments;
+  uint8_t *frame = malloc(part + len % fragments + 14);
+  FIO_ASSERT_ALLOC(frame);
+  for (size_t i = 0; i < fragments; ++i) {
+    size_t n = (i + 1 == fragments ? len - (part * i) : part);
+    size_t wrapped =
+        websocket_client_wrap(frame, (void *)(msg + (part * i)), n, opcode,
+                              i == 0, i + 1 == fragments, 0);
+    write_all(fd, frame, wrapped);
+  }
+  free(frame);
+}
+
+/* reads a small text frame from the server */
+static void expect_reply(int fd, const char *expected) {
+  uint8_t buf[128];
+  size_t len = 0;
+  while (len < 2 || len < (size_t)(buf[1] & 127) + 2) {
+    ssize_t r = read(fd, buf + len, sizeof(buf) - 1 - len);
+    if (r <= 0)
+      fail("no reply", expected);
+    len += (size_t)r;
+  }
+  buf[len] = 0;
+  if (buf[0] != 0x81 || (buf[1] & 127) != len - 2 ||
+      strcmp((char *)buf + 2, expected)) {
+    fprintf(stderr, "got: %s\n", (char *)buf + 2);
+    fail("unexpected reply", expected);
+  }
+}
+
+static void *client(void *ignr) {
+  char expected[64];
+  char *data = malloc(BIG_SIZE + FRAGMENT_SIZE * FRAGMENTS);
+  FIO_ASSERT_ALLOC(data);
+  for (size_t i = 0; i < BIG_SIZE + FRAGMENT_SIZE * FRAGMENTS; ++i)
+    data[i] = (char)i;
+  int fd = ws_connect();
+
+  snprintf(expected, sizeof(expected), "buffer=%zu msg=none",
+           (size_t)WS_INITIAL_BUFFER_SIZE);
+  send_message(fd, "state", 5, 1, 1);
+  expect_reply(fd, expected);
+
+  /* a large single frame grows the read buffer */
+  send_message(fd, data, BIG_SIZE, 2, 1);
+  snprintf(expected, sizeof(expected), "%zu", (size_t)BIG_SIZE);
+  expect_reply(fd, expected);
+  snprintf(expected, sizeof(expected), "buffer=%zu msg=none",
+           (size_t)WS_INITIAL_BUFFER_SIZE);
+  send_message(fd, "state", 5, 1, 1);
+  expect_reply(fd, expected);
+
+  /* a large fragmented message grows the assembly buffer */
+  send_message(fd, data, FRAGMENT_SIZE * FRAGMENTS, 2, FRAGMENTS);
+  snprintf(expected, sizeof(expected), "%zu",
+           (size_t)(FRAGMENT_SIZE * FRAGMENTS));
+  expect_reply(fd, expected);
+  snprintf(expected, sizeof(expected), "buffer=%zu msg=none",
+           (size_t)WS_INITIAL_BUFFER_SIZE);
+  send_message(fd, "state", 5, 1, 1);
+  expect_reply(fd, expected);
+
+  /* a small fragmented message keeps its assembly buffer for the next one */
+  send_message(fd, data, 100, 2, 2);
+  expect_reply(fd, "100");
+  snprintf(expected, sizeof(expected), "buffer=%zu msg=kept",
+           (size_t)WS_INITIAL_BUFFER_SIZE);
+  send_message(fd, "state", 5, 1, 1);
+  expect_reply(fd, expected);
+
+  close(fd);
+  free(data);
+  fio_stop();
+  return ignr;
+}
+
+/* *****************************************************************************
+The read buffer, with a frame pending
+***************************************************************************** */
+
+static void test_pending_frame(void) {
+  static char payload[BIG_SIZE];
+  ws_s *ws = calloc(1, sizeof(*ws));
+  FIO_ASSERT_ALLOC(ws);
+  ws->buffer = create_ws_buffer(ws);
+  ws->buffer.size = BIG_SIZE + 16;
+  ws->buffer = resize_ws_buffer(ws, ws->buffer);
+  FIO_ASSERT_ALLOC(ws->buffer.data);
+  const size_t grown = ws->buffer.size;
+
+  /* part of a large frame was read: the buffer is needed for the rest */
+  ws->length = (size_t)websocket_client_wrap(ws->buffer.data, payload,
+                                             BIG_SIZE, 2, 1, 1, 0) /
+               2;
+  websocket_shrink_buffer(ws);
+  if (ws->buffer.size != grown)
+    fail("the read buffer shrank while a large frame was pending", NULL);
+
+  /* a small frame is pending: it's kept, in a smaller buffer */
+  uint8_t small[32];
+  ws->length = (size_t)websocket_client_wrap(ws->buffer.data, "small", 5, 1, 1,
+                                             1, 0);
+  memcpy(small, ws->buffer.data, ws->length);
+  websocket_shrink_buffer(ws);
+  if (ws->buffer.size != WS_INITIAL_BUFFER_SIZE ||
+      memcmp(small, ws->buffer.data, ws->length))
+    fail("the read buffer didn't shrink around a small pending frame", NULL);
+
+  free_ws_buffer(ws, ws->buffer);
+  free(ws);
+}
+
+static void on_timeout(void *arg) {
+  fail("timed out", NULL);
+  (void)arg;
+}
+
+int main(void) {
+  test_pending_frame();
+  if (http_listen(FIO_MACRO2STR(PORT), NULL, .on_request = on_request,
+                  .on_upgrade = on_upgrade,
+                  .ws_max_msg_size = BIG_SIZE * 2) == -1)
+    fail("couldn't listen", NULL);
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, client, NULL))
+    fail("couldn't start the client", NULL);
+  fio_run_every(30000, 1, on_timeout, NULL, NULL);
+  fio_start(.threads = 1, .workers = 1);
+  pthread_join(thread, NULL);
+  fprintf(stderr, "large frames and fragmented messages released memory.\n");
+  return 0;
+}
@@ -15,7 +15,6 @@ const std = @import("std");
 const Allocator = std.mem.Allocator;
 const ArenaAllocator = std.heap.ArenaAllocator;
 const Thread = std.Thread;
-const RwLock = Thread.RwLock;
 
 const zap = @import("zap.zig");
 const Request = zap.Request;
@@ -25,7 +24,38 @@ const ErrorStrategy = zap.Endpoint.ErrorStrategy;
 pub const AppOpts = struct {
     /// ErrorStrategy for (optional) request handler if no endpoint matches
     default_error_strategy: ErrorStrategy = .log_to_console,
+    /// Upper limit of memory a thread's request arena keeps between requests
     arena_retain_capacity: usize = 16 * 1024 * 1024,
+    /// How much memory a thread's request arena keeps between requests
+    arena_retain_policy: ArenaRetainPolicy = .high_water,
+    /// Number of requests per window, see ArenaRetainPolicy.high_water
+    arena_high_water_window: usize = 1024,
+};
+
+pub const ArenaRetainPolicy = enum {
+    /// Always keep up to `arena_retain_capacity` bytes.
+    fixed,
+    /// Keep as much as the biggest request of the current or the previous
+    /// window of `arena_high_water_window` requests needed, up to
+    /// `arena_retain_capacity` bytes. Memory from a burst of big requests is
+    /// released once they no longer occur.
+    high_water,
+    /// Free all memory after each request.
+    free_all,
+};
+
+/// Per-thread request arena counters, see `App.arenaStats()`.
+pub const ArenaStats = struct {
+    thread_id: Thread.Id,
+    /// most memory used by a single request
+    peak_bytes: usize,
+    /// memory kept after the last request
+    retained_bytes: usize,
+    /// number of requests served from the arena
+    resets: usize,
+    /// number of times a request outgrew the retained memory and the arena
+    /// had to allocate from the gpa
+    gpa_fallbacks: usize,
 };
 
 /// creates an App with custom app context
@@ -55,8 +85,10 @@ pub fn Create(
             endpoints: std.ArrayListUnmanaged(*Endpoint.Interface) = .empty,
 
             there_can_be_only_one: bool = false,
-            track_arenas: std.AutoHashMapUnmanaged(Thread.Id, ArenaAllocator) = .empty,
-            track_arena_lock: RwLock = .{},
+            /// all threads' request arenas. only locked when a thread uses its
+            /// arena for the first time, and by arenaStats() and deinit().
+            arenas: std.ArrayListUnmanaged(*RequestArena) = .empty,
+            arenas_lock: Thread.Mutex = .{},
 
             /// the internal http listener
             listener: HttpListener = undefined,
@@ -73,9 +105,176 @@ pub fn Create(
             /// provides an `unhandledError` function of type `fn(*Context,
             /// Allocator, Request, anyerror) void`.
             unhandled_error: ?*const fn (*Context, Request, anyerror) void = null,
+
+            /// the compile-time route table, see registerRoutes()
+            routes: ?*const anyopaque = null,
+            routes_dispatch: *const fn (*const anyopaque, Request) anyerror!bool = undefined,
+            routes_paths: []const []const u8 = &.{},
         };
         var _static: InstanceData = .{};
 
+        /// this thread's request arena, valid while `_thread_arena_generation`
+        /// equals `_generation`
+        threadlocal var _thread_arena: ?*RequestArena = null;
+        threadlocal var _thread_arena_generation: usize = 0;
+        /// bumped by deinit(), which frees the arenas of all threads
+        var _generation: usize = 0;
+
+        /// A request arena, owned by one thread. Its counters are atomics so
+        /// arenaStats() can read them, but only the owning thread writes them.
+        const RequestArena = struct {
+            arena: ArenaAllocator,
+            gpa: Allocator,
+            thread_id: Thread.Id,
+
+            /// bytes handed out to the current request
+            request_bytes: usize = 0,
+            /// set when the current request made the arena allocate from the gpa
+            grew: bool = false,
+
+            // high water mark state
+            requests_in_window: usize = 0,
+            window_peak: usize = 0,
+            prev_window_peak: usize = 0,
+
+            peak_bytes: std.atomic.Value(usize) = .init(0),
+            retained_bytes: std.atomic.Value(usize) = .init(0),
+            resets: std.atomic.Value(usize) = .init(0),
+            gpa_fallbacks: std.atomic.Value(usize) = .init(0),
+
+            /// The allocator passed to request handlers: the arena, counting
+            /// the bytes a request allocates.
+            const request_vtable: Allocator.VTable = .{
+                .alloc = requestAlloc,
+                .resize = requestResize,
+                .remap = requestRemap,
+                .free = requestFree,
+            };
+
+            /// The arena's child allocator: the gpa, noting when the arena
+            /// grows.
+            const counting_vtable: Allocator.VTable = .{
+                .alloc = countingAlloc,
+                .resize = countingResize,
+                .remap = countingRemap,
+                .free = countingFree,
+            };
+
+            fn create(gpa: Allocator) !*RequestArena {
+                const self = try gpa.create(RequestArena);
+                self.* = .{
+                    .arena = ArenaAllocator.init(.{ .ptr = self, .vtable = &counting_vtable }),
+                    .gpa = gpa,
+                    .thread_id = Thread.getCurrentId(),
+                };
+                return self;
+            }
+
+            fn destroy(self: *RequestArena) void {
+                self.arena.deinit();
+                self.gpa.destroy(self);
+            }
+
+            fn allocator(self: *RequestArena) Allocator {
+                return .{ .ptr = self, .vtable = &request_vtable };
+            }
+
+            /// Call after each request: resets the arena according to the
+            /// retain policy and updates the counters.
+            fn reset(self: *RequestArena) void {
+                const opts = &_static.opts;
+                const used = self.request_bytes;
+                self.request_bytes = 0;
+                if (used > self.peak_bytes.raw) self.peak_bytes.store(used, .monotonic);
+
+                const limit = switch (opts.arena_retain_policy) {
+                    .fixed => opts.arena_retain_capacity,
+                    .free_all => 0,
+                    .high_water => blk: {
+                        self.window_peak = @max(self.window_peak, used);
+                        self.requests_in_window += 1;
+                        if (self.requests_in_window >= opts.arena_high_water_window) {
+                            self.prev_window_peak = self.window_peak;
+                            self.window_peak = 0;
+                            self.requests_in_window = 0;
+                        }
+                        break :blk @min(
+                            opts.arena_retain_capacity,
+                            @max(self.window_peak, self.prev_window_peak),
+                        );
+                    },
+                };
+                if (self.grew) self.gpa_fallbacks.store(self.gpa_fallbacks.raw + 1, .monotonic);
+                _ = self.arena.reset(if (limit == 0) .free_all else .{ .retain_with_limit = limit });
+                // reset() itself reallocates the retained buffer
+                self.grew = false;
+
+                self.retained_bytes.store(self.arena.queryCapacity(), .monotonic);
+                self.resets.store(self.resets.raw + 1, .monotonic);
+            }
+
+            fn stats(self: *RequestArena) ArenaStats {
+                return .{
+                    .thread_id = self.thread_id,
+                    .peak_bytes = self.peak_bytes.load(.monotonic),
+                    .retained_bytes = self.retained_bytes.load(.monotonic),
+                    .resets = self.resets.load(.monotonic),
+                    .gpa_fallbacks = self.gpa_fallbacks.load(.monotonic),
+                };
+            }
+
+            fn requestAlloc(ctx: *anyopaque, len: usize, alignment: std.mem.Alignment, ret_addr: usize) ?[*]u8 {
+                const self: *RequestArena = @ptrCast(@alignCast(ctx));
+                const ptr = self.arena.allocator().rawAlloc(len, alignment, ret_addr) orelse return null;
+                self.request_bytes += len;
+                return ptr;
+            }
+
+            fn requestResize(ctx: *anyopaque, memory: []u8, alignment: std.mem.Alignment, new_len: usize, ret_addr: usize) bool {
+                const self: *RequestArena = @ptrCast(@alignCast(ctx));
+                if (!self.arena.allocator().rawResize(memory, alignment, new_len, ret_addr)) return false;
+                if (new_len > memory.len) self.request_bytes += new_len - memory.len;
+                return true;
+            }
+
+            fn requestRemap(ctx: *anyopaque, memory: []u8, alignment: std.mem.Alignment, new_len: usize, ret_addr: usize) ?[*]u8 {
+                const self: *RequestArena = @ptrCast(@alignCast(ctx));
+                const ptr = self.arena.allocator().rawRemap(memory, alignment, new_len, ret_addr) orelse return null;
+                if (new_len > memory.len) self.request_bytes += new_len - memory.len;
+                return ptr;
+            }
+
+            fn requestFree(ctx: *anyopaque, memory: []u8, alignment: std.mem.Alignment, ret_addr: usize) void {
+                const self: *RequestArena = @ptrCast(@alignCast(ctx));
+                self.arena.allocator().rawFree(memory, alignment, ret_addr);
+            }
+
+            fn countingAlloc(ctx: *anyopaque, len: usize, alignment: std.mem.Alignment, ret_addr: usize) ?[*]u8 {
+                const self: *RequestArena = @ptrCast(@alignCast(ctx));
+                self.grew = true;
+                return self.gpa.rawAlloc(len, alignment, ret_addr);
+            }
+
+            fn countingResize(ctx: *anyopaque, memory: []u8, alignment: std.mem.Alignment, new_len: usize, ret_addr: usize) bool {
+                const self: *RequestArena = @ptrCast(@alignCast(ctx));
+                if (!self.gpa.rawResize(memory, alignment, new_len, ret_addr)) return false;
+                if (new_len > memory.len) self.grew = true;
+                return true;
+            }
+
+            fn countingRemap(ctx: *anyopaque, memory: []u8, alignment: std.mem.Alignment, new_len: usize, ret_addr: usize) ?[*]u8 {
+                const self: *RequestArena = @ptrCast(@alignCast(ctx));
+                const ptr = self.gpa.rawRemap(memory, alignment, new_len, ret_addr) orelse return null;
+                if (new_len > memory.len) self.grew = true;
+                return ptr;
+            }
+
+            fn countingFree(ctx: *anyopaque, memory: []u8, alignment: std.mem.Alignment, ret_addr: usize) void {
+                const self: *RequestArena = @ptrCast(@alignCast(ctx));
+                self.gpa.rawFree(memory, alignment, ret_addr);
+            }
+        };
+
         pub const Endpoint = struct {
             pub const Interface = struct {
                 call: *const fn (*Interface, Request) anyerror!void = undefined,
@@ -104,39 +303,68 @@ pub fn Create(
 
                     pub fn onRequestInterface(interface: *Interface, r: Request) !void {
                         var self: *Bound = Bound.unwrap(interface);
-                        var arena = try get_arena();
+                        const arena = try requestArena();
+                        defer arena.reset();
                         try self.onRequest(arena.allocator(), self.app_context, r);
-                        _ = arena.reset(.{ .retain_with_limit = _static.opts.arena_retain_capacity });
                     }
 
                     pub fn onRequest(self: *Bound, arena: Allocator, app_context: *Context, r: Request) !void {
-                        // TODO: simplitfy this with @tagName?
-                        const ret = switch (r.methodAsEnum()) {
-                            .GET => callHandlerIfExist("get", self.endpoint, arena, app_context, r),
-                            .POST => callHandlerIfExist("post", self.endpoint, arena, app_context, r),
-                            .PUT => callHandlerIfExist("put", self.endpoint, arena, app_context, r),
-                            .DELETE => callHandlerIfExist("delete", self.endpoint, arena, app_context, r),
-                            .PATCH => callHandlerIfExist("patch", self.endpoint, arena, app_context, r),
-                            .OPTIONS => callHandlerIfExist("options", self.endpoint, arena, app_context, r),
-                            .HEAD => callHandlerIfExist("head", self.endpoint, arena, app_context, r),
-                            else => error.UnsupportedHtmlRequestMethod,
-                        };
-                        if (ret) {
-                            // handled without error
-                        } else |err| {
-                            switch (self.endpoint.*.error_strategy) {
-                                .raise => return err,
-                                .log_to_response => return r.sendError(err, if (@errorReturnTrace()) |t| t.* else null, 505),
-                                .log_to_console => zap.log.err(
-                                    "Error in {} {s} : {}",
-                                    .{ Bound, r.method orelse "(no method)", err },
-                                ),
-                            }
-                        }
+                        return handleRequest(self.endpoint, arena, app_context, r);
                     }
                 };
             }
 
+            /// Call the handler of endpoint `e` for the request method and
+            /// deal with errors according to the endpoint's ErrorStrategy.
+            pub fn handleRequest(e: anytype, arena: Allocator, app_context: *Context, r: Request) !void {
+                // TODO: simplitfy this with @tagName?
+                const ret = switch (r.methodAsEnum()) {
+                    .GET => callHandlerIfExist("get", e, arena, app_context, r),
+                    .POST => callHandlerIfExist("post", e, arena, app_context, r),
+                    .PUT => callHandlerIfExist("put", e, arena, app_context, r),
+                    .DELETE => callHandlerIfExist("delete", e, arena, app_context, r),
+                    .PATCH => callHandlerIfExist("patch", e, arena, app_context, r),
+                    .OPTIONS => callHandlerIfExist("options", e, arena, app_context, r),
+                    .HEAD => callHandlerIfExist("head", e, arena, app_context, r),
+                    else => error.UnsupportedHtmlRequestMethod,
+                };
+                if (ret) {
+                    // handled without error
+                } else |err| {
+                    switch (e.*.error_strategy) {
+                        .raise => return err,
+                        .log_to_response => return r.sendError(err, if (@errorReturnTrace()) |t| t.* else null, 505),
+                        .log_to_console => zap.log.err(
+                            "Error in {s} {s} : {}",
+                            .{ @typeName(@TypeOf(e.*)), r.method orelse "(no method)", err },
+                        ),
+                    }
+                }
+            }
+
+            /// A route table that is known at compile time, for
+            /// `App.registerRoutes()`. See `zap.Endpoint.Routes()`.
+            ///
+            /// ```zig
+            /// const MyRoutes = App.Endpoint.Routes(.{
+            ///     .{ "/users", UserEndpoint },
+            ///     .{ "/stop", StopEndpoint },
+            /// });
+            /// const routes: MyRoutes = .{ .endpoints = .{ &user_endpoint, &stop_endpoint } };
+            /// try App.registerRoutes(&routes);
+            /// ```
+            pub fn Routes(comptime routes: anytype) type {
+                return zap.Endpoint.RouteTable(routes, checkEndpointType, callRoute);
+            }
+
+            /// Serve a request matched by a route table, with this thread's
+            /// request arena.
+            fn callRoute(e: anytype, r: Request) anyerror!void {
+                const arena = try requestArena();
+                defer arena.reset();
+                return handleRequest(e, arena.allocator(), _static.context, r);
+            }
+
             pub fn init(ArbitraryEndpoint: type, endpoint: *ArbitraryEndpoint) Endpoint.Bind(ArbitraryEndpoint) {
                 checkEndpointType(ArbitraryEndpoint);
                 const BoundEp = Endpoint.Bind(ArbitraryEndpoint);
@@ -329,6 +557,17 @@ pub fn Create(
             max_body_size: ?usize = null,
             timeout: ?u8 = null,
             tls: ?zap.Tls = null,
+            /// optional response cache, see zap.ResponseCache
+            response_cache: ?*zap.ResponseCache = null,
+            /// called once the App is serving requests, see zap.HttpListenerSettings
+            on_ready: ?zap.HttpReadyFn = null,
+            /// per-IP limits, see zap.HttpListenerSettings
+            max_clients_per_ip: u32 = 0,
+            max_requests_per_ip: u32 = 0,
+            max_requests_burst: u32 = 0,
+            /// load shedding, see zap.HttpListenerSettings
+            shed_target_ms: u32 = 0,
+            priority_hints: []const zap.PriorityHint = &.{},
         };
 
         pub fn init(gpa_: Allocator, context_: *Context, opts_: AppOpts) !void {
@@ -377,14 +616,17 @@ pub fn Create(
             }
             _static.endpoints.deinit(_static.gpa);
 
-            _static.track_arena_lock.lock();
-            defer _static.track_arena_lock.unlock();
+            _static.arenas_lock.lock();
+            defer _static.arenas_lock.unlock();
 
-            var it = _static.track_arenas.valueIterator();
-            while (it.next()) |arena| {
-                arena.deinit();
+            for (_static.arenas.items) |arena| {
+                arena.destroy();
             }
-            _static.track_arenas.deinit(_static.gpa);
+            _static.arenas.deinit(_static.gpa);
+            _static.arenas = .empty;
+            // other threads may still point at their (freed) arenas
+            _generation +%= 1;
+            _thread_arena = null;
         }
 
         // This can be resolved at comptime so *perhaps it does affect optimiazation
@@ -402,20 +644,43 @@ pub fn Create(
             return;
         }
 
+        /// Returns this thread's request arena. Prefer the arena passed to
+        /// your request handlers, which is reset after each request.
         pub fn get_arena() !*ArenaAllocator {
-            const thread_id = std.Thread.getCurrentId();
-            _static.track_arena_lock.lockShared();
-            if (_static.track_arenas.getPtr(thread_id)) |arena| {
-                _static.track_arena_lock.unlockShared();
-                return arena;
-            } else {
-                _static.track_arena_lock.unlockShared();
-                _static.track_arena_lock.lock();
-                defer _static.track_arena_lock.unlock();
-                const arena = ArenaAllocator.init(_static.gpa);
-                try _static.track_arenas.put(_static.gpa, thread_id, arena);
-                return _static.track_arenas.getPtr(thread_id).?;
+            return &(try requestArena()).arena;
+        }
+
+        fn requestArena() !*RequestArena {
+            if (_thread_arena) |arena| {
+                if (_thread_arena_generation == _generation) return arena;
             }
+            return newRequestArena();
+        }
+
+        /// slow path: a thread's first request
+        fn newRequestArena() !*RequestArena {
+            const arena = try RequestArena.create(_static.gpa);
+            errdefer arena.destroy();
+
+            _static.arenas_lock.lock();
+            defer _static.arenas_lock.unlock();
+            try _static.arenas.append(_static.gpa, arena);
+            _thread_arena = arena;
+            _thread_arena_generation = _generation;
+            return arena;
+        }
+
+        /// Get a snapshot of the request arena counters of all threads that
+        /// have served requests. Free the result with `allocator`.
+        pub fn arenaStats(allocator: Allocator) ![]ArenaStats {
+            _static.arenas_lock.lock();
+            defer _static.arenas_lock.unlock();
+
+            const result = try allocator.alloc(ArenaStats, _static.arenas.items.len);
+            for (_static.arenas.items, result) |arena, *stats| {
+                stats.* = arena.stats();
+            }
+            return result;
         }
 
         /// Register an endpoint with this listener.
@@ -438,6 +703,11 @@ pub fn Create(
                     return zap.Endpoint.ListenerError.EndpointPathShadowError;
                 }
             }
+            for (_static.routes_paths) |path| {
+                if (zap.Endpoint.pathsOverlap(path, endpoint.path)) {
+                    return zap.Endpoint.ListenerError.EndpointPathShadowError;
+                }
+            }
             const EndpointType = @typeInfo(@TypeOf(endpoint)).pointer.child;
             Endpoint.checkEndpointType(EndpointType);
             const bound = try _static.gpa.create(Endpoint.Bind(EndpointType));
@@ -445,6 +715,32 @@ pub fn Create(
             try _static.endpoints.append(_static.gpa, &bound.interface);
         }
 
+        /// Register a compile-time route table, see `Endpoint.Routes()`. Its
+        /// endpoints are matched before the ones added with register().
+        /// `table` must outlive the App.
+        pub fn registerRoutes(table: anytype) !void {
+            const Table = @typeInfo(@TypeOf(table)).pointer.child;
+            if (_static.routes != null) {
+                return zap.Endpoint.ListenerError.RoutesAlreadyRegistered;
+            }
+            for (Table.paths) |path| {
+                for (_static.endpoints.items) |other| {
+                    if (zap.Endpoint.pathsOverlap(path, other.path)) {
+                        return zap.Endpoint.ListenerError.EndpointPathShadowError;
+                    }
+                }
+            }
+            const Dispatch = struct {
+                fn dispatch(ptr: *const anyopaque, r: Request) anyerror!bool {
+                    const t: *const Table = @ptrCast(@alignCast(ptr));
+                    return t.dispatch(r);
+                }
+            };
+            _static.routes = table;
+            _static.routes_dispatch = Dispatch.dispatch;
+            _static.routes_paths = Table.paths;
+        }
+
         pub fn listen(l: ListenerSettings) !void {
             _static.listener = HttpListener.init(.{
                 .interface = l.interface,
@@ -454,6 +750,13 @@ pub fn Create(
                 .max_body_size = l.max_body_size,
                 .timeout = l.timeout,
                 .tls = l.tls,
+                .response_cache = l.response_cache,
+                .on_ready = l.on_ready,
+                .max_clients_per_ip = l.max_clients_per_ip,
+                .max_requests_per_ip = l.max_requests_per_ip,
+                .max_requests_burst = l.max_requests_burst,
+                .shed_target_ms = l.shed_target_ms,
+                .priority_hints = l.priority_hints,
 
                 .on_request = onRequest,
             });
@@ -461,6 +764,19 @@ pub fn Create(
         }
 
         fn onRequest(r: Request) !void {
+            if (_static.routes) |table| {
+                const handled = _static.routes_dispatch(table, r) catch |err| blk: {
+                    // if error is not dealt with in the endpoint, e.g.
+                    // if error strategy is .raise:
+                    if (_static.unhandled_error) |error_cb| {
+                        error_cb(_static.context, r, err);
+                    } else {
+                        zap.log.err("App.Endpoint onRequest error {} in route table\n", .{err});
+                    }
+                    break :blk true;
+                };
+                if (handled) return;
+            }
             if (r.path) |p| {
                 for (_static.endpoints.items) |interface| {
                     if (std.mem.startsWith(u8, p, interface.path)) {
@@ -482,7 +798,8 @@ pub fn Create(
 
             // this is basically the "not found" handler
             if (_static.unhandled_request) |foo| {
-                var arena = try get_arena();
+                const arena = try requestArena();
+                defer arena.reset();
                 foo(_static.context, arena.allocator(), r) catch |err| {
                     switch (_static.opts.default_error_strategy) {
                         .raise => if (_static.unhandled_error) |error_cb| {
@@ -0,0 +1,274 @@
+//! A bounded thread pool for blocking or CPU-heavy work (password hashing,
+//! database calls, file generation, ...), separate from the server's I/O
+//! threads.
+//!
+//! Work submitted from a request handler runs on one of the pool's own
+//! threads, so a slow endpoint can't starve socket I/O for everyone. The pool
+//! has its own queue: when `max_queued` tasks are waiting, `submit()` fails
+//! with `error.QueueFull` instead of queueing more work than the pool can
+//! handle.
+//!
+//! When a task completes, an optional continuation is scheduled back onto the
+//! server's I/O threads. `submitPaused()` combines this with
+//! `Request.pause()`: the work runs on the pool, then the request is resumed.
+//!
+//! Threads don't survive `fork()`: with `workers > 1`, use `startWithServer()`
+//! so that every worker process starts threads of its own. `start()` only
+//! suits single process servers (or work outside of the server).
+//!
+//! ```zig
+//! var pool = try zap.BlockingPool.init(allocator, .{ .threads = 4 });
+//! defer pool.deinit();
+//! pool.startWithServer(); // before zap.start()
+//!
+//! fn on_request(r: zap.Request) !void {
+//!     const job = try allocator.create(Job);
+//!     r.pause(job, startJob);
+//! }
+//!
+//! fn startJob(paused: zap.Request.PausedRequest(*Job)) void {
+//!     pool.submitPaused(paused, Job.hashPassword, Job.respond) catch {
+//!         paused.resumeWith(Job.respondBusy, null);
+//!     };
+//! }
+//! ```
+const std = @import("std");
+const Allocator = std.mem.Allocator;
+
+const fio = @import("fio.zig");
+const zap = @import("zap.zig");
+const Request = zap.Request;
+
+const BlockingPool = @This();
+
+pub const Options = struct {
+    /// Number of worker threads.
+    threads: usize = 4,
+    /// Maximum number of tasks waiting for a thread.
+    max_queued: usize = 1024,
+};
+
+/// Counters, see `stats()`.
+pub const Stats = struct {
+    /// tasks currently waiting for a thread
+    queued: usize = 0,
+    /// tasks currently running
+    running: usize = 0,
+    completed: usize = 0,
+    /// submissions that failed because the queue was full
+    rejected: usize = 0,
+    /// time completed tasks spent waiting in the queue
+    total_wait_ns: u64 = 0,
+    max_wait_ns: u64 = 0,
+};
+
+pub const Error = error{
+    QueueFull,
+    NotRunning,
+};
+
+/// A type erased task. `run` performs the work and schedules the continuation.
+const Task = struct {
+    run: *const fn (Task) void,
+    context: *anyopaque,
+    /// a paused request handle, if any
+    extra: ?*anyopaque = null,
+    queued_at: u64 = 0,
+};
+
+allocator: Allocator,
+options: Options,
+mutex: std.Thread.Mutex = .{},
+not_empty: std.Thread.Condition = .{},
+/// ring buffer of `options.max_queued` tasks
+tasks: []Task,
+head: usize = 0,
+threads: []std.Thread = &.{},
+running: bool = false,
+timer: std.time.Timer,
+counters: Stats = .{},
+
+/// Create a blocking pool. Call `start()` to spawn its threads.
+pub fn init(allocator: Allocator, options: Options) !BlockingPool {
+    std.debug.assert(options.threads > 0 and options.max_queued > 0);
+    return .{
+        .allocator = allocator,
+        .options = options,
+        .tasks = try allocator.alloc(Task, options.max_queued),
+        .timer = try std.time.Timer.start(),
+    };
+}
+
+/// Stop the pool (see `stop()`) and free its memory.
+pub fn deinit(self: *BlockingPool) void {
+    self.stop();
+    self.allocator.free(self.tasks);
+}
+
+/// Spawn the worker threads. The pool must not be moved afterwards.
+///
+/// The threads only exist in the calling process: when called before
+/// `zap.start()` with `workers > 1`, tasks submitted by the worker processes
+/// never run. See `startWithServer()`.
+pub fn start(self: *BlockingPool) !void {
+    self.mutex.lock();
+    defer self.mutex.unlock();
+    if (self.running) return;
+
+    self.threads = try self.allocator.alloc(std.Thread, self.options.threads);
+    var spawned: usize = 0;
+    errdefer {
+        self.running = false;
+        self.not_empty.broadcast();
+        self.mutex.unlock();
+        for (self.threads[0..spawned]) |t| t.join();
+        self.mutex.lock();
+        self.allocator.free(self.threads);
+        self.threads = &.{};
+    }
+    self.running = true;
+    while (spawned < self.threads.len) : (spawned += 1) {
+        self.threads[spawned] = try std.Thread.spawn(.{}, worker, .{self});
+    }
+}
+
+/// Start the pool in every worker process once the server runs, and stop it
+/// when the server stops. Call before `zap.start()` (again before each
+/// `zap.start()`). The pool must not be moved afterwards.
+pub fn startWithServer(self: *BlockingPool) void {
+    fio.fio_state_callback_add(fio.FIO_CALL_ON_START, onServerStart, self);
+    fio.fio_state_callback_add(fio.FIO_CALL_ON_FINISH, onServerFinish, self);
+}
+
+fn onServerStart(arg: ?*anyopaque) callconv(.c) void {
+    const self: *BlockingPool = @ptrCast(@alignCast(arg.?));
+    self.start() catch |err| {
+        zap.Logging.on_uncaught_error("BlockingPool start", err);
+    };
+}
+
+fn onServerFinish(arg: ?*anyopaque) callconv(.c) void {
+    const self: *BlockingPool = @ptrCast(@alignCast(arg.?));
+    self.stop();
+}
+
+/// Stop accepting tasks, finish the queued ones and join the threads.
+pub fn stop(self: *BlockingPool) void {
+    self.mutex.lock();
+    self.running = false;
+    self.not_empty.broadcast();
+    const threads = self.threads;
+    self.threads = &.{};
+    self.mutex.unlock();
+
+    for (threads) |t| t.join();
+    if (threads.len > 0) self.allocator.free(threads);
+}
+
+/// Get a snapshot of the pool's counters.
+pub fn stats(self: *BlockingPool) Stats {
+    self.mutex.lock();
+    defer self.mutex.unlock();
+    return self.counters;
+}
+
+/// Run `work(context)` on the pool. When it returns, `done(context)` (if
+/// provided) is scheduled onto the server's I/O threads.
+///
+/// `context` must be a single-item pointer that stays valid until `done` (or
+/// `work`, without `done`) has run.
+pub fn submit(
+    self: *BlockingPool,
+    context: anytype,
+    comptime work: fn (@TypeOf(context)) void,
+    comptime done: ?fn (@TypeOf(context)) void,
+) Error!void {
+    const Context = @TypeOf(context);
+    const Wrapper = struct {
+        fn run(task: Task) void {
+            const ctx: Context = @ptrCast(@alignCast(task.context));
+            work(ctx);
+            if (done != null) {
+                _ = fio.fio_defer(continuation, task.context, null);
+            }
+        }
+
+        fn continuation(udata1: ?*anyopaque, _: ?*anyopaque) callconv(.c) void {
+            if (done) |d| d(@ptrCast(@alignCast(udata1.?)));
+        }
+    };
+    try self.push(.{ .run = Wrapper.run, .context = @ptrCast(@constCast(context)) });
+}
+
+/// Run `work(context)` on the pool for a paused request, then resume the
+/// request with `on_resume` (see `Request.PausedRequest.resumeWith()`).
+///
+/// On error, the request is still paused and must be resumed by the caller,
+/// e.g. with a 503 response.
+pub fn submitPaused(
+    self: *BlockingPool,
+    paused: anytype,
+    comptime work: fn (@TypeOf(paused.context)) void,
+    comptime on_resume: fn (Request, @TypeOf(paused.context)) anyerror!void,
+) Error!void {
+    const Context = @TypeOf(paused.context);
+    const Paused = Request.PausedRequest(Context);
+    const Wrapper = struct {
+        fn run(task: Task) void {
+            const p: Paused = .{
+                .handle = @ptrCast(task.extra.?),
+                .context = @ptrCast(@alignCast(task.context)),
+            };
+            work(p.context);
+            // http_resume() continues on the I/O threads
+            p.resumeWith(on_resume, null);
+        }
+    };
+    try self.push(.{
+        .run = Wrapper.run,
+        .context = @ptrCast(@constCast(paused.context)),
+        .extra = @ptrCast(paused.handle),
+    });
+}
+
+fn push(self: *BlockingPool, task: Task) Error!void {
+    self.mutex.lock();
+    defer self.mutex.unlock();
+    if (!self.running) return error.NotRunning;
+    if (self.counters.queued == self.tasks.len) {
+        self.counters.rejected += 1;
+        return error.QueueFull;
+    }
+    var t = task;
+    t.queued_at = self.timer.read();
+    self.tasks[(self.head + self.counters.queued) % self.tasks.len] = t;
+    self.counters.queued += 1;
+    self.not_empty.signal();
+}
+
+fn worker(self: *BlockingPool) void {
+    self.mutex.lock();
+    while (true) {
+        while (self.counters.queued == 0 and self.running) {
+            self.not_empty.wait(&self.mutex);
+        }
+        // finish queued work before stopping
+        if (self.counters.queued == 0) break;
+
+        const task = self.tasks[self.head];
+        self.head = (self.head + 1) % self.tasks.len;
+        self.counters.queued -= 1;
+        self.counters.running += 1;
+        const waited = self.timer.read() -| task.queued_at;
+        self.counters.total_wait_ns += waited;
+        self.counters.max_wait_ns = @max(self.counters.max_wait_ns, waited);
+        self.mutex.unlock();
+
+        task.run(task);
+
+        self.mutex.lock();
+        self.counters.running -= 1;
+        self.counters.completed += 1;
+    }
+    self.mutex.unlock();
+}
@@ -29,6 +29,56 @@ pub extern fn fio_log_error(msg: [*c]const u8) void;
 pub extern fn fio_log_fatal(msg: [*c]const u8) void;
 pub extern fn fio_log_debug(msg: [*c]const u8) void;
 
+/// Access log line format, see `AccessLogSettings`.
+pub const AccessLogFormat = enum(c_int) {
+    /// `peer - - [date] "METHOD path VERSION" status bytes duration`
+    common = 0,
+    /// One JSON object per line
+    json = 1,
+};
+
+/// Settings for the asynchronous access log.
+pub const AccessLogSettings = struct {
+    /// null or "stderr": stderr, "-" or "stdout": stdout, "unix:/path": a unix
+    /// stream socket; anything else is a file path opened for appending.
+    target: ?[:0]const u8 = null,
+    format: AccessLogFormat = .common,
+    /// log only one of every `sample_rate` requests
+    sample_rate: u32 = 1,
+    /// records buffered per thread before dropping (rounded up to a power of 2)
+    ring_size: u32 = 1024,
+    /// how often the background writer flushes
+    flush_interval_ms: u32 = 50,
+};
+
+pub const AccessLogError = error{AccessLogSetup};
+
+/// Makes listeners with `.log = true` log through a buffered background writer
+/// instead of writing to stderr from the request thread.
+///
+/// Request threads copy a small record into a per-thread ring buffer, a writer
+/// thread per worker batches them into large writes. When a ring is full, the
+/// record is dropped and counted (see `accessLogDropped()`) instead of
+/// blocking the request.
+///
+/// Call this before `zap.start()`.
+pub fn setupAccessLog(settings: AccessLogSettings) AccessLogError!void {
+    const fio = @import("fio.zig");
+    const ret = fio.http_log_setup(.{
+        .target = if (settings.target) |t| t.ptr else null,
+        .format = @intFromEnum(settings.format),
+        .sample_rate = settings.sample_rate,
+        .ring_size = settings.ring_size,
+        .flush_interval_ms = settings.flush_interval_ms,
+    });
+    if (ret != 0) return error.AccessLogSetup;
+}
+
+/// Number of access log records dropped because a ring buffer was full.
+pub fn accessLogDropped() usize {
+    return @import("fio.zig").http_log_dropped();
+}
+
 /// Error reporting of last resort
 pub fn on_uncaught_error(comptime domain: []const u8, err: anyerror) void {
     const std = @import("std");
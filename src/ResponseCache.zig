@@ -0,0 +1,622 @@
+//! An optional response micro-cache that sits in front of your request
+//! handlers.
+//!
+//! Pass a pointer to a `ResponseCache` to the `response_cache` field of
+//! `zap.HttpListenerSettings` (or `App.ListenerSettings`,
+//! `Endpoint.Listener.Settings`). Only `GET` requests are considered.
+//!
+//! A response becomes cacheable when the handler either calls
+//! `r.cacheFor(seconds, vary)` before sending the body, or sets a
+//! `Cache-Control: max-age=N` response header (`private`, `no-store` and
+//! `no-cache` are respected). Responses setting cookies are never cached.
+//!
+//! Cached responses are stored as one serialized buffer (status, headers,
+//! body), keyed by method, host, path, query and the values of the request
+//! headers listed in `vary`. Subsequent hits are served without calling the
+//! handler.
+//!
+//! Concurrent misses for the same key are coalesced: only the first request
+//! runs the handler, the others are paused (see `Request.pause()`, no thread
+//! waits) until its result is stored, or up to `coalesce_timeout_ms`. This
+//! protects expensive pages from stampedes after expiry.
+//!
+//! ```zig
+//! var cache = zap.ResponseCache.init(allocator, .{});
+//! defer cache.deinit();
+//!
+//! var listener = zap.HttpListener.init(.{
+//!     .port = 3000,
+//!     .on_request = on_request,
+//!     .response_cache = &cache,
+//! });
+//!
+//! fn on_request(r: zap.Request) !void {
+//!     r.cacheFor(5, &.{"accept-language"});
+//!     try r.sendBody(try renderExpensivePage());
+//! }
+//! ```
+const std = @import("std");
+const Allocator = std.mem.Allocator;
+
+const fio = @import("fio.zig");
+const util = @import("util.zig");
+const zap = @import("zap.zig");
+const Request = zap.Request;
+
+const ResponseCache = @This();
+
+pub const Options = struct {
+    /// Maximum number of cached responses. When full, expired entries are
+    /// purged; if that doesn't free a slot, the new response isn't cached.
+    /// The vary header names learned per path are dropped with the last
+    /// response cached under them, so they are bounded by this as well.
+    max_entries: usize = 1024,
+    /// Responses with larger bodies are not cached.
+    max_body_size: usize = 1024 * 1024,
+    /// Maximum time a coalesced request waits for the in-flight computation
+    /// before it calls the handler itself. 0 disables coalescing.
+    coalesce_timeout_ms: u64 = 5000,
+};
+
+/// Counters, see `stats()`.
+pub const Stats = struct {
+    hits: usize = 0,
+    misses: usize = 0,
+    coalesced: usize = 0,
+    stored: usize = 0,
+    entries: usize = 0,
+};
+
+/// A serialized response. Immutable after creation, refcounted so that hits
+/// can be sent outside of the lock.
+const Entry = struct {
+    /// owned copy of the full cache key
+    key: []u8,
+    /// length of the base key at the start of `key`
+    base_len: usize,
+    expires_at_ms: i64,
+    status: usize,
+    /// `name:value\r\n` lines followed by the body
+    data: []u8,
+    headers_len: usize,
+    refs: std.atomic.Value(u32) = .init(1),
+
+    fn headers(self: *const Entry) []const u8 {
+        return self.data[0..self.headers_len];
+    }
+
+    fn body(self: *const Entry) []const u8 {
+        return self.data[self.headers_len..];
+    }
+};
+
+/// The in-flight computation of a key. Concurrent misses are paused in
+/// `waiters` until it is `done`.
+const Flight = struct {
+    cache: *ResponseCache,
+    key: []u8,
+    /// set when the leader finished, or the waiters timed out
+    done: bool = false,
+    waiters: ?*Waiter = null,
+    timer_started: bool = false,
+    /// the leader, the timeout timer and all waiters
+    refs: usize = 1,
+
+    fn onTimeout(arg: ?*anyopaque) callconv(.c) void {
+        const flight: *Flight = @ptrCast(@alignCast(arg.?));
+        flight.cache.finishFlight(flight);
+    }
+
+    fn onTimerFinish(arg: ?*anyopaque) callconv(.c) void {
+        const flight: *Flight = @ptrCast(@alignCast(arg.?));
+        const cache = flight.cache;
+        cache.mutex.lock();
+        defer cache.mutex.unlock();
+        cache.releaseFlight(flight);
+    }
+};
+
+/// A coalesced request, paused while its flight is in progress.
+const Waiter = struct {
+    flight: *Flight,
+    handler: zap.HttpRequestFn,
+    paused: ?Paused = null,
+    next: ?*Waiter = null,
+
+    const Paused = Request.PausedRequest(*Waiter);
+
+    fn onPaused(paused: Paused) void {
+        const waiter = paused.context;
+        const cache = waiter.flight.cache;
+        cache.mutex.lock();
+        if (!waiter.flight.done) {
+            waiter.paused = paused;
+            waiter.next = waiter.flight.waiters;
+            waiter.flight.waiters = waiter;
+            cache.mutex.unlock();
+            return;
+        }
+        cache.mutex.unlock();
+        paused.resumeWith(onResume, onAbort);
+    }
+
+    /// serves the leader's response, or calls the handler if there is none
+    fn onResume(r: Request, waiter: *Waiter) anyerror!void {
+        const cache = waiter.flight.cache;
+        const handler = waiter.handler;
+        var key_buf: [2048]u8 = undefined;
+        cache.mutex.lock();
+        cache.releaseFlight(waiter.flight);
+        const maybe_entry = if (cache.buildKey(&key_buf, &r, null)) |k| cache.lookup(k) else null;
+        cache.mutex.unlock();
+        cache.allocator.destroy(waiter);
+        if (maybe_entry) |entry| {
+            defer cache.release(entry);
+            return serveEntry(&r, entry);
+        }
+        return handler(r);
+    }
+
+    fn onAbort(waiter: *Waiter) void {
+        const cache = waiter.flight.cache;
+        cache.mutex.lock();
+        cache.releaseFlight(waiter.flight);
+        cache.mutex.unlock();
+        cache.allocator.destroy(waiter);
+    }
+};
+
+/// The vary header names learned for a base key, kept while responses are
+/// cached under them.
+const VaryNames = struct {
+    /// owned, comma-separated, lower case header names
+    names: []u8,
+    /// number of cached responses stored under these names
+    entries: usize,
+};
+
+/// Used internally: per-request capture state. The listener points
+/// `Request._cache_capture` at this while the leader's handler runs.
+pub const Capture = struct {
+    cache: *ResponseCache,
+    /// set by `Request.cacheFor()`
+    ttl_s: ?u32 = null,
+    /// set by `Request.cacheFor()`
+    vary: []const []const u8 = &.{},
+    stored: bool = false,
+};
+
+allocator: Allocator,
+options: Options,
+mutex: std.Thread.Mutex = .{},
+entries: std.StringHashMapUnmanaged(*Entry) = .empty,
+/// base key (method, host, path, query) -> the vary header names of the
+/// responses cached for it
+vary_names: std.StringHashMapUnmanaged(VaryNames) = .empty,
+flights: std.StringHashMapUnmanaged(*Flight) = .empty,
+counters: Stats = .{},
+
+/// Create a response cache. Call `deinit()` after `zap.start()` returned.
+pub fn init(allocator: Allocator, options: Options) ResponseCache {
+    return .{
+        .allocator = allocator,
+        .options = options,
+    };
+}
+
+/// Free all cached responses.
+pub fn deinit(self: *ResponseCache) void {
+    self.clear();
+    self.entries.deinit(self.allocator);
+    self.vary_names.deinit(self.allocator);
+    self.flights.deinit(self.allocator);
+}
+
+/// Drop all cached responses.
+pub fn clear(self: *ResponseCache) void {
+    self.mutex.lock();
+    defer self.mutex.unlock();
+    var it = self.entries.valueIterator();
+    while (it.next()) |entry| {
+        self.release(entry.*);
+    }
+    self.entries.clearRetainingCapacity();
+    var names = self.vary_names.iterator();
+    while (names.next()) |kv| {
+        self.allocator.free(kv.key_ptr.*);
+        self.allocator.free(kv.value_ptr.names);
+    }
+    self.vary_names.clearRetainingCapacity();
+}
+
+/// Returns a snapshot of the cache counters.
+pub fn stats(self: *ResponseCache) Stats {
+    self.mutex.lock();
+    defer self.mutex.unlock();
+    var ret = self.counters;
+    ret.entries = self.entries.count();
+    return ret;
+}
+
+/// Used internally by the listener: serve `r` from the cache or call
+/// `handler`, capturing its response if it is marked cacheable.
+pub fn handle(self: *ResponseCache, r: *Request, handler: zap.HttpRequestFn) anyerror!void {
+    if (r.methodAsEnum() != .GET) return handler(r.*);
+
+    var key_buf: [2048]u8 = undefined;
+    self.mutex.lock();
+    const key = self.buildKey(&key_buf, r, null) orelse {
+        self.mutex.unlock();
+        return handler(r.*);
+    };
+
+    if (self.lookup(key)) |entry| {
+        self.counters.hits += 1;
+        self.mutex.unlock();
+        defer self.release(entry);
+        return serveEntry(r, entry);
+    }
+
+    if (self.flights.get(key)) |flight| {
+        // someone else is computing this response (unless it timed out)
+        if (flight.done or self.options.coalesce_timeout_ms == 0) {
+            self.mutex.unlock();
+            return handler(r.*);
+        }
+        const waiter = self.allocator.create(Waiter) catch {
+            self.mutex.unlock();
+            return handler(r.*);
+        };
+        waiter.* = .{ .flight = flight, .handler = handler };
+        self.counters.coalesced += 1;
+        flight.refs += 1;
+        const start_timer = !flight.timer_started;
+        if (start_timer) {
+            flight.timer_started = true;
+            flight.refs += 1;
+        }
+        self.mutex.unlock();
+        // wait without blocking the thread: the waiter is resumed once the
+        // leader is done (it may have stored the response under a
+        // vary-extended key), or when the timer fires
+        if (start_timer) {
+            _ = fio.fio_run_every(@intCast(self.options.coalesce_timeout_ms), 1, Flight.onTimeout, flight, Flight.onTimerFinish);
+        }
+        r.pause(waiter, Waiter.onPaused);
+        return;
+    }
+
+    // we are the leader for this key
+    self.counters.misses += 1;
+    const flight = self.newFlight(key) catch {
+        self.mutex.unlock();
+        return handler(r.*);
+    };
+    self.mutex.unlock();
+
+    var capture: Capture = .{ .cache = self };
+    r._cache_capture = &capture;
+    defer {
+        r._cache_capture = null;
+        self.mutex.lock();
+        _ = self.flights.remove(flight.key);
+        self.mutex.unlock();
+        self.finishFlight(flight);
+        self.mutex.lock();
+        self.releaseFlight(flight);
+        self.mutex.unlock();
+    }
+    return handler(r.*);
+}
+
+/// Marks the flight as done and resumes its waiters.
+fn finishFlight(self: *ResponseCache, flight: *Flight) void {
+    self.mutex.lock();
+    flight.done = true;
+    var waiters = flight.waiters;
+    flight.waiters = null;
+    self.mutex.unlock();
+    while (waiters) |waiter| {
+        waiters = waiter.next;
+        waiter.paused.?.resumeWith(Waiter.onResume, Waiter.onAbort);
+    }
+}
+
+/// Used internally by `Request.sendBody()`: store the response that is about
+/// to be sent if it is cacheable. Never fails the response.
+pub fn store(capture: *Capture, r: *const Request, body: []const u8) void {
+    if (capture.stored) return;
+    capture.stored = true;
+    const self = capture.cache;
+    const status = r.h.*.status;
+    if (status < 200 or status > 299) return;
+    if (body.len > self.options.max_body_size) return;
+
+    self.storeImpl(capture, r, status, body) catch |err| {
+        zap.log.debug("ResponseCache: response not cached: {}", .{err});
+    };
+}
+
+fn storeImpl(self: *ResponseCache, capture: *Capture, r: *const Request, status: usize, body: []const u8) !void {
+    var data: std.ArrayList(u8) = .empty;
+    defer data.deinit(self.allocator);
+
+    var ctx: HeaderSerializer = .{ .out = &data, .allocator = self.allocator };
+    _ = fio.fiobj_each1(r.h.*.private_data.out_headers, 0, HeaderSerializer.callback, &ctx);
+    if (ctx.failed) return error.OutOfMemory;
+    if (ctx.sets_cookie) return error.SetsCookie;
+
+    const ttl_s: u32 = capture.ttl_s orelse ttl: {
+        const cc = ctx.cache_control orelse return error.NotCacheable;
+        break :ttl maxAgeFromCacheControl(cc) orelse return error.NotCacheable;
+    };
+    if (ttl_s == 0) return error.NotCacheable;
+
+    const headers_len = data.items.len;
+    try data.appendSlice(self.allocator, body);
+
+    var vary_buf: [256]u8 = undefined;
+    var vary_w: std.io.Writer = .fixed(&vary_buf);
+    for (capture.vary, 0..) |name, i| {
+        if (i > 0) try vary_w.writeByte(',');
+        for (name) |c| try vary_w.writeByte(std.ascii.toLower(c));
+    }
+    const vary = vary_w.buffered();
+
+    const entry = try self.allocator.create(Entry);
+    errdefer self.allocator.destroy(entry);
+    entry.* = .{
+        .key = &.{},
+        .base_len = 0,
+        .expires_at_ms = std.time.milliTimestamp() + @as(i64, ttl_s) * std.time.ms_per_s,
+        .status = status,
+        .data = try data.toOwnedSlice(self.allocator),
+        .headers_len = headers_len,
+    };
+    errdefer self.allocator.free(entry.data);
+
+    var key_buf: [2048]u8 = undefined;
+    var base_w: std.io.Writer = .fixed(&key_buf);
+    writeBaseKey(&base_w, r) catch return error.KeyTooLong;
+    const base_len = base_w.end;
+
+    self.mutex.lock();
+    defer self.mutex.unlock();
+
+    const key = self.buildKey(&key_buf, r, vary) orelse return error.KeyTooLong;
+
+    if (self.entries.count() >= self.options.max_entries) {
+        self.purgeExpired();
+        if (self.entries.count() >= self.options.max_entries) return error.CacheFull;
+    }
+
+    entry.key = try self.allocator.dupe(u8, key);
+    errdefer self.allocator.free(entry.key);
+    entry.base_len = base_len;
+    try self.entries.ensureUnusedCapacity(self.allocator, 1);
+    try self.setVaryNames(key[0..base_len], vary);
+    const gop = self.entries.getOrPutAssumeCapacity(entry.key);
+    if (gop.found_existing) {
+        const old = gop.value_ptr.*;
+        gop.key_ptr.* = entry.key;
+        gop.value_ptr.* = entry;
+        self.evict(old);
+    } else {
+        gop.value_ptr.* = entry;
+    }
+    self.counters.stored += 1;
+}
+
+/// Collects response headers as `name:value\r\n` lines and notes the ones
+/// relevant for caching.
+const HeaderSerializer = struct {
+    out: *std.ArrayList(u8),
+    allocator: Allocator,
+    name: fio.FIOBJ = 0,
+    failed: bool = false,
+    sets_cookie: bool = false,
+    cache_control: ?[]const u8 = null,
+
+    fn callback(value: fio.FIOBJ, ctx_: ?*anyopaque) callconv(.c) c_int {
+        const ctx: *HeaderSerializer = @ptrCast(@alignCast(ctx_));
+        const key = fio.fiobj_hash_key_in_loop();
+        if (key != 0) ctx.name = key;
+        if (fio.fiobj_type(value) == fio.FIOBJ_T_ARRAY) {
+            _ = fio.fiobj_each1(value, 0, callback, ctx);
+            return 0;
+        }
+        const name = util.fio2str(ctx.name) orelse return 0;
+        const str = util.fio2str(value) orelse return 0;
+        // added when sending (and already set by Request.writeJson)
+        if (std.ascii.eqlIgnoreCase(name, "date")) return 0;
+        if (std.ascii.eqlIgnoreCase(name, "set-cookie")) {
+            ctx.sets_cookie = true;
+        } else if (std.ascii.eqlIgnoreCase(name, "cache-control")) {
+            ctx.cache_control = str;
+        }
+        ctx.out.appendSlice(ctx.allocator, name) catch return ctx.fail();
+        ctx.out.append(ctx.allocator, ':') catch return ctx.fail();
+        ctx.out.appendSlice(ctx.allocator, str) catch return ctx.fail();
+        ctx.out.appendSlice(ctx.allocator, "\r\n") catch return ctx.fail();
+        return 0;
+    }
+
+    fn fail(ctx: *HeaderSerializer) c_int {
+        ctx.failed = true;
+        return -1;
+    }
+};
+
+/// Parse `max-age=N` (or `s-maxage=N`) from a Cache-Control value.
+/// Returns null if the response must not be cached.
+fn maxAgeFromCacheControl(value: []const u8) ?u32 {
+    var max_age: ?u32 = null;
+    var it = std.mem.tokenizeAny(u8, value, ", ");
+    while (it.next()) |directive| {
+        if (std.ascii.eqlIgnoreCase(directive, "no-store") or
+            std.ascii.eqlIgnoreCase(directive, "no-cache") or
+            std.ascii.eqlIgnoreCase(directive, "private"))
+        {
+            return null;
+        }
+        const eq = std.mem.indexOfScalar(u8, directive, '=') orelse continue;
+        const name = directive[0..eq];
+        if (std.ascii.eqlIgnoreCase(name, "max-age") or std.ascii.eqlIgnoreCase(name, "s-maxage")) {
+            max_age = std.fmt.parseInt(u32, directive[eq + 1 ..], 10) catch continue;
+        }
+    }
+    return max_age;
+}
+
+/// Write `METHOD host path?query`, the part of the key that doesn't depend
+/// on the vary headers.
+fn writeBaseKey(w: *std.io.Writer, r: *const Request) std.io.Writer.Error!void {
+    try w.print("{s} {s} {s}?{s}", .{
+        r.method orelse "",
+        r.getHeader("host") orelse "",
+        r.path orelse "/",
+        r.query orelse "",
+    });
+}
+
+/// Build the base key plus the values of the vary headers. If `vary` is
+/// null, the vary header names learned for this path are used. Must be
+/// called with the mutex held.
+fn buildKey(self: *ResponseCache, buf: []u8, r: *const Request, vary: ?[]const u8) ?[]const u8 {
+    var w: std.io.Writer = .fixed(buf);
+    writeBaseKey(&w, r) catch return null;
+    const base_len = w.end;
+    const names = vary orelse (if (self.vary_names.get(buf[0..base_len])) |v| v.names else return w.buffered());
+    var it = std.mem.tokenizeScalar(u8, names, ',');
+    while (it.next()) |name| {
+        w.writeByte(0) catch return null;
+        w.writeAll(r.getHeader(name) orelse "") catch return null;
+    }
+    return w.buffered();
+}
+
+/// Records the vary header names of a response about to be cached under
+/// `base`. Responses cached under different names can't be found anymore,
+/// they are dropped. Must be called with the mutex held.
+fn setVaryNames(self: *ResponseCache, base: []const u8, vary: []const u8) !void {
+    if (self.vary_names.getEntry(base)) |existing| {
+        if (std.mem.eql(u8, existing.value_ptr.names, vary)) {
+            existing.value_ptr.entries += 1;
+            return;
+        }
+        const new = if (vary.len > 0) try self.allocator.dupe(u8, vary) else null;
+        self.dropVaried(base);
+        self.allocator.free(existing.value_ptr.names);
+        if (new) |names| {
+            existing.value_ptr.* = .{ .names = names, .entries = 1 };
+        } else {
+            const owned_base = existing.key_ptr.*;
+            self.vary_names.removeByPtr(existing.key_ptr);
+            self.allocator.free(owned_base);
+        }
+        return;
+    }
+    if (vary.len == 0) return;
+    const owned_base = try self.allocator.dupe(u8, base);
+    errdefer self.allocator.free(owned_base);
+    const owned_vary = try self.allocator.dupe(u8, vary);
+    errdefer self.allocator.free(owned_vary);
+    try self.vary_names.put(self.allocator, owned_base, .{ .names = owned_vary, .entries = 1 });
+    // a response cached without vary headers can't be found anymore
+    if (self.entries.fetchRemove(base)) |kv| self.release(kv.value);
+}
+
+/// Drops the responses cached under `base` with vary headers, without
+/// touching its vary names. Must be called with the mutex held.
+fn dropVaried(self: *ResponseCache, base: []const u8) void {
+    var it = self.entries.iterator();
+    while (it.next()) |kv| {
+        const entry = kv.value_ptr.*;
+        if (entry.key.len > entry.base_len and std.mem.eql(u8, entry.key[0..entry.base_len], base)) {
+            self.entries.removeByPtr(kv.key_ptr);
+            self.release(entry);
+            // iterator is invalidated by removal, start over
+            it = self.entries.iterator();
+        }
+    }
+}
+
+/// Releases an entry that was removed from `entries`, forgetting its vary
+/// names with the last response cached under them. Must be called with the
+/// mutex held.
+fn evict(self: *ResponseCache, entry: *Entry) void {
+    if (entry.key.len > entry.base_len) {
+        if (self.vary_names.getEntry(entry.key[0..entry.base_len])) |kv| {
+            kv.value_ptr.entries -= 1;
+            if (kv.value_ptr.entries == 0) {
+                const owned_base = kv.key_ptr.*;
+                self.allocator.free(kv.value_ptr.names);
+                self.vary_names.removeByPtr(kv.key_ptr);
+                self.allocator.free(owned_base);
+            }
+        }
+    }
+    self.release(entry);
+}
+
+/// Returns a referenced, non-expired entry. Must be called with the mutex held.
+fn lookup(self: *ResponseCache, key: []const u8) ?*Entry {
+    const entry = self.entries.get(key) orelse return null;
+    if (entry.expires_at_ms <= std.time.milliTimestamp()) {
+        _ = self.entries.remove(key);
+        self.evict(entry);
+        return null;
+    }
+    _ = entry.refs.fetchAdd(1, .monotonic);
+    return entry;
+}
+
+fn purgeExpired(self: *ResponseCache) void {
+    const now = std.time.milliTimestamp();
+    var it = self.entries.iterator();
+    while (it.next()) |kv| {
+        const entry = kv.value_ptr.*;
+        if (entry.expires_at_ms <= now) {
+            self.entries.removeByPtr(kv.key_ptr);
+            self.evict(entry);
+            // iterator is invalidated by removal, start over
+            it = self.entries.iterator();
+        }
+    }
+}
+
+fn newFlight(self: *ResponseCache, key: []const u8) !*Flight {
+    const flight = try self.allocator.create(Flight);
+    errdefer self.allocator.destroy(flight);
+    flight.* = .{ .cache = self, .key = try self.allocator.dupe(u8, key) };
+    errdefer self.allocator.free(flight.key);
+    try self.flights.put(self.allocator, flight.key, flight);
+    return flight;
+}
+
+/// Must be called with the mutex held.
+fn releaseFlight(self: *ResponseCache, flight: *Flight) void {
+    flight.refs -= 1;
+    if (flight.refs == 0) {
+        self.allocator.free(flight.key);
+        self.allocator.destroy(flight);
+    }
+}
+
+fn release(self: *ResponseCache, entry: *Entry) void {
+    if (entry.refs.fetchSub(1, .acq_rel) == 1) {
+        self.allocator.free(entry.key);
+        self.allocator.free(entry.data);
+        self.allocator.destroy(entry);
+    }
+}
+
+fn serveEntry(r: *const Request, entry: *const Entry) !void {
+    r.setStatusNumeric(entry.status);
+    var lines = std.mem.splitSequence(u8, entry.headers(), "\r\n");
+    while (lines.next()) |line| {
+        const colon = std.mem.indexOfScalar(u8, line, ':') orelse continue;
+        try r.setHeader(line[0..colon], line[colon + 1 ..]);
+    }
+    try r.sendBody(entry.body());
+}
@@ -172,6 +172,179 @@ pub fn callHandlerIfExist(comptime fn_name: []const u8, e: anytype, r: Request)
     return;
 }
 
+/// Call the handler of endpoint `e` for the request method and deal with
+/// errors according to the endpoint's ErrorStrategy.
+pub fn handleRequest(e: anytype, r: zap.Request) !void {
+    const ret = switch (r.methodAsEnum()) {
+        .GET => callHandlerIfExist("get", e, r),
+        .POST => callHandlerIfExist("post", e, r),
+        .PUT => callHandlerIfExist("put", e, r),
+        .DELETE => callHandlerIfExist("delete", e, r),
+        .PATCH => callHandlerIfExist("patch", e, r),
+        .OPTIONS => callHandlerIfExist("options", e, r),
+        .HEAD => callHandlerIfExist("head", e, r),
+        else => error.UnsupportedHtmlRequestMethod,
+    };
+    if (ret) {
+        // handled without error
+    } else |err| {
+        switch (e.*.error_strategy) {
+            .raise => return err,
+            .log_to_response => return r.sendError(err, if (@errorReturnTrace()) |t| t.* else null, 505),
+            .log_to_console => zap.log.err("Error in {s} {s} : {}", .{ @typeName(@TypeOf(e.*)), r.method orelse "(no method)", err }),
+        }
+    }
+}
+
+/// Prefix matching over a set of paths known at compile time.
+///
+/// The paths are turned into a trie at compile time: prefixes shared by all
+/// remaining candidates are compared in one go, then a `switch` on the next
+/// byte picks the branch. Paths must not shadow each other, see
+/// `ListenerError.EndpointPathShadowError`.
+pub fn PrefixSwitch(comptime paths: []const []const u8) type {
+    comptime {
+        for (paths, 0..) |a, i| {
+            for (paths[i + 1 ..]) |b| {
+                if (std.mem.startsWith(u8, a, b) or std.mem.startsWith(u8, b, a)) {
+                    @compileError("endpoint paths \"" ++ a ++ "\" and \"" ++ b ++ "\" shadow each other");
+                }
+            }
+        }
+    }
+
+    return struct {
+        const all: []const usize = blk: {
+            var indices: [paths.len]usize = undefined;
+            for (&indices, 0..) |*index, i| index.* = i;
+            const final = indices;
+            break :blk &final;
+        };
+
+        /// If `p` starts with one of the paths, call `visitor.visit(i)` with
+        /// its comptime-known index `i` and return true.
+        pub fn dispatch(p: []const u8, visitor: anytype) anyerror!bool {
+            if (paths.len == 0) return false;
+            return matchFrom(all, 0, p, visitor);
+        }
+
+        /// All `candidates` match `p[0..depth]`.
+        fn matchFrom(comptime candidates: []const usize, comptime depth: usize, p: []const u8, visitor: anytype) anyerror!bool {
+            if (candidates.len == 1) {
+                if (!std.mem.startsWith(u8, p[depth..], paths[candidates[0]][depth..])) return false;
+                try visitor.visit(candidates[0]);
+                return true;
+            }
+
+            const common = comptime commonPrefixLen(candidates, depth);
+            if (common > 0) {
+                if (!std.mem.startsWith(u8, p[depth..], paths[candidates[0]][depth..][0..common])) return false;
+                return matchFrom(candidates, depth + common, p, visitor);
+            }
+
+            if (p.len <= depth) return false;
+            switch (p[depth]) {
+                inline else => |c| {
+                    const next = comptime withByteAt(candidates, depth, c);
+                    if (next.len == 0) return false;
+                    return matchFrom(next, depth + 1, p, visitor);
+                },
+            }
+        }
+
+        fn commonPrefixLen(comptime candidates: []const usize, comptime depth: usize) usize {
+            @setEvalBranchQuota(100_000);
+            const first = paths[candidates[0]];
+            var len: usize = 0;
+            while (true) : (len += 1) {
+                for (candidates) |i| {
+                    const path = paths[i];
+                    if (depth + len >= path.len or path[depth + len] != first[depth + len]) return len;
+                }
+            }
+        }
+
+        fn withByteAt(comptime candidates: []const usize, comptime depth: usize, comptime c: u8) []const usize {
+            @setEvalBranchQuota(100_000);
+            var out: [candidates.len]usize = undefined;
+            var n: usize = 0;
+            for (candidates) |i| {
+                if (paths[i][depth] == c) {
+                    out[n] = i;
+                    n += 1;
+                }
+            }
+            const final = out[0..n].*;
+            return &final;
+        }
+    };
+}
+
+/// A route table that is known at compile time, for
+/// `Listener.registerRoutes()`:
+///
+/// ```zig
+/// const MyRoutes = zap.Endpoint.Routes(.{
+///     .{ "/users", UserEndpoint },
+///     .{ "/stop", StopEndpoint },
+/// });
+/// const routes: MyRoutes = .{ .endpoints = .{ &user_endpoint, &stop_endpoint } };
+/// try listener.registerRoutes(&routes);
+/// ```
+///
+/// Requests are matched by a `PrefixSwitch` on the paths given here, and
+/// dispatched to the endpoints' methods by direct calls.
+pub fn Routes(comptime routes: anytype) type {
+    return RouteTable(routes, checkEndpointType, handleRequest);
+}
+
+/// The route table behind `Routes()` and `App.Endpoint.Routes()`. Endpoint
+/// types are checked with `check`, matched requests are passed to
+/// `call(endpoint, r)`.
+pub fn RouteTable(comptime routes: anytype, comptime check: fn (type) void, comptime call: anytype) type {
+    const route_paths = comptime blk: {
+        var out: [routes.len][]const u8 = undefined;
+        for (0..routes.len) |i| out[i] = routes[i][0];
+        break :blk out;
+    };
+    const endpoint_types = comptime blk: {
+        var out: [routes.len]type = undefined;
+        for (0..routes.len) |i| {
+            check(routes[i][1]);
+            out[i] = *routes[i][1];
+        }
+        break :blk out;
+    };
+
+    return struct {
+        endpoints: std.meta.Tuple(&endpoint_types),
+
+        pub const paths: []const []const u8 = &route_paths;
+        const Switch = PrefixSwitch(paths);
+        const Self = @This();
+
+        /// Returns true if an endpoint handled the request.
+        pub fn dispatch(self: *const Self, r: zap.Request) anyerror!bool {
+            const p = r.path orelse return false;
+            return Switch.dispatch(p, Visitor{ .self = self, .r = r });
+        }
+
+        const Visitor = struct {
+            self: *const Self,
+            r: zap.Request,
+
+            pub fn visit(v: Visitor, comptime i: usize) anyerror!void {
+                return call(v.self.endpoints[i], v.r);
+            }
+        };
+    };
+}
+
+/// Returns true if `a` and `b` would shadow each other.
+pub fn pathsOverlap(a: []const u8, b: []const u8) bool {
+    return std.mem.startsWith(u8, a, b) or std.mem.startsWith(u8, b, a);
+}
+
 pub const Binder = struct {
     pub const Interface = struct {
         call: *const fn (*Interface, zap.Request) anyerror!void = undefined,
@@ -201,25 +374,7 @@ pub const Binder = struct {
             }
 
             pub fn onRequest(self: *Bound, r: zap.Request) !void {
-                const ret = switch (r.methodAsEnum()) {
-                    .GET => callHandlerIfExist("get", self.endpoint, r),
-                    .POST => callHandlerIfExist("post", self.endpoint, r),
-                    .PUT => callHandlerIfExist("put", self.endpoint, r),
-                    .DELETE => callHandlerIfExist("delete", self.endpoint, r),
-                    .PATCH => callHandlerIfExist("patch", self.endpoint, r),
-                    .OPTIONS => callHandlerIfExist("options", self.endpoint, r),
-                    .HEAD => callHandlerIfExist("head", self.endpoint, r),
-                    else => error.UnsupportedHtmlRequestMethod,
-                };
-                if (ret) {
-                    // handled without error
-                } else |err| {
-                    switch (self.endpoint.*.error_strategy) {
-                        .raise => return err,
-                        .log_to_response => return r.sendError(err, if (@errorReturnTrace()) |t| t.* else null, 505),
-                        .log_to_console => zap.log.err("Error in {} {s} : {}", .{ Bound, r.method orelse "(no method)", err }),
-                    }
-                }
+                return handleRequest(self.endpoint, r);
             }
         };
     }
@@ -330,6 +485,8 @@ pub const ListenerError = error{
     /// an endpoint whose path would shadow an already registered one, you will
     /// receive this error.
     EndpointPathShadowError,
+    /// Only one compile-time route table can be registered.
+    RoutesAlreadyRegistered,
 };
 
 /// The listener with endpoint support
@@ -349,6 +506,8 @@ pub const Listener = struct {
         on_response: ?zap.HttpRequestFn = null,
         on_upgrade: ?zap.HttpUpgradeFn = null,
         on_finish: ?zap.HttpFinishFn = null,
+        /// see zap.HttpListenerSettings
+        on_ready: ?zap.HttpReadyFn = null,
 
         /// Callback, called if an error is raised and not caught by the
         /// ErrorStrategy
@@ -364,7 +523,23 @@ pub const Listener = struct {
         log: bool = false,
         ws_timeout: u8 = 40,
         ws_max_msg_size: usize = 262144,
+        /// permessage-deflate, see zap.HttpListenerSettings
+        ws_deflate: bool = false,
+        ws_deflate_context_takeover: bool = false,
+        ws_deflate_window_bits: u8 = 15,
+        /// output coalescing, see zap.HttpListenerSettings
+        ws_coalesce_bytes: u32 = 0,
+        ws_coalesce_us: u32 = 0,
         tls: ?zap.Tls = null,
+        /// optional response cache, see zap.ResponseCache
+        response_cache: ?*zap.ResponseCache = null,
+        /// per-IP limits, see zap.HttpListenerSettings
+        max_clients_per_ip: u32 = 0,
+        max_requests_per_ip: u32 = 0,
+        max_requests_burst: u32 = 0,
+        /// load shedding, see zap.HttpListenerSettings
+        shed_target_ms: u32 = 0,
+        priority_hints: []const zap.PriorityHint = &.{},
     };
     /// Internal static interface struct of member endpoints
     var endpoints: std.ArrayListUnmanaged(*Binder.Interface) = .empty;
@@ -377,6 +552,11 @@ pub const Listener = struct {
     /// Callback, called if an error is raised and not caught by the ErrorStrategy
     var on_error: ?*const fn (Request, anyerror) void = null;
 
+    /// The compile-time route table, see registerRoutes()
+    var routes: ?*const anyopaque = null;
+    var routes_dispatch: *const fn (*const anyopaque, Request) anyerror!bool = undefined;
+    var routes_paths: []const []const u8 = &.{};
+
     /// Initialize a new endpoint listener. Note, if you pass an `on_request`
     /// callback in the provided ListenerSettings, this request callback will be
     /// called every time a request arrives that no endpoint matches.
@@ -384,6 +564,8 @@ pub const Listener = struct {
         // reset the global in case init is called multiple times, as is the
         // case in the authentication tests
         endpoints = .empty;
+        routes = null;
+        routes_paths = &.{};
 
         var ls: zap.HttpListenerSettings = .{
             .port = settings.port,
@@ -395,6 +577,7 @@ pub const Listener = struct {
             .on_response = settings.on_response,
             .on_upgrade = settings.on_upgrade,
             .on_finish = settings.on_finish,
+            .on_ready = settings.on_ready,
             .udata = settings.udata,
             .public_folder = settings.public_folder,
             .max_clients = settings.max_clients,
@@ -403,7 +586,18 @@ pub const Listener = struct {
             .log = settings.log,
             .ws_timeout = settings.ws_timeout,
             .ws_max_msg_size = settings.ws_max_msg_size,
+            .ws_deflate = settings.ws_deflate,
+            .ws_deflate_context_takeover = settings.ws_deflate_context_takeover,
+            .ws_deflate_window_bits = settings.ws_deflate_window_bits,
+            .ws_coalesce_bytes = settings.ws_coalesce_bytes,
+            .ws_coalesce_us = settings.ws_coalesce_us,
             .tls = settings.tls,
+            .response_cache = settings.response_cache,
+            .max_clients_per_ip = settings.max_clients_per_ip,
+            .max_requests_per_ip = settings.max_requests_per_ip,
+            .max_requests_burst = settings.max_requests_burst,
+            .shed_target_ms = settings.shed_target_ms,
+            .priority_hints = settings.priority_hints,
         };
 
         // override the settings with our internal, actual callback function
@@ -454,6 +648,11 @@ pub const Listener = struct {
                 return ListenerError.EndpointPathShadowError;
             }
         }
+        for (routes_paths) |path| {
+            if (pathsOverlap(path, e.path)) {
+                return ListenerError.EndpointPathShadowError;
+            }
+        }
         const EndpointType = @typeInfo(@TypeOf(e)).pointer.child;
         checkEndpointType(EndpointType);
         const bound = try self.allocator.create(Binder.Bind(EndpointType));
@@ -461,12 +660,52 @@ pub const Listener = struct {
         try endpoints.append(self.allocator, &bound.interface);
     }
 
+    /// Register a compile-time route table, see `Routes()`. Its endpoints are
+    /// matched before the ones added with register(). `table` must outlive
+    /// the listener.
+    pub fn registerRoutes(self: *Listener, table: anytype) !void {
+        _ = self;
+        const Table = @typeInfo(@TypeOf(table)).pointer.child;
+        if (routes != null) {
+            return ListenerError.RoutesAlreadyRegistered;
+        }
+        for (Table.paths) |path| {
+            for (endpoints.items) |other| {
+                if (pathsOverlap(path, other.path)) {
+                    return ListenerError.EndpointPathShadowError;
+                }
+            }
+        }
+        const Dispatch = struct {
+            fn dispatch(ptr: *const anyopaque, r: Request) anyerror!bool {
+                const t: *const Table = @ptrCast(@alignCast(ptr));
+                return t.dispatch(r);
+            }
+        };
+        routes = table;
+        routes_dispatch = Dispatch.dispatch;
+        routes_paths = Table.paths;
+    }
+
     fn onRequest(r: Request) !void {
+        if (routes) |table| {
+            const handled = routes_dispatch(table, r) catch |err| blk: {
+                // if error is not dealt with in the endpoint, e.g.
+                // if error strategy is .raise:
+                if (on_error) |error_cb| {
+                    error_cb(r, err);
+                } else {
+                    zap.log.err("Endpoint onRequest error {} in route table\n", .{err});
+                }
+                break :blk true;
+            };
+            if (handled) return;
+        }
         if (r.path) |p| {
             for (endpoints.items) |interface| {
                 if (std.mem.startsWith(u8, p, interface.path)) {
                     return interface.call(interface, r) catch |err| {
-                        // if error is not dealt with in the entpoint, e.g.
+                        // if error is not dealt with in the endpoint, e.g.
                         // if error strategy is .raise:
                         if (on_error) |error_cb| {
                             error_cb(r, err);
@@ -483,7 +722,7 @@ pub const Listener = struct {
         // if set, call the user-provided default callback
         if (on_request) |foo| {
             foo(r) catch |err| {
-                // if error is not dealt with in the entpoint, e.g.
+                // if error is not dealt with in the endpoint, e.g.
                 // if error strategy is .raise:
                 if (on_error) |error_cb| {
                     error_cb(r, err);
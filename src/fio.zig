@@ -26,6 +26,17 @@ pub const struct_fio_start_args = extern struct {
 pub const fio_start_args = struct_fio_start_args;
 pub extern fn fio_start(args: struct_fio_start_args) void;
 pub extern fn fio_stop() void;
+pub extern fn fio_is_running() i16;
+pub const FIO_CALL_ON_START: c_uint = 6;
+pub const FIO_CALL_ON_FINISH: c_uint = 9;
+pub extern fn fio_state_callback_add(c_type: c_uint, func: ?*const fn (?*anyopaque) callconv(.c) void, arg: ?*anyopaque) void;
+pub extern fn fio_defer(task: ?*const fn (?*anyopaque, ?*anyopaque) callconv(.c) void, udata1: ?*anyopaque, udata2: ?*anyopaque) c_int;
+pub extern fn fio_run_every(milliseconds: usize, repetitions: usize, task: ?*const fn (?*anyopaque) callconv(.c) void, arg: ?*anyopaque, on_finish: ?*const fn (?*anyopaque) callconv(.c) void) c_int;
+pub extern fn fio_defer_latency_target(target_ms: usize, interval_ms: usize) void;
+pub extern fn fio_defer_latency_p90() usize;
+pub extern fn fio_defer_latency_current() usize;
+pub extern fn fio_defer_is_overloaded() c_int;
+pub extern fn fio_defer_should_shed() c_int;
 const struct_unnamed_37 = extern struct {
     vtbl: ?*anyopaque,
     flag: usize,
@@ -58,6 +69,25 @@ pub const struct_http_settings_s = extern struct {
     ws_timeout: u8,
     log: u8,
     is_client: u8,
+    max_clients_per_ip: u32 = 0,
+    max_requests_per_ip: u32 = 0,
+    max_requests_burst: u32 = 0,
+    shed_target_ms: u32 = 0,
+    priority_hints_len: u32 = 0,
+    priority_hints: [*c]const http_priority_hint_s = null,
+    ws_deflate: u8 = 0,
+    ws_deflate_context_takeover: u8 = 0,
+    ws_deflate_window_bits: u8 = 0,
+    ws_coalesce_bytes: u32 = 0,
+    ws_coalesce_us: u32 = 0,
+};
+pub const HTTP_PRIORITY_NORMAL: c_int = 0;
+pub const HTTP_PRIORITY_CRITICAL: c_int = 1;
+pub const HTTP_PRIORITY_LOW: c_int = 2;
+pub const http_priority_hint_s = extern struct {
+    prefix: [*c]const u8,
+    len: usize,
+    priority: c_int,
 };
 pub const http_settings_s = struct_http_settings_s;
 pub const http_s = extern struct {
@@ -124,6 +154,8 @@ pub const struct_fio_str_info_s = extern struct {
 };
 pub const fio_str_info_s = struct_fio_str_info_s;
 pub extern fn http_send_body(h: [*c]http_s, data: ?*anyopaque, length: usize) c_int;
+pub extern fn http_packet_start(h: [*c]http_s, body_capa: usize) FIOBJ;
+pub extern fn http_packet_send(h: [*c]http_s, packet: FIOBJ, body_start: usize) c_int;
 pub fn fiobj_each1(arg_o: FIOBJ, arg_start_at: usize, arg_task: ?*const fn (FIOBJ, ?*anyopaque) callconv(.c) c_int, arg_arg: ?*anyopaque) callconv(.c) usize {
     const o = arg_o;
     const start_at = arg_start_at;
@@ -223,6 +255,7 @@ pub extern fn fio_tls_accept(uuid: *u32, tls: ?*anyopaque, udata: ?*anyopaque) v
 pub extern fn fio_tls_connect(uuid: *u32, tls: ?*anyopaque, udata: ?*anyopaque) void;
 
 pub extern fn fiobj_free_wrapped(o: FIOBJ) callconv(.c) void;
+pub extern fn fiobj_json2obj(pobj: [*c]FIOBJ, data: ?*const anyopaque, len: usize) callconv(.c) usize;
 pub fn fiobj_null() callconv(.c) FIOBJ {
     return @as(FIOBJ, @bitCast(@as(c_long, FIOBJ_T_NULL)));
 }
@@ -234,6 +267,9 @@ pub fn fiobj_false() callconv(.c) FIOBJ {
 }
 pub extern fn fiobj_str_new(str: [*c]const u8, len: usize) FIOBJ;
 pub extern fn fiobj_str_buf(capa: usize) FIOBJ;
+pub extern fn fiobj_str_capa(str: FIOBJ) usize;
+pub extern fn fiobj_str_capa_assert(str: FIOBJ, size: usize) usize;
+pub extern fn fiobj_str_resize(str: FIOBJ, size: usize) void;
 
 pub inline fn FIOBJ_TYPE(obj: anytype) @TypeOf(fiobj_type(obj)) {
     return fiobj_type(obj);
@@ -484,6 +520,12 @@ pub extern fn websocket_udata_set(ws: ?*ws_s, udata: ?*anyopaque) ?*anyopaque;
 pub extern fn websocket_uuid(ws: ?*ws_s) isize;
 pub extern fn websocket_is_client(ws: ?*ws_s) u8;
 pub extern fn websocket_write(ws: ?*ws_s, msg: fio_str_info_s, is_text: u8) c_int;
+pub const websocket_frame_s = opaque {};
+pub extern fn websocket_frame_new(msg: fio_str_info_s, is_text: u8) ?*websocket_frame_s;
+pub extern fn websocket_frame_dup(frame: ?*websocket_frame_s) ?*websocket_frame_s;
+pub extern fn websocket_frame_free(frame: ?*websocket_frame_s) void;
+pub extern fn websocket_write_frame(ws: ?*ws_s, frame: ?*websocket_frame_s) c_int;
+pub extern fn websocket_coalesce(ws: ?*ws_s, max_bytes: usize, max_delay_us: usize) void;
 pub extern fn websocket_close(ws: ?*ws_s) void; // zig-cache/i/e0c8a6e617497ade13de512cbe191f23/include/websockets.h:104:12: warning: struct demoted to opaque type - has bitfield
 pub const struct_websocket_subscribe_s = opaque {};
 pub extern fn websocket_subscribe(args: struct_websocket_subscribe_s) usize;
@@ -502,6 +544,38 @@ pub const struct_fio_publish_args_s = extern struct {
     is_json: u8,
 };
 
+pub const subscription_s = opaque {};
+pub const fio_msg_s = extern struct {
+    filter: i32,
+    channel: fio_str_info_s,
+    msg: fio_str_info_s,
+    udata1: ?*anyopaque,
+    udata2: ?*anyopaque,
+    is_json: u8,
+};
+pub const subscribe_args_s = extern struct {
+    filter: i32 = 0,
+    channel: fio_str_info_s = .{ .capa = 0, .len = 0, .data = null },
+    match: fio_match_fn = null,
+    on_message: ?*const fn (msg: [*c]fio_msg_s) callconv(.c) void,
+    on_unsubscribe: ?*const fn (udata1: ?*anyopaque, udata2: ?*anyopaque) callconv(.c) void = null,
+    udata1: ?*anyopaque = null,
+    udata2: ?*anyopaque = null,
+};
+pub extern fn fio_subscribe(args: subscribe_args_s) ?*subscription_s;
+pub extern fn fio_unsubscribe(subscription: ?*subscription_s) void;
+pub extern fn fio_subscription_channel(subscription: ?*subscription_s) fio_str_info_s;
+/// the engine used when publishing without one, initially FIO_PUBSUB_CLUSTER
+pub extern var FIO_PUBSUB_DEFAULT: ?*anyopaque;
+pub extern var FIO_MATCH_GLOB: fio_match_fn;
+pub extern fn fio_pubsub_cluster_shm(capacity: usize) void;
+pub const fio_channel_handle_s = opaque {};
+pub extern fn fio_channel_handle_new(channel: fio_str_info_s) ?*fio_channel_handle_s;
+pub extern fn fio_channel_handle_free(handle: ?*fio_channel_handle_s) void;
+pub extern fn fio_channel_handle_publish(handle: ?*fio_channel_handle_s, engine: ?*anyopaque, message: fio_str_info_s, is_json: u8) void;
+pub extern fn fio_is_master() c_int;
+pub extern fn fio_is_worker() c_int;
+
 pub const http_sse_s = struct_http_sse_s;
 pub const struct_http_sse_s = extern struct {
     on_open: ?*const fn ([*c]http_sse_s) callconv(.c) void,
@@ -560,6 +634,17 @@ pub extern var HTTP_HEADER_SET_COOKIE: FIOBJ;
 pub extern var HTTP_HEADER_UPGRADE: FIOBJ;
 pub extern fn http_req2str(h: [*c]http_s) FIOBJ;
 pub extern fn http_write_log(h: [*c]http_s) void;
+pub const HTTP_LOG_FORMAT_COMMON: c_int = 0;
+pub const HTTP_LOG_FORMAT_JSON: c_int = 1;
+pub const http_log_settings_s = extern struct {
+    target: [*c]const u8 = null,
+    format: c_int = HTTP_LOG_FORMAT_COMMON,
+    sample_rate: u32 = 0,
+    ring_size: u32 = 0,
+    flush_interval_ms: u32 = 0,
+};
+pub extern fn http_log_setup(settings: http_log_settings_s) c_int;
+pub extern fn http_log_dropped() usize;
 pub extern fn http_gmtime(timer: time_t, tmbuf: [*c]struct_tm) [*c]struct_tm;
 pub extern fn http_date2rfc7231(target: [*c]u8, tmbuf: [*c]struct_tm) usize;
 pub extern fn http_date2rfc2109(target: [*c]u8, tmbuf: [*c]struct_tm) usize;
@@ -0,0 +1,414 @@
+//! Typed JSON decoding straight from a request body into Zig values, without
+//! building a FIOBJ tree or a `std.json.Value` first.
+//!
+//! ```zig
+//! const Order = struct {
+//!     id: u64,
+//!     customer: []const u8,
+//!     items: []const struct { sku: []const u8, qty: u32 },
+//!     note: ?[]const u8 = null,
+//! };
+//!
+//! const order = try r.decodeJson(Order, arena);
+//! ```
+//!
+//! Supported types: bools, integers, floats, enums (from strings),
+//! `[]const u8`, slices and arrays of supported types, optionals and structs.
+//! Missing struct fields take their default value, or `null` if they are
+//! optional; otherwise decoding fails with `error.MissingField`. Unknown
+//! fields are skipped.
+//!
+//! Strings without escapes are slices of the input; only escaped strings,
+//! slices and arrays are allocated, in `arena`. Strings are scanned a vector
+//! at a time for quotes, backslashes and control characters.
+const std = @import("std");
+const Allocator = std.mem.Allocator;
+
+pub const DecodeError = error{
+    SyntaxError,
+    UnexpectedEndOfInput,
+    /// a struct field without default value is not present
+    MissingField,
+    /// a value does not fit the type, e.g. a float for an integer field
+    InvalidValue,
+    /// arrays or objects are nested deeper than `max_depth`
+    TooDeep,
+} || Allocator.Error;
+
+/// Maximum nesting of arrays and objects.
+pub const max_depth = 256;
+
+/// Decode the JSON document `input` into a `T`.
+pub fn decode(comptime T: type, arena: Allocator, input: []const u8) DecodeError!T {
+    var p: Parser = .{ .input = input, .arena = arena };
+    const value = try p.parseValue(T);
+    p.skipWhitespace();
+    if (p.pos != input.len) return error.SyntaxError;
+    return value;
+}
+
+const vector_len = std.simd.suggestVectorLength(u8) orelse 16;
+const Chunk = @Vector(vector_len, u8);
+const Mask = std.meta.Int(.unsigned, vector_len);
+
+const Parser = struct {
+    input: []const u8,
+    pos: usize = 0,
+    depth: usize = 0,
+    arena: Allocator,
+
+    fn skipWhitespace(p: *Parser) void {
+        while (p.pos < p.input.len) : (p.pos += 1) {
+            switch (p.input[p.pos]) {
+                ' ', '\t', '\n', '\r' => {},
+                else => return,
+            }
+        }
+    }
+
+    /// Skip whitespace and return the next byte without consuming it.
+    fn peek(p: *Parser) DecodeError!u8 {
+        p.skipWhitespace();
+        if (p.pos >= p.input.len) return error.UnexpectedEndOfInput;
+        return p.input[p.pos];
+    }
+
+    fn expect(p: *Parser, c: u8) DecodeError!void {
+        if (try p.peek() != c) return error.SyntaxError;
+        p.pos += 1;
+    }
+
+    fn expectLiteral(p: *Parser, comptime literal: []const u8) DecodeError!void {
+        p.skipWhitespace();
+        const rest = p.input[p.pos..];
+        if (!std.mem.startsWith(u8, rest, literal)) {
+            if (rest.len < literal.len and std.mem.startsWith(u8, literal, rest)) {
+                return error.UnexpectedEndOfInput;
+            }
+            return error.SyntaxError;
+        }
+        p.pos += literal.len;
+    }
+
+    fn enter(p: *Parser) DecodeError!void {
+        if (p.depth == max_depth) return error.TooDeep;
+        p.depth += 1;
+    }
+
+    /// Index of the first `"`, `\` or control character at or after `start`.
+    fn findStringSpecial(p: *const Parser, start: usize) ?usize {
+        const input = p.input;
+        var i = start;
+        while (i + vector_len <= input.len) : (i += vector_len) {
+            const chunk: Chunk = input[i..][0..vector_len].*;
+            const quote: Mask = @bitCast(chunk == @as(Chunk, @splat('"')));
+            const backslash: Mask = @bitCast(chunk == @as(Chunk, @splat('\\')));
+            const control: Mask = @bitCast(chunk < @as(Chunk, @splat(0x20)));
+            const special = quote | backslash | control;
+            if (special != 0) return i + @ctz(special);
+        }
+        while (i < input.len) : (i += 1) {
+            switch (input[i]) {
+                '"', '\\', 0...0x1f => return i,
+                else => {},
+            }
+        }
+        return null;
+    }
+
+    fn parseString(p: *Parser) DecodeError![]const u8 {
+        try p.expect('"');
+        const start = p.pos;
+        var i = p.findStringSpecial(start) orelse return error.UnexpectedEndOfInput;
+        if (p.input[i] == '"') {
+            p.pos = i + 1;
+            return p.input[start..i];
+        }
+
+        // escaped string: copy into the arena
+        var out: std.ArrayList(u8) = .empty;
+        try out.appendSlice(p.arena, p.input[start..i]);
+        while (true) {
+            switch (p.input[i]) {
+                '"' => {
+                    p.pos = i + 1;
+                    return out.items;
+                },
+                '\\' => i = try p.unescape(&out, i + 1),
+                else => return error.SyntaxError,
+            }
+            const next = p.findStringSpecial(i) orelse return error.UnexpectedEndOfInput;
+            try out.appendSlice(p.arena, p.input[i..next]);
+            i = next;
+        }
+    }
+
+    /// Skip a string whose opening quote is at `pos - 1`.
+    fn skipString(p: *Parser) DecodeError!void {
+        var i = p.pos;
+        while (true) {
+            i = p.findStringSpecial(i) orelse return error.UnexpectedEndOfInput;
+            switch (p.input[i]) {
+                '"' => {
+                    p.pos = i + 1;
+                    return;
+                },
+                '\\' => i += 2,
+                else => return error.SyntaxError,
+            }
+        }
+    }
+
+    /// `i` points behind a backslash. Returns the index after the escape.
+    fn unescape(p: *Parser, out: *std.ArrayList(u8), i: usize) DecodeError!usize {
+        if (i >= p.input.len) return error.UnexpectedEndOfInput;
+        const c: u8 = switch (p.input[i]) {
+            '"' => '"',
+            '\\' => '\\',
+            '/' => '/',
+            'b' => 0x08,
+            'f' => 0x0c,
+            'n' => '\n',
+            'r' => '\r',
+            't' => '\t',
+            'u' => {
+                var codepoint: u21 = try p.hex4(i + 1);
+                var end = i + 5;
+                if (codepoint >= 0xd800 and codepoint < 0xdc00) {
+                    // high surrogate, must be followed by a low one
+                    if (end + 6 > p.input.len) return error.UnexpectedEndOfInput;
+                    if (p.input[end] != '\\' or p.input[end + 1] != 'u') return error.SyntaxError;
+                    const low = try p.hex4(end + 2);
+                    if (low < 0xdc00 or low > 0xdfff) return error.SyntaxError;
+                    codepoint = 0x10000 + ((codepoint - 0xd800) << 10) + (low - 0xdc00);
+                    end += 6;
+                } else if (codepoint >= 0xdc00 and codepoint <= 0xdfff) {
+                    return error.SyntaxError;
+                }
+                var buf: [4]u8 = undefined;
+                const len = std.unicode.utf8Encode(codepoint, &buf) catch return error.SyntaxError;
+                try out.appendSlice(p.arena, buf[0..len]);
+                return end;
+            },
+            else => return error.SyntaxError,
+        };
+        try out.append(p.arena, c);
+        return i + 1;
+    }
+
+    fn hex4(p: *Parser, i: usize) DecodeError!u16 {
+        if (i + 4 > p.input.len) return error.UnexpectedEndOfInput;
+        var value: u16 = 0;
+        for (p.input[i..][0..4]) |c| {
+            const digit = std.fmt.charToDigit(c, 16) catch return error.SyntaxError;
+            value = value << 4 | digit;
+        }
+        return value;
+    }
+
+    /// Scan a number as the JSON grammar defines it:
+    /// `-?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?`
+    fn parseNumberToken(p: *Parser) DecodeError![]const u8 {
+        p.skipWhitespace();
+        const start = p.pos;
+        if (p.nextIs("-")) p.pos += 1;
+        if (p.nextIs("0")) p.pos += 1 else try p.scanDigits();
+        if (p.nextIs(".")) {
+            p.pos += 1;
+            try p.scanDigits();
+        }
+        if (p.nextIs("eE")) {
+            p.pos += 1;
+            if (p.nextIs("+-")) p.pos += 1;
+            try p.scanDigits();
+        }
+        return p.input[start..p.pos];
+    }
+
+    /// Whether the next byte is one of `chars`.
+    fn nextIs(p: *const Parser, comptime chars: []const u8) bool {
+        return p.pos < p.input.len and std.mem.indexOfScalar(u8, chars, p.input[p.pos]) != null;
+    }
+
+    /// Scan one or more digits.
+    fn scanDigits(p: *Parser) DecodeError!void {
+        const start = p.pos;
+        while (p.pos < p.input.len and std.ascii.isDigit(p.input[p.pos])) p.pos += 1;
+        if (p.pos == start) {
+            return if (start == p.input.len) error.UnexpectedEndOfInput else error.SyntaxError;
+        }
+    }
+
+    fn parseValue(p: *Parser, comptime V: type) DecodeError!V {
+        switch (@typeInfo(V)) {
+            .bool => {
+                if (try p.peek() == 't') {
+                    try p.expectLiteral("true");
+                    return true;
+                }
+                try p.expectLiteral("false");
+                return false;
+            },
+            .int => return std.fmt.parseInt(V, try p.parseNumberToken(), 10) catch error.InvalidValue,
+            .float => return std.fmt.parseFloat(V, try p.parseNumberToken()) catch error.InvalidValue,
+            .optional => |o| {
+                if (try p.peek() == 'n') {
+                    try p.expectLiteral("null");
+                    return null;
+                }
+                return try p.parseValue(o.child);
+            },
+            .@"enum" => return std.meta.stringToEnum(V, try p.parseString()) orelse error.InvalidValue,
+            .pointer => |ptr| {
+                if (ptr.size != .slice or !ptr.is_const) {
+                    @compileError("unsupported type " ++ @typeName(V) ++ ", use a const slice");
+                }
+                if (ptr.child == u8) return p.parseString();
+                return p.parseArray(ptr.child);
+            },
+            .array => |a| {
+                const items = try p.parseArray(a.child);
+                if (items.len != a.len) return error.InvalidValue;
+                return items[0..a.len].*;
+            },
+            .@"struct" => return p.parseObject(V),
+            else => @compileError("unsupported type " ++ @typeName(V)),
+        }
+    }
+
+    fn parseArray(p: *Parser, comptime E: type) DecodeError![]const E {
+        try p.enter();
+        defer p.depth -= 1;
+
+        try p.expect('[');
+        var items: std.ArrayList(E) = .empty;
+        if (try p.peek() == ']') {
+            p.pos += 1;
+            return items.items;
+        }
+        while (true) {
+            try items.append(p.arena, try p.parseValue(E));
+            switch (try p.peek()) {
+                ',' => p.pos += 1,
+                ']' => {
+                    p.pos += 1;
+                    return items.items;
+                },
+                else => return error.SyntaxError,
+            }
+        }
+    }
+
+    fn parseObject(p: *Parser, comptime V: type) DecodeError!V {
+        const fields = @typeInfo(V).@"struct".fields;
+        try p.enter();
+        defer p.depth -= 1;
+
+        try p.expect('{');
+        var result: V = undefined;
+        var seen = std.StaticBitSet(fields.len).initEmpty();
+        if (try p.peek() == '}') {
+            p.pos += 1;
+        } else while (true) {
+            const key = try p.parseString();
+            try p.expect(':');
+            if (fields.len == 0) {
+                try p.skipValue();
+            } else {
+                const field_map = comptime blk: {
+                    var kvs: [fields.len]struct { []const u8, usize } = undefined;
+                    for (fields, 0..) |field, i| kvs[i] = .{ field.name, i };
+                    break :blk std.StaticStringMap(usize).initComptime(kvs);
+                };
+                if (field_map.get(key)) |index| {
+                    switch (index) {
+                        inline 0...fields.len - 1 => |i| {
+                            @field(result, fields[i].name) = try p.parseValue(fields[i].type);
+                            seen.set(i);
+                        },
+                        else => unreachable,
+                    }
+                } else {
+                    try p.skipValue();
+                }
+            }
+            switch (try p.peek()) {
+                ',' => p.pos += 1,
+                '}' => {
+                    p.pos += 1;
+                    break;
+                },
+                else => return error.SyntaxError,
+            }
+        }
+
+        inline for (fields, 0..) |field, i| {
+            if (!seen.isSet(i)) {
+                if (field.defaultValue()) |default| {
+                    @field(result, field.name) = default;
+                } else if (@typeInfo(field.type) == .optional) {
+                    @field(result, field.name) = null;
+                } else {
+                    return error.MissingField;
+                }
+            }
+        }
+        return result;
+    }
+
+    /// Skip any value, e.g. of an unknown field.
+    fn skipValue(p: *Parser) DecodeError!void {
+        // the open containers, a set bit for an object
+        var objects = std.StaticBitSet(max_depth).initEmpty();
+        var depth: usize = 0;
+        while (true) {
+            switch (try p.peek()) {
+                '{', '[' => |c| {
+                    p.pos += 1;
+                    if (p.depth + depth >= max_depth) return error.TooDeep;
+                    const close: u8 = if (c == '{') '}' else ']';
+                    if (try p.peek() == close) {
+                        p.pos += 1;
+                    } else {
+                        objects.setValue(depth, c == '{');
+                        depth += 1;
+                        if (c == '{') try p.skipKey();
+                        continue;
+                    }
+                },
+                '"' => {
+                    p.pos += 1;
+                    try p.skipString();
+                },
+                't' => try p.expectLiteral("true"),
+                'f' => try p.expectLiteral("false"),
+                'n' => try p.expectLiteral("null"),
+                else => _ = try p.parseNumberToken(),
+            }
+            // after a value: close containers until the next element
+            while (depth > 0) {
+                const in_object = objects.isSet(depth - 1);
+                switch (try p.peek()) {
+                    ',' => {
+                        p.pos += 1;
+                        if (in_object) try p.skipKey();
+                        break;
+                    },
+                    '}', ']' => |c| {
+                        if ((c == '}') != in_object) return error.SyntaxError;
+                        p.pos += 1;
+                        depth -= 1;
+                    },
+                    else => return error.SyntaxError,
+                }
+            } else return;
+        }
+    }
+
+    /// Skip an object key and the colon after it.
+    fn skipKey(p: *Parser) DecodeError!void {
+        try p.expect('"');
+        try p.skipString();
+        try p.expect(':');
+    }
+};
@@ -32,6 +32,14 @@ const MustacheLoadArgsFio = extern struct {
     err: [*c]mustache_error_en,
 };
 
+const template = @import("mustache_template.zig");
+
+/// A template compiled at build time, rendered straight from Zig values
+/// without FIOBJs. See `mustache_template.zig`.
+pub const Template = template.Template;
+/// Like `Template`, with partials. See `mustache_template.zig`.
+pub const TemplateWithPartials = template.TemplateWithPartials;
+
 /// Handle to the underlying fiobj mustache instance.
 handle: *mustache_s,
 
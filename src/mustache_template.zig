@@ -0,0 +1,346 @@
+//! Mustache templates compiled at build time.
+//!
+//! The template is parsed at comptime, and `render()` is specialized for the
+//! type of the data passed to it. Names are resolved against the data's
+//! fields at compile time, and output is written straight into a
+//! `std.io.Writer`, without converting the data to FIOBJs.
+//!
+//! ```zig
+//! const Page = zap.Mustache.Template(@embedFile("page.html"));
+//!
+//! fn on_request(r: zap.Request) !void {
+//!     try r.sendTemplate(Page, .{ .title = "Users", .users = users });
+//! }
+//! ```
+//!
+//! Supported: variables (`{{name}}`, HTML escaped), unescaped variables
+//! (`{{{name}}}`, `{{& name}}`), dotted names, sections and inverted
+//! sections, comments, delimiter changes and partials (see
+//! `TemplateWithPartials`). Lambdas are not.
+//!
+//! Names are looked up from the innermost section outwards, like in
+//! `zap.Mustache`. Unlike there, a name that doesn't exist in any context is
+//! a compile error.
+//!
+//! Sections are skipped for `false`, `null` and empty slices or arrays,
+//! repeated for each element of slices and arrays, and otherwise rendered
+//! once with the value pushed onto the context.
+const std = @import("std");
+const Writer = std.io.Writer;
+
+/// Compile `source` into a template type. See the module documentation.
+pub fn Template(comptime source: []const u8) type {
+    return TemplateWithPartials(source, .{});
+}
+
+/// Like `Template`, with partials given as a tuple of name / source pairs:
+/// `.{ .{ "header.html", @embedFile("header.html") } }`.
+pub fn TemplateWithPartials(comptime source: []const u8, comptime partials: anytype) type {
+    return struct {
+        /// The parsed template.
+        pub const nodes: []const Node = parse(source, partials, 0);
+
+        /// Render the template for `data` into `w`.
+        pub fn render(w: *Writer, data: anytype) Writer.Error!void {
+            try renderNodes(nodes, w, .{data});
+        }
+
+        /// Render the template for `data` into a newly allocated string.
+        pub fn renderAlloc(allocator: std.mem.Allocator, data: anytype) error{OutOfMemory}![]u8 {
+            var out: Writer.Allocating = .init(allocator);
+            defer out.deinit();
+            render(&out.writer, data) catch return error.OutOfMemory;
+            return out.toOwnedSlice();
+        }
+    };
+}
+
+pub const Node = struct {
+    kind: Kind,
+    /// the text, for `.text` nodes
+    text: []const u8 = "",
+    /// the dotted name, split; empty for `.`
+    path: []const []const u8 = &.{},
+    /// the content of sections
+    children: []const Node = &.{},
+
+    pub const Kind = enum { text, variable, raw, section, inverted };
+};
+
+/// Partials can include each other, but not indefinitely.
+const max_partial_depth = 16;
+
+const Parser = struct {
+    source: []const u8,
+    pos: usize = 0,
+    open: []const u8 = "{{",
+    close: []const u8 = "}}",
+};
+
+fn parse(comptime source: []const u8, comptime partials: anytype, comptime depth: usize) []const Node {
+    @setEvalBranchQuota(100_000 + source.len * 100);
+    var p: Parser = .{ .source = source };
+    return parseBlock(&p, partials, depth, null);
+}
+
+/// Parse up to the closing tag of `section`, or to the end for `null`.
+fn parseBlock(comptime p: *Parser, comptime partials: anytype, comptime depth: usize, comptime section: ?[]const u8) []const Node {
+    var nodes: []const Node = &.{};
+    while (true) {
+        const tag_start = std.mem.indexOfPos(u8, p.source, p.pos, p.open) orelse {
+            if (section) |name| @compileError("mustache: unclosed section '" ++ name ++ "'");
+            nodes = appendText(nodes, p.source[p.pos..]);
+            return nodes;
+        };
+
+        // triple mustache: {{{name}}}
+        const triple = std.mem.startsWith(u8, p.source[tag_start + p.open.len ..], "{");
+        const content_start = tag_start + p.open.len + @intFromBool(triple);
+        const close = if (triple) "}" ++ p.close else p.close;
+        const content_end = std.mem.indexOfPos(u8, p.source, content_start, close) orelse
+            @compileError("mustache: unclosed tag at offset " ++ std.fmt.comptimePrint("{d}", .{tag_start}));
+        var content = std.mem.trim(u8, p.source[content_start..content_end], " \t");
+        const sigil: u8 = if (triple) '{' else if (content.len > 0) content[0] else 0;
+        switch (sigil) {
+            '#', '^', '/', '!', '=', '>', '&' => content = std.mem.trim(u8, content[1..], " \t"),
+            else => {},
+        }
+
+        const text_start = p.pos;
+        var text = p.source[text_start..tag_start];
+        p.pos = content_end + close.len;
+
+        // tags other than variables alone on their line don't leave an
+        // empty line behind
+        switch (sigil) {
+            '#', '^', '/', '!', '=', '>' => {
+                const line_start = if (std.mem.lastIndexOfScalar(u8, text, '\n')) |i| i + 1 else 0;
+                const at_line_start = line_start > 0 or text_start == 0 or p.source[text_start - 1] == '\n';
+                if (at_line_start and isBlank(text[line_start..])) {
+                    if (lineEnd(p.source, p.pos)) |next| {
+                        text = text[0..line_start];
+                        p.pos = next;
+                    }
+                }
+            },
+            else => {},
+        }
+        nodes = appendText(nodes, text);
+
+        switch (sigil) {
+            '!' => {},
+            '=' => {
+                if (content.len == 0 or content[content.len - 1] != '=') {
+                    @compileError("mustache: invalid delimiter tag '" ++ content ++ "'");
+                }
+                var it = std.mem.tokenizeAny(u8, content[0 .. content.len - 1], " \t");
+                p.open = it.next() orelse @compileError("mustache: missing delimiters");
+                p.close = it.next() orelse @compileError("mustache: missing closing delimiter");
+            },
+            '#', '^' => {
+                const children = parseBlock(p, partials, depth, content);
+                nodes = nodes ++ [_]Node{.{
+                    .kind = if (sigil == '#') .section else .inverted,
+                    .path = splitName(content),
+                    .children = children,
+                }};
+            },
+            '/' => {
+                const name = section orelse @compileError("mustache: unexpected closing tag '" ++ content ++ "'");
+                if (!std.mem.eql(u8, name, content)) {
+                    @compileError("mustache: section '" ++ name ++ "' closed by '" ++ content ++ "'");
+                }
+                return nodes;
+            },
+            '>' => {
+                if (depth == max_partial_depth) @compileError("mustache: partials nested too deep");
+                nodes = nodes ++ parse(findPartial(partials, content), partials, depth + 1);
+            },
+            else => {
+                nodes = nodes ++ [_]Node{.{
+                    .kind = if (sigil == '{' or sigil == '&') .raw else .variable,
+                    .path = splitName(content),
+                }};
+            },
+        }
+    }
+}
+
+fn appendText(comptime nodes: []const Node, comptime text: []const u8) []const Node {
+    if (text.len == 0) return nodes;
+    return nodes ++ [_]Node{.{ .kind = .text, .text = text }};
+}
+
+fn isBlank(s: []const u8) bool {
+    for (s) |c| if (c != ' ' and c != '\t') return false;
+    return true;
+}
+
+/// The position after the end of the line at `pos`, if only blanks are left
+/// on it.
+fn lineEnd(source: []const u8, pos: usize) ?usize {
+    var i = pos;
+    while (i < source.len and (source[i] == ' ' or source[i] == '\t')) i += 1;
+    if (i == source.len) return i;
+    if (source[i] == '\n') return i + 1;
+    if (std.mem.startsWith(u8, source[i..], "\r\n")) return i + 2;
+    return null;
+}
+
+fn splitName(comptime name: []const u8) []const []const u8 {
+    if (std.mem.eql(u8, name, ".")) return &.{};
+    var path: []const []const u8 = &.{};
+    var it = std.mem.splitScalar(u8, name, '.');
+    while (it.next()) |part| {
+        if (part.len == 0) @compileError("mustache: invalid name '" ++ name ++ "'");
+        path = path ++ [_][]const u8{part};
+    }
+    return path;
+}
+
+fn findPartial(comptime partials: anytype, comptime name: []const u8) []const u8 {
+    inline for (partials) |partial| {
+        if (std.mem.eql(u8, partial[0], name)) return partial[1];
+    }
+    @compileError("mustache: unknown partial '" ++ name ++ "'");
+}
+
+fn renderNodes(comptime nodes: []const Node, w: *Writer, ctx: anytype) Writer.Error!void {
+    inline for (nodes) |node| {
+        switch (node.kind) {
+            .text => try w.writeAll(node.text),
+            .variable => try writeValue(w, lookup(ctx, node.path), true),
+            .raw => try writeValue(w, lookup(ctx, node.path), false),
+            .section => try renderSection(node.children, w, ctx, lookup(ctx, node.path)),
+            .inverted => if (!truthy(lookup(ctx, node.path))) try renderNodes(node.children, w, ctx),
+        }
+    }
+}
+
+fn renderSection(comptime nodes: []const Node, w: *Writer, ctx: anytype, value: anytype) Writer.Error!void {
+    const V = @TypeOf(value);
+    if (comptime isString(V)) return renderNodes(nodes, w, ctx ++ .{value});
+    switch (@typeInfo(V)) {
+        .bool => if (value) try renderNodes(nodes, w, ctx),
+        .optional => if (value) |payload| try renderSection(nodes, w, ctx, payload),
+        .array => for (&value) |*item| try renderNodes(nodes, w, ctx ++ .{item}),
+        .pointer => |p| switch (p.size) {
+            .slice => for (value) |*item| try renderNodes(nodes, w, ctx ++ .{item}),
+            .one => if (@typeInfo(p.child) == .array)
+                for (value) |*item| try renderNodes(nodes, w, ctx ++ .{item})
+            else
+                try renderNodes(nodes, w, ctx ++ .{value}),
+            else => @compileError("mustache: unsupported section type " ++ @typeName(V)),
+        },
+        else => try renderNodes(nodes, w, ctx ++ .{value}),
+    }
+}
+
+fn truthy(value: anytype) bool {
+    const V = @TypeOf(value);
+    if (comptime isString(V)) return true;
+    return switch (@typeInfo(V)) {
+        .bool => value,
+        .optional => if (value) |payload| truthy(payload) else false,
+        .array => |a| a.len > 0,
+        .pointer => |p| switch (p.size) {
+            .slice => value.len > 0,
+            .one => if (@typeInfo(p.child) == .array) value.len > 0 else true,
+            else => true,
+        },
+        else => true,
+    };
+}
+
+fn writeValue(w: *Writer, value: anytype, comptime escape: bool) Writer.Error!void {
+    const V = @TypeOf(value);
+    if (comptime isString(V)) {
+        const s: []const u8 = if (@typeInfo(V) == .array) &value else value;
+        return if (escape) writeEscaped(w, s) else w.writeAll(s);
+    }
+    switch (@typeInfo(V)) {
+        .int, .float => try w.print("{d}", .{value}),
+        .bool => try w.writeAll(if (value) "true" else "false"),
+        .@"enum" => try w.writeAll(@tagName(value)),
+        .optional => if (value) |payload| try writeValue(w, payload, escape),
+        .pointer => |p| if (p.size == .one) try writeValue(w, value.*, escape) else @compileError("mustache: cannot render " ++ @typeName(V)),
+        else => @compileError("mustache: cannot render " ++ @typeName(V)),
+    }
+}
+
+fn writeEscaped(w: *Writer, s: []const u8) Writer.Error!void {
+    var start: usize = 0;
+    for (s, 0..) |c, i| {
+        const entity = switch (c) {
+            '&' => "&amp;",
+            '<' => "&lt;",
+            '>' => "&gt;",
+            '"' => "&quot;",
+            '\'' => "&#39;",
+            else => continue,
+        };
+        try w.writeAll(s[start..i]);
+        try w.writeAll(entity);
+        start = i + 1;
+    }
+    try w.writeAll(s[start..]);
+}
+
+fn isString(comptime T: type) bool {
+    return switch (@typeInfo(T)) {
+        .pointer => |p| switch (p.size) {
+            .slice => p.child == u8,
+            .one => switch (@typeInfo(p.child)) {
+                .array => |a| a.child == u8,
+                else => false,
+            },
+            else => false,
+        },
+        .array => |a| a.child == u8,
+        else => false,
+    };
+}
+
+/// The type of a looked up value; comptime-only numbers from anonymous
+/// struct literals become runtime ones.
+fn Lookup(comptime Ctx: type, comptime path: []const []const u8) type {
+    const frames = @typeInfo(Ctx).@"struct".fields;
+    var T = frames[frameIndex(Ctx, path)].type;
+    for (path) |name| {
+        const S = switch (@typeInfo(T)) {
+            .pointer => |p| if (p.size == .one) p.child else T,
+            else => T,
+        };
+        T = @FieldType(S, name);
+    }
+    return switch (T) {
+        comptime_int => i128,
+        comptime_float => f64,
+        else => T,
+    };
+}
+
+/// The innermost context that has the first part of `path`.
+fn frameIndex(comptime Ctx: type, comptime path: []const []const u8) usize {
+    const frames = @typeInfo(Ctx).@"struct".fields;
+    if (path.len == 0) return frames.len - 1;
+    var i = frames.len;
+    while (i > 0) {
+        i -= 1;
+        const S = switch (@typeInfo(frames[i].type)) {
+            .pointer => |p| if (p.size == .one) p.child else frames[i].type,
+            else => frames[i].type,
+        };
+        if (@typeInfo(S) == .@"struct" and @hasField(S, path[0])) return i;
+    }
+    @compileError("mustache: '" ++ path[0] ++ "' not found in " ++ @typeName(Ctx));
+}
+
+fn lookup(ctx: anytype, comptime path: []const []const u8) Lookup(@TypeOf(ctx), path) {
+    return fieldPath(ctx[comptime frameIndex(@TypeOf(ctx), path)], path);
+}
+
+fn fieldPath(value: anytype, comptime path: []const []const u8) Lookup(struct { @TypeOf(value) }, path) {
+    if (path.len == 0) return value;
+    return fieldPath(@field(value, path[0]), path[1..]);
+}
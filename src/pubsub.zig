@@ -0,0 +1,221 @@
+//! Publish/subscribe messaging between threads and worker processes, using
+//! facil.io's pub/sub layer (the one behind `WebSockets.Handler.subscribe`),
+//! e.g. for cache invalidation or job signalling across workers.
+//!
+//! Messages are published to a channel name, or to an integer filter, and are
+//! delivered to every matching subscription in the processes selected by the
+//! `Engine`:
+//!
+//! ```zig
+//! const Cache = struct {
+//!     fn invalidate(self: *Cache, msg: zap.PubSub.Message) !void {
+//!         self.remove(msg.message);
+//!     }
+//! };
+//!
+//! // before zap.start(): every worker inherits the subscription
+//! _ = try zap.PubSub.subscribe(.{ .channel = "cache-invalidate" }, &cache, Cache.invalidate, null);
+//!
+//! // later, in any worker
+//! zap.PubSub.publish(.{ .channel = "cache-invalidate", .message = key });
+//! ```
+//!
+//! Subscription callbacks run on facil.io's threads, like request handlers.
+//! Messages are copied when published; across processes they travel over
+//! facil.io's cluster socket, or through shared memory (see
+//! `useSharedMemory()`).
+const std = @import("std");
+
+const fio = @import("fio.zig");
+const zap = @import("zap.zig");
+const util = @import("util.zig");
+
+/// Selects the processes a message is delivered to.
+pub const Engine = enum(usize) {
+    /// all processes, including the publishing one
+    cluster = 1,
+    /// only the publishing process
+    process = 2,
+    /// all processes except the publishing one
+    siblings = 3,
+    /// only the root (master) process
+    root = 4,
+
+    /// facil.io's engines are the constants 1 to 4 (`FIO_PUBSUB_CLUSTER`, ...)
+    fn toFio(self: Engine) *anyopaque {
+        return @ptrFromInt(@intFromEnum(self));
+    }
+};
+
+/// Set the engine used when publishing without one (this includes
+/// `WebSockets.Handler.publish`). Initially `.cluster`.
+pub fn setDefaultEngine(engine: Engine) void {
+    fio.FIO_PUBSUB_DEFAULT = engine.toFio();
+}
+
+/// Pass messages between processes through rings in shared memory instead of
+/// the cluster socket: the root process writes each message once, for all
+/// workers to read, and wakes them with an `eventfd`. Workers each write to a
+/// ring of their own, read by the root.
+///
+/// `capacity` is the size of the root's ring in bytes (rounded up to a power of
+/// 2, at least 64 KiB); workers' rings are a quarter of that. 0 switches back
+/// to the socket. Call before `zap.start()`. Linux only, ignored elsewhere and
+/// with a single worker.
+pub fn useSharedMemory(capacity: usize) void {
+    fio.fio_pubsub_cluster_shm(capacity);
+}
+
+/// A message, as passed to subscription callbacks. The slices are only valid
+/// during the callback.
+pub const Message = struct {
+    /// the channel it was published to (empty for filter messages)
+    channel: []const u8,
+    message: []const u8,
+    /// the filter it was published to (0 for channel messages)
+    filter: i32,
+    is_json: bool,
+};
+
+pub const SubscribeArgs = struct {
+    /// the channel name, or a glob pattern if `pattern` is set
+    channel: []const u8 = "",
+    /// subscribe to an integer filter (> 0) instead of a channel
+    filter: i32 = 0,
+    /// match channel names against `channel` as a glob pattern (`*`, `?`,
+    /// `[...]`). Patterns are indexed by the literal text before their first
+    /// wildcard, so only patterns starting with a wildcard are tested
+    /// against every published channel.
+    pattern: bool = false,
+};
+
+pub const PublishArgs = struct {
+    /// the channel; ignored when publishing to a `filter`
+    channel: []const u8 = "",
+    /// publish to subscriptions of an integer filter (> 0) instead
+    filter: i32 = 0,
+    message: []const u8,
+    is_json: bool = false,
+    /// `null` selects the default engine, see `setDefaultEngine()`
+    engine: ?Engine = null,
+};
+
+pub const Error = error{SubscribeError};
+
+/// An active subscription.
+pub const Subscription = struct {
+    handle: *fio.subscription_s,
+
+    /// Cancel the subscription. Its `on_unsubscribe` callback runs once no
+    /// `on_message` callback is running anymore, possibly on another thread.
+    pub fn unsubscribe(self: Subscription) void {
+        fio.fio_unsubscribe(self.handle);
+    }
+
+    /// The channel (or a string representing the filter). Only valid until
+    /// the subscription is cancelled.
+    pub fn channel(self: Subscription) []const u8 {
+        const name = fio.fio_subscription_channel(self.handle);
+        if (name.len == 0) return "";
+        return name.data[0..name.len];
+    }
+};
+
+/// Subscribe to a channel, a channel pattern or a filter:
+/// `on_message(context, message)` is called for every matching message.
+///
+/// `on_unsubscribe(context)`, if provided, is called once the subscription was
+/// cancelled, to release the context. Subscriptions left at exit are
+/// cancelled then.
+///
+/// `context` must be a single-item pointer that stays valid until the
+/// subscription was cancelled. Subscriptions made before `zap.start()` are
+/// inherited by all workers.
+pub fn subscribe(
+    args: SubscribeArgs,
+    context: anytype,
+    comptime on_message: *const fn (@TypeOf(context), Message) anyerror!void,
+    comptime on_unsubscribe: ?*const fn (@TypeOf(context)) void,
+) Error!Subscription {
+    std.debug.assert(args.filter >= 0); // negative filters are facil.io's
+    const Wrapper = struct {
+        fn onMessage(msg: [*c]fio.fio_msg_s) callconv(.c) void {
+            const m = msg[0];
+            const message: Message = .{
+                .channel = if (m.channel.len > 0) m.channel.data[0..m.channel.len] else "",
+                .message = if (m.msg.len > 0) m.msg.data[0..m.msg.len] else "",
+                .filter = m.filter,
+                .is_json = m.is_json != 0,
+            };
+            on_message(@ptrCast(@alignCast(m.udata1.?)), message) catch |err| {
+                zap.Logging.on_uncaught_error("PubSub on_message", err);
+            };
+        }
+
+        fn onUnsubscribe(udata1: ?*anyopaque, _: ?*anyopaque) callconv(.c) void {
+            if (on_unsubscribe) |f| f(@ptrCast(@alignCast(udata1.?)));
+        }
+    };
+    const handle = fio.fio_subscribe(.{
+        .filter = args.filter,
+        .channel = util.str2fio(args.channel),
+        .match = if (args.pattern) fio.FIO_MATCH_GLOB else null,
+        .on_message = Wrapper.onMessage,
+        .on_unsubscribe = if (on_unsubscribe != null) Wrapper.onUnsubscribe else null,
+        .udata1 = @ptrCast(@constCast(context)),
+    }) orelse return error.SubscribeError;
+    return .{ .handle = handle };
+}
+
+/// A channel resolved once, for publishing to it repeatedly: `publish()` looks
+/// the channel up by name (and matches it against pattern subscriptions) for
+/// every message, a `Channel` only when subscriptions changed.
+///
+/// ```zig
+/// const prices = zap.PubSub.Channel.init("prices");
+/// defer prices.deinit();
+/// prices.publish(.{ .message = quote });
+/// ```
+///
+/// Safe to publish through from multiple threads.
+pub const Channel = struct {
+    handle: *fio.fio_channel_handle_s,
+
+    pub const PublishArgs = struct {
+        message: []const u8,
+        is_json: bool = false,
+        /// `null` selects the default engine, see `setDefaultEngine()`
+        engine: ?Engine = null,
+    };
+
+    /// The channel name is copied.
+    pub fn init(name: []const u8) Channel {
+        return .{ .handle = fio.fio_channel_handle_new(util.str2fio(name)).? };
+    }
+
+    pub fn deinit(self: Channel) void {
+        fio.fio_channel_handle_free(self.handle);
+    }
+
+    /// Publish a message to the channel. The message is copied.
+    pub fn publish(self: Channel, args: PublishArgs) void {
+        fio.fio_channel_handle_publish(
+            self.handle,
+            if (args.engine) |engine| engine.toFio() else null,
+            util.str2fio(args.message),
+            if (args.is_json) 1 else 0,
+        );
+    }
+};
+
+/// Publish a message to a channel or filter. The message is copied.
+pub fn publish(args: PublishArgs) void {
+    std.debug.assert(args.filter >= 0); // negative filters are facil.io's
+    fio.fio_publish(.{
+        .engine = if (args.engine) |engine| engine.toFio() else null,
+        .filter = args.filter,
+        .channel = util.str2fio(args.channel),
+        .message = util.str2fio(args.message),
+        .is_json = if (args.is_json) 1 else 0,
+    });
+}
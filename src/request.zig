@@ -5,6 +5,8 @@ const http = @import("http.zig");
 const fio = @import("fio.zig");
 
 const util = @import("util.zig");
+const urlencoded = @import("urlencoded.zig");
+const Json = @import("json.zig");
 const zap = @import("zap.zig");
 
 const ContentType = zap.ContentType;
@@ -298,6 +300,13 @@ _is_finished_request_global: bool,
 /// NEVER touch this field!!!!
 /// this is part of the hack.
 _is_finished: *bool = undefined,
+/// NEVER touch this field!!!!
+/// set by the listener while a response may be stored in its ResponseCache.
+/// use cacheFor() instead.
+_cache_capture: ?*zap.ResponseCache.Capture = null,
+/// set by zap.Router for routes with `:param` or `*wildcard` segments.
+/// use getRouteParam() instead.
+_route_params: zap.Router.Params = .{},
 
 pub const UserContext = struct {
     user_context: ?*anyopaque = null,
@@ -333,6 +342,112 @@ pub fn getUserContext(self: *const Request, comptime Context: type) ?*Context {
         return null;
     }
 }
+
+/// A request detached from its connection by `Request.pause()`.
+///
+/// `Context` is the (pointer) type passed to `pause()`.
+pub fn PausedRequest(comptime Context: type) type {
+    switch (@typeInfo(Context)) {
+        .pointer => |p| if (p.size != .one) @compileError("pause context must be a single-item pointer"),
+        else => @compileError("pause context must be a pointer, got " ++ @typeName(Context)),
+    }
+
+    return struct {
+        handle: *fio.http_pause_handle_s,
+        context: Context,
+
+        const Self = @This();
+
+        /// Continue handling the request. Must be called exactly once, and may
+        /// be called from any thread.
+        ///
+        /// `on_resume` is called on one of the server's threads with a fresh
+        /// `Request` (only valid during the call). If it doesn't send a
+        /// response, an empty response is sent. If it returns an error before
+        /// sending a response, a 500 response is sent.
+        ///
+        /// If the connection was closed while the request was paused,
+        /// `on_abort` (if provided) is called instead, e.g. to free the
+        /// context.
+        pub fn resumeWith(
+            self: Self,
+            comptime on_resume: fn (Request, Context) anyerror!void,
+            comptime on_abort: ?fn (Context) void,
+        ) void {
+            const Wrapper = struct {
+                fn task(h: [*c]fio.http_s) callconv(.c) void {
+                    const context: Context = @ptrCast(@alignCast(h.*.udata.?));
+                    var req: Request = .{
+                        .path = util.fio2str(h.*.path),
+                        .query = util.fio2str(h.*.query),
+                        .body = util.fio2str(h.*.body),
+                        .method = util.fio2str(h.*.method),
+                        .h = h,
+                        ._is_finished_request_global = false,
+                        ._user_context = undefined,
+                    };
+                    req._is_finished = &req._is_finished_request_global;
+
+                    var user_context: UserContext = .{};
+                    req._user_context = &user_context;
+
+                    on_resume(req, context) catch |err| {
+                        zap.Logging.on_uncaught_error("Request resume", err);
+                        if (!req.isFinished()) {
+                            _ = fio.http_send_error(h, 500);
+                            return;
+                        }
+                    };
+                    if (!req.isFinished()) fio.http_finish(h);
+                }
+
+                fn fallback(udata: ?*anyopaque) callconv(.c) void {
+                    if (on_abort) |abort| abort(@ptrCast(@alignCast(udata.?)));
+                }
+            };
+            fio.http_resume(self.handle, Wrapper.task, Wrapper.fallback);
+        }
+    };
+}
+
+/// Detach the request from its connection, so the response can be sent later
+/// without blocking one of the server's threads in the meantime, e.g. while
+/// another thread does slow work or an upstream service responds.
+///
+/// `on_paused` is called shortly after (on a server thread) with a
+/// `PausedRequest` holding `context`. It should hand the paused request over
+/// to whoever completes the work - and return quickly. That code then calls
+/// `resumeWith()` (from any thread) to send the response.
+///
+/// `context` must be a pointer that stays valid until the request is resumed
+/// or aborted. The request must not be used after calling `pause()`.
+///
+/// ```zig
+/// fn onRequest(r: zap.Request) !void {
+///     const job = try allocator.create(Job);
+///     r.pause(job, Job.start); // Job.start(paused: zap.Request.PausedRequest(*Job))
+/// }
+/// ```
+pub fn pause(
+    self: *const Request,
+    context: anytype,
+    comptime on_paused: fn (PausedRequest(@TypeOf(context))) void,
+) void {
+    const Context = @TypeOf(context);
+    const Wrapper = struct {
+        fn task(handle: ?*fio.http_pause_handle_s) callconv(.c) void {
+            on_paused(.{
+                .handle = handle.?,
+                .context = @ptrCast(@alignCast(fio.http_paused_udata_get(handle).?)),
+            });
+        }
+    };
+    // http_pause() hands h.udata over to the paused handle
+    self.h.*.udata = @ptrCast(@constCast(context));
+    self.markAsFinished(true);
+    fio.http_pause(self.h, Wrapper.task);
+}
+
 /// Tries to send an error stack trace.
 /// Use like this:
 /// ```zig
@@ -366,8 +481,21 @@ pub fn _internal_sendError(self: *const Request, err: anyerror, err_trace: ?std.
     try self.sendBody(writer.buffered());
 }
 
+/// Mark the response as cacheable for `seconds` by the listener's
+/// `zap.ResponseCache` (if any). `vary` lists request header names whose
+/// values become part of the cache key, e.g. `&.{"accept-language"}`.
+/// Call this before sending the body. Without a ResponseCache, this is a
+/// no-op.
+pub fn cacheFor(self: *const Request, seconds: u32, vary: []const []const u8) void {
+    if (self._cache_capture) |capture| {
+        capture.ttl_s = seconds;
+        capture.vary = vary;
+    }
+}
+
 /// Send body.
 pub fn sendBody(self: *const Request, body: []const u8) HttpError!void {
+    if (self._cache_capture) |capture| zap.ResponseCache.store(capture, self, body);
     const ret = fio.http_send_body(self.h, @as(
         *anyopaque,
         @ptrFromInt(@intFromPtr(body.ptr)),
@@ -379,6 +507,7 @@ pub fn sendBody(self: *const Request, body: []const u8) HttpError!void {
 /// Set content type and send json buffer.
 pub fn sendJson(self: *const Request, json: []const u8) HttpError!void {
     if (self.setContentType(.JSON)) {
+        if (self._cache_capture) |capture| zap.ResponseCache.store(capture, self, json);
         if (fio.http_send_body(self.h, @as(
             *anyopaque,
             @ptrFromInt(@intFromPtr(json.ptr)),
@@ -387,6 +516,111 @@ pub fn sendJson(self: *const Request, json: []const u8) HttpError!void {
     } else |err| return err;
 }
 
+/// Serialize `value` as JSON straight into the outgoing response packet,
+/// behind the headers, and send it. Unlike `sendJson`, the body is written
+/// only once, without a temporary buffer. See `writeJsonWithOptions`.
+pub fn writeJson(self: *const Request, value: anytype) HttpError!void {
+    return self.writeJsonWithOptions(value, .{});
+}
+
+/// Like `writeJson`, with `std.json.Stringify` options.
+pub fn writeJsonWithOptions(self: *const Request, value: anytype, options: std.json.Stringify.Options) HttpError!void {
+    try self.setContentType(.JSON);
+    var packet = PacketWriter.start(self.h) orelse return error.HttpSendBody;
+    std.json.Stringify.value(value, options, &packet.writer) catch {
+        // nothing was sent, the request can still be answered
+        packet.abort();
+        return error.HttpSendBody;
+    };
+    try self.sendPacket(&packet);
+}
+
+/// Render a compiled `zap.Mustache.Template` for `data` straight into the
+/// outgoing response packet and send it as HTML.
+pub fn sendTemplate(self: *const Request, comptime Template: type, data: anytype) HttpError!void {
+    try self.setContentType(.HTML);
+    var packet = PacketWriter.start(self.h) orelse return error.HttpSendBody;
+    Template.render(&packet.writer, data) catch {
+        packet.abort();
+        return error.HttpSendBody;
+    };
+    try self.sendPacket(&packet);
+}
+
+fn sendPacket(self: *const Request, packet: *PacketWriter) HttpError!void {
+    const body = packet.commit();
+    if (self._cache_capture) |capture| zap.ResponseCache.store(capture, self, body);
+    if (fio.http_packet_send(self.h, packet.packet, packet.body_start) != 0) return error.HttpSendBody;
+    self.markAsFinished(true);
+}
+
+/// A writer into the spare capacity of a response packet from
+/// `fio.http_packet_start`, growing the packet as needed.
+const PacketWriter = struct {
+    packet: fio.FIOBJ,
+    /// length of the headers
+    body_start: usize,
+    writer: std.io.Writer,
+
+    /// initial room for the body, the packet grows as needed
+    const initial_capa = 4096;
+
+    fn start(h: [*c]fio.http_s) ?PacketWriter {
+        const packet = fio.http_packet_start(h, initial_capa);
+        if (packet == 0) return null;
+        const len = fio.fiobj_obj2cstr(packet).len;
+        var self: PacketWriter = .{
+            .packet = packet,
+            .body_start = len,
+            .writer = .{
+                .vtable = &.{ .drain = drain, .flush = std.io.Writer.noopFlush },
+                .buffer = &.{},
+                .end = len,
+            },
+        };
+        self.remap();
+        return self;
+    }
+
+    /// point the writer's buffer at the packet's current memory
+    fn remap(self: *PacketWriter) void {
+        const capa = fio.fiobj_str_capa(self.packet);
+        self.writer.buffer = fio.fiobj_obj2cstr(self.packet).data[0..capa];
+    }
+
+    /// Set the packet's length to what was written, returns the body.
+    fn commit(self: *PacketWriter) []const u8 {
+        fio.fiobj_str_resize(self.packet, self.writer.end);
+        return self.writer.buffer[self.body_start..self.writer.end];
+    }
+
+    fn abort(self: *PacketWriter) void {
+        fio.fiobj_free_wrapped(self.packet);
+    }
+
+    fn drain(w: *std.io.Writer, data: []const []const u8, splat: usize) std.io.Writer.Error!usize {
+        const self: *PacketWriter = @fieldParentPtr("writer", w);
+        const pattern = data[data.len - 1];
+        var len = pattern.len * splat;
+        for (data[0 .. data.len - 1]) |bytes| len += bytes.len;
+
+        // buffered bytes are already in the packet: grow, keeping them
+        fio.fiobj_str_resize(self.packet, w.end);
+        _ = fio.fiobj_str_capa_assert(self.packet, @max(w.end + len, w.buffer.len * 2));
+        self.remap();
+
+        for (data[0 .. data.len - 1]) |bytes| {
+            @memcpy(w.buffer[w.end..][0..bytes.len], bytes);
+            w.end += bytes.len;
+        }
+        for (0..splat) |_| {
+            @memcpy(w.buffer[w.end..][0..pattern.len], pattern);
+            w.end += pattern.len;
+        }
+        return len;
+    }
+};
+
 /// Set content type.
 pub fn setContentType(self: *const Request, c: ContentType) HttpError!void {
     const s = switch (c) {
@@ -594,6 +828,36 @@ pub fn parseQuery(self: *const Request) void {
     fio.http_parse_query(self.h);
 }
 
+/// Decodes the query string into a `T`, without parseQuery() and FIOBJs.
+/// Only escaped strings are copied into `arena`. See zap.UrlEncoded.
+pub fn decodeQuery(self: *const Request, comptime T: type, arena: Allocator) urlencoded.DecodeError!T {
+    return urlencoded.decode(T, arena, self.query orelse "");
+}
+
+/// Decodes an `application/x-www-form-urlencoded` body into a `T`, without
+/// parseBody() and FIOBJs. Only escaped strings are copied into `arena`.
+/// See zap.UrlEncoded.
+pub fn decodeForm(self: *const Request, comptime T: type, arena: Allocator) (urlencoded.DecodeError || error{UnsupportedContentType})!T {
+    if (self.getHeader("content-type")) |content_type| {
+        if (!std.ascii.startsWithIgnoreCase(content_type, "application/x-www-form-urlencoded")) {
+            return error.UnsupportedContentType;
+        }
+    }
+    return urlencoded.decode(T, arena, self.body orelse "");
+}
+
+/// Decodes a JSON body into a `T`, straight from the body buffer and without
+/// FIOBJs. Only escaped strings, slices and arrays are allocated in `arena`.
+/// See zap.Json.
+pub fn decodeJson(self: *const Request, comptime T: type, arena: Allocator) (Json.DecodeError || error{UnsupportedContentType})!T {
+    if (self.getHeader("content-type")) |content_type| {
+        if (std.ascii.indexOfIgnoreCase(content_type, "json") == null) {
+            return error.UnsupportedContentType;
+        }
+    }
+    return Json.decode(T, arena, self.body orelse "");
+}
+
 /// Parse received cookie headers
 pub fn parseCookies(self: *const Request, url_encoded: bool) void {
     fio.http_parse_cookies(self.h, if (url_encoded) 1 else 0);
@@ -908,6 +1172,13 @@ pub fn getParamSlice(self: *const Request, name: []const u8) ?[]const u8 {
     return null;
 }
 
+/// Returns the value of a `:param` or `*wildcard` path segment captured by
+/// zap.Router, e.g. `getRouteParam("id")` for the route "/users/:id".
+/// - no allocation: the value is a slice into `path`, non-decoded
+pub fn getRouteParam(self: *const Request, name: []const u8) ?[]const u8 {
+    return self._route_params.get(name);
+}
+
 pub const ParameterSlices = struct { name: []const u8, value: []const u8 };
 
 pub const ParamSliceIterator = struct {
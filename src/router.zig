@@ -1,12 +1,40 @@
+//! A compressed radix-tree (prefix tree) router.
+//!
+//! Routes consist of static parts, `:param` segments and an optional trailing
+//! `*wildcard`:
+//!
+//! ```zig
+//! try router.handle_func_unbound("/", on_index);
+//! try router.handle_method_unbound(.GET, "/users/:id", on_get_user);
+//! try router.handle_method_unbound(.DELETE, "/users/:id", on_delete_user);
+//! try router.handle_func_unbound("/static/*path", on_static);
+//! ```
+//!
+//! Static parts take precedence over params, params over wildcards. A `:param`
+//! matches one non-empty path segment, a `*wildcard` matches the rest of the
+//! path (possibly empty). Captured values are slices into `r.path`, read them
+//! with `r.getRouteParam("id")`.
+//!
+//! Each route has one handler slot per HTTP method, plus one for any method
+//! (`handle_func`, `handle_func_unbound`). A route without a handler for the
+//! request method doesn't match it: lookup continues with the less specific
+//! routes. If some route matches the path but none accepts the method, a 405 is
+//! sent.
 const std = @import("std");
 const zap = @import("zap.zig");
+const http = zap.http;
 
 const Allocator = std.mem.Allocator;
 
-/// Errors returnable by init()
+/// Errors returnable by the handle_* functions
 const RouterError = error{
     AlreadyExists,
     EmptyPath,
+    /// empty param name, or a `*wildcard` that is not the last segment
+    InvalidPath,
+    /// a different param name was already registered at the same position
+    ParamConflict,
+    TooManyParams,
 };
 
 const Router = @This();
@@ -20,6 +48,25 @@ pub const Options = struct {
     not_found: ?zap.HttpRequestFn = null,
 };
 
+/// Maximum number of `:param` and `*wildcard` captures per route.
+pub const max_params = 8;
+
+/// Path parameters captured by the router. Names point into the router,
+/// values into the request path: nothing is copied.
+pub const Params = struct {
+    names: []const []const u8 = &.{},
+    values: [max_params][]const u8 = undefined,
+    len: u8 = 0,
+
+    /// Get the value of a captured parameter by name.
+    pub fn get(self: *const Params, name: []const u8) ?[]const u8 {
+        for (self.names, self.values[0..self.names.len]) |n, v| {
+            if (std.mem.eql(u8, n, name)) return v;
+        }
+        return null;
+    }
+};
+
 const CallbackTag = enum { bound, unbound };
 const BoundHandler = *fn (*const anyopaque, zap.Request) anyerror!void;
 const Callback = union(CallbackTag) {
@@ -27,35 +74,74 @@ const Callback = union(CallbackTag) {
     unbound: zap.HttpRequestFn,
 };
 
-routes: std.StringHashMap(Callback),
+const method_count = @typeInfo(http.Method).@"enum".fields.len;
+
+const Node = struct {
+    kind: enum { static, param, wildcard },
+    /// static nodes: the (compressed) path bytes; otherwise the param name
+    label: []const u8,
+    static_children: std.ArrayListUnmanaged(*Node) = .empty,
+    param_child: ?*Node = null,
+    wildcard_child: ?*Node = null,
+    /// handlers by `http.Method`
+    handlers: [method_count]?Callback = @splat(null),
+    /// handler for any method
+    any: ?Callback = null,
+    /// names of all params captured on the way to this node
+    param_names: []const []const u8 = &.{},
+
+    fn hasHandlers(self: *const Node) bool {
+        if (self.any != null) return true;
+        for (self.handlers) |h| if (h != null) return true;
+        return false;
+    }
+
+    fn handlerFor(self: *const Node, method: http.Method) ?Callback {
+        if (self.handlers[@intFromEnum(method)]) |h| return h;
+        // answer HEAD requests with the GET handler
+        if (method == .HEAD) {
+            if (self.handlers[@intFromEnum(http.Method.GET)]) |h| return h;
+        }
+        return self.any;
+    }
+};
+
+/// Result of `lookup()`.
+pub const Match = union(enum) {
+    found: Callback,
+    /// the path matched, but there is no handler for the method
+    method_not_allowed,
+    not_found,
+};
+
+/// owns all nodes and labels
+arena: std.heap.ArenaAllocator,
+root: Node = .{ .kind = .static, .label = "" },
 not_found: ?zap.HttpRequestFn,
 
 /// Create a new Router
 pub fn init(allocator: Allocator, options: Options) Router {
     return .{
-        .routes = std.StringHashMap(Callback).init(allocator),
-
+        .arena = std.heap.ArenaAllocator.init(allocator),
         .not_found = options.not_found,
     };
 }
 
 /// Deinit the router
 pub fn deinit(self: *Router) void {
-    self.routes.deinit();
+    self.arena.deinit();
 }
 
 /// Call this to add a route with an unbound handler: a handler that is not member of a struct.
 /// To be precise: a handler that doesn't take an instance pointer as first argument.
+/// The handler is called for any request method.
 pub fn handle_func_unbound(self: *Router, path: []const u8, h: zap.HttpRequestFn) !void {
-    if (path.len == 0) {
-        return RouterError.EmptyPath;
-    }
-
-    if (self.routes.contains(path)) {
-        return RouterError.AlreadyExists;
-    }
+    try self.addRoute(null, path, Callback{ .unbound = h });
+}
 
-    try self.routes.put(path, Callback{ .unbound = h });
+/// Like `handle_func_unbound()`, but only for requests with the given method.
+pub fn handle_method_unbound(self: *Router, method: http.Method, path: []const u8, h: zap.HttpRequestFn) !void {
+    try self.addRoute(method, path, Callback{ .unbound = h });
 }
 
 /// Call this to add a route with a handler that is bound to an instance of a struct.
@@ -72,6 +158,15 @@ pub fn handle_func_unbound(self: *Router, path: []const u8, h: zap.HttpRequestFn
 /// my_router.handle_func("/getA", &handler_instance, HandlerType.getA);
 /// ```
 pub fn handle_func(self: *Router, path: []const u8, instance: *anyopaque, handler: anytype) !void {
+    try self.handle_func_for(null, path, instance, handler);
+}
+
+/// Like `handle_func()`, but only for requests with the given method.
+pub fn handle_method(self: *Router, method: http.Method, path: []const u8, instance: *anyopaque, handler: anytype) !void {
+    try self.handle_func_for(method, path, instance, handler);
+}
+
+fn handle_func_for(self: *Router, method: ?http.Method, path: []const u8, instance: *anyopaque, handler: anytype) !void {
     // TODO: assert type of instance has handler
 
     // Introspection checks on handler type
@@ -115,15 +210,7 @@ pub fn handle_func(self: *Router, path: []const u8, instance: *anyopaque, handle
         }
     }
 
-    if (path.len == 0) {
-        return RouterError.EmptyPath;
-    }
-
-    if (self.routes.contains(path)) {
-        return RouterError.AlreadyExists;
-    }
-
-    try self.routes.put(path, Callback{ .bound = .{
+    try self.addRoute(method, path, Callback{ .bound = .{
         .instance = @intFromPtr(instance),
         .handler = @intFromPtr(handler),
     } });
@@ -142,17 +229,180 @@ fn zap_on_request(r: zap.Request) !void {
 fn serve(self: *Router, r: zap.Request) !void {
     const path = r.path orelse "/";
 
-    if (self.routes.get(path)) |routeInfo| {
-        switch (routeInfo) {
-            .bound => |b| try @call(.auto, @as(BoundHandler, @ptrFromInt(b.handler)), .{ @as(*anyopaque, @ptrFromInt(b.instance)), r }),
-            .unbound => |h| try h(r),
+    var req = r;
+    switch (self.lookup(r.methodAsEnum(), path, &req._route_params)) {
+        .found => |routeInfo| switch (routeInfo) {
+            .bound => |b| try @call(.auto, @as(BoundHandler, @ptrFromInt(b.handler)), .{ @as(*anyopaque, @ptrFromInt(b.instance)), req }),
+            .unbound => |h| try h(req),
+        },
+        .method_not_allowed => {
+            r.setStatus(.method_not_allowed);
+            try r.sendBody("405 Method Not Allowed");
+        },
+        .not_found => if (self.not_found) |handler| {
+            // not found handler
+            try handler(r);
+        } else {
+            // default 404 output
+            r.setStatus(.not_found);
+            try r.sendBody("404 Not Found");
+        },
+    }
+}
+
+/// Find the handler for `method` and `path`, capturing params into `params`.
+pub fn lookup(self: *const Router, method: http.Method, path: []const u8, params: *Params) Match {
+    params.len = 0;
+    const node = find(&self.root, path, method, params) orelse {
+        // is there a route for the path with other methods?
+        params.len = 0;
+        if (find(&self.root, path, null, params) != null) return .method_not_allowed;
+        return .not_found;
+    };
+    params.names = node.param_names;
+    return .{ .found = node.handlerFor(method).? };
+}
+
+/// Whether `node` ends a route accepting `method` (any method if null).
+fn accepts(node: *const Node, method: ?http.Method) bool {
+    if (method) |m| return node.handlerFor(m) != null;
+    return node.hasHandlers();
+}
+
+/// `rest` is the part of the path after `node`'s label. Routes that match the
+/// path but don't accept `method` are skipped.
+fn find(node: *const Node, rest: []const u8, method: ?http.Method, params: *Params) ?*const Node {
+    if (rest.len == 0) {
+        if (accepts(node, method)) return node;
+        // a wildcard also matches an empty rest
+        if (node.wildcard_child) |w| {
+            if (accepts(w, method)) {
+                params.values[params.len] = rest;
+                params.len += 1;
+                return w;
+            }
+        }
+        return null;
+    }
+
+    // at most one static child starts with the same byte
+    for (node.static_children.items) |child| {
+        if (child.label[0] != rest[0]) continue;
+        if (std.mem.startsWith(u8, rest, child.label)) {
+            if (find(child, rest[child.label.len..], method, params)) |found| return found;
+        }
+        break;
+    }
+
+    if (node.param_child) |p| {
+        const end = std.mem.indexOfScalar(u8, rest, '/') orelse rest.len;
+        if (end > 0) {
+            const saved = params.len;
+            params.values[params.len] = rest[0..end];
+            params.len += 1;
+            if (find(p, rest[end..], method, params)) |found| return found;
+            params.len = saved;
+        }
+    }
+
+    if (node.wildcard_child) |w| {
+        if (accepts(w, method)) {
+            params.values[params.len] = rest;
+            params.len += 1;
+            return w;
+        }
+    }
+    return null;
+}
+
+fn isParamStart(path: []const u8, i: usize) bool {
+    return (path[i] == ':' or path[i] == '*') and (i == 0 or path[i - 1] == '/');
+}
+
+fn addRoute(self: *Router, method: ?http.Method, path: []const u8, cb: Callback) !void {
+    if (path.len == 0) {
+        return RouterError.EmptyPath;
+    }
+
+    // validate before touching the tree
+    var param_count: usize = 0;
+    for (0..path.len) |i| {
+        if (!isParamStart(path, i)) continue;
+        const end = std.mem.indexOfScalarPos(u8, path, i, '/') orelse path.len;
+        if (end == i + 1) return RouterError.InvalidPath;
+        if (path[i] == '*' and end != path.len) return RouterError.InvalidPath;
+        param_count += 1;
+    }
+    if (param_count > max_params) return RouterError.TooManyParams;
+
+    const a = self.arena.allocator();
+    var names: [max_params][]const u8 = undefined;
+    var node: *Node = &self.root;
+    var i: usize = 0;
+    param_count = 0;
+    while (i < path.len) {
+        if (isParamStart(path, i)) {
+            const end = std.mem.indexOfScalarPos(u8, path, i, '/') orelse path.len;
+            const name = path[i + 1 .. end];
+            const slot = if (path[i] == '*') &node.wildcard_child else &node.param_child;
+            if (slot.*) |child| {
+                if (!std.mem.eql(u8, child.label, name)) return RouterError.ParamConflict;
+            } else {
+                const child = try a.create(Node);
+                child.* = .{
+                    .kind = if (path[i] == '*') .wildcard else .param,
+                    .label = try a.dupe(u8, name),
+                };
+                slot.* = child;
+            }
+            node = slot.*.?;
+            names[param_count] = node.label;
+            param_count += 1;
+            i = end;
+        } else {
+            var end = i + 1;
+            while (end < path.len and !isParamStart(path, end)) end += 1;
+            node = try insertStatic(a, node, path[i..end]);
+            i = end;
+        }
+    }
+
+    const slot = if (method) |m| &node.handlers[@intFromEnum(m)] else &node.any;
+    if (slot.* != null) {
+        return RouterError.AlreadyExists;
+    }
+    if (param_count > 0 and node.param_names.len == 0) {
+        node.param_names = try a.dupe([]const u8, names[0..param_count]);
+    }
+    slot.* = cb;
+}
+
+/// Insert the static path part `s` below `parent`, splitting nodes that share
+/// a prefix with it. Returns the node ending at `s`.
+fn insertStatic(a: Allocator, parent: *Node, s: []const u8) !*Node {
+    var node = parent;
+    var rest = s;
+    outer: while (rest.len > 0) {
+        for (node.static_children.items, 0..) |child, k| {
+            if (child.label[0] != rest[0]) continue;
+            const common = std.mem.indexOfDiff(u8, child.label, rest) orelse child.label.len;
+            if (common < child.label.len) {
+                const mid = try a.create(Node);
+                mid.* = .{ .kind = .static, .label = child.label[0..common] };
+                try mid.static_children.append(a, child);
+                child.label = child.label[common..];
+                node.static_children.items[k] = mid;
+                node = mid;
+            } else {
+                node = child;
+            }
+            rest = rest[common..];
+            continue :outer;
         }
-    } else if (self.not_found) |handler| {
-        // not found handler
-        try handler(r);
-    } else {
-        // default 404 output
-        r.setStatus(.not_found);
-        try r.sendBody("404 Not Found");
+        const child = try a.create(Node);
+        child.* = .{ .kind = .static, .label = try a.dupe(u8, rest) };
+        try node.static_children.append(a, child);
+        return child;
     }
+    return node;
 }
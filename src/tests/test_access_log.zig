@@ -0,0 +1,106 @@
+const std = @import("std");
+const zap = @import("zap");
+
+// set default log level to .info and ZAP log level to .debug
+pub const std_options: std.Options = .{
+    .log_level = .info,
+    .log_scope_levels = &[_]std.log.ScopeLevel{
+        .{ .scope = .zap, .level = .debug },
+    },
+};
+
+const log_path = "/tmp/zap_test_access_log.json";
+
+const Answer = struct {
+    answer: u32,
+};
+
+fn on_request(r: zap.Request) !void {
+    if (std.mem.eql(u8, r.path orelse "/", "/json")) {
+        // written into the response packet, without a content-length header
+        return r.writeJson(Answer{ .answer = 42 });
+    }
+    try r.sendBody("hello");
+}
+
+fn fetch(client: *std.http.Client, url: []const u8) !void {
+    var body: [64]u8 = undefined;
+    var response_writer: std.io.Writer = .fixed(&body);
+    _ = try client.fetch(.{
+        .location = .{ .url = url },
+        .response_writer = &response_writer,
+    });
+}
+
+fn makeRequests() !void {
+    defer zap.stop();
+    var http_client: std.http.Client = .{ .allocator = std.testing.allocator };
+    defer http_client.deinit();
+    try fetch(&http_client, "http://127.0.0.1:3046/hello");
+    try fetch(&http_client, "http://127.0.0.1:3046/json");
+}
+
+var client_thread: ?std.Thread = null;
+
+fn on_ready(_: *zap.HttpListener) void {
+    client_thread = std.Thread.spawn(.{}, makeRequests, .{}) catch unreachable;
+}
+
+/// the fields of a `.json` access log line
+const Line = struct {
+    time: []const u8,
+    peer: []const u8,
+    method: []const u8,
+    path: []const u8,
+    version: []const u8,
+    status: u16,
+    bytes: usize,
+    duration_us: i64,
+};
+
+fn expectLine(line: []const u8, path: []const u8, bytes: usize) !void {
+    const parsed = try std.json.parseFromSlice(Line, std.testing.allocator, line, .{});
+    defer parsed.deinit();
+    const l = parsed.value;
+    try std.testing.expect(std.mem.endsWith(u8, l.time, " GMT"));
+    try std.testing.expectEqualStrings("127.0.0.1", l.peer);
+    try std.testing.expectEqualStrings("GET", l.method);
+    try std.testing.expectEqualStrings(path, l.path);
+    try std.testing.expectEqualStrings("HTTP/1.1", l.version);
+    try std.testing.expectEqual(200, l.status);
+    try std.testing.expectEqual(bytes, l.bytes);
+    try std.testing.expect(l.duration_us >= 0);
+}
+
+test "access log lines and their fields" {
+    const allocator = std.testing.allocator;
+    std.fs.cwd().deleteFile(log_path) catch {};
+    defer std.fs.cwd().deleteFile(log_path) catch {};
+
+    try zap.Logging.setupAccessLog(.{ .target = log_path, .format = .json });
+
+    var listener = zap.HttpListener.init(.{
+        .port = 3046,
+        .on_request = on_request,
+        .on_ready = on_ready,
+        .log = true,
+        .max_clients = 10,
+    });
+    try listener.listen();
+
+    // the log writer is drained when the server stops
+    zap.start(.{
+        .threads = 1,
+        .workers = 1,
+    });
+    (client_thread orelse return error.Wrong).join();
+
+    const content = try std.fs.cwd().readFileAlloc(allocator, log_path, 1 << 16);
+    defer allocator.free(content);
+
+    var lines = std.mem.tokenizeScalar(u8, content, '\n');
+    try expectLine(lines.next() orelse return error.Wrong, "/hello", "hello".len);
+    try expectLine(lines.next() orelse return error.Wrong, "/json", "{\"answer\":42}".len);
+    try std.testing.expect(lines.next() == null);
+    try std.testing.expectEqual(0, zap.Logging.accessLogDropped());
+}
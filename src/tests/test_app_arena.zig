@@ -0,0 +1,88 @@
+const std = @import("std");
+const zap = @import("zap");
+
+// set default log level to .info and ZAP log level to .debug
+pub const std_options: std.Options = .{
+    .log_level = .info,
+    .log_scope_levels = &[_]std.log.ScopeLevel{
+        .{ .scope = .zap, .level = .debug },
+    },
+};
+
+const big = 1024 * 1024;
+const small = 16;
+
+const Context = struct {};
+const App = zap.App.Create(Context);
+
+/// Allocates `size` bytes from the request arena
+const AllocatingEndpoint = struct {
+    path: []const u8,
+    size: usize,
+    error_strategy: zap.Endpoint.ErrorStrategy = .log_to_response,
+
+    pub fn get(e: *AllocatingEndpoint, arena: std.mem.Allocator, _: *Context, r: zap.Request) !void {
+        const buf = try arena.alloc(u8, e.size);
+        @memset(buf, 'x');
+        try r.sendBody("ok");
+    }
+};
+
+// one burst, then two windows of small requests
+const paths = [_][]const u8{ "/big", "/small", "/small", "/small", "/small" };
+
+fn makeRequests() !void {
+    defer zap.stop();
+    var http_client: std.http.Client = .{ .allocator = std.testing.allocator };
+    defer http_client.deinit();
+
+    var url_buf: [64]u8 = undefined;
+    for (paths) |path| {
+        var body: [16]u8 = undefined;
+        var response_writer: std.io.Writer = .fixed(&body);
+        _ = try http_client.fetch(.{
+            .location = .{ .url = try std.fmt.bufPrint(&url_buf, "http://127.0.0.1:3051{s}", .{path}) },
+            .response_writer = &response_writer,
+        });
+    }
+}
+
+var client_thread: ?std.Thread = null;
+
+fn on_ready(_: *zap.HttpListener) void {
+    client_thread = std.Thread.spawn(.{}, makeRequests, .{}) catch unreachable;
+}
+
+test "high water arenas release a burst" {
+    var context: Context = .{};
+    try App.init(std.testing.allocator, &context, .{ .arena_high_water_window = 2 });
+    defer App.deinit();
+
+    var big_endpoint: AllocatingEndpoint = .{ .path = "/big", .size = big };
+    var small_endpoint: AllocatingEndpoint = .{ .path = "/small", .size = small };
+    try App.register(&big_endpoint);
+    try App.register(&small_endpoint);
+
+    try App.listen(.{
+        .port = 3051,
+        .on_ready = on_ready,
+    });
+    zap.start(.{
+        .threads = 1,
+        .workers = 1,
+    });
+    (client_thread orelse return error.Wrong).join();
+
+    const stats = try App.arenaStats(std.testing.allocator);
+    defer std.testing.allocator.free(stats);
+    try std.testing.expectEqual(1, stats.len);
+    const s = stats[0];
+
+    try std.testing.expectEqual(paths.len, s.resets);
+    // the bytes the biggest request allocated, not the arena's capacity
+    try std.testing.expectEqual(big, s.peak_bytes);
+    // the burst is out of both windows
+    try std.testing.expect(s.retained_bytes < big);
+    // the first request had to grow the arena, the retained ones didn't
+    try std.testing.expectEqual(1, s.gpa_fallbacks);
+}
@@ -0,0 +1,139 @@
+const std = @import("std");
+const zap = @import("zap");
+
+// set default log level to .info and ZAP log level to .debug
+pub const std_options: std.Options = .{
+    .log_level = .info,
+    .log_scope_levels = &[_]std.log.ScopeLevel{
+        .{ .scope = .zap, .level = .debug },
+    },
+};
+
+/// Tasks block until the gate is opened.
+const Gate = struct {
+    opened: std.Thread.ResetEvent = .{},
+    ran: std.atomic.Value(usize) = .init(0),
+
+    fn work(self: *Gate) void {
+        self.opened.wait();
+        _ = self.ran.fetchAdd(1, .monotonic);
+    }
+};
+
+test "submit runs tasks and rejects them when the queue is full" {
+    var pool = try zap.BlockingPool.init(std.testing.allocator, .{ .threads = 1, .max_queued = 2 });
+    defer pool.deinit();
+
+    var gate: Gate = .{};
+    try std.testing.expectError(error.NotRunning, pool.submit(&gate, Gate.work, null));
+
+    try pool.start();
+    // occupy the only thread, then fill the queue
+    try pool.submit(&gate, Gate.work, null);
+    while (pool.stats().running == 0) std.Thread.sleep(std.time.ns_per_ms);
+    try pool.submit(&gate, Gate.work, null);
+    try pool.submit(&gate, Gate.work, null);
+    try std.testing.expectError(error.QueueFull, pool.submit(&gate, Gate.work, null));
+
+    gate.opened.set();
+    pool.stop();
+
+    const s = pool.stats();
+    try std.testing.expectEqual(3, gate.ran.load(.monotonic));
+    try std.testing.expectEqual(3, s.completed);
+    try std.testing.expectEqual(1, s.rejected);
+    try std.testing.expectEqual(0, s.queued);
+    try std.testing.expectEqual(0, s.running);
+}
+
+const Job = struct {
+    n: u64 = 20,
+    result: u64 = 0,
+
+    const Paused = zap.Request.PausedRequest(*Job);
+
+    // runs on the pool
+    fn work(self: *Job) void {
+        var a: u64 = 0;
+        var b: u64 = 1;
+        for (0..self.n) |_| {
+            const next = a + b;
+            a = b;
+            b = next;
+        }
+        self.result = a;
+    }
+
+    // runs on a server thread again
+    fn respond(r: zap.Request, self: *Job) anyerror!void {
+        var buf: [32]u8 = undefined;
+        try r.sendBody(try std.fmt.bufPrint(&buf, "result: {d}", .{self.result}));
+    }
+
+    fn busy(r: zap.Request, _: *Job) anyerror!void {
+        try r.sendBody("busy");
+    }
+};
+
+var pool: zap.BlockingPool = undefined;
+var job: Job = .{};
+
+fn startJob(paused: Job.Paused) void {
+    pool.submitPaused(paused, Job.work, Job.respond) catch {
+        paused.resumeWith(Job.busy, null);
+    };
+}
+
+fn on_request(r: zap.Request) !void {
+    r.pause(&job, startJob);
+}
+
+var response: [64]u8 = undefined;
+var response_len: usize = 0;
+
+fn makeRequest() !void {
+    defer zap.stop();
+    var http_client: std.http.Client = .{ .allocator = std.testing.allocator };
+    defer http_client.deinit();
+
+    var response_writer: std.io.Writer = .fixed(&response);
+    _ = try http_client.fetch(.{
+        .location = .{ .url = "http://127.0.0.1:3048/" },
+        .response_writer = &response_writer,
+    });
+    response_len = response_writer.end;
+}
+
+var client_thread: ?std.Thread = null;
+
+fn on_ready(_: *zap.HttpListener) void {
+    client_thread = std.Thread.spawn(.{}, makeRequest, .{}) catch unreachable;
+}
+
+test "startWithServer runs paused requests on the pool" {
+    pool = try zap.BlockingPool.init(std.testing.allocator, .{ .threads = 2 });
+    defer pool.deinit();
+    // started by the (worker) process once the server runs
+    pool.startWithServer();
+    try std.testing.expectError(error.NotRunning, pool.submit(&job, Job.work, null));
+
+    var listener = zap.HttpListener.init(.{
+        .port = 3048,
+        .on_request = on_request,
+        .on_ready = on_ready,
+        .log = false,
+        .max_clients = 10,
+    });
+    try listener.listen();
+
+    zap.start(.{
+        .threads = 1,
+        .workers = 1,
+    });
+    (client_thread orelse return error.Wrong).join();
+
+    try std.testing.expectEqualStrings("result: 6765", response[0..response_len]);
+    // stopped with the server
+    try std.testing.expectError(error.NotRunning, pool.submit(&job, Job.work, null));
+    try std.testing.expectEqual(1, pool.stats().completed);
+}
@@ -0,0 +1,90 @@
+const std = @import("std");
+const zap = @import("zap");
+
+test "decode json into struct" {
+    const Kind = enum { book, music };
+    const Item = struct { sku: []const u8, qty: u32, kind: Kind = .book };
+    const Order = struct {
+        id: u64,
+        customer: []const u8,
+        items: []const Item,
+        total: f64,
+        gift: bool = false,
+        note: ?[]const u8,
+        pos: [2]i32 = .{ 0, 0 },
+    };
+
+    var arena_state = std.heap.ArenaAllocator.init(std.testing.allocator);
+    defer arena_state.deinit();
+    const arena = arena_state.allocator();
+
+    const input: []const u8 =
+        \\ {
+        \\   "id": 42, "customer": "Zig \"Ziggy\" Stardust é😀",
+        \\   "unknown": {"a": [1, 2, {"b": "}"}], "c": null},
+        \\   "items": [{"sku": "a-very-long-stock-keeping-unit-string", "qty": 2},
+        \\             {"qty": 1, "sku": "b", "kind": "music"}],
+        \\   "total": 12.5e1, "gift": true, "pos": [-1, 2]
+        \\ }
+    ;
+    const order = try zap.Json.decode(Order, arena, input);
+    try std.testing.expectEqual(42, order.id);
+    try std.testing.expectEqualStrings("Zig \"Ziggy\" Stardust \u{e9}\u{1f600}", order.customer);
+    try std.testing.expectEqual(2, order.items.len);
+    try std.testing.expectEqualStrings("a-very-long-stock-keeping-unit-string", order.items[0].sku);
+    try std.testing.expectEqual(Kind.music, order.items[1].kind);
+    try std.testing.expectEqual(125.0, order.total);
+    try std.testing.expect(order.gift);
+    try std.testing.expect(order.note == null);
+    try std.testing.expectEqual([2]i32{ -1, 2 }, order.pos);
+
+    // unescaped strings point into the input
+    const sku = order.items[0].sku;
+    try std.testing.expect(@intFromPtr(sku.ptr) > @intFromPtr(input.ptr) and
+        @intFromPtr(sku.ptr) < @intFromPtr(input.ptr) + input.len);
+
+    try std.testing.expectError(error.MissingField, zap.Json.decode(Item, arena, "{\"qty\": 1}"));
+    try std.testing.expectError(error.InvalidValue, zap.Json.decode(Item, arena, "{\"sku\": \"x\", \"qty\": 1.5}"));
+    try std.testing.expectError(error.SyntaxError, zap.Json.decode(Item, arena, "{\"sku\": \"x\" \"qty\": 1}"));
+    try std.testing.expectError(error.UnexpectedEndOfInput, zap.Json.decode(Item, arena, "{\"sku\": \"x"));
+    try std.testing.expectError(error.SyntaxError, zap.Json.decode(u32, arena, "1 2"));
+}
+
+test "reject malformed json" {
+    var arena_state = std.heap.ArenaAllocator.init(std.testing.allocator);
+    defer arena_state.deinit();
+    const arena = arena_state.allocator();
+
+    const Item = struct { sku: []const u8, qty: i32 = 0 };
+
+    // numbers follow the JSON grammar
+    try std.testing.expectEqual(-5, try zap.Json.decode(i32, arena, "-5"));
+    try std.testing.expectEqual(0.25, try zap.Json.decode(f64, arena, "25e-2"));
+    for ([_][]const u8{ "+5", "05", ".5", "--1", "1-2", "1.e3" }) |input| {
+        try std.testing.expectError(error.SyntaxError, zap.Json.decode(i32, arena, input));
+    }
+    try std.testing.expectError(error.SyntaxError, zap.Json.decode(f64, arena, "+0.5"));
+    for ([_][]const u8{ "-", "1.", "1e", "1e+" }) |input| {
+        try std.testing.expectError(error.UnexpectedEndOfInput, zap.Json.decode(i32, arena, input));
+    }
+    try std.testing.expectError(error.SyntaxError, zap.Json.decode(Item, arena, "{\"sku\": \"x\", \"qty\": +5}"));
+
+    // skipped values are validated, too
+    const valid = try zap.Json.decode(Item, arena,
+        \\{"skip": {"a": [1, {}, [], -0.5e3, "]"], "b": {"c": null}}, "sku": "x"}
+    );
+    try std.testing.expectEqualStrings("x", valid.sku);
+    for ([_][]const u8{
+        "{\"skip\": [1:2], \"sku\": \"x\"}",
+        "{\"skip\": [1, 2}, \"sku\": \"x\"}",
+        "{\"skip\": {\"a\" 1}, \"sku\": \"x\"}",
+        "{\"skip\": {\"a\": 1, 2}, \"sku\": \"x\"}",
+        "{\"skip\": {1: 2}, \"sku\": \"x\"}",
+        "{\"skip\": {\"a\": 1]], \"sku\": \"x\"}",
+        "{\"skip\": [1 2], \"sku\": \"x\"}",
+        "{\"skip\": +5, \"sku\": \"x\"}",
+    }) |input| {
+        try std.testing.expectError(error.SyntaxError, zap.Json.decode(Item, arena, input));
+    }
+    try std.testing.expectError(error.UnexpectedEndOfInput, zap.Json.decode(Item, arena, "{\"skip\": [1, {\"a\": "));
+}
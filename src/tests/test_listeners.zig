@@ -0,0 +1,83 @@
+const std = @import("std");
+const zap = @import("zap");
+
+// set default log level to .info and ZAP log level to .debug
+pub const std_options: std.Options = .{
+    .log_level = .info,
+    .log_scope_levels = &[_]std.log.ScopeLevel{
+        .{ .scope = .zap, .level = .debug },
+    },
+};
+
+var public_buffer: [1024]u8 = undefined;
+var public_len: ?usize = null;
+var admin_buffer: [1024]u8 = undefined;
+var admin_len: ?usize = null;
+
+fn fetch(a: std.mem.Allocator, url: []const u8, buffer: []u8) !usize {
+    var http_client: std.http.Client = .{ .allocator = a };
+    defer http_client.deinit();
+
+    var response_writer = std.io.Writer.Allocating.init(a);
+    defer response_writer.deinit();
+
+    _ = try http_client.fetch(.{
+        .location = .{ .url = url },
+        .response_writer = &response_writer.writer,
+    });
+
+    const response_text = response_writer.written();
+    @memcpy(buffer[0..response_text.len], response_text);
+    return response_text.len;
+}
+
+fn makeRequests(a: std.mem.Allocator) !void {
+    public_len = try fetch(a, "http://127.0.0.1:3042/", &public_buffer);
+    admin_len = try fetch(a, "http://127.0.0.1:3043/", &admin_buffer);
+    zap.stop();
+}
+
+var client_thread: ?std.Thread = null;
+
+// send traffic as soon as the server is up
+fn on_ready(_: *zap.HttpListener) void {
+    client_thread = std.Thread.spawn(.{}, makeRequests, .{std.testing.allocator}) catch unreachable;
+}
+
+fn on_public(r: zap.Request) !void {
+    try r.sendBody("public");
+}
+
+fn on_admin(r: zap.Request) !void {
+    try r.sendBody("admin");
+}
+
+test "two listeners with different handlers" {
+    var public = zap.HttpListener.init(.{
+        .port = 3042,
+        .on_request = on_public,
+        .log = false,
+        .max_clients = 10,
+    });
+    try public.listen();
+
+    var admin = zap.HttpListener.init(.{
+        .port = 3043,
+        .interface = "127.0.0.1",
+        .on_request = on_admin,
+        .on_ready = on_ready,
+        .log = false,
+        .max_clients = 10,
+        .max_body_size = 1024,
+    });
+    try admin.listen();
+
+    zap.start(.{
+        .threads = 1,
+        .workers = 1,
+    });
+    (client_thread orelse return error.Wrong).join();
+
+    try std.testing.expectEqualStrings("public", public_buffer[0 .. public_len orelse return error.Wrong]);
+    try std.testing.expectEqualStrings("admin", admin_buffer[0 .. admin_len orelse return error.Wrong]);
+}
@@ -1,6 +1,14 @@
 const std = @import("std");
 const zap = @import("zap");
 
+// set default log level to .info and ZAP log level to .debug
+pub const std_options: std.Options = .{
+    .log_level = .info,
+    .log_scope_levels = &[_]std.log.ScopeLevel{
+        .{ .scope = .zap, .level = .debug },
+    },
+};
+
 const User = struct {
     name: []const u8,
     id: isize,
@@ -43,3 +51,141 @@ test "mustacheLoad" {
 
     try std.testing.expectEqualSlices(u8, "* Users:\n1. Rene (Rene)\n6. Caro (Caro)\nNested: nesting works.\n", ret.str().?);
 }
+
+test "mustacheTemplate" {
+    const Page = zap.Mustache.TemplateWithPartials(@embedFile("testtemplate.html"), .{
+        .{ "testpartial.html", @embedFile("testpartial.html") },
+    });
+
+    const ret = try Page.renderAlloc(std.testing.allocator, data);
+    defer std.testing.allocator.free(ret);
+
+    try std.testing.expectEqualSlices(u8, "* Users:\n1. Rene (Rene)\n6. Caro (Caro)\nNested: nesting works.\n", ret);
+}
+
+test "render comptime template" {
+    const Role = enum { admin, user };
+    const Member = struct { name: []const u8, role: Role, email: ?[]const u8 = null };
+    const Page = zap.Mustache.TemplateWithPartials(
+        \\<h1>{{title}}</h1>
+        \\{{! a comment }}
+        \\<ul>
+        \\{{#users}}
+        \\  <li>{{name}} ({{role}}){{#email}} <{{.}}>{{/email}}</li>
+        \\{{/users}}
+        \\{{^users}}
+        \\  <li>nobody</li>
+        \\{{/users}}
+        \\</ul>
+        \\{{> footer}}
+    , .{.{ "footer", "{{{title}}} - {{count}} users\n" }});
+
+    const members = [_]Member{
+        .{ .name = "Zig & Zag", .role = .admin, .email = "zz@example.com" },
+        .{ .name = "<script>", .role = .user },
+    };
+    const html = try Page.renderAlloc(std.testing.allocator, .{
+        .title = "Users & Roles",
+        .users = @as([]const Member, &members),
+        .count = 2,
+    });
+    defer std.testing.allocator.free(html);
+    try std.testing.expectEqualStrings(
+        \\<h1>Users &amp; Roles</h1>
+        \\<ul>
+        \\  <li>Zig &amp; Zag (admin) <zz@example.com></li>
+        \\  <li>&lt;script&gt; (user)</li>
+        \\</ul>
+        \\Users & Roles - 2 users
+        \\
+    , html);
+
+    const empty = try Page.renderAlloc(std.testing.allocator, .{
+        .title = "None",
+        .users = @as([]const Member, &.{}),
+        .count = 0,
+    });
+    defer std.testing.allocator.free(empty);
+    try std.testing.expect(std.mem.indexOf(u8, empty, "<li>nobody</li>") != null);
+}
+
+const ListPage = zap.Mustache.Template(
+    \\<ul>
+    \\{{#users}}
+    \\  <li>{{id}}. {{name}}</li>
+    \\{{/users}}
+    \\</ul>
+    \\
+);
+
+// larger than the initial packet capacity, so the packet has to grow
+var list_users: [500]User = undefined;
+
+const Response = struct {
+    content_type: ?[]u8 = null,
+    content_length: ?u64 = null,
+    body: ?[]u8 = null,
+};
+
+var response: Response = .{};
+
+fn fetchPage(a: std.mem.Allocator, url: []const u8) !void {
+    defer zap.stop();
+    var http_client: std.http.Client = .{ .allocator = a };
+    defer http_client.deinit();
+
+    var req = try http_client.request(.GET, try std.Uri.parse(url), .{});
+    defer req.deinit();
+    try req.sendBodiless();
+    var redirect_buffer: [1024]u8 = undefined;
+    var res = try req.receiveHead(&redirect_buffer);
+
+    // the head points into the connection's buffer, copy it before reading on
+    if (res.head.content_type) |t| response.content_type = try a.dupe(u8, t);
+    response.content_length = res.head.content_length;
+    var transfer_buffer: [64]u8 = undefined;
+    response.body = try res.reader(&transfer_buffer).allocRemaining(a, .unlimited);
+}
+
+var client_thread: ?std.Thread = null;
+
+fn on_ready(_: *zap.HttpListener) void {
+    client_thread = std.Thread.spawn(.{}, fetchPage, .{ std.testing.allocator, "http://127.0.0.1:3052/" }) catch unreachable;
+}
+
+fn on_request(r: zap.Request) !void {
+    try r.sendTemplate(ListPage, .{ .users = @as([]const User, &list_users) });
+}
+
+test "send template into the response packet" {
+    const allocator = std.testing.allocator;
+    for (&list_users, 0..) |*user, i| user.* = .{ .name = "Zig & Zag", .id = @intCast(i) };
+
+    var listener = zap.HttpListener.init(.{
+        .port = 3052,
+        .on_request = on_request,
+        .on_ready = on_ready,
+        .log = false,
+        .max_clients = 10,
+    });
+    try listener.listen();
+
+    zap.start(.{
+        .threads = 1,
+        .workers = 1,
+    });
+    (client_thread orelse return error.Wrong).join();
+
+    const content_type = response.content_type orelse return error.Wrong;
+    defer allocator.free(content_type);
+    const body = response.body orelse return error.Wrong;
+    defer allocator.free(body);
+
+    try std.testing.expectEqualStrings("text/html", content_type);
+    const expected = try ListPage.renderAlloc(allocator, .{ .users = @as([]const User, &list_users) });
+    defer allocator.free(expected);
+    try std.testing.expect(expected.len > 4096);
+    try std.testing.expectEqualStrings(expected, body);
+    // the content-length was patched to the rendered body
+    try std.testing.expectEqual(@as(?u64, expected.len), response.content_length);
+}
@@ -0,0 +1,96 @@
+const std = @import("std");
+const zap = @import("zap");
+
+// set default log level to .info and ZAP log level to .debug
+pub const std_options: std.Options = .{
+    .log_level = .info,
+    .log_scope_levels = &[_]std.log.ScopeLevel{
+        .{ .scope = .zap, .level = .debug },
+    },
+};
+
+var buffer: [1024]u8 = undefined;
+var read_len: ?usize = null;
+
+fn makeRequest(a: std.mem.Allocator, url: []const u8) !void {
+    var http_client: std.http.Client = .{ .allocator = a };
+    defer http_client.deinit();
+
+    var response_writer = std.io.Writer.Allocating.init(a);
+    defer response_writer.deinit();
+
+    _ = try http_client.fetch(.{
+        .location = .{ .url = url },
+        .response_writer = &response_writer.writer,
+    });
+
+    const response_text = response_writer.written();
+    read_len = response_text.len;
+    @memcpy(buffer[0..read_len.?], response_text);
+
+    zap.stop();
+}
+
+fn makeRequestThread(a: std.mem.Allocator, url: []const u8) !std.Thread {
+    return try std.Thread.spawn(.{}, makeRequest, .{ a, url });
+}
+
+const Job = struct {
+    answer: u32 = 0,
+    thread: ?std.Thread = null,
+
+    const Paused = zap.Request.PausedRequest(*Job);
+
+    // runs on a server thread: hand the request over to a worker thread
+    fn start(paused: Paused) void {
+        paused.context.thread = std.Thread.spawn(.{}, work, .{paused}) catch unreachable;
+    }
+
+    // runs outside of the server's threads
+    fn work(paused: Paused) void {
+        std.Thread.sleep(10 * std.time.ns_per_ms);
+        paused.context.answer = 42;
+        paused.resumeWith(finish, null);
+    }
+
+    // runs on a server thread again
+    fn finish(r: zap.Request, job: *Job) !void {
+        var buf: [32]u8 = undefined;
+        try r.sendBody(try std.fmt.bufPrint(&buf, "answer: {d}", .{job.answer}));
+    }
+};
+
+var job: Job = .{};
+
+fn on_request(r: zap.Request) !void {
+    r.pause(&job, Job.start);
+}
+
+test "pause and resume a request" {
+    const allocator = std.testing.allocator;
+
+    // setup listener
+    var listener = zap.HttpListener.init(
+        .{
+            .port = 3041,
+            .on_request = on_request,
+            .log = false,
+            .max_clients = 10,
+        },
+    );
+    try listener.listen();
+
+    const thread = try makeRequestThread(allocator, "http://127.0.0.1:3041/");
+    defer thread.join();
+    zap.start(.{
+        .threads = 1,
+        .workers = 1,
+    });
+    if (job.thread) |t| t.join();
+
+    if (read_len) |rl| {
+        try std.testing.expectEqualSlices(u8, "answer: 42", buffer[0..rl]);
+    } else {
+        return error.Wrong;
+    }
+}
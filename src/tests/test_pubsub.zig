@@ -0,0 +1,67 @@
+const std = @import("std");
+const zap = @import("zap");
+
+const Inbox = struct {
+    received: usize = 0,
+    last: [32]u8 = undefined,
+    last_len: usize = 0,
+    last_filter: i32 = -1,
+    unsubscribed: bool = false,
+
+    fn onMessage(self: *Inbox, msg: zap.PubSub.Message) !void {
+        self.received += 1;
+        self.last_len = msg.message.len;
+        @memcpy(self.last[0..msg.message.len], msg.message);
+        self.last_filter = msg.filter;
+        // all four messages were delivered
+        if (delivered.fetchAdd(1, .monotonic) + 1 == 4) zap.stop();
+    }
+
+    fn onUnsubscribe(self: *Inbox) void {
+        self.unsubscribed = true;
+    }
+
+    fn lastMessage(self: *const Inbox) []const u8 {
+        return self.last[0..self.last_len];
+    }
+};
+
+var delivered: std.atomic.Value(usize) = .init(0);
+
+test "subscribe and publish to channels, patterns and filters" {
+    var channel: Inbox = .{};
+    var pattern: Inbox = .{};
+    var filter: Inbox = .{};
+
+    const channel_sub = try zap.PubSub.subscribe(.{ .channel = "news" }, &channel, Inbox.onMessage, Inbox.onUnsubscribe);
+    const pattern_sub = try zap.PubSub.subscribe(.{ .channel = "news.*", .pattern = true }, &pattern, Inbox.onMessage, Inbox.onUnsubscribe);
+    const filter_sub = try zap.PubSub.subscribe(.{ .filter = 42 }, &filter, Inbox.onMessage, null);
+    try std.testing.expectEqualStrings("news", channel_sub.channel());
+
+    // delivered once the reactor runs
+    zap.PubSub.publish(.{ .channel = "news", .message = "hello", .engine = .process });
+    zap.PubSub.publish(.{ .channel = "news.sport", .message = "goal", .engine = .process });
+    zap.PubSub.publish(.{ .filter = 42, .message = "job", .engine = .process });
+    const news = zap.PubSub.Channel.init("news");
+    defer news.deinit();
+    news.publish(.{ .message = "update", .engine = .process });
+
+    zap.start(.{
+        .threads = 1,
+        .workers = 1,
+    });
+
+    try std.testing.expectEqual(2, channel.received);
+    try std.testing.expectEqualStrings("update", channel.lastMessage());
+    try std.testing.expectEqual(1, pattern.received);
+    try std.testing.expectEqualStrings("goal", pattern.lastMessage());
+    try std.testing.expectEqual(1, filter.received);
+    try std.testing.expectEqualStrings("job", filter.lastMessage());
+    try std.testing.expectEqual(42, filter.last_filter);
+
+    channel_sub.unsubscribe();
+    pattern_sub.unsubscribe();
+    filter_sub.unsubscribe();
+    try std.testing.expect(channel.unsubscribed);
+    try std.testing.expect(pattern.unsubscribed);
+}
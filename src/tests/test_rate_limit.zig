@@ -0,0 +1,73 @@
+const std = @import("std");
+const zap = @import("zap");
+
+// set default log level to .info and ZAP log level to .debug
+pub const std_options: std.Options = .{
+    .log_level = .info,
+    .log_scope_levels = &[_]std.log.ScopeLevel{
+        .{ .scope = .zap, .level = .debug },
+    },
+};
+
+const requests = 5;
+
+var handled: usize = 0;
+var ok: usize = 0;
+var too_many: usize = 0;
+
+fn on_request(r: zap.Request) !void {
+    handled += 1;
+    try r.sendBody("ok");
+}
+
+fn makeRequests() !void {
+    defer zap.stop();
+    var http_client: std.http.Client = .{ .allocator = std.testing.allocator };
+    defer http_client.deinit();
+
+    // well within one second: the bucket only holds the rate plus the burst
+    for (0..requests) |_| {
+        var body: [16]u8 = undefined;
+        var response_writer: std.io.Writer = .fixed(&body);
+        const result = try http_client.fetch(.{
+            .location = .{ .url = "http://127.0.0.1:3047/" },
+            .response_writer = &response_writer,
+        });
+        switch (result.status) {
+            .ok => ok += 1,
+            .too_many_requests => too_many += 1,
+            else => return error.Wrong,
+        }
+    }
+}
+
+var client_thread: ?std.Thread = null;
+
+fn on_ready(_: *zap.HttpListener) void {
+    client_thread = std.Thread.spawn(.{}, makeRequests, .{}) catch unreachable;
+}
+
+test "requests over the per-IP rate get a 429" {
+    var listener = zap.HttpListener.init(.{
+        .port = 3047,
+        .on_request = on_request,
+        .on_ready = on_ready,
+        .log = false,
+        .max_clients = 10,
+        .max_requests_per_ip = 1,
+        .max_requests_burst = 1,
+    });
+    try listener.listen();
+
+    zap.start(.{
+        .threads = 1,
+        .workers = 1,
+    });
+    (client_thread orelse return error.Wrong).join();
+
+    try std.testing.expectEqual(requests, ok + too_many);
+    try std.testing.expect(ok >= 1);
+    try std.testing.expect(too_many >= 1);
+    // rejected requests never reach the handler
+    try std.testing.expectEqual(ok, handled);
+}
@@ -0,0 +1,186 @@
+const std = @import("std");
+const zap = @import("zap");
+
+// set default log level to .info and ZAP log level to .debug
+pub const std_options: std.Options = .{
+    .log_level = .info,
+    .log_scope_levels = &[_]std.log.ScopeLevel{
+        .{ .scope = .zap, .level = .debug },
+    },
+};
+
+var page_calls: std.atomic.Value(usize) = .init(0);
+var slow_calls: std.atomic.Value(usize) = .init(0);
+var other_calls: std.atomic.Value(usize) = .init(0);
+var changing_calls: std.atomic.Value(usize) = .init(0);
+
+const max_entries = 16;
+
+fn on_request(r: zap.Request) !void {
+    var buf: [32]u8 = undefined;
+    const path = r.path orelse "/";
+    if (std.mem.eql(u8, path, "/slow")) {
+        // keeps the leader busy while the other requests arrive
+        const n = slow_calls.fetchAdd(1, .monotonic) + 1;
+        std.Thread.sleep(300 * std.time.ns_per_ms);
+        r.cacheFor(60, &.{});
+        return r.sendBody(try std.fmt.bufPrint(&buf, "slow {d}", .{n}));
+    }
+    if (std.mem.eql(u8, path, "/header") or std.mem.eql(u8, path, "/private")) {
+        const n = other_calls.fetchAdd(1, .monotonic) + 1;
+        const cache_control = if (path[1] == 'h') "public, max-age=60" else "private, max-age=60";
+        try r.setHeader("cache-control", cache_control);
+        return r.sendBody(try std.fmt.bufPrint(&buf, "{s} {d}", .{ path[1..], n }));
+    }
+    if (std.mem.eql(u8, path, "/varied")) {
+        // every query string is a new base key with vary names
+        r.cacheFor(60, &.{"accept-language"});
+        return r.sendBody("varied");
+    }
+    if (std.mem.eql(u8, path, "/changing")) {
+        const n = changing_calls.fetchAdd(1, .monotonic) + 1;
+        r.cacheFor(60, if (r.getHeader("x-vary") != null) &.{"accept-language"} else &.{});
+        return r.sendBody(try std.fmt.bufPrint(&buf, "changing {d}", .{n}));
+    }
+    const n = page_calls.fetchAdd(1, .monotonic) + 1;
+    r.cacheFor(1, &.{});
+    try r.sendBody(try std.fmt.bufPrint(&buf, "page {d}", .{n}));
+}
+
+const Fetched = struct {
+    buf: [64]u8 = undefined,
+    len: usize = 0,
+
+    fn body(self: *const Fetched) []const u8 {
+        return self.buf[0..self.len];
+    }
+};
+
+fn get(path: []const u8, host: ?[]const u8, out: *Fetched) !void {
+    return getWithHeaders(path, host, &.{}, out);
+}
+
+fn getWithHeaders(path: []const u8, host: ?[]const u8, headers: []const std.http.Header, out: *Fetched) !void {
+    var http_client: std.http.Client = .{ .allocator = std.testing.allocator };
+    defer http_client.deinit();
+
+    var url_buf: [96]u8 = undefined;
+    var response_writer: std.io.Writer = .fixed(&out.buf);
+    _ = try http_client.fetch(.{
+        .location = .{ .url = try std.fmt.bufPrint(&url_buf, "http://127.0.0.1:3045{s}", .{path}) },
+        .headers = .{ .host = if (host) |h| .{ .override = h } else .default },
+        .extra_headers = headers,
+        .response_writer = &response_writer,
+    });
+    out.len = response_writer.end;
+}
+
+var miss: Fetched = .{};
+var hit: Fetched = .{};
+var other_host: Fetched = .{};
+var expired: Fetched = .{};
+var header: [2]Fetched = .{ .{}, .{} };
+var private: [2]Fetched = .{ .{}, .{} };
+var slow: [4]Fetched = .{ .{}, .{}, .{}, .{} };
+var changing: [3]Fetched = .{ .{}, .{}, .{} };
+
+var cache_under_test: *zap.ResponseCache = undefined;
+// cached responses and vary names, before and after the vary names changed
+var entries_before_change: usize = 0;
+var entries_after_change: usize = 0;
+var vary_names_before_change: usize = 0;
+var vary_names_after_change: usize = 0;
+var vary_names_after_flood: usize = 0;
+
+fn makeRequests() !void {
+    defer zap.stop();
+    try get("/page", null, &miss);
+    try get("/page", null, &hit);
+    try get("/page", "other.example", &other_host);
+    std.Thread.sleep(1100 * std.time.ns_per_ms);
+    try get("/page", null, &expired);
+
+    for (&header) |*out| try get("/header", null, out);
+    for (&private) |*out| try get("/private", null, out);
+
+    // concurrent misses for the same key
+    var threads: [slow.len]std.Thread = undefined;
+    for (&threads, &slow) |*t, *out| t.* = try std.Thread.spawn(.{}, get, .{ "/slow", null, out });
+    for (threads) |t| t.join();
+
+    // the vary names of a path change: the response cached under the old
+    // names can't be found anymore, it is dropped with them
+    const en: std.http.Header = .{ .name = "accept-language", .value = "en" };
+    const fr: std.http.Header = .{ .name = "accept-language", .value = "fr" };
+    const vary: std.http.Header = .{ .name = "x-vary", .value = "1" };
+    try getWithHeaders("/changing", null, &.{ en, vary }, &changing[0]);
+    entries_before_change = cache_under_test.stats().entries;
+    vary_names_before_change = cache_under_test.vary_names.count();
+    try getWithHeaders("/changing", null, &.{fr}, &changing[1]);
+    entries_after_change = cache_under_test.stats().entries;
+    vary_names_after_change = cache_under_test.vary_names.count();
+    try getWithHeaders("/changing", null, &.{ en, vary }, &changing[2]);
+
+    // many distinct query strings don't grow the vary names past the cache
+    for (0..max_entries * 4) |i| {
+        var path_buf: [32]u8 = undefined;
+        var out: Fetched = .{};
+        try getWithHeaders(try std.fmt.bufPrint(&path_buf, "/varied?i={d}", .{i}), null, &.{en}, &out);
+    }
+    vary_names_after_flood = cache_under_test.vary_names.count();
+}
+
+var client_thread: ?std.Thread = null;
+
+fn on_ready(_: *zap.HttpListener) void {
+    client_thread = std.Thread.spawn(.{}, makeRequests, .{}) catch unreachable;
+}
+
+test "response cache: miss, hit, host, expiry, coalescing and vary" {
+    var cache = zap.ResponseCache.init(std.testing.allocator, .{ .max_entries = max_entries });
+    defer cache.deinit();
+    cache_under_test = &cache;
+
+    var listener = zap.HttpListener.init(.{
+        .port = 3045,
+        .on_request = on_request,
+        .on_ready = on_ready,
+        .log = false,
+        .max_clients = 10,
+        .response_cache = &cache,
+    });
+    try listener.listen();
+
+    // coalesced requests are paused, so the leader only blocks its own thread
+    zap.start(.{
+        .threads = 4,
+        .workers = 1,
+    });
+    (client_thread orelse return error.Wrong).join();
+
+    try std.testing.expectEqualStrings("page 1", miss.body());
+    try std.testing.expectEqualStrings("page 1", hit.body());
+    // virtual hosts don't share responses
+    try std.testing.expectEqualStrings("page 2", other_host.body());
+    try std.testing.expectEqualStrings("page 3", expired.body());
+
+    // Cache-Control: max-age is respected, private responses aren't cached
+    try std.testing.expectEqualStrings(header[0].body(), header[1].body());
+    try std.testing.expect(!std.mem.eql(u8, private[0].body(), private[1].body()));
+
+    // one handler call, the other requests got its response
+    try std.testing.expectEqual(1, slow_calls.load(.monotonic));
+    for (&slow) |*out| try std.testing.expectEqualStrings("slow 1", out.body());
+
+    const stats = cache.stats();
+    try std.testing.expect(stats.coalesced >= 1);
+    try std.testing.expect(stats.hits >= 3); // page, header, changing
+    try std.testing.expect(stats.entries <= max_entries);
+
+    try std.testing.expectEqualStrings("changing 1", changing[0].body());
+    try std.testing.expectEqualStrings("changing 2", changing[1].body());
+    try std.testing.expectEqualStrings("changing 2", changing[2].body());
+    try std.testing.expectEqual(entries_before_change, entries_after_change);
+    try std.testing.expectEqual(vary_names_before_change - 1, vary_names_after_change);
+    try std.testing.expect(vary_names_after_flood <= max_entries);
+}
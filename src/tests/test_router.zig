@@ -0,0 +1,107 @@
+const std = @import("std");
+const zap = @import("zap");
+
+fn on_index(_: zap.Request) !void {}
+fn on_user(_: zap.Request) !void {}
+fn on_user_delete(_: zap.Request) !void {}
+fn on_user_post(_: zap.Request) !void {}
+fn on_me(_: zap.Request) !void {}
+fn on_static(_: zap.Request) !void {}
+
+fn expectRoute(
+    router: *const zap.Router,
+    method: zap.http.Method,
+    path: []const u8,
+    expected: zap.HttpRequestFn,
+) !zap.Router.Params {
+    var params: zap.Router.Params = .{};
+    switch (router.lookup(method, path, &params)) {
+        .found => |cb| try std.testing.expectEqual(expected, cb.unbound),
+        else => return error.RouteNotFound,
+    }
+    return params;
+}
+
+test "router matches static, param and wildcard routes" {
+    var router = zap.Router.init(std.testing.allocator, .{});
+    defer router.deinit();
+
+    try router.handle_func_unbound("/", on_index);
+    try router.handle_method_unbound(.GET, "/users/:id", on_user);
+    try router.handle_method_unbound(.DELETE, "/users/:id", on_user_delete);
+    try router.handle_method_unbound(.GET, "/users/me", on_me);
+    try router.handle_method_unbound(.GET, "/users/:id/posts/:post", on_user_post);
+    try router.handle_func_unbound("/static/*path", on_static);
+
+    _ = try expectRoute(&router, .GET, "/", on_index);
+    _ = try expectRoute(&router, .POST, "/", on_index);
+
+    // static beats param
+    _ = try expectRoute(&router, .GET, "/users/me", on_me);
+
+    var params = try expectRoute(&router, .GET, "/users/42", on_user);
+    try std.testing.expectEqualStrings("42", params.get("id").?);
+    params = try expectRoute(&router, .DELETE, "/users/42", on_user_delete);
+    try std.testing.expectEqualStrings("42", params.get("id").?);
+
+    // backtracks from the static "me" prefix into the param
+    params = try expectRoute(&router, .GET, "/users/mel/posts/7", on_user_post);
+    try std.testing.expectEqualStrings("mel", params.get("id").?);
+    try std.testing.expectEqualStrings("7", params.get("post").?);
+    try std.testing.expect(params.get("nope") == null);
+
+    // HEAD falls back to GET
+    _ = try expectRoute(&router, .HEAD, "/users/42", on_user);
+
+    params = try expectRoute(&router, .GET, "/static/css/site.css", on_static);
+    try std.testing.expectEqualStrings("css/site.css", params.get("path").?);
+    params = try expectRoute(&router, .GET, "/static/", on_static);
+    try std.testing.expectEqualStrings("", params.get("path").?);
+
+    var p: zap.Router.Params = .{};
+    try std.testing.expect(router.lookup(.PUT, "/users/42", &p) == .method_not_allowed);
+    try std.testing.expect(router.lookup(.GET, "/users/", &p) == .not_found);
+    try std.testing.expect(router.lookup(.GET, "/users/42/posts", &p) == .not_found);
+    try std.testing.expect(router.lookup(.GET, "/nope", &p) == .not_found);
+}
+
+test "router falls back to routes accepting the method" {
+    var router = zap.Router.init(std.testing.allocator, .{});
+    defer router.deinit();
+
+    try router.handle_method_unbound(.GET, "/users/me", on_me);
+    try router.handle_method_unbound(.DELETE, "/users/:id", on_user_delete);
+    try router.handle_method_unbound(.GET, "/files/readme", on_index);
+    try router.handle_method_unbound(.POST, "/files/*path", on_static);
+
+    // the static route has no DELETE handler, the param route has
+    _ = try expectRoute(&router, .GET, "/users/me", on_me);
+    var params = try expectRoute(&router, .DELETE, "/users/me", on_user_delete);
+    try std.testing.expectEqualStrings("me", params.get("id").?);
+
+    // same for a wildcard
+    params = try expectRoute(&router, .POST, "/files/readme", on_static);
+    try std.testing.expectEqualStrings("readme", params.get("path").?);
+
+    // no route for the path accepts the method
+    var p: zap.Router.Params = .{};
+    try std.testing.expect(router.lookup(.PUT, "/users/me", &p) == .method_not_allowed);
+    try std.testing.expect(router.lookup(.GET, "/files/other", &p) == .method_not_allowed);
+    try std.testing.expect(router.lookup(.GET, "/nope", &p) == .not_found);
+}
+
+test "router rejects invalid routes" {
+    var router = zap.Router.init(std.testing.allocator, .{});
+    defer router.deinit();
+
+    try router.handle_method_unbound(.GET, "/users/:id", on_user);
+    try std.testing.expectError(error.AlreadyExists, router.handle_method_unbound(.GET, "/users/:id", on_user));
+    try std.testing.expectError(error.ParamConflict, router.handle_method_unbound(.GET, "/users/:name", on_user));
+    try std.testing.expectError(error.EmptyPath, router.handle_func_unbound("", on_user));
+    try std.testing.expectError(error.InvalidPath, router.handle_func_unbound("/a/:", on_user));
+    try std.testing.expectError(error.InvalidPath, router.handle_func_unbound("/a/*rest/b", on_user));
+    try std.testing.expectError(
+        error.TooManyParams,
+        router.handle_func_unbound("/:a/:b/:c/:d/:e/:f/:g/:h/:i", on_user),
+    );
+}
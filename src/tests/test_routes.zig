@@ -0,0 +1,182 @@
+const std = @import("std");
+const zap = @import("zap");
+
+// set default log level to .info and ZAP log level to .debug
+pub const std_options: std.Options = .{
+    .log_level = .info,
+    .log_scope_levels = &[_]std.log.ScopeLevel{
+        .{ .scope = .zap, .level = .debug },
+    },
+};
+
+test "PrefixSwitch matches the longest distinct prefix" {
+    const Switch = zap.Endpoint.PrefixSwitch(&.{ "/users", "/user_groups", "/stop", "/static/" });
+    const Visitor = struct {
+        index: *?usize,
+
+        pub fn visit(v: @This(), comptime i: usize) anyerror!void {
+            v.index.* = i;
+        }
+    };
+
+    const cases = [_]struct { []const u8, ?usize }{
+        .{ "/users", 0 },
+        .{ "/users/42", 0 },
+        .{ "/user_groups/1", 1 },
+        .{ "/stop", 2 },
+        .{ "/static/css/site.css", 3 },
+        .{ "/static", null },
+        .{ "/user", null },
+        .{ "/", null },
+        .{ "", null },
+        .{ "/nope", null },
+    };
+    for (cases) |case| {
+        var index: ?usize = null;
+        const matched = try Switch.dispatch(case[0], Visitor{ .index = &index });
+        try std.testing.expectEqual(case[1] != null, matched);
+        try std.testing.expectEqual(case[1], index);
+    }
+}
+
+const paths = [_][]const u8{ "/users/42", "/user_groups/1", "/other", "/nope" };
+var bodies: [paths.len][64]u8 = undefined;
+var lens: [paths.len]usize = @splat(0);
+
+fn makeRequests(port: u16) !void {
+    defer zap.stop();
+    var http_client: std.http.Client = .{ .allocator = std.testing.allocator };
+    defer http_client.deinit();
+
+    for (paths, &bodies, &lens) |path, *body, *len| {
+        var url_buf: [64]u8 = undefined;
+        var response_writer: std.io.Writer = .fixed(body);
+        _ = try http_client.fetch(.{
+            .location = .{ .url = try std.fmt.bufPrint(&url_buf, "http://127.0.0.1:{d}{s}", .{ port, path }) },
+            .response_writer = &response_writer,
+        });
+        len.* = response_writer.end;
+    }
+}
+
+fn expectBodies(expected: [paths.len][]const u8) !void {
+    for (expected, &bodies, lens) |e, *body, len| {
+        try std.testing.expectEqualStrings(e, body[0..len]);
+    }
+}
+
+var client_thread: ?std.Thread = null;
+
+fn on_ready(l: *zap.HttpListener) void {
+    client_thread = std.Thread.spawn(.{}, makeRequests, .{@as(u16, @intCast(l.settings.port))}) catch unreachable;
+}
+
+/// Answers GET requests with its name
+const NamedEndpoint = struct {
+    path: []const u8,
+    name: []const u8,
+    error_strategy: zap.Endpoint.ErrorStrategy = .log_to_response,
+
+    pub fn get(e: *NamedEndpoint, r: zap.Request) !void {
+        try r.sendBody(e.name);
+    }
+};
+
+fn on_unmatched(r: zap.Request) !void {
+    try r.sendBody("unmatched");
+}
+
+test "Endpoint.Listener.registerRoutes" {
+    var listener = zap.Endpoint.Listener.init(std.testing.allocator, .{
+        .port = 3049,
+        .on_request = on_unmatched,
+        .on_ready = on_ready,
+        .log = false,
+        .max_clients = 10,
+    });
+    defer listener.deinit();
+
+    var users: NamedEndpoint = .{ .path = "/users", .name = "users" };
+    var groups: NamedEndpoint = .{ .path = "/user_groups", .name = "groups" };
+    var other: NamedEndpoint = .{ .path = "/other", .name = "other" };
+    var shadowing: NamedEndpoint = .{ .path = "/users/me", .name = "me" };
+
+    const MyRoutes = zap.Endpoint.Routes(.{
+        .{ "/users", NamedEndpoint },
+        .{ "/user_groups", NamedEndpoint },
+    });
+    const routes: MyRoutes = .{ .endpoints = .{ &users, &groups } };
+    try listener.registerRoutes(&routes);
+    try std.testing.expectError(error.RoutesAlreadyRegistered, listener.registerRoutes(&routes));
+
+    // endpoints registered at runtime can't shadow the table
+    try listener.register(&other);
+    try std.testing.expectError(error.EndpointPathShadowError, listener.register(&shadowing));
+
+    try listener.listen();
+    zap.start(.{
+        .threads = 1,
+        .workers = 1,
+    });
+    (client_thread orelse return error.Wrong).join();
+    client_thread = null;
+
+    try expectBodies(.{ "users", "groups", "other", "unmatched" });
+}
+
+const Context = struct {
+    greeting: []const u8,
+
+    pub fn unhandledRequest(_: *Context, _: std.mem.Allocator, r: zap.Request) anyerror!void {
+        try r.sendBody("unmatched");
+    }
+};
+
+const App = zap.App.Create(Context);
+
+/// Answers GET requests with the app's greeting and its name, formatted in
+/// the request arena
+const AppEndpoint = struct {
+    path: []const u8,
+    name: []const u8,
+    error_strategy: zap.Endpoint.ErrorStrategy = .log_to_response,
+
+    pub fn get(e: *AppEndpoint, arena: std.mem.Allocator, context: *Context, r: zap.Request) !void {
+        try r.sendBody(try std.fmt.allocPrint(arena, "{s} {s}", .{ context.greeting, e.name }));
+    }
+};
+
+test "App.registerRoutes" {
+    var context: Context = .{ .greeting = "hi" };
+    try App.init(std.testing.allocator, &context, .{});
+    defer App.deinit();
+
+    var users: AppEndpoint = .{ .path = "/users", .name = "users" };
+    var groups: AppEndpoint = .{ .path = "/user_groups", .name = "groups" };
+    var other: AppEndpoint = .{ .path = "/other", .name = "other" };
+    var shadowing: AppEndpoint = .{ .path = "/user_groups/1", .name = "one" };
+
+    const MyRoutes = App.Endpoint.Routes(.{
+        .{ "/users", AppEndpoint },
+        .{ "/user_groups", AppEndpoint },
+    });
+    const routes: MyRoutes = .{ .endpoints = .{ &users, &groups } };
+    try App.registerRoutes(&routes);
+    try std.testing.expectError(error.RoutesAlreadyRegistered, App.registerRoutes(&routes));
+
+    try App.register(&other);
+    try std.testing.expectError(error.EndpointPathShadowError, App.register(&shadowing));
+
+    try App.listen(.{
+        .port = 3050,
+        .on_ready = on_ready,
+    });
+    zap.start(.{
+        .threads = 1,
+        .workers = 1,
+    });
+    (client_thread orelse return error.Wrong).join();
+    client_thread = null;
+
+    try expectBodies(.{ "hi users", "hi groups", "hi other", "unmatched" });
+}
@@ -0,0 +1,56 @@
+const std = @import("std");
+const zap = @import("zap");
+
+test "decode query into struct" {
+    const Sort = enum { relevance, date };
+    const Search = struct {
+        q: []const u8,
+        page: u32 = 1,
+        exact: bool = false,
+        sort: Sort = .relevance,
+        lang: ?[]const u8,
+        ratio: f32 = 0,
+        limit: ?u8 = null,
+    };
+
+    var arena_state = std.heap.ArenaAllocator.init(std.testing.allocator);
+    defer arena_state.deinit();
+    const arena = arena_state.allocator();
+
+    const data = "q=zig+web%20server&page=3&exact=on&sort=date&ratio=0.5&unknown=1&limit=";
+    const search = try zap.UrlEncoded.decode(Search, arena, data);
+    try std.testing.expectEqualStrings("zig web server", search.q);
+    try std.testing.expectEqual(3, search.page);
+    try std.testing.expect(search.exact);
+    try std.testing.expectEqual(Sort.date, search.sort);
+    try std.testing.expect(search.lang == null);
+    try std.testing.expectEqual(0.5, search.ratio);
+    // empty values: null for scalars, "" for strings
+    try std.testing.expect(search.limit == null);
+    const empty = try zap.UrlEncoded.decode(Search, arena, "q=&lang=");
+    try std.testing.expectEqualStrings("", empty.q);
+    try std.testing.expectEqualStrings("", empty.lang.?);
+
+    // unescaped strings are not copied
+    const plain_data: []const u8 = "q=zap&lang=en";
+    const plain = try zap.UrlEncoded.decode(Search, arena, plain_data);
+    try std.testing.expectEqual(plain_data.ptr + 2, plain.q.ptr);
+    try std.testing.expectEqualStrings("en", plain.lang.?);
+    try std.testing.expectEqual(1, plain.page);
+
+    // encoded keys, last value wins
+    const keyed = try zap.UrlEncoded.decode(Search, arena, "%71=a&q=b");
+    try std.testing.expectEqualStrings("b", keyed.q);
+
+    try std.testing.expectError(error.MissingField, zap.UrlEncoded.decode(Search, arena, "page=2"));
+    try std.testing.expectError(error.InvalidValue, zap.UrlEncoded.decode(Search, arena, "q=x&page=-1"));
+    try std.testing.expectError(error.InvalidValue, zap.UrlEncoded.decode(Search, arena, "q=x&sort=name"));
+}
+
+test "percent decoding" {
+    var buf: [32]u8 = undefined;
+    try std.testing.expectEqualStrings("a b/c", zap.UrlEncoded.percentDecodeBuf(&buf, "a+b%2Fc").?);
+    try std.testing.expectEqualStrings("100%", zap.UrlEncoded.percentDecodeBuf(&buf, "100%").?);
+    try std.testing.expectEqualStrings("%zz", zap.UrlEncoded.percentDecodeBuf(&buf, "%zz").?);
+    try std.testing.expect(zap.UrlEncoded.percentDecodeBuf(buf[0..2], "abc") == null);
+}
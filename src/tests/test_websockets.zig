@@ -0,0 +1,150 @@
+const std = @import("std");
+const zap = @import("zap");
+
+// set default log level to .info and ZAP log level to .debug
+pub const std_options: std.Options = .{
+    .log_level = .info,
+    .log_scope_levels = &[_]std.log.ScopeLevel{
+        .{ .scope = .zap, .level = .debug },
+    },
+};
+
+const WebsocketHandler = zap.WebSockets.Handler(Context);
+
+const Context = struct {
+    handle: zap.WebSockets.WsHandle = null,
+    settings: WebsocketHandler.WebSocketSettings = .{},
+};
+
+var contexts: [2]Context = .{ .{}, .{} };
+var upgraded: usize = 0;
+var opened: usize = 0;
+var closed: usize = 0;
+
+// failure counts of the broadcasts, null until they ran
+var failed_on_open: ?usize = null;
+var failed_on_close: ?usize = null;
+
+fn on_open(context: ?*Context, handle: zap.WebSockets.WsHandle) !void {
+    context.?.handle = handle;
+    opened += 1;
+    if (opened < contexts.len) return;
+    failed_on_open = WebsocketHandler.broadcast(&.{ contexts[0].handle, contexts[1].handle }, "hello", true);
+}
+
+fn on_close(context: ?*Context, _: isize) !void {
+    // the closed connection's handle is valid until this returns, but it can't
+    // be written to anymore
+    closed += 1;
+    if (closed == 1) {
+        failed_on_close = WebsocketHandler.broadcast(&.{ contexts[0].handle, contexts[1].handle }, "bye", true);
+    }
+    context.?.handle = null;
+}
+
+fn on_request(r: zap.Request) !void {
+    r.setStatus(.bad_request);
+    try r.sendBody("400 - BAD REQUEST");
+}
+
+fn on_upgrade(r: zap.Request, target_protocol: []const u8) !void {
+    if (!std.mem.eql(u8, target_protocol, "websocket") or upgraded == contexts.len) {
+        r.setStatus(.bad_request);
+        try r.sendBody("400 - BAD REQUEST");
+        return;
+    }
+    const context = &contexts[upgraded];
+    upgraded += 1;
+    context.settings = .{
+        .on_open = on_open,
+        .on_close = on_close,
+        .context = context,
+    };
+    try WebsocketHandler.upgrade(r.h, &context.settings);
+}
+
+fn connect() !std.net.Stream {
+    const stream = try std.net.tcpConnectToAddress(try std.net.Address.parseIp4("127.0.0.1", 3053));
+    errdefer stream.close();
+    _ = try std.posix.write(stream.handle, "GET / HTTP/1.1\r\n" ++
+        "Host: localhost\r\n" ++
+        "Upgrade: websocket\r\n" ++
+        "Connection: Upgrade\r\n" ++
+        "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n" ++
+        "Sec-WebSocket-Version: 13\r\n\r\n");
+    // byte by byte, frames may follow the response
+    var buf: [1024]u8 = undefined;
+    var len: usize = 0;
+    while (len < 4 or !std.mem.eql(u8, buf[len - 4 .. len], "\r\n\r\n")) {
+        if (len == buf.len) return error.Wrong;
+        if (try std.posix.read(stream.handle, buf[len .. len + 1]) != 1) return error.Wrong;
+        len += 1;
+    }
+    if (!std.mem.startsWith(u8, buf[0..len], "HTTP/1.1 101")) return error.Wrong;
+    return stream;
+}
+
+fn readExact(stream: std.net.Stream, dest: []u8) !void {
+    var pos: usize = 0;
+    while (pos < dest.len) {
+        const n = try std.posix.read(stream.handle, dest[pos..]);
+        if (n == 0) return error.Wrong;
+        pos += n;
+    }
+}
+
+/// Expect a small, unmasked text frame.
+fn expectMessage(stream: std.net.Stream, expected: []const u8) !void {
+    var head: [2]u8 = undefined;
+    try readExact(stream, &head);
+    if (head[0] != 0x81 or head[1] != expected.len) return error.Wrong;
+    var payload: [16]u8 = undefined;
+    try readExact(stream, payload[0..expected.len]);
+    if (!std.mem.eql(u8, payload[0..expected.len], expected)) return error.Wrong;
+}
+
+var received: usize = 0;
+
+fn makeConnections() !void {
+    defer zap.stop();
+    const first = try connect();
+    const second = try connect();
+    defer second.close();
+
+    try expectMessage(first, "hello");
+    try expectMessage(second, "hello");
+    received += 2;
+
+    first.close();
+    try expectMessage(second, "bye");
+    received += 1;
+}
+
+var client_thread: ?std.Thread = null;
+
+fn on_ready(_: *zap.HttpListener) void {
+    client_thread = std.Thread.spawn(.{}, makeConnections, .{}) catch unreachable;
+}
+
+test "broadcast a shared frame, counting failed writes" {
+    var listener = zap.HttpListener.init(.{
+        .port = 3053,
+        .on_request = on_request,
+        .on_upgrade = on_upgrade,
+        .on_ready = on_ready,
+        .log = false,
+        .max_clients = 10,
+    });
+    try listener.listen();
+
+    zap.start(.{
+        .threads = 1,
+        .workers = 1,
+    });
+    (client_thread orelse return error.Wrong).join();
+
+    try std.testing.expectEqual(3, received);
+    try std.testing.expectEqual(@as(?usize, 0), failed_on_open);
+    // the first connection was closed, the second one got the message
+    try std.testing.expectEqual(@as(?usize, 1), failed_on_close);
+}
@@ -0,0 +1,78 @@
+const std = @import("std");
+const zap = @import("zap");
+
+// set default log level to .info and ZAP log level to .debug
+pub const std_options: std.Options = .{
+    .log_level = .info,
+    .log_scope_levels = &[_]std.log.ScopeLevel{
+        .{ .scope = .zap, .level = .debug },
+    },
+};
+
+const Item = struct {
+    id: usize,
+    name: []const u8,
+};
+
+const Reply = struct {
+    status: []const u8,
+    items: []const Item,
+};
+
+// larger than the initial packet capacity, so the packet has to grow
+var items: [500]Item = undefined;
+
+var response: ?[]u8 = null;
+
+fn makeRequest(a: std.mem.Allocator, url: []const u8) !void {
+    defer zap.stop();
+    var http_client: std.http.Client = .{ .allocator = a };
+    defer http_client.deinit();
+
+    var response_writer = std.io.Writer.Allocating.init(a);
+    defer response_writer.deinit();
+
+    _ = try http_client.fetch(.{
+        .location = .{ .url = url },
+        .response_writer = &response_writer.writer,
+    });
+    response = try response_writer.toOwnedSlice();
+}
+
+var client_thread: ?std.Thread = null;
+
+fn on_ready(_: *zap.HttpListener) void {
+    client_thread = std.Thread.spawn(.{}, makeRequest, .{ std.testing.allocator, "http://127.0.0.1:3044/" }) catch unreachable;
+}
+
+fn on_request(r: zap.Request) !void {
+    try r.writeJson(Reply{ .status = "ok", .items = &items });
+}
+
+test "write json into the response packet" {
+    const allocator = std.testing.allocator;
+    for (&items, 0..) |*item, i| item.* = .{ .id = i, .name = "some item name" };
+
+    var listener = zap.HttpListener.init(.{
+        .port = 3044,
+        .on_request = on_request,
+        .on_ready = on_ready,
+        .log = false,
+        .max_clients = 10,
+    });
+    try listener.listen();
+
+    zap.start(.{
+        .threads = 1,
+        .workers = 1,
+    });
+    (client_thread orelse return error.Wrong).join();
+
+    const body = response orelse return error.Wrong;
+    defer allocator.free(body);
+
+    // the body was complete according to the patched content-length
+    const expected = try std.json.Stringify.valueAlloc(allocator, Reply{ .status = "ok", .items = &items }, .{});
+    defer allocator.free(expected);
+    try std.testing.expectEqualStrings(expected, body);
+}
@@ -0,0 +1,172 @@
+//! Decoding of `application/x-www-form-urlencoded` data (query strings and
+//! form posts) directly into Zig structs, without going through facilio's
+//! FIOBJ hash maps.
+//!
+//! ```zig
+//! const Search = struct {
+//!     q: []const u8,
+//!     page: u32 = 1,
+//!     exact: bool = false,
+//!     sort: enum { relevance, date } = .relevance,
+//!     lang: ?[]const u8,
+//! };
+//!
+//! const search = try r.decodeQuery(Search, arena);
+//! ```
+//!
+//! Supported field types: `[]const u8`, integers, floats, `bool`, enums and
+//! optionals of those. Missing fields take their default value, or `null` if
+//! they are optional; otherwise decoding fails with `error.MissingField`. An
+//! empty value (`limit=`) decodes to `null` for optional scalars, and to `""`
+//! for optional strings.
+//! Unknown keys are ignored, and for repeated keys the last one wins.
+//!
+//! Strings are only copied (into `arena`) if they contain escapes; otherwise
+//! they point into the request.
+const std = @import("std");
+const Allocator = std.mem.Allocator;
+
+pub const DecodeError = error{
+    /// a field without default value is not present
+    MissingField,
+    /// a value cannot be parsed as the field's type
+    InvalidValue,
+} || Allocator.Error;
+
+/// Decode url-encoded `data` (without leading `?`) into a `T`.
+pub fn decode(comptime T: type, arena: Allocator, data: []const u8) DecodeError!T {
+    const fields = @typeInfo(T).@"struct".fields;
+    var result: T = undefined;
+    var seen = std.StaticBitSet(fields.len).initEmpty();
+
+    if (fields.len > 0) {
+        const field_map = comptime blk: {
+            var kvs: [fields.len]struct { []const u8, usize } = undefined;
+            for (fields, 0..) |field, i| kvs[i] = .{ field.name, i };
+            break :blk std.StaticStringMap(usize).initComptime(kvs);
+        };
+
+        var it = std.mem.tokenizeScalar(u8, data, '&');
+        while (it.next()) |pair| {
+            const eq = std.mem.indexOfScalar(u8, pair, '=');
+            const raw_key = pair[0 .. eq orelse pair.len];
+            const raw_value = if (eq) |pos| pair[pos + 1 ..] else "";
+
+            // no field name is longer than that
+            var key_buf: [field_map.max_len]u8 = undefined;
+            const key = if (needsDecoding(raw_key))
+                percentDecodeBuf(&key_buf, raw_key) orelse continue
+            else
+                raw_key;
+
+            switch (field_map.get(key) orelse continue) {
+                inline 0...fields.len - 1 => |i| {
+                    const field = fields[i];
+                    @field(result, field.name) = try parseValue(field.type, arena, raw_value);
+                    seen.set(i);
+                },
+                else => unreachable,
+            }
+        }
+    }
+
+    inline for (fields, 0..) |field, i| {
+        if (!seen.isSet(i)) {
+            if (field.defaultValue()) |default| {
+                @field(result, field.name) = default;
+            } else if (@typeInfo(field.type) == .optional) {
+                @field(result, field.name) = null;
+            } else {
+                return error.MissingField;
+            }
+        }
+    }
+    return result;
+}
+
+fn parseValue(comptime V: type, arena: Allocator, raw: []const u8) DecodeError!V {
+    switch (@typeInfo(V)) {
+        .optional => |o| {
+            if (raw.len == 0 and o.child != []const u8) return null;
+            return try parseValue(o.child, arena, raw);
+        },
+        .pointer => |p| {
+            if (p.size != .slice or p.child != u8 or !p.is_const) {
+                @compileError("unsupported field type " ++ @typeName(V));
+            }
+            if (!needsDecoding(raw)) return raw;
+            const buf = try arena.alloc(u8, raw.len);
+            return percentDecodeBuf(buf, raw).?;
+        },
+        .bool, .int, .float, .@"enum" => {
+            // scalars are short: decode them on the stack
+            var buf: [64]u8 = undefined;
+            const text = if (needsDecoding(raw))
+                percentDecodeBuf(&buf, raw) orelse return error.InvalidValue
+            else
+                raw;
+            return parseScalar(V, text) orelse error.InvalidValue;
+        },
+        else => @compileError("unsupported field type " ++ @typeName(V)),
+    }
+}
+
+fn parseScalar(comptime V: type, text: []const u8) ?V {
+    return switch (@typeInfo(V)) {
+        .bool => if (eqlAny(text, &.{ "true", "1", "on", "yes" }))
+            true
+        else if (eqlAny(text, &.{ "false", "0", "off", "no" }))
+            false
+        else
+            null,
+        .int => std.fmt.parseInt(V, text, 10) catch null,
+        .float => std.fmt.parseFloat(V, text) catch null,
+        .@"enum" => std.meta.stringToEnum(V, text),
+        else => unreachable,
+    };
+}
+
+fn eqlAny(text: []const u8, comptime candidates: []const []const u8) bool {
+    inline for (candidates) |candidate| {
+        if (std.ascii.eqlIgnoreCase(text, candidate)) return true;
+    }
+    return false;
+}
+
+fn needsDecoding(s: []const u8) bool {
+    return std.mem.indexOfAny(u8, s, "%+") != null;
+}
+
+/// Percent-decode `s` into `buf`, turning `+` into spaces. Malformed escapes
+/// are kept as they are. Returns null if `buf` is too small.
+pub fn percentDecodeBuf(buf: []u8, s: []const u8) ?[]u8 {
+    var out: usize = 0;
+    var i: usize = 0;
+    while (i < s.len) : (out += 1) {
+        if (out == buf.len) return null;
+        switch (s[i]) {
+            '+' => {
+                buf[out] = ' ';
+                i += 1;
+            },
+            '%' => {
+                if (i + 2 < s.len) {
+                    const hi = std.fmt.charToDigit(s[i + 1], 16) catch null;
+                    const lo = std.fmt.charToDigit(s[i + 2], 16) catch null;
+                    if (hi != null and lo != null) {
+                        buf[out] = hi.? << 4 | lo.?;
+                        i += 3;
+                        continue;
+                    }
+                }
+                buf[out] = '%';
+                i += 1;
+            },
+            else => |c| {
+                buf[out] = c;
+                i += 1;
+            },
+        }
+    }
+    return buf[0..out];
+}
@@ -136,6 +136,43 @@ pub fn Handler(comptime ContextType: type) type {
             }
         }
 
+        /// A message framed once, to be written to many connections. Server
+        /// connections share the frame's memory instead of each getting a
+        /// copy; it is freed once the last connection has sent it and
+        /// `deinit()` was called.
+        pub const Frame = struct {
+            frame: *fio.websocket_frame_s,
+
+            pub fn init(message: []const u8, is_text: bool) Frame {
+                return .{ .frame = fio.websocket_frame_new(util.str2fio(message), if (is_text) 1 else 0).? };
+            }
+
+            pub fn deinit(self: Frame) void {
+                fio.websocket_frame_free(self.frame);
+            }
+
+            /// Write the frame to the websocket identified by the handle.
+            pub fn write(self: Frame, handle: WsHandle) WebSocketError!void {
+                if (fio.websocket_write_frame(handle, self.frame) != 0) {
+                    return error.WriteError;
+                }
+            }
+        };
+
+        /// Write the same message to all `handles`, framing it only once.
+        /// Returns the number of connections it could not be written to.
+        pub fn broadcast(handles: []const WsHandle, message: []const u8, is_text: bool) usize {
+            const frame = Frame.init(message, is_text);
+            defer frame.deinit();
+            var failed: usize = 0;
+            for (handles) |handle| {
+                frame.write(handle) catch {
+                    failed += 1;
+                };
+            }
+            return failed;
+        }
+
         /// The context pointer is stored in facilio's udata pointer. Use
         /// this function to turn that pointer into a pointer to your
         /// ContextType.
@@ -143,6 +180,14 @@ pub fn Handler(comptime ContextType: type) type {
             return @as(*ContextType, @ptrCast(@alignCast(udata)));
         }
 
+        /// Coalesce small outgoing frames of this connection into a buffer of
+        /// up to `max_bytes` (0 disables it), written once the currently
+        /// queued tasks have run or, if set, after `max_delay_us`. Overrides
+        /// the listener's `ws_coalesce_bytes` and `ws_coalesce_us`.
+        pub inline fn coalesce(handle: WsHandle, max_bytes: usize, max_delay_us: usize) void {
+            fio.websocket_coalesce(handle, max_bytes, max_delay_us);
+        }
+
         /// Close the websocket connection.
         pub inline fn close(handle: WsHandle) void {
             fio.websocket_close(handle);
@@ -15,6 +15,12 @@ pub const Router = @import("router.zig");
 
 pub const App = @import("App.zig");
 
+/// Optional response micro-cache with request coalescing.
+pub const ResponseCache = @import("ResponseCache.zig");
+
+/// Bounded thread pool for blocking work, separate from the I/O threads.
+pub const BlockingPool = @import("BlockingPool.zig");
+
 /// A struct to handle Mustache templating.
 ///
 /// This is a wrapper around fiobj's mustache template handling.
@@ -37,10 +43,17 @@ pub const Middleware = @import("middleware.zig");
 /// Websocket API
 pub const WebSockets = @import("websockets.zig");
 
+/// Publish/subscribe between threads and worker processes
+pub const PubSub = @import("pubsub.zig");
+
 pub const Logging = @import("Logging.zig");
 pub const log = std.log.scoped(.zap);
 
 pub const http = @import("http.zig");
+/// Decoding of url-encoded query strings and forms into structs
+pub const UrlEncoded = @import("urlencoded.zig");
+/// Typed JSON decoding
+pub const Json = @import("json.zig");
 pub const util = @import("util.zig");
 
 /// Start the IO reactor
@@ -132,14 +145,58 @@ pub const HttpFinishSettings = [*c]fio.struct_http_settings_s;
 /// Http finish callback type
 pub const HttpFinishFn = *const fn (HttpFinishSettings) anyerror!void;
 
+/// Listener ready callback type, see `HttpListenerSettings.on_ready`
+pub const HttpReadyFn = *const fn (*HttpListener) void;
+
+/// Load shedding priority of requests matching a `PriorityHint`.
+pub const Priority = enum(c_int) {
+    /// shed when the request itself waited longer than the target
+    normal = fio.HTTP_PRIORITY_NORMAL,
+    /// never shed, e.g. health checks and admin routes
+    critical = fio.HTTP_PRIORITY_CRITICAL,
+    /// shed whenever the server is overloaded
+    low = fio.HTTP_PRIORITY_LOW,
+};
+
+/// Load shedding hint for requests whose path starts with a prefix.
+pub const PriorityHint = fio.http_priority_hint_s;
+
+/// Create a load shedding hint, e.g. `zap.priorityHint("/health", .critical)`.
+/// The prefix must outlive the listener.
+pub fn priorityHint(prefix: []const u8, priority: Priority) PriorityHint {
+    return .{
+        .prefix = prefix.ptr,
+        .len = prefix.len,
+        .priority = @intFromEnum(priority),
+    };
+}
+
+/// Returns the task queue's 90th percentile queueing delay in microseconds,
+/// measured over the last interval. Only measured when load shedding is
+/// enabled (see `HttpListenerSettings.shed_target_ms`).
+pub fn queueDelayP90() usize {
+    return fio.fio_defer_latency_p90();
+}
+
+/// Returns true while the task queue is overloaded and requests are shed.
+pub fn isOverloaded() bool {
+    return fio.fio_defer_is_overloaded() != 0;
+}
+
 /// Listener settings
 pub const HttpListenerSettings = struct {
+    /// TCP port; 0 to listen on the Unix socket at `interface`
     port: usize,
+    /// IP interface to bind to, or the path of a Unix socket
     interface: [*c]const u8 = null,
     on_request: ?HttpRequestFn,
     on_response: ?HttpRequestFn = null,
     on_upgrade: ?HttpUpgradeFn = null,
     on_finish: ?HttpFinishFn = null,
+    /// called once the server is running and the listener is serving
+    /// requests, in every worker process. Use it to signal readiness, e.g.
+    /// to start sending traffic in tests.
+    on_ready: ?HttpReadyFn = null,
     // provide any pointer in there for "user data". it will be passed pack in
     // on_finish()'s copy of the struct_http_settings_s
     udata: ?*anyopaque = null,
@@ -147,18 +204,53 @@ pub const HttpListenerSettings = struct {
     max_clients: ?isize = null,
     max_body_size: ?usize = null,
     timeout: ?u8 = null,
+    /// log requests; see `Logging.setupAccessLog()` for buffered logging
     log: bool = false,
     ws_timeout: u8 = 40,
     ws_max_msg_size: usize = 262144,
+    /// accept permessage-deflate compression when a WebSocket client offers
+    /// it. Requires building with `-Dzlib=true`, otherwise offers are ignored.
+    ws_deflate: bool = false,
+    /// keep the compression context between messages: compresses better but
+    /// costs a deflate stream (~256KB) per connection. Without it, deflate
+    /// streams are pooled and broadcasts are compressed only once.
+    ws_deflate_context_takeover: bool = false,
+    /// LZ77 window bits (9-15) used for compression
+    ws_deflate_window_bits: u8 = 15,
+    /// coalesce small outgoing WebSocket frames into a buffer of this many
+    /// bytes per connection, so bursts go out in a single write. 0 = disabled.
+    ws_coalesce_bytes: u32 = 0,
+    /// max microseconds a coalesced frame waits for more frames (rounded up to
+    /// milliseconds, the reactor's timer resolution). With 0, the buffer is
+    /// written once the tasks queued before it have run.
+    ws_coalesce_us: u32 = 0,
     tls: ?Tls = null,
+    /// optional response cache consulted before `on_request` is called
+    response_cache: ?*ResponseCache = null,
+    /// max concurrent connections per client IP (per worker), 0 = unlimited.
+    /// Excess connections are closed right after accept().
+    max_clients_per_ip: u32 = 0,
+    /// max requests per second per client IP (per worker), 0 = unlimited.
+    /// Excess requests get a prebuilt 429 response and never reach Zig.
+    max_requests_per_ip: u32 = 0,
+    /// requests a client IP may burst above `max_requests_per_ip`
+    max_requests_burst: u32 = 0,
+    /// adaptive load shedding: target p90 task queue delay, 0 = never shed.
+    /// While the delay stays above target, requests that waited longer than
+    /// the target get a prebuilt 503 with Retry-After before reaching Zig.
+    shed_target_ms: u32 = 0,
+    /// per-route load shedding hints, matched by path prefix in order
+    priority_hints: []const PriorityHint = &.{},
 };
 
 /// Http listener
+///
+/// Any number of listeners can be started, e.g. a public one and an internal
+/// one for admin or metrics routes, each with its own handlers and limits.
+/// A listener must not be moved or go out of scope once it is listening.
 pub const HttpListener = struct {
     settings: HttpListenerSettings,
 
-    var the_one_and_only_listener: ?*HttpListener = null;
-
     /// Create a listener
     pub fn init(settings: HttpListenerSettings) HttpListener {
         std.debug.assert(settings.on_request != null);
@@ -167,10 +259,15 @@ pub const HttpListener = struct {
         };
     }
 
-    // we could make it dynamic by passing a HttpListener via udata
+    /// The listener is passed to the callbacks via facilio's settings udata,
+    /// which facilio copies into each request's udata.
+    fn fromUdata(udata: ?*anyopaque) ?*HttpListener {
+        return @ptrCast(@alignCast(udata));
+    }
+
     /// Used internally: the listener's facilio request callback
-    pub fn theOneAndOnlyRequestCallBack(r: [*c]fio.http_s) callconv(.c) void {
-        if (the_one_and_only_listener) |l| {
+    pub fn fioRequestCallback(r: [*c]fio.http_s) callconv(.c) void {
+        if (fromUdata(r.*.udata)) |l| {
             var req: Request = .{
                 .path = util.fio2str(r.*.path),
                 .query = util.fio2str(r.*.query),
@@ -188,16 +285,22 @@ pub const HttpListener = struct {
             req.markAsFinished(false);
             std.debug.assert(l.settings.on_request != null);
             if (l.settings.on_request) |on_request| {
-                on_request(req) catch |err| {
-                    Logging.on_uncaught_error("HttpListener on_request", err);
-                };
+                if (l.settings.response_cache) |cache| {
+                    cache.handle(&req, on_request) catch |err| {
+                        Logging.on_uncaught_error("HttpListener on_request", err);
+                    };
+                } else {
+                    on_request(req) catch |err| {
+                        Logging.on_uncaught_error("HttpListener on_request", err);
+                    };
+                }
             }
         }
     }
 
     /// Used internally: the listener's facilio response callback
-    pub fn theOneAndOnlyResponseCallBack(r: [*c]fio.http_s) callconv(.c) void {
-        if (the_one_and_only_listener) |l| {
+    pub fn fioResponseCallback(r: [*c]fio.http_s) callconv(.c) void {
+        if (fromUdata(r.*.udata)) |l| {
             var req: Request = .{
                 .path = util.fio2str(r.*.path),
                 .query = util.fio2str(r.*.query),
@@ -219,8 +322,8 @@ pub const HttpListener = struct {
     }
 
     /// Used internally: the listener's facilio upgrade callback
-    pub fn theOneAndOnlyUpgradeCallBack(r: [*c]fio.http_s, target: [*c]u8, target_len: usize) callconv(.c) void {
-        if (the_one_and_only_listener) |l| {
+    pub fn fioUpgradeCallback(r: [*c]fio.http_s, target: [*c]u8, target_len: usize) callconv(.c) void {
+        if (fromUdata(r.*.udata)) |l| {
             var req: Request = .{
                 .path = util.fio2str(r.*.path),
                 .query = util.fio2str(r.*.query),
@@ -236,6 +339,8 @@ pub const HttpListener = struct {
             var user_context: Request.UserContext = .{};
             req._user_context = &user_context;
 
+            // the upgraded connection must not see the listener as udata
+            r.*.udata = null;
             l.settings.on_upgrade.?(req, zigtarget) catch |err| {
                 Logging.on_uncaught_error("HttpListener on_upgrade", err);
             };
@@ -243,8 +348,10 @@ pub const HttpListener = struct {
     }
 
     /// Used internally: the listener's facilio finish callback
-    pub fn theOneAndOnlyFinishCallBack(s: [*c]fio.struct_http_settings_s) callconv(.c) void {
-        if (the_one_and_only_listener) |l| {
+    pub fn fioFinishCallback(s: [*c]fio.struct_http_settings_s) callconv(.c) void {
+        if (fromUdata(s.*.udata)) |l| {
+            // hand the user's udata back
+            s.*.udata = l.settings.udata;
             l.settings.on_finish.?(s) catch |err| {
                 Logging.on_uncaught_error("HttpListener on_finish", err);
             };
@@ -263,11 +370,11 @@ pub const HttpListener = struct {
         }
 
         const x: fio.http_settings_s = .{
-            .on_request = if (self.settings.on_request) |_| HttpListener.theOneAndOnlyRequestCallBack else null,
-            .on_upgrade = if (self.settings.on_upgrade) |_| HttpListener.theOneAndOnlyUpgradeCallBack else null,
-            .on_response = if (self.settings.on_response) |_| HttpListener.theOneAndOnlyResponseCallBack else null,
-            .on_finish = if (self.settings.on_finish) |_| HttpListener.theOneAndOnlyFinishCallBack else null,
-            .udata = null,
+            .on_request = if (self.settings.on_request) |_| HttpListener.fioRequestCallback else null,
+            .on_upgrade = if (self.settings.on_upgrade) |_| HttpListener.fioUpgradeCallback else null,
+            .on_response = if (self.settings.on_response) |_| HttpListener.fioResponseCallback else null,
+            .on_finish = if (self.settings.on_finish) |_| HttpListener.fioFinishCallback else null,
+            .udata = self,
             .public_folder = pfolder,
             .public_folder_length = pfolder_len,
             .max_header_size = 32 * 1024,
@@ -283,28 +390,48 @@ pub const HttpListener = struct {
             .ws_timeout = self.settings.ws_timeout,
             .log = if (self.settings.log) 1 else 0,
             .is_client = 0,
+            .max_clients_per_ip = self.settings.max_clients_per_ip,
+            .max_requests_per_ip = self.settings.max_requests_per_ip,
+            .max_requests_burst = self.settings.max_requests_burst,
+            .shed_target_ms = self.settings.shed_target_ms,
+            .priority_hints_len = @intCast(self.settings.priority_hints.len),
+            .priority_hints = self.settings.priority_hints.ptr,
+            .ws_deflate = if (self.settings.ws_deflate) 1 else 0,
+            .ws_deflate_context_takeover = if (self.settings.ws_deflate_context_takeover) 1 else 0,
+            .ws_deflate_window_bits = self.settings.ws_deflate_window_bits,
+            .ws_coalesce_bytes = self.settings.ws_coalesce_bytes,
+            .ws_coalesce_us = self.settings.ws_coalesce_us,
         };
-        // TODO: BUG: without this print/sleep statement, -Drelease* loop forever
-        // in debug2 and debug3 of hello example
-        // std.debug.print("X\n", .{});
-        // TODO: still happening?
-        std.Thread.sleep(500 * std.time.ns_per_ms);
-
         var portbuf: [100]u8 = undefined;
-        const printed_port = try std.fmt.bufPrintZ(&portbuf, "{d}", .{self.settings.port});
+        const printed_port: [*c]const u8 = if (self.settings.port == 0)
+            null // Unix socket
+        else
+            (try std.fmt.bufPrintZ(&portbuf, "{d}", .{self.settings.port})).ptr;
 
-        const ret = fio.http_listen(printed_port.ptr, self.settings.interface, x);
+        const ret = fio.http_listen(printed_port, self.settings.interface, x);
         if (ret == -1) {
             return error.ListenError;
         }
 
-        // set ourselves up to handle requests:
-        // TODO: do we mind the race condition?
-        // the HttpRequestFn will check if this is null and not process
-        // the request if it isn't set. hence, if started under full load, the
-        // first request(s) might not be serviced, as long as it takes from
-        // fio.http_listen() to here
-        HttpListener.the_one_and_only_listener = self;
+        if (self.settings.on_ready) |_| {
+            if (fio.fio_is_running() != 0) {
+                _ = fio.fio_defer(fioReadyTask, self, null);
+            } else {
+                // facilio attaches the listening socket on start, too
+                fio.fio_state_callback_add(fio.FIO_CALL_ON_START, fioStartCallback, self);
+            }
+        }
+    }
+
+    /// Used internally: runs when the reactor starts, before any tasks
+    fn fioStartCallback(udata: ?*anyopaque) callconv(.c) void {
+        // defer until all on-start callbacks have run and the socket is attached
+        _ = fio.fio_defer(fioReadyTask, udata, null);
+    }
+
+    fn fioReadyTask(udata: ?*anyopaque, _: ?*anyopaque) callconv(.c) void {
+        const l = fromUdata(udata).?;
+        l.settings.on_ready.?(l);
     }
 };
 
@@ -360,12 +487,6 @@ pub const LowLevel = struct {
             .log = if (settings.log) 1 else 0,
             .is_client = 0,
         };
-        // TODO: BUG: without this print/sleep statement, -Drelease* loop forever
-        // in debug2 and debug3 of hello example
-        // std.debug.print("X\n", .{});
-        // TODO: still happening?
-        std.Thread.sleep(500 * std.time.ns_per_ms);
-
         if (fio.http_listen(port, interface, x) == -1) {
             return error.ListenError;
         }